@@ -14,13 +14,15 @@
 
 /**
  * CSC369 Assignment 1 - a1fs driver implementation.
+ *
+ * The high-level FUSE driver: resolves the paths it is given to inode numbers
+ * and passes them on to the file system operations in fsops.c. See a1fs_ll.c
+ * for the low-level one.
  */
 
 #include <errno.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 
 // Using 2.9.x FUSE API
 #define FUSE_USE_VERSION 29
@@ -28,8 +30,8 @@
 
 #include "a1fs.h"
 #include "fs_ctx.h"
+#include "fsops.h"
 #include "options.h"
-#include "map.h"
 
 //NOTE: All path arguments are absolute paths within the a1fs file system and
 // start with a '/' that corresponds to the a1fs root directory.
@@ -43,54 +45,42 @@
 // FUSE callbacks as "/dir".
 
 
+/** Get file system context. */
+static fs_ctx *get_fs(void)
+{
+	return (fs_ctx*)fuse_get_context()->private_data;
+}
+
 /**
- * Initialize the file system.
+ * Start the background work of the file system.
  *
- * Called when the file system is mounted. NOTE: we are not using the FUSE
- * init() callback since it doesn't support returning errors. This function must
- * be called explicitly before fuse_main().
+ * Called by FUSE once the file system is mounted. Threads started in
+ * fsop_init() would not survive FUSE forking into the background, and neither
+ * would locked memory, so the mapping policy is applied and the journal commit,
+ * writeback and readahead threads are started here.
  *
- * @param fs    file system context to initialize.
- * @param opts  command line options.
- * @return      true on success; false on failure.
+ * @param conn  unused.
+ * @return      the file system context, which FUSE keeps as private data.
  */
-static bool a1fs_init(fs_ctx *fs, a1fs_opts *opts)
+static void *a1fs_start(struct fuse_conn_info *conn)
 {
-	// Nothing to initialize if only printing help or version
-	if (opts->help || opts->version) return true;
-
-	size_t size;
-	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size);
-	if (!image) return false;
-
-	return fs_ctx_init(fs, image, size, opts);
+	(void)conn;// unused
+	fs_ctx *fs = get_fs();
+	fsop_start(fs);
+	return fs;
 }
 
 /**
  * Cleanup the file system.
  *
  * Called when the file system is unmounted. Must cleanup all the resources
- * created in a1fs_init().
+ * created in fsop_init().
  */
 static void a1fs_destroy(void *ctx)
 {
-	fs_ctx *fs = (fs_ctx*)ctx;
-	if (fs->image) {
-		if (fs->opts->sync && (msync(fs->image, fs->size, MS_SYNC) < 0)) {
-			perror("msync");
-		}
-		munmap(fs->image, fs->size);
-		fs_ctx_destroy(fs);
-	}
-}
-
-/** Get file system context. */
-static fs_ctx *get_fs(void)
-{
-	return (fs_ctx*)fuse_get_context()->private_data;
+	fsop_destroy((fs_ctx*)ctx);
 }
 
-
 /**
  * Get file system statistics.
  *
@@ -107,387 +97,10 @@ static fs_ctx *get_fs(void)
 static int a1fs_statfs(const char *path, struct statvfs *st)
 {
 	(void)path;// unused
-	fs_ctx *fs = get_fs();
-
-	memset(st, 0, sizeof(*st));
-	st->f_bsize   = A1FS_BLOCK_SIZE;
-	st->f_frsize  = A1FS_BLOCK_SIZE;
-	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
-	st->f_namemax = A1FS_NAME_MAX;
-	st->f_blocks = sb->size / A1FS_BLOCK_SIZE;
-	st->f_bfree = sb->free_blocks_count;
-	st->f_bavail = st->f_bfree;
-	st->f_files = sb->inodes_count;
-	st->f_ffree = sb->free_inodes_count;
-	st->f_favail = st->f_ffree;
-
+	fsop_statfs(get_fs(), st);
 	return 0;
-
-	return -ENOSYS;
-}
-
-/**
- * Return an integer indicating whether this bit in the bitmap is 1
- * 
- * @param bm		the bitmap
- * @param index		the index of the bit
- * @return 			1 if bit is 1; otherwise 0
- */
-int get_bm(unsigned char *bm, int index){
-	 return (bm[index / 8] & (1 << (index % 8))) != 0;
-}
-
-/**
- * Set the bit at index in bm to the value value
- * 
- * @param bm		the bitmap
- * @param index		the index of the bit
- * @param value		the value to set the bit to
- */
-void set_bm(unsigned char *bm, int index, char value){
-	if (value == 1){
-		bm[index / 8] |= 1 << (index % 8);
-	}
-	else {
-		bm[index / 8] &= ~(1 << (index % 8));
-	}
-}
-
-/**
- * Find the inode given by name inside the directory inode dir. Modifies
- * file by setting it to the inode given by name. Return 0 on success, 1 on failure
- * 
- * @param	dir		the directory that should contain the inode specified by name
- * @param	file	the inode struct to be modified and set to the inode specified by name
- * @param	name	the name of the inode
- * @param	image	the disk image
- * @return			0 on success, 1 on failure 
- */
-int inode_by_name(a1fs_inode *dir, a1fs_inode **file, char *name, void *image){
-	a1fs_superblock *sb = (a1fs_superblock*)(image);
-	a1fs_extent *curr_extent;
-	int entry_count = 0;
-
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < dir->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(sb->data_region + ((dir->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = &(dir->extent)[i];
-		}
-		if (curr_extent->count > 0){
-			// Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = sb->data_region + curr_extent->start + j;
-
-				// Loop through all the entries in this extent (while keeping track of entry count).
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-					if (entry_count < dir->dentry){
-						a1fs_dentry *curr_entry = (a1fs_dentry*)(image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-						// Check if this entry is not in use.
-						if (curr_entry->ino == 0 && (curr_entry->name)[0] == '\0'){
-							continue;
-						}
-
-						// Check if this is the entry we are looking for.
-						if (strcmp(curr_entry->name, name) == 0){
-							int inode_location = sb->inode_table*A1FS_BLOCK_SIZE + curr_entry->ino*sizeof(a1fs_inode);
-							*file = (a1fs_inode*)(image + inode_location);
-							return 0;
-						}
-					}
-					entry_count++;
-				}
-			}
-			extents_count++;
-		}
-		i ++;
-	}
-	return 1;
-}
-
-/**
- * Find the inode given by path inside the directory inode dir. Modifies
- * file by setting it to the inode given by name. Return 0 on success, 1 on failure 
- * 
- * @param dir		the directory that should contain the inode specified by path
- * @param file		the inode struct to be modified
- * @param path		the path of the inode
- * @param image		the disk iage
- * @return 			0 on success; 1 on failure
- */
-int inode_from_path(a1fs_inode *dir, a1fs_inode **file, const char *path, void *image){
-	// Extract dir/file names from path one by one.
-	int start = 0;
-	int end = 0;
-	int started = 0;
-	char currFile[A1FS_NAME_MAX];
-	a1fs_inode *curr_dir = dir;
-	for (size_t i = 0; i < strlen(path); i++){
-		// Either we reached the end of the path string or we reached a '/' char.
-		if (i == strlen(path) - 1 || path[i] == '/'){
-			// Check if the '/' char is the ending of a file/dir name.
-			if (started){
-				// Is the last char part of the file/dir name or is it a '/'?
-				if (path[i] == '/'){
-					end = i;
-				} else {
-					end = i + 1;
-				}
-				strncpy(currFile, path+start+1, end-start-1);
-				currFile[end-start-1] = '\0';
-				a1fs_inode* target = ((void*)0);
-				// We found the file in the current directory.
-				if (inode_by_name(curr_dir, &target, currFile, image) == 0){
-					// This was the last file/dir in the path string so it must be the target.
-					if (i == strlen(path) - 1){
-						*file = target;
-						return 0;
-					// This is just an intermediate directory in the path.
-					} else {
-						// Check if this is a directory.
-						if (S_ISDIR(target->mode)){
-							curr_dir = target;
-							start = i;
-						}
-						else {
-							return -ENOTDIR;
-						}
-					}
-				// We didn't find the file from the path.
-				} else {
-					return -ENOENT;
-				}
-			} else {
-				started = 1;
-				start = i;
-			}
-		} 
-	}	
-	return -ENOSYS;
-}
-
-
-/**
- * Find the index of an available spot on the block or inode bitmap
- * 
- * @param image	the disk image
- * @param type	the desired spot; 0 for block 1 for inode
- * @return		the index of the available spot; -1 if no available space
- */
-int find_available_space(void *image, int type) {
-
-	a1fs_superblock *superblock = (a1fs_superblock*)(image);
-	int index = -1;
-	if (type) {
-		unsigned char* inode_bitmap;
-		for (int i = 0; (unsigned int)i < superblock->inode_bitmap_span; i++) {
-			inode_bitmap = (unsigned char*)(image + (A1FS_BLOCK_SIZE * (superblock->inode_bitmap + i)));
-
-			if ((unsigned int)i == superblock->inode_bitmap_span - 1) {
-				for (int j = 0; (unsigned int)j < superblock->inodes_count - (i * A1FS_BLOCK_SIZE * 8); j++) {
-					if (!get_bm(inode_bitmap, j)) {
-						index = i * A1FS_BLOCK_SIZE*8 + j;
-						return index;
-					}
-				}
-			}
-			else {
-				for (int j = 0; (unsigned int)j < A1FS_BLOCK_SIZE*8; j++) {
-					if (!get_bm(inode_bitmap, j)) {
-						index = i * A1FS_BLOCK_SIZE*8 + j;
-						return index;
-					}
-				}
-			}
-			
-		}
-	}
-	else {
-		unsigned char* block_bitmap;
-		for (int i = 0; (unsigned int)i < superblock->block_bitmap_span; i++) {
-			block_bitmap = (unsigned char*)(image + (A1FS_BLOCK_SIZE * (superblock->block_bitmap + i)));
-
-			//alternate for loop for when we are on the final bitmap block which doesn't necessarily have all 4096 bits
-			if ((unsigned int)i == superblock->block_bitmap_span - 1) {
-				for (int j = 0; (unsigned int)j < superblock->blocks_count - (i * A1FS_BLOCK_SIZE * 8); j++) {
-					if (!get_bm(block_bitmap, j)){
-						index = i * A1FS_BLOCK_SIZE*8 + j;
-						return index;
-					}
-				}
-			}
-			else {
-				for (int j = 0; (unsigned int)j < A1FS_BLOCK_SIZE*8; j++) {
-					if (!get_bm(block_bitmap, j)){
-						index = i * A1FS_BLOCK_SIZE*8 + j;
-						return index;
-					}
-				}
-			}
-
-		}
-	}
-	return -1;
-}
-
-/**
- * Initialize a new inode to the default parameters and provided mode
- * 
- * @param inode		the inode to be modified
- * @param mode		the mode for the inode
- */
-void init_inode(a1fs_inode *inode, mode_t mode){
-	inode->mode = mode;
-	inode->size = 0; 									
-	inode->links = 1;									
-	inode->extents = 0;	
-
-	// Initialize the extents to be empty (count = 0).
-	for (int i = 0; i < A1FS_EXTENTS_LENGTH; i ++){
-		(inode->extent)[0].count = 0;
-	}
-
-	clock_gettime(CLOCK_REALTIME, &inode->mtime);
-}
-
-/**
- * Initialize a new extent 
- * 
- * @param extent	the extent to be modified
- * @param start		the starting block number of this extent
- * @param count		the number of blocks this extent has
- * @param image		the disk image
- */
-void init_extent(a1fs_extent *extent, int start, int count, void *image){
-	a1fs_superblock *superblock = (a1fs_superblock*)(image);
-	unsigned char *block_bitmap = (unsigned char*)(image + (A1FS_BLOCK_SIZE * superblock->block_bitmap));
-
-	extent->start = start;
-	extent->count = count;
-	set_bm(block_bitmap, start, 1);
-	superblock->free_blocks_count -= 1;
 }
 
-/**
- * Allocates a new block for an a1fs_inode or append (add to the end) a new block to an inode.
- * 
- * @param inode		the inode to be modified
- * @param image		the disk image
- * @param append a boolean value if we want to append the new block or not
- * @return			-1 on failure, index of modified extent array on success
- */
-int allocate_new_block(a1fs_inode *inode, void *image, int append){
-
-	a1fs_superblock *sb = (a1fs_superblock*)(image);
-	unsigned char *block_bitmap = (unsigned char*)(image + (A1FS_BLOCK_SIZE * sb->block_bitmap));
-
-	// Check if there are any available blocks in the file system.
-	int block_index = find_available_space(image, 0);
-	if (block_index == -1){
-		return -1;
-	}
-
-	int extents_count = 0;
-	int i = 0;
-	a1fs_extent *curr_extent;
-	while (1){
-		if (append && extents_count >= inode->extents){
-			break;
-		}
-		if (i >= A1FS_EXTENTS_LENGTH){
-			break;
-		}
-		if (i >= A1FS_IND_BLOCK){
-			// Need to check if the indirect block has been initialized.
-			if ((inode->extent[A1FS_IND_BLOCK]).count == 0){
-				// We need to initialize the independent block.
-				int indirect_block_index = find_available_space(image, 0); 
-				init_extent(inode->extent + A1FS_IND_BLOCK, indirect_block_index, 1, image);
-			}
-
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(sb->data_region + ((inode->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = inode->extent + i;
-		}
-
-		if (append){
-			// Check if we can extend the last extent.
-			if (extents_count == inode->extents - 1){
-				if (get_bm(block_bitmap, curr_extent->start + curr_extent->count) == 0) {
-					set_bm(block_bitmap, curr_extent->start + curr_extent->count, 1);
-					curr_extent->count += 1;
-					sb->free_blocks_count -= 1;
-					printf("APPENDING\n");
-					return i;
-				}
-			}
-		}
-		else {
-			if (curr_extent->count != 0) {
-				if (get_bm(block_bitmap, curr_extent->start + curr_extent->count) == 0) {
-					set_bm(block_bitmap, curr_extent->start + curr_extent->count, 1);
-					curr_extent->count += 1;
-					sb->free_blocks_count -= 1;
-					printf("ALLOCATING\n");
-					return i;
-				}
-			}
-			else {												//case where this extent is empty and was never assigned any blocks
-				init_extent(curr_extent, block_index, 1, image);
-				inode->extents += 1;
-				return i;
-			}
-		}
-		if (curr_extent->count > 0){
-			extents_count++;
-		}
-		i++;
-	}
-
-	// Two possible cases: 1. Could not extend last extent. 2. Inode has no extents.
-	// In both scenarios we need to create a new extent at the end. 
-
-	// Check if we have run out of extents.
-	if (i >= A1FS_EXTENTS_LENGTH){
-		return -1;
-	}
-
-	// Check if the new extent will be in the indirect block.
-	if (i >= A1FS_IND_BLOCK){
-		// Need to check if the indirect block has been initialized.
-		if ((inode->extent[A1FS_IND_BLOCK]).count == 0){
-			// We need to initialize the independent block.
-			int indirect_block_index = find_available_space(image, 0); 
-			init_extent(inode->extent + A1FS_IND_BLOCK, indirect_block_index, 1, image);
-		}
-
-		int extent_location = A1FS_BLOCK_SIZE*(sb->data_region + ((inode->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-		curr_extent = (a1fs_extent*)(image + extent_location);
-	}
-	else{
-		// We are looking at the extent at index i in the extents array.
-		curr_extent = inode->extent + i;
-	}
-
-	init_extent(curr_extent, block_index, 1, image);
-	inode->extents += 1;
-	sb->free_blocks_count -= 1;
-	return i;
-}
-
-
-
 /**
  * Get file or directory attributes.
  *
@@ -512,38 +125,97 @@ static int a1fs_getattr(const char *path, struct stat *st)
 	if (strlen(path) >= A1FS_PATH_MAX) return -ENAMETOOLONG;
 	fs_ctx *fs = get_fs();
 
-	memset(st, 0, sizeof(*st));
+	a1fs_ino_t ino;
+	int ret = fsop_path_lookup(fs, path, &ino);
+	if (ret != 0){
+		return ret;
+	}
+	return fsop_getattr(fs, ino, st);
+}
 
-	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * sb->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
+/**
+ * Get attributes of an open file or directory.
+ *
+ * Implements the fstat() system call, and stat() of open files. Same as
+ * a1fs_getattr(), but without a path walk.
+ *
+ * @param path  unused; NULL with flag_nopath.
+ * @param st    pointer to the struct stat that receives the result.
+ * @param fi    the state of the open file or directory.
+ * @return      0 on success; -errno on error;
+ */
+static int a1fs_fgetattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	return fsop_getattr(get_fs(), fsop_ino(fi), st);
+}
 
-	// Base case if getattr is being called on the root directory.
-	if (strcmp(path, "/") == 0) {
-		st->st_mode = root_inode->mode;
-		st->st_nlink = root_inode->links;
-		st->st_size = root_inode->size;
-		st->st_blocks = root_inode->size / 512;
-		st->st_mtim = root_inode->mtime;
-		return 0;
+/** State passed to readdir_entry() through fsop_readdir(). */
+typedef struct readdir_state {
+	void *buf;
+	fuse_fill_dir_t filler;
+} readdir_state;
+
+static int readdir_entry(const char *name, size_t len, a1fs_ino_t ino, unsigned int type, void *arg){
+	(void)ino;
+	readdir_state *state = (readdir_state*)arg;
+	char buf[A1FS_NAME_MAX];
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+
+	// Compact entries carry the file type, so the inode isn't needed for it.
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	st.st_mode = type << 12;
+	if (state->filler(state->buf, buf, (type != 0) ? &st : NULL, 0)){
+		return -ENOMEM;
 	}
+	return 0;
+}
 
-	// Extract dir/file names from path one by one.
-	a1fs_inode *target = (void *)0;
-	int ret = inode_from_path(root_inode, &target, path,fs->image);
-	if (ret == 0){
-		st->st_mode = target->mode;
-		st->st_nlink = target->links;
-		st->st_size = target->size;
-		st->st_blocks = target->size / 512;
-		st->st_mtim = target->mtime;
-		return 0;
-	}
-	else {
+/**
+ * Open a directory.
+ *
+ * Implements the opendir() system call. Resolves the path once; readdir()
+ * works from the inode number kept in the handle.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *
+ * @param path  path to the directory.
+ * @param fi    receives the state of the open directory.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_opendir(const char *path, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+
+	a1fs_ino_t ino;
+	int ret = fsop_path_lookup(fs, path, &ino);
+	if (ret != 0){
 		return ret;
-	}	
-	
-	return -ENOSYS;
+	}
+	return fsop_open(fs, ino, fi);
+}
+
+/**
+ * Release an open directory.
+ *
+ * Called when the last file descriptor that refers to an open directory has
+ * been closed. Frees the state set up by a1fs_opendir().
+ *
+ * @param path  unused; NULL with flag_nopath.
+ * @param fi    the state of the open directory.
+ * @return      0.
+ */
+static int a1fs_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	fsop_release(fi);
+	return 0;
 }
 
 /**
@@ -552,84 +224,25 @@ static int a1fs_getattr(const char *path, struct stat *st)
  * Implements the readdir() system call. Should call filler() for each directory
  * entry. See fuse.h in libfuse source code for details.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a directory.
- *
  * Errors:
  *   ENOMEM  not enough memory (e.g. a filler() call failed).
  *
- * @param path    path to the directory.
+ * @param path    unused; NULL with flag_nopath.
  * @param buf     buffer that receives the result.
  * @param filler  function that needs to be called for each directory entry.
  *                Pass 0 as offset (4th argument). 3rd argument can be NULL.
  * @param offset  unused.
- * @param fi      unused.
+ * @param fi      the state of the open directory.
  * @return        0 on success; -errno on error.
  */
 static int a1fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                         off_t offset, struct fuse_file_info *fi)
 {
+	(void)path;// unused
 	(void)offset;// unused
-	(void)fi;// unused
-	fs_ctx *fs = get_fs();
-
-
-	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * sb->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-
-	a1fs_inode *target = (void *)0;
-	if (strcmp(path, "/") == 0){
-		target = root_inode;
-	} else{
-		inode_from_path(root_inode, &target, path, fs->image);
-	}
-	a1fs_extent *curr_extent;
-	int entry_count = 0;
-
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < target->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(sb->data_region + ((target->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = &(target->extent)[i];
-		}
-		if (curr_extent->count > 0){
-			// Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = sb->data_region + curr_extent->start + j;
-
-				// Loop through all the entries in this extent (while keeping track of entry count).
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-					if (entry_count < target->dentry){
-						a1fs_dentry *curr_entry = (a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-						// Check if this entry is not in use.
-						if (curr_entry->ino == 0 && (curr_entry->name)[0] == '\0'){
-							continue;
-						}
-
-						// Check if this is the entry we are looking for.
-						if (filler(buf, curr_entry->name, NULL, 0)){
-							return -ENOMEM;
-						}
-					}
-					entry_count++;
-				}
-			}
-			extents_count++;
-		}
-		i++;
-	}
-	return 0;
 
-
-	return -ENOSYS;
+	readdir_state state = { buf, filler };
+	return fsop_readdir(get_fs(), fsop_ino(fi), readdir_entry, &state);
 }
 
 
@@ -659,122 +272,14 @@ static int a1fs_mkdir(const char *path, mode_t mode)
 {
 	fs_ctx *fs = get_fs();
 
-	a1fs_superblock *superblock = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * superblock->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-	unsigned char *inode_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->inode_bitmap)); 
-
-	//check to see if there is space for an additional inode
-	if (superblock->free_inodes_count == 0) {
-		return -ENOSPC;
-	}
-
-	// From path extract the parent directory and the name of the new directory.
-	a1fs_inode *parent_directory = (void *)0;
-	char path_copy[A1FS_NAME_MAX];
-	strcpy(path_copy, path);
-	char *final_slash = strrchr(path_copy, '/');
-	*final_slash = '\0';
-	char file_name[A1FS_NAME_MAX];
-	strcpy(file_name, (final_slash + 1));
-
-	// Base case for when we are creating a new dir in the root.
-	if (strlen(path_copy) == 0){
-		parent_directory = root_inode;
-	}
-	else {
-		inode_from_path(root_inode, &parent_directory, path_copy, fs->image);
-	}
-
-	// Make sure we have an available inode for the new dir entry.
-	int created_dentry = 0;
-	int inode_index = find_available_space(fs->image, 1);
-
-
-	// Look through the parent's existing extents looking for free space.
-	a1fs_extent *curr_extent;
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < parent_directory->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((parent_directory->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = parent_directory->extent + i;
-		}
-		if (curr_extent->count > 0){
-	        // Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = superblock->data_region + curr_extent->start + j;
-
-				// Loop through all the entries in this extent.
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-						a1fs_dentry *curr_entry = (a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-						// Check if this entry is not in use.
-						if ((curr_entry->ino == 0 && (curr_entry->name)[0] == '\0') || curr_entry == NULL){
-				            strcpy(curr_entry->name, file_name);
-				            curr_entry->ino = inode_index;
-				            created_dentry = 1;
-				            break;
-						}
-				}
-				if (created_dentry){
-					break;
-				}
-			}
-			if (created_dentry) {
-				break;
-			}
-			extents_count++;
-		}
-		i++;
-	}
-
-	// The existing extents had no space available, need to assign more space to the parent dir.
-	if (!created_dentry) {	
-		// Check if we can extend an existing extent, or create a new extent in the parent dir.
-		int extent_index = allocate_new_block(parent_directory, fs->image, 0);
-		if (extent_index == -1){
-			return -ENOSPC;
-		}
-
-		// Now that we have allocated a new block, we need to get a pointer to that location.
-		a1fs_dentry *new_entry;
-
-		// Check if the new block is part of an extent stored in the indirect block.
-		if (extent_index >= A1FS_IND_BLOCK){
-			int extent_block = (superblock->data_region + ((parent_directory->extent)[A1FS_IND_BLOCK]).start)*A1FS_BLOCK_SIZE;
-			a1fs_extent *extent = (a1fs_extent*)(fs->image + extent_block + sizeof(a1fs_extent)*(extent_index % A1FS_IND_BLOCK));
-
-			int entry_byte = (superblock->data_region + extent->start)*A1FS_BLOCK_SIZE;
-			new_entry = (a1fs_dentry*)(fs->image + entry_byte + (extent->count - 1)*A1FS_BLOCK_SIZE);
-		}
-		else {
-			int entry_byte = (superblock->data_region + ((parent_directory->extent)[extent_index]).start)*A1FS_BLOCK_SIZE;
-			new_entry = (a1fs_dentry*)(fs->image + entry_byte + (((parent_directory->extent)[extent_index]).count - 1)*A1FS_BLOCK_SIZE);
-		}
-
-		// Copy the information into the newly created dentry.
-		strcpy(new_entry->name, file_name);
-        new_entry->ino = inode_index;
+	a1fs_ino_t dir;
+	const char *name;
+	size_t len;
+	int ret = fsop_walk(fs, path, &dir, &name, &len);
+	if (ret != 0){
+		return ret;
 	}
-	
-	//create the inode for the new directory and save it to the inode table
-	a1fs_inode *inode = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE*superblock->inode_table + inode_index*sizeof(a1fs_inode));
-	init_inode(inode, mode | S_IFDIR);
-
-	// Update the file system.
-	set_bm(inode_bitmap, inode_index, 1);
-	superblock->free_inodes_count -= 1;
-	parent_directory->dentry++;
-	parent_directory->links++;
-	parent_directory->size += sizeof(a1fs_dentry);
-
-	return 0;
+	return fsop_mkdir(fs, dir, name, len, mode, NULL);
 }
 
 /**
@@ -795,121 +300,14 @@ static int a1fs_rmdir(const char *path)
 {
 	fs_ctx *fs = get_fs();
 
-	a1fs_superblock *superblock = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * superblock->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-	unsigned char *inode_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->inode_bitmap));
-	unsigned char *block_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->block_bitmap));
-
-	//find the directory to be removed
-	a1fs_inode *directory = (void *)0;
-	char path_copy[A1FS_NAME_MAX];
-	strcpy(path_copy, path);
-	inode_from_path(root_inode, &directory, path, fs->image);
-
-	//check if directory is empty or not
-	if (directory->size != 0 || directory->dentry != 0) {
-		return -ENOTEMPTY;
-	}
-
-	//find the parent directory
-	a1fs_inode *parent_directory = (void *)0;
-	char *final_slash = strrchr(path_copy, '/');
-	*final_slash = '\0';
-	char file_name[A1FS_NAME_MAX];
-	strcpy(file_name, (final_slash + 1));
-
-	// Base case for when we are removing a directory in the root.
-	if (strlen(path_copy) == 0){
-		parent_directory = root_inode;
-	}
-	else {
-		inode_from_path(root_inode, &parent_directory, path_copy, fs->image);
-	}
-
-	// Look through the directory's existing extents to free space
-	a1fs_extent *curr_extent;
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < directory->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((directory->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = directory->extent + i;
-		}
-		if (curr_extent->count > 0){
-	        // Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = superblock->data_region + curr_extent->start + j;
-				set_bm(block_bitmap, curr_entry_block, 0);
-				memset((fs->image + (A1FS_BLOCK_SIZE * curr_entry_block)), 0, A1FS_BLOCK_SIZE);
-				superblock->free_blocks_count += 1;
-			}
-			extents_count++;
-		}
-		i++;
-	}
-
-	// Look through the parent directory's existing extents to locate the dentry for the removed directory
-	extents_count = 0;
-	i = 0;
-	int removed = 0;
-	int inode_num = -1;
-	while (extents_count < parent_directory->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((parent_directory->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = parent_directory->extent + i;
-		}
-		if (curr_extent->count > 0){
-	        // Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = superblock->data_region + curr_extent->start + j;
-
-				// Loop through all the entries in this extent.
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-						a1fs_dentry *curr_entry = (a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-						// Check if this entry is the removed directory's
-						if (curr_entry != NULL) {
-							if (!strcmp(curr_entry->name, file_name)) {
-								inode_num = curr_entry->ino;
-								set_bm(inode_bitmap, curr_entry->ino, 0);
-								memset(curr_entry, 0, sizeof(a1fs_dentry));	
-								superblock->free_inodes_count += 1;
-								removed = 1;
-								parent_directory->dentry -= 1;
-								parent_directory->size -= sizeof(a1fs_dentry);
-								break;
-							}
-						}
-				}
-				if (removed){
-					break;
-				}
-			}
-			if (removed) {
-				break;
-			}
-			extents_count++;
-		}
-		i++;
-	}
-
-	//remove the directory inode from the inode table		
-	if (inode_num > 0) {
-		memset((fs->image + (A1FS_BLOCK_SIZE * superblock->inode_table) + (sizeof(a1fs_inode) * inode_num)), 0, sizeof(a1fs_inode));
+	a1fs_ino_t dir;
+	const char *name;
+	size_t len;
+	int ret = fsop_walk(fs, path, &dir, &name, &len);
+	if (ret != 0){
+		return ret;
 	}
-
-	return 0;
+	return fsop_rmdir(fs, dir, name, len, NULL);
 }
 
 /**
@@ -928,126 +326,21 @@ static int a1fs_rmdir(const char *path)
  *
  * @param path  path to the file to create.
  * @param mode  file mode bits.
- * @param fi    unused.
+ * @param fi    receives the state of the new open file.
  * @return      0 on success; -errno on error.
  */
 static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	(void)fi;// unused
-	assert(S_ISREG(mode));
 	fs_ctx *fs = get_fs();
 
-	a1fs_superblock *superblock = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * superblock->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-	unsigned char *inode_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->inode_bitmap)); 
-	
-	//check to see if there is space for an additional inode
-	if (superblock->free_inodes_count == 0) {
-		return -ENOSPC;
-	}
-
-	//find parent directory to insert new dentry in
-	a1fs_inode *parent_directory = (void *)0;
-	char path_copy[A1FS_NAME_MAX];
-	strcpy(path_copy, path);
-	char *final_slash = strrchr(path_copy, '/');
-	*final_slash = '\0';
-	char file_name[A1FS_NAME_MAX];
-	strcpy(file_name, (final_slash + 1));
-
-	// Base case for when we are creating a new dir in the root.
-	if (strlen(path_copy) == 0){
-		parent_directory = root_inode;
-	}
-	else {
-		inode_from_path(root_inode, &parent_directory, path_copy, fs->image);
-	}
-
-	//find place in parent directory to insert new dentry into
-	int created_dentry = 0;
-	int inode_index = find_available_space(fs->image, 1);
-
-	// Look through the parent's existing extents for free space.
-	a1fs_extent *curr_extent;
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < parent_directory->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((parent_directory->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = parent_directory->extent + i;
-		}
-		if (curr_extent->count > 0){
-	        // Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = superblock->data_region + curr_extent->start + j;
-
-				// Loop through all the entries in this extent.
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-						a1fs_dentry *curr_entry = (a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-						// Check if this entry is not in use.
-						if ((curr_entry->ino == 0 && (curr_entry->name)[0] == '\0') || curr_entry == NULL){
-				            strcpy(curr_entry->name, file_name);
-				            curr_entry->ino = inode_index;
-				            created_dentry = 1;
-				            break;
-						}
-				}
-				if (created_dentry){
-					break;
-				}
-			}
-			if (created_dentry) {
-				break;
-			}
-			extents_count++;
-		}
-		i++;
-	}
-
-	//The existing extents had no space available, need to assign more space to the parent dir.
-	if (!created_dentry) {	
-		int extent_index = allocate_new_block(parent_directory, fs->image, 0);
-		if (extent_index == -1){
-			return -ENOSPC;
-		}
-
-		a1fs_dentry *new_entry;
-
-		// Check if the new block is part of an extent stored in the indirect block.
-		if (extent_index >= A1FS_IND_BLOCK){
-			int extent_block = (superblock->data_region + ((parent_directory->extent)[A1FS_IND_BLOCK]).start)*A1FS_BLOCK_SIZE;
-			a1fs_extent *extent = (a1fs_extent*)(fs->image + extent_block + sizeof(a1fs_extent)*(extent_index % A1FS_IND_BLOCK));
-
-			int entry_byte = (superblock->data_region + extent->start)*A1FS_BLOCK_SIZE;
-			new_entry = (a1fs_dentry*)(fs->image + entry_byte + (extent->count - 1)*A1FS_BLOCK_SIZE);
-		}
-		else {
-			int entry_byte = (superblock->data_region + ((parent_directory->extent)[extent_index]).start)*A1FS_BLOCK_SIZE;
-			new_entry = (a1fs_dentry*)(fs->image + entry_byte + (((parent_directory->extent)[extent_index]).count - 1)*A1FS_BLOCK_SIZE);
-		}
-
-		strcpy(new_entry->name, file_name);
-        new_entry->ino = inode_index;
+	a1fs_ino_t dir;
+	const char *name;
+	size_t len;
+	int ret = fsop_walk(fs, path, &dir, &name, &len);
+	if (ret != 0){
+		return ret;
 	}
-	
-	//create the inode for the new directory and save it to the inode table
-	a1fs_inode *inode = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE*superblock->inode_table + inode_index*sizeof(a1fs_inode));
-	init_inode(inode, mode);
-
-	// Update
-	set_bm(inode_bitmap, inode_index, 1);
-	superblock->free_inodes_count -= 1;
-	parent_directory->dentry++;
-	parent_directory->size += sizeof(a1fs_dentry);
-
-	return 0;
+	return fsop_create(fs, dir, name, len, mode, fi, NULL);
 }
 
 /**
@@ -1064,116 +357,15 @@ static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 static int a1fs_unlink(const char *path)
 {
 	fs_ctx *fs = get_fs();
-	
-	a1fs_superblock *superblock = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * superblock->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-	unsigned char *inode_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->inode_bitmap));
-	unsigned char *block_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->block_bitmap));
-
-	//find the file to be removed
-	a1fs_inode *file = (void *)0;
-	char path_copy[A1FS_NAME_MAX];
-	strcpy(path_copy, path);
-	inode_from_path(root_inode, &file, path, fs->image);
-
-	//find the parent directory
-	a1fs_inode *parent_directory = (void *)0;
-	char *final_slash = strrchr(path_copy, '/');
-	*final_slash = '\0';
-	char file_name[A1FS_NAME_MAX];
-	strcpy(file_name, (final_slash + 1));
-
-	// Base case for when we are removing a file in the root.
-	if (strlen(path_copy) == 0){
-		parent_directory = root_inode;
-	}
-	else {
-		inode_from_path(root_inode, &parent_directory, path_copy, fs->image);
-	}
-
-	// Look through the directory's existing extents to free space
-	a1fs_extent *curr_extent;
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < file->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((file->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = file->extent + i;
-		}
-		if (curr_extent->count > 0){
-	        // Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = superblock->data_region + curr_extent->start + j;
-				set_bm(block_bitmap, curr_entry_block, 0);
-				memset((fs->image + (A1FS_BLOCK_SIZE * curr_entry_block)), 0, A1FS_BLOCK_SIZE);
-				superblock->free_blocks_count += 1;
-			}
-			extents_count++;
-		}
-		i++;
-	}
 
-	// Look through the parent directory's existing extents to locate the dentry for the removed file
-	extents_count = 0;
-	i = 0;
-	int removed = 0;
-	int inode_num = -1;
-	while (extents_count < parent_directory->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((parent_directory->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = parent_directory->extent + i;
-		}
-		if (curr_extent->count > 0){
-	        // Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_entry_block = superblock->data_region + curr_extent->start + j;
-
-				// Loop through all the entries in this extent.
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-						a1fs_dentry *curr_entry = (a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-						// Check if this entry is the removed directory's
-						if (curr_entry != NULL) {
-							if (!strcmp(curr_entry->name, file_name)) {
-								inode_num = curr_entry->ino;
-								set_bm(inode_bitmap, curr_entry->ino, 0);
-								memset(curr_entry, 0, sizeof(a1fs_dentry));	
-								superblock->free_inodes_count += 1;
-								removed = 1;
-								parent_directory->dentry -= 1;
-								break;
-							}
-						}
-				}
-				if (removed){
-					break;
-				}
-			}
-			if (removed) {
-				break;
-			}
-			extents_count++;
-		}
-		i++;
-	}
-
-	//remove the directory inode from the inode table		
-	if (inode_num > 0) {
-		memset((fs->image + (A1FS_BLOCK_SIZE * superblock->inode_table) + (sizeof(a1fs_inode) * inode_num)), 0, sizeof(a1fs_inode));
+	a1fs_ino_t dir;
+	const char *name;
+	size_t len;
+	int ret = fsop_walk(fs, path, &dir, &name, &len);
+	if (ret != 0){
+		return ret;
 	}
-
-	return 0;
+	return fsop_unlink(fs, dir, name, len, NULL);
 }
 
 /**
@@ -1201,219 +393,9 @@ static int a1fs_unlink(const char *path)
  */
 static int a1fs_rename(const char *from, const char *to)
 {
-	fs_ctx *fs = get_fs();
-
-	if (!strcmp(from, to)) {			//are the same files; no need to modify anything
-		return 0;
-	}
-
-	//initialize values
-	struct a1fs_superblock *superblock = (struct a1fs_superblock*)(fs->image);
-	struct a1fs_inode *inodes = (struct a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * superblock->inode_table);
-	struct a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-	unsigned char *inode_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->inode_bitmap));
-	//unsigned char *block_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->block_bitmap));
-
-	//find inodes of file to be moved and file to be replaced
-	struct a1fs_inode *orig_file = (void *)0;
-	struct a1fs_inode *dest_file = (void *)0;
-	char orig_copy[A1FS_NAME_MAX];
-	char dest_copy[A1FS_NAME_MAX];
-
-	strcpy(orig_copy, from);
-	strcpy(dest_copy, to);
-	inode_from_path(root_inode, &orig_file, from, fs->image);
-	int dest_exists = inode_from_path(root_inode, &dest_file, to, fs->image);
-
-	//find inodes of parent directories of file to be moved and replaced
-	struct a1fs_inode *orig_parent = (void *)0;
-	struct a1fs_inode *dest_parent = (void *)0;
-
-	char *orig_slash = strrchr(orig_copy, '/');
-	char *dest_slash = strrchr(dest_copy, '/');
-	*orig_slash = '\0';
-	*dest_slash = '\0';
-	char orig_name[A1FS_NAME_MAX];
-	char dest_name[A1FS_NAME_MAX];
-	strcpy(orig_name, (orig_slash + 1));
-	strcpy(dest_name, (dest_slash + 1));
-
-	// Base case for when files are in the root
-	if (strlen(orig_copy) == 0){
-		orig_parent = root_inode;
-	}
-	else {
-		inode_from_path(root_inode, &orig_parent, orig_copy, fs->image);
-	}
-	if (strlen(dest_copy) == 0){
-		dest_parent = root_inode;
-	}
-	else {
-		inode_from_path(root_inode, &dest_parent, dest_copy, fs->image);
-	}
-
-	if (S_ISREG(orig_file->mode)) {								//original file is a regular file and so is dest_file
-
-		if (dest_exists == 0) { 								//to exists and is a regular file; must be replaced
-			a1fs_unlink(to);
-		}
-
-		//create a new file with the path to
-		int status = a1fs_create(to, orig_file->mode, (void*)0);			
-		if (status != 0) {			
-			return status;
-		}
-
-		//get the inode of the newly created file
-		dest_file = (void*)0;
-		inode_from_path(root_inode, &dest_file, to, fs->image);
-		
-		//copy the contents of the original file into the new file's inode
-		memcpy(dest_file, orig_file, sizeof(a1fs_inode));
-		
-		//delete the old file's dentry from the parent
-		//look through the parent directory's existing extents to locate the dentry for the removed file
-		struct a1fs_extent *curr_extent;
-		int extents_count = 0;
-		int i = 0;
-		int removed = 0;
-		int inode_num = -1;
-		while (extents_count < orig_parent->extents){
-			if (i >= A1FS_IND_BLOCK){
-				// We are now looking in the indirect block.
-				int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((orig_parent->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-				curr_extent = (struct a1fs_extent*)(fs->image + extent_location);
-			}
-			else{
-				// We are looking at the extent at index i in the extents array.
-				curr_extent = orig_parent->extent + i;
-			}
-			if (curr_extent->count > 0){
-				// Loop through this entire extent (depending on extent length).
-				for (size_t j = 0; j < curr_extent->count; j++){
-					int curr_entry_block = superblock->data_region + curr_extent->start + j;
-
-					// Loop through all the entries in this extent.
-					for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-							struct a1fs_dentry *curr_entry = (struct a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-							// Check if this entry is the removed directory's
-							if (curr_entry != NULL) {
-								if (!strcmp(curr_entry->name, orig_name)) {
-									inode_num = curr_entry->ino;
-									set_bm(inode_bitmap, curr_entry->ino, 0);
-									memset(curr_entry, 0, sizeof(a1fs_dentry));				
-									superblock->free_inodes_count += 1;
-									removed = 1;
-									orig_parent->dentry -= 1;
-									break;
-								}
-							}
-					}
-					if (removed){
-						break;
-					}
-				}
-				if (removed) {
-					break;
-				}
-				extents_count++;
-			}
-			i++;
-		}
-
-		//update the inode table
-		//remove the file inode from the inode table		
-		if (inode_num > 0) {
-			memset((fs->image + (A1FS_BLOCK_SIZE * superblock->inode_table) + (sizeof(a1fs_inode) * inode_num)), 0, sizeof(a1fs_inode));
-		}
-		return 0;
-	}
-	else if (S_ISDIR(orig_file->mode)) {						//original file is a directory and so is dest_file
-
-		if (dest_exists < 0) {									//to does not exist and must be created
-			
-			int status = a1fs_mkdir(to, orig_file->mode | S_IFDIR);
-			if (status != 0) {
-				return status;
-			}
-
-			//get the inode of the newly created directory
-			dest_file = (void*)0;
-			inode_from_path(root_inode, &dest_file, to, fs->image);
-		}
-		else {															//to exists and is a directory; using -T option
-			if (dest_file->size != 0 || dest_file->dentry != 0) {		//directory is not empty
-				return -ENOTEMPTY;
-			}
-		}
-	
-		//copy the contents of the original directory into the new directory's inode
-		memcpy(dest_file, orig_file, sizeof(a1fs_inode));
-
-		//delete the old file's dentry from the parent
-		//look through the parent directory's existing extents to locate the dentry for the removed file
-		struct a1fs_extent *curr_extent;
-		int extents_count = 0;
-		int i = 0;
-		int removed = 0;
-		int inode_num = -1;
-		while (extents_count < orig_parent->extents){
-			if (i >= A1FS_IND_BLOCK){
-				// We are now looking in the indirect block.
-				int extent_location = A1FS_BLOCK_SIZE*(superblock->data_region + ((orig_parent->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-				curr_extent = (struct a1fs_extent*)(fs->image + extent_location);
-			}
-			else{
-				// We are looking at the extent at index i in the extents array.
-				curr_extent = orig_parent->extent + i;
-			}
-			if (curr_extent->count > 0){
-				// Loop through this entire extent (depending on extent length).
-				for (size_t j = 0; j < curr_extent->count; j++){
-					int curr_entry_block = superblock->data_region + curr_extent->start + j;
-
-					// Loop through all the entries in this extent.
-					for (size_t k = 0; k < A1FS_BLOCK_SIZE/sizeof(a1fs_dentry); k++){
-							struct a1fs_dentry *curr_entry = (struct a1fs_dentry*)(fs->image + A1FS_BLOCK_SIZE*curr_entry_block + k*sizeof(a1fs_dentry));
-
-							// Check if this entry is the removed directory's
-							if (curr_entry != NULL) {
-								if (!strcmp(curr_entry->name, orig_name)) {
-									inode_num = curr_entry->ino;
-									set_bm(inode_bitmap, curr_entry->ino, 0);
-									memset(curr_entry, 0, sizeof(a1fs_dentry));				
-									superblock->free_inodes_count += 1;
-									removed = 1;
-									orig_parent->dentry -= 1;
-									break;
-								}
-							}
-					}
-					if (removed){
-						break;
-					}
-				}
-				if (removed) {
-					break;
-				}
-				extents_count++;
-			}
-			i++;
-		}
-
-		//update the inode table
-		//remove the file inode from the inode table		
-		if (inode_num > 0) {
-			memset((fs->image + (A1FS_BLOCK_SIZE * superblock->inode_table) + (sizeof(a1fs_inode) * inode_num)), 0, sizeof(a1fs_inode));
-		}
-		return 0;
-	}
-
-	return -ENOSYS;							//should never reach here
+	return fsop_rename_path(get_fs(), from, to);
 }
 
-
 /**
  * Change the access and modification times of a file or directory.
  *
@@ -1432,21 +414,13 @@ static int a1fs_utimens(const char *path, const struct timespec tv[2])
 {
 	fs_ctx *fs = get_fs();
 
-	a1fs_superblock *superblock = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * superblock->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-	a1fs_inode *target = (void *)0;
-	inode_from_path(root_inode, &target, path, fs->image);
-	
-	if (tv->tv_nsec == UTIME_NOW || tv == NULL) {				//change to current time
-		clock_gettime(CLOCK_REALTIME, &target->mtime);
-	}
-	else if (tv->tv_nsec != UTIME_OMIT) {						//change to time stored in struct
-		target->mtime.tv_sec = tv->tv_sec;
-		target->mtime.tv_nsec = tv->tv_nsec;
+	a1fs_ino_t ino;
+	int ret = fsop_path_lookup(fs, path, &ino);
+	if (ret != 0){
+		return ret;
 	}
-
-	return 0;
+	// tv[0] is the access time, which isn't kept.
+	return fsop_utimens(fs, ino, (tv != NULL) ? &tv[1] : NULL);
 }
 
 /**
@@ -1470,155 +444,78 @@ static int a1fs_utimens(const char *path, const struct timespec tv[2])
 static int a1fs_truncate(const char *path, off_t size)
 {
 	fs_ctx *fs = get_fs();
-	
-	// Setup all of the usefull variables we will need.
-	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * sb->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-
-	// Get the target file that we will be reading, we do not need to check the return value of 'inode_from_path'
-	// because we are assuming it has already beed checked by a1fs_getattr().
-	a1fs_inode *target = (void *)0;
-	inode_from_path(root_inode, &target, path, fs->image);
-
-	a1fs_extent extents[A1FS_NUM_EXTENTS];
-
-	a1fs_extent *curr_extent;
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < target->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(sb->data_region + ((target->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = target->extent + i;
-		}
-		if (curr_extent->count > 0){
-			extents[extents_count] = *curr_extent;
-			extents_count++;
-		}
-		i++;
-	}
-
-	// Check if we need to extend or shrink the file.
-
-	if (target->size < (uint64_t)size) { // Need to extend the file.
-	
-		// We are measuring size based on actual data bytes, so need to find the data bytes first. 
-		int started = 0;
-		int byte_count = 0;
-		for (int i = 0; i < extents_count-1; i++){
-			for (size_t j = 0; j < extents[i].count; j++){
-				int curr_block = sb->data_region + extents[i].start + j;
-
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE; k++){
-					unsigned char *byte = (unsigned char*)(fs->image + A1FS_BLOCK_SIZE*curr_block + k);
-					
-					// If the byte has some value then it is the first data byte and we havent started yet.
-					if (*byte != 0 && !started){
-						started = 1;
-					}
-					// We found the first byte and are counting up to the last byte.
-					if (started){
-						byte_count++;
-					}
-				}
-			}
-		}
-
-		// We already have enough space allocated to the file to extend to the given size.
-		if (byte_count >= size){
-			target->size = size;
-			return 0;
-		}
-		// We need to extend the file to have enough space for the given size.
-		else {
-			while (byte_count < size){
-				int extent_index = allocate_new_block(target, fs->image, 1);
-				if (extent_index== -1){
-					return -ENOSPC;
-				}
-				byte_count += A1FS_BLOCK_SIZE;
-			}
-			target->size = size;
-			return 0;
-		}
-
 
+	a1fs_ino_t ino;
+	int ret = fsop_path_lookup(fs, path, &ino);
+	if (ret != 0){
+		return ret;
 	}
-	else {                     // Need to shrink the file.
-
-		// We need to shrink the file from the end, so need to find the last data byte.
-		int started = 0;
-		size_t byte_count = 0;
-		int found_last_byte = 0;
-		int last_byte_loc[3];
-		for (int i = 0; i < extents_count; i++){
-			for (size_t j = 0; j < extents[i].count; j++){
-				int curr_block = sb->data_region + extents[i].start + j;
-
-				for (int k = 0; k < A1FS_BLOCK_SIZE; k++){
-					unsigned char *byte = (unsigned char*)(fs->image + A1FS_BLOCK_SIZE*curr_block + k);
-					
-					// If the byte has some value then it is the first data byte and we havent started yet.
-					if (*byte != 0 && !started){
-						started = 1;
-					}
-					// We found the first byte and are counting up to the last byte.
-					if (started){
-						byte_count++;
-					}
-					// We found the last byte, write down its location.
-					if (byte_count == target->size){
-						found_last_byte = 1;
-						last_byte_loc[0] = i;
-						last_byte_loc[1] = j;
-						last_byte_loc[2] = k;
-						break;
-					}
-				}
-				if (found_last_byte){
-					break;
-				}
-			}
-			if (found_last_byte){
-				break;
-			}
-		}
+	return fsop_truncate(fs, ino, size);
+}
 
-		// Now iterate backwards starting from the last data byte, deleting values.
-		int size_achieved = 0;
-		for (int i = last_byte_loc[0]; i >= 0; i--){
-			for (int j = last_byte_loc[1]; j >= 0; j--){
-				int curr_block = sb->data_region + extents[i].start + j;
+/**
+ * Change the size of an open file.
+ *
+ * Implements the ftruncate() system call. Same as a1fs_truncate(), but
+ * without a path walk.
+ *
+ * @param path  unused; NULL with flag_nopath.
+ * @param size  new file size in bytes.
+ * @param fi    the state of the open file.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	return fsop_truncate(get_fs(), fsop_ino(fi), size);
+}
 
-				for (int k = last_byte_loc[2]; k >= 0; k--){
-					unsigned char *byte = (unsigned char*)(fs->image + A1FS_BLOCK_SIZE*curr_block + k);
+/**
+ * Open a file.
+ *
+ * Implements the open() system call for existing files. Resolves the path
+ * once; reads and writes through the new file descriptor work from the inode
+ * number kept in the handle, and pick up the extent cursor left by the last
+ * one where they can.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *
+ * @param path  path to the file.
+ * @param fi    receives the state of the open file.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_open(const char *path, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
 
-					if (target->size <= (uint64_t) size){
-						size_achieved = 1;
-						break;
-					}
-					if (*byte != 0){
-						*byte = 0;
-					}
-					target->size--;
-				}
-				if (size_achieved){
-					break;
-				}
-			}
-			if (size_achieved){
-				break;
-			}
-		}
-		return 0;
+	a1fs_ino_t ino;
+	int ret = fsop_path_lookup(fs, path, &ino);
+	if (ret != 0){
+		return ret;
 	}
+	return fsop_open(fs, ino, fi);
 }
 
+/**
+ * Release an open file.
+ *
+ * Called once the last file descriptor that refers to an open file has been
+ * closed. Frees the state set up by a1fs_open() or a1fs_create().
+ *
+ * @param path  unused; NULL with flag_nopath.
+ * @param fi    the state of the open file.
+ * @return      0.
+ */
+static int a1fs_release(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	fsop_release(fi);
+	return 0;
+}
 
 /**
  * Read data from a file.
@@ -1628,88 +525,23 @@ static int a1fs_truncate(const char *path, off_t size)
  * data will be substituted with zeros. Reads from file ranges that have not
  * been written to must return ranges filled with zeros.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
+ * There is no read_buf(): libfuse frees the memory buffers it returns and only
+ * replies after the file is unlocked, so they can't point into the image. The
+ * low-level driver (a1fs_ll.c) replies straight from the image instead.
  *
- * @param path    path to the file to read from.
+ * @param path    unused; NULL with flag_nopath.
  * @param buf     pointer to the buffer that receives the data.
  * @param size    buffer size (number of bytes requested).
  * @param offset  offset from the beginning of the file to read from.
- * @param fi      unused.
+ * @param fi      the state of the open file.
  * @return        number of bytes read on success; 0 if offset is beyond EOF;
  *                -errno on error.
  */
 static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
                      struct fuse_file_info *fi)
 {
-	(void)fi;// unused
-	fs_ctx *fs = get_fs();
-
-	// Setup all of the usefull variables we will need.
-	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * sb->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-
-	// Get the target file that we will be reading, we do not need to check the return value of 'inode_from_path'
-	// because we are assuming it has already beed checked by a1fs_getattr().
-	a1fs_inode *target = (void *)0;
-	inode_from_path(root_inode, &target, path, fs->image);
-
-	// Loop through the file's extents
-	size_t byte_count = 0;
-	int offset_count = 0;
-	a1fs_extent *curr_extent;
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < target->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(sb->data_region + ((target->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = target->extent + i;
-		}
-		if (curr_extent->count > 0){
-			// Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_block = sb->data_region + curr_extent->start + j;
-
-				// Loop through all the bytes in this block.
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE; k++){
-					// First we must get to the start of the read range.
-					if (offset_count < offset){
-						offset_count++;
-					}
-					// Check if we still need to read more bytes.
-					else if (byte_count < size){
-						buf[byte_count] = *((unsigned char*)(fs->image + A1FS_BLOCK_SIZE*curr_block + k));
-						byte_count++;
-					}
-					// We have read the number of bytes requested, return success.
-					else {
-						return byte_count;
-					}
-				}
-			}
-			extents_count++;
-		}
-		i++;
-	}
-
-	// We reached EOF.
-
-	// Check if the offset was beyong EOF.
-	if (byte_count == 0){
-		return 0;
-	}
-
-	// Fill the rest of the buffer with 0's.
-	for (size_t i = 0; i < size - byte_count; i ++){
-		buf[byte_count + i] = 0;
-	}
-	return byte_count;
+	(void)path;// unused
+	return fsop_read(get_fs(), fi, buf, size, offset);
 }
 
 /**
@@ -1720,135 +552,135 @@ static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
  * the file must be extended. If the write creates a "hole" of uninitialized
  * data, future reads from the "hole" must return ranges filled with zeros.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
- *
- * @param path    path to the file to write to.
+ * @param path    unused; NULL with flag_nopath.
  * @param buf     pointer to the buffer containing the data.
  * @param size    buffer size (number of bytes requested).
  * @param offset  offset from the beginning of the file to write to.
- * @param fi      unused.
+ * @param fi      the state of the open file.
  * @return        number of bytes written on success; -errno on error.
  */
 static int a1fs_write(const char *path, const char *buf, size_t size,
                       off_t offset, struct fuse_file_info *fi)
 {
-	(void)fi;// unused
-	fs_ctx *fs = get_fs();
-
-	// Setup all of the usefull variables we will need.
-	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
-	a1fs_inode *inodes = (a1fs_inode*)(fs->image + A1FS_BLOCK_SIZE * sb->inode_table);
-	a1fs_inode *root_inode = inodes + A1FS_ROOT_INO;
-
-	// Get the target file that we will be reading, we do not need to check the return value of 'inode_from_path'
-	// because we are assuming it has already beed checked by a1fs_getattr().
-	a1fs_inode *target = (void *)0;
-	inode_from_path(root_inode, &target, path, fs->image);
-
-	// Loop through the file's extents
-	size_t byte_count = 0;
-	int offset_count = 0;
-	a1fs_extent *curr_extent;
-	int extents_count = 0;
-	int i = 0;
-	while (extents_count < target->extents){
-		if (i >= A1FS_IND_BLOCK){
-			// We are now looking in the indirect block.
-			int extent_location = A1FS_BLOCK_SIZE*(sb->data_region + ((target->extent)[A1FS_IND_BLOCK]).start) + (i-A1FS_IND_BLOCK)*sizeof(a1fs_extent);
-			curr_extent = (a1fs_extent*)(fs->image + extent_location);
-		}
-		else{
-			// We are looking at the extent at index i in the extents array.
-			curr_extent = target->extent + i;
-		}
-		if (curr_extent->count > 0){
-			// Loop through this entire extent (depending on extent length).
-			for (size_t j = 0; j < curr_extent->count; j++){
-				int curr_block = sb->data_region + curr_extent->start + j;
-				unsigned char *byte = (unsigned char*)(fs->image + A1FS_BLOCK_SIZE*curr_block);
-
-				// Loop through all the bytes in this block.
-				for (size_t k = 0; k < A1FS_BLOCK_SIZE; k++){
-					// First we must get to the start of the read range.
-					if (offset_count < offset){
-						offset_count++;
-					}
-					// Check if we still need to write more bytes.
-					else if (byte_count < size){
-						byte[k] = buf[byte_count];
-						byte_count++;
-					}
-					// We have read the number of bytes requested, return success.
-					else {
-						target->size += byte_count;
-						return byte_count;
-					}
-				}
-			}
-			extents_count++;
-		}
-		i++;
-	}
-
-	// We reached EOF.
-
-	// Check if the offset was beyong EOF.
-	if (byte_count == 0){
-		// The file must be extended.
-		 if (allocate_new_block(target, fs->image, 0) == -1){
-		 	return -ENOSPC;
-		 }
-		 return a1fs_write(path, buf, size, offset, fi);
-	}
+	(void)path;// unused
+	return fsop_write(get_fs(), fi, buf, size, offset);
+}
 
-	// Check if we still have bytes to write.
-	while (byte_count < size){
-		int extent_index = allocate_new_block(target, fs->image, 1);
-		if (extent_index== -1){
-			return -ENOSPC;
-		}
-		unsigned char *byte;
+/**
+ * Write data to a file from a FUSE buffer.
+ *
+ * Same as a1fs_write(), but with -o splice_read the data may still be in a
+ * pipe, and is read from it straight into the file's blocks.
+ *
+ * @param path    unused; NULL with flag_nopath.
+ * @param buf     the data.
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      the state of the open file.
+ * @return        number of bytes written on success; -errno on error.
+ */
+static int a1fs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                          struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	return fsop_write_buf(get_fs(), fi, buf, offset);
+}
 
-		// Check if the new block is part of an extent stored in the indirect block.
-		if (extent_index >= A1FS_IND_BLOCK){
-			int extent_block = (sb->data_region + ((target->extent)[A1FS_IND_BLOCK]).start)*A1FS_BLOCK_SIZE;
-			a1fs_extent *extent = (a1fs_extent*)(fs->image + extent_block + sizeof(a1fs_extent)*(extent_index % A1FS_IND_BLOCK));
+/**
+ * Flush a file on close.
+ *
+ * Called on every close() of a file descriptor. Writes out the data held back
+ * by delayed allocation, if any.
+ *
+ * @param path  unused; NULL with flag_nopath.
+ * @param fi    the state of the open file.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_flush(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	return fsop_flush(get_fs(), fi);
+}
 
-			int new_block = (sb->data_region + extent->start)*A1FS_BLOCK_SIZE;
-			byte = (unsigned char*)(fs->image + new_block + (extent->count - 1)*A1FS_BLOCK_SIZE);
-		}
-		// The new block is in the direct extents array.
-		else {
-			int new_block = (sb->data_region + ((target->extent)[extent_index]).start)*A1FS_BLOCK_SIZE;
-			byte = (unsigned char*)(fs->image + new_block + (((target->extent)[extent_index]).count - 1)*A1FS_BLOCK_SIZE);
-		}
+/**
+ * Synchronize file contents.
+ *
+ * Implements the fsync() and fdatasync() system calls. Writes out the data
+ * held back by delayed allocation, syncs the changed blocks of the file, then
+ * commits the journal. The rest of the image is left to writeback, so the cost
+ * depends on how much of the file has changed, not on the size of the image.
+ * fdatasync() does the same: the inode holds the size and the extents, which
+ * are needed to read the data back.
+ *
+ * @param path      unused; NULL with flag_nopath.
+ * @param datasync  unused.
+ * @param fi        the state of the open file.
+ * @return          0 on success; -errno on error.
+ */
+static int a1fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	(void)datasync;// unused
+	return fsop_fsync(get_fs(), fi);
+}
 
-		// Fill this new block with the remaining data.
-		for (int i = 0; i < A1FS_BLOCK_SIZE; i++){
-			byte[i] = buf[byte_count];
-			byte_count++;
-		}
-	}
-	target->size += byte_count;
-	return byte_count;
+/**
+ * Preallocate space for a file.
+ *
+ * Implements the fallocate() system call for the default mode and for
+ * FALLOC_FL_KEEP_SIZE. The blocks missing from the range are allocated in a
+ * single pass, so they are contiguous if there is a long enough free run, and
+ * zeroed. Writes into the range never need to allocate blocks afterwards.
+ *
+ * On images with the "sparse" feature, FALLOC_FL_PUNCH_HOLE (which must come
+ * with FALLOC_FL_KEEP_SIZE) zeroes the range instead, freeing the blocks that
+ * are wholly inside it.
+ *
+ * @param path    unused; NULL with flag_nopath.
+ * @param mode    0 or FALLOC_FL_KEEP_SIZE; with the latter, the file size
+ *                is left unchanged even if the range extends past EOF. Or
+ *                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE.
+ * @param offset  offset of the start of the range.
+ * @param length  length of the range.
+ * @param fi      the state of the open file.
+ * @return        0 on success; -errno on error.
+ */
+static int a1fs_fallocate(const char *path, int mode, off_t offset, off_t length,
+                          struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	return fsop_fallocate(get_fs(), fi, mode, offset, length);
 }
 
 
 static struct fuse_operations a1fs_ops = {
+	// Everything that gets a struct fuse_file_info works from the handle in it,
+	// so libfuse doesn't need to build paths for those.
+	.flag_nullpath_ok = 1,
+	.flag_nopath      = 1,
+	.init     = a1fs_start,
 	.destroy  = a1fs_destroy,
 	.statfs   = a1fs_statfs,  // done
 	.getattr  = a1fs_getattr, // done
+	.fgetattr = a1fs_fgetattr,
+	.opendir  = a1fs_opendir,
 	.readdir  = a1fs_readdir, // done
+	.releasedir = a1fs_releasedir,
 	.mkdir    = a1fs_mkdir,   // done
 	.rmdir    = a1fs_rmdir,   // done
 	.create   = a1fs_create,  // done
+	.open     = a1fs_open,
+	.release  = a1fs_release,
 	.unlink   = a1fs_unlink,  // Ethan done?
 	.rename   = a1fs_rename,  // done
 	.utimens  = a1fs_utimens, // done
 	.truncate = a1fs_truncate,
+	.ftruncate = a1fs_ftruncate,
 	.read     = a1fs_read,    // done
 	.write    = a1fs_write,   // done
+	.write_buf = a1fs_write_buf,
+	.flush    = a1fs_flush,
+	.fsync    = a1fs_fsync,
+	.fallocate = a1fs_fallocate,
 };
 
 int main(int argc, char *argv[])
@@ -1858,7 +690,7 @@ int main(int argc, char *argv[])
 	if (!a1fs_opt_parse(&args, &opts)) return 1;
 
 	fs_ctx fs = {0};
-	if (!a1fs_init(&fs, &opts)) {
+	if (!fsop_init(&fs, &opts)) {
 		fprintf(stderr, "Failed to mount the file system\n");
 		return 1;
 	}
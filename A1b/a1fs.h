@@ -19,6 +19,7 @@
 #pragma once
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <limits.h>
 #include <sys/stat.h>
@@ -36,9 +37,10 @@
 
 
 /* Block number (block pointer) type. */
-typedef uint32_t a1fs_blk_t;
+typedef uint64_t a1fs_blk_t;
 
-/* Inode number type. */
+/* Inode number type. 2^32 inodes would take up 1 TiB of inode table, so inode
+   numbers stay 32-bit, which keeps the directory entry formats unchanged. */
 typedef uint32_t a1fs_ino_t;
 
 /* The index of the first data block that is not reserved
@@ -48,6 +50,23 @@ typedef uint32_t a1fs_ino_t;
 /** Magic value that can be used to identify an a1fs image. */
 #define A1FS_MAGIC 0xC5C369A1C5C369A1ul
 
+/* Superblock feature flags. An image with a feature the driver doesn't know
+   about must not be mounted. */
+#define A1FS_FEATURE_DIR_INDEX      0x1 /* Large directories use a hash index */
+#define A1FS_FEATURE_COMPACT_DENTRY 0x2 /* Directories use a1fs_dirent records */
+#define A1FS_FEATURE_SPARSE         0x4 /* Files can have holes (A1FS_HOLE extents) */
+#define A1FS_FEATURE_GROUPS         0x8 /* Blocks and inodes are split into allocation groups */
+#define A1FS_FEATURE_JOURNAL        0x10 /* Metadata changes go through a journal */
+#define A1FS_FEATURE_64BIT          0x20 /* Block numbers and superblock fields are 64-bit */
+
+#define A1FS_FEATURES_SUPPORTED (A1FS_FEATURE_DIR_INDEX | A1FS_FEATURE_COMPACT_DENTRY | \
+                                 A1FS_FEATURE_SPARSE | A1FS_FEATURE_GROUPS | \
+                                 A1FS_FEATURE_JOURNAL | A1FS_FEATURE_64BIT)
+
+/* Features without which an image can't be mounted. Images formatted before
+   A1FS_FEATURE_64BIT use 32-bit block numbers and must be reformatted. */
+#define A1FS_FEATURES_REQUIRED A1FS_FEATURE_64BIT
+
 /** a1fs superblock. */
 typedef struct a1fs_superblock {
 	/** Must match A1FS_MAGIC. */
@@ -56,25 +75,122 @@ typedef struct a1fs_superblock {
 	uint64_t size;
 
 	//TODO
-	unsigned int inodes_count;       /* Total number of inodes */
-	unsigned int blocks_count;       /* Total number of data blocks */
-	unsigned int free_inodes_count;  /* Number of free inodes */
-	unsigned int free_blocks_count;  /* Number of free data blocks */
+	uint64_t inodes_count;       /* Total number of inodes */
+	uint64_t blocks_count;       /* Total number of data blocks */
+	uint64_t free_inodes_count;  /* Number of free inodes */
+	uint64_t free_blocks_count;  /* Number of free data blocks */
 
 	// Block indexes starting from 0. Superblock is block index 0.
-	unsigned int block_bitmap;      /* Blocks bitmap block */
-	unsigned int inode_bitmap;      /* Inodes bitmap block */
-	unsigned int inode_table;       /* Inodes table block */
-	unsigned int data_region;       /* Data region starting block */ 
+	uint64_t block_bitmap;       /* Blocks bitmap block */
+
+	// At the same offset as in the old 32-bit layout, so that drivers of
+	// either layout can tell them apart by A1FS_FEATURE_64BIT.
+	uint32_t features;           /* Feature flags (A1FS_FEATURE_*) */
+	uint32_t reserved;
+
+	uint64_t inode_bitmap;       /* Inodes bitmap block */
+	uint64_t inode_table;        /* Inodes table block */
+	uint64_t data_region;        /* Data region starting block */
+
+	uint64_t block_bitmap_span;  /* The number of blocks the block bitmap spans */
+	uint64_t inode_bitmap_span;  /* The number of blocks the inode bitmap spans */
 
-	unsigned int block_bitmap_span; /* The number of blocks the block bitmap spans */
-	unsigned int inode_bitmap_span; /* The number of blocks the inode bitmap spans */ 
+	// Only used with A1FS_FEATURE_GROUPS.
+	uint64_t groups_count;       /* Number of allocation groups */
+	uint64_t blocks_per_group;   /* Data blocks in each group (the last one may have fewer) */
+	uint64_t inodes_per_group;   /* Inodes in each group (the last ones may have fewer) */
+	uint64_t group_table;        /* Group descriptor table block */
+	uint64_t group_table_span;   /* The number of blocks the group descriptor table spans */
+
+	// Only used with A1FS_FEATURE_JOURNAL.
+	uint64_t journal;            /* Journal region starting block */
+	uint64_t journal_span;       /* The number of blocks the journal spans */
 
 } a1fs_superblock;
 
 // Superblock must fit into a single block
 static_assert(sizeof(a1fs_superblock) <= A1FS_BLOCK_SIZE,
               "superblock is too large");
+static_assert(offsetof(a1fs_superblock, features) == 56, "features moved");
+
+
+/**
+ * Allocation group descriptor. Group g owns the data blocks starting at
+ * g * blocks_per_group and the inodes starting at g * inodes_per_group, i.e. a
+ * slice of each bitmap. The descriptors let the allocators pick a group with
+ * enough free space without looking at the bitmaps.
+ */
+typedef struct a1fs_group_desc {
+	/** Number of free data blocks in the group. */
+	uint32_t free_blocks_count;
+	/** Number of free inodes in the group. */
+	uint32_t free_inodes_count;
+	/** Number of directories whose inodes are in the group. */
+	uint32_t used_dirs_count;
+	/** All the inodes of the group before this one (relative to the group)
+	    are in use. */
+	uint32_t first_free_inode;
+
+} a1fs_group_desc;
+
+static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_group_desc) == 0, "invalid group descriptor size");
+
+/** Default number of data blocks per group: as many as one bitmap block covers. */
+#define A1FS_BLOCKS_PER_GROUP (A1FS_BLOCK_SIZE * 8)
+
+
+/**
+ * Journal superblock, in the first block of the journal region. The
+ * transactions in the journal follow it back to back, starting with sequence
+ * number seq; the first block that doesn't continue that sequence ends them.
+ *
+ * A transaction is a run of descriptor blocks, each followed by the copies of
+ * the blocks it lists, then any revoke blocks, then a commit block. All of
+ * them start with an a1fs_journal_header. Block numbers count from the start
+ * of the image.
+ */
+typedef struct a1fs_journal_sb {
+	/** Must match A1FS_JOURNAL_MAGIC. */
+	uint32_t magic;
+	uint32_t reserved;
+	/** Sequence number of the first transaction in the journal. */
+	uint64_t seq;
+
+} a1fs_journal_sb;
+
+/** Magic value of journal blocks. */
+#define A1FS_JOURNAL_MAGIC 0xC369A1D0u
+
+/* Journal block types */
+#define A1FS_JOURNAL_DESCRIPTOR 1 /* Lists the blocks whose copies follow it */
+#define A1FS_JOURNAL_REVOKE     2 /* Lists blocks not to replay from earlier transactions */
+#define A1FS_JOURNAL_COMMIT     3 /* Ends a transaction */
+
+/** Header of a descriptor, revoke or commit block in the journal. */
+typedef struct a1fs_journal_header {
+	/** Must match A1FS_JOURNAL_MAGIC. */
+	uint32_t magic;
+	/** Block type (A1FS_JOURNAL_*). */
+	uint32_t type;
+	/** Sequence number of the transaction. */
+	uint64_t seq;
+	/** Number of entries in blocks[]; for a commit block, the number of
+	    journal blocks in the transaction before it. */
+	uint32_t count;
+	/** Commit block only: checksum of the blocks of the transaction before it. */
+	uint32_t checksum;
+	/** Block numbers (descriptor and revoke blocks only). */
+	uint64_t blocks[];
+
+} a1fs_journal_header;
+
+static_assert(sizeof(a1fs_journal_header) == 24, "invalid journal header size");
+
+/** Maximum number of block numbers in a descriptor or revoke block. */
+#define A1FS_JOURNAL_ENTRIES ((A1FS_BLOCK_SIZE - sizeof(a1fs_journal_header)) / sizeof(uint64_t))
+
+/** Smallest journal mkfs will create. */
+#define A1FS_JOURNAL_MIN_BLOCKS 64
 
 
 /** Extent - a contiguous range of blocks. */
@@ -86,6 +202,12 @@ typedef struct a1fs_extent {
 
 } a1fs_extent;
 
+/* Start block of an extent that is a hole: count blocks of the file that have
+   no data blocks and read as zeros. Only used with A1FS_FEATURE_SPARSE. The
+   logical position of an extent in a file is the sum of the counts of the
+   extents before it, holes included. */
+#define A1FS_HOLE ((a1fs_blk_t)-1)
+
 /* The index of the single indirect pointer in the extent array of an inode */
 #define A1FS_IND_BLOCK 10
 
@@ -95,7 +217,13 @@ typedef struct a1fs_extent {
 /* The length of the inode extents array */
 #define A1FS_EXTENTS_LENGTH 11
 
-#define A1FS_NUM_EXTENTS 512
+/* The number of extents in the single indirect block */
+#define A1FS_NUM_EXTENTS 256
+
+static_assert(A1FS_NUM_EXTENTS * sizeof(a1fs_extent) == A1FS_BLOCK_SIZE, "invalid indirect block size");
+
+/* Inode flags */
+#define A1FS_INODE_INDEXED 0x1 /* Directory entries are found through dx_root */
 
 
 /** a1fs inode. */
@@ -130,10 +258,14 @@ typedef struct a1fs_inode {
 	a1fs_extent extent[A1FS_EXTENTS_LENGTH]; /* Pointers to extents */
 	// extent[0-9] are direct, extent[10] is Single Indirect
 
+	uint32_t flags;    /* Inode flags (A1FS_INODE_*) */
+	a1fs_blk_t dx_root; /* Root block of the directory index (if A1FS_INODE_INDEXED) */
+
 	//NOTE: You might have to add padding (e.g. a dummy char array field) at the
 	// end of the struct in order to satisfy the assertion below. Try to keep
 	// the size of this struct minimal, but don't worry about the "wasted space"
 	// introduced by the required padding.
+	char padding[24];
 
 } a1fs_inode;
 
@@ -157,3 +289,81 @@ typedef struct a1fs_dentry {
 } a1fs_dentry;
 
 static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size");
+
+/**
+ * Variable length directory entry, used instead of a1fs_dentry if the file
+ * system has the A1FS_FEATURE_COMPACT_DENTRY feature.
+ *
+ * A dentry block is a sequence of records that covers the whole block. Each
+ * record's rec_len includes any free space after its name, which can be used
+ * for new entries. Only the first record in a block can be unused; removing
+ * any other record merges it into the previous one.
+ */
+typedef struct a1fs_dirent {
+	/** Inode number. */
+	a1fs_ino_t ino;
+	/** Length of this record in bytes; a multiple of 4. */
+	uint16_t rec_len;
+	/** Length of the name; 0 if the record is unused. */
+	uint8_t name_len;
+	/** File type, the S_IFMT bits of the mode shifted right by 12 (DT_*). */
+	uint8_t type;
+	/** a1fs_name_hash() of the name, checked before comparing names. */
+	uint32_t hash;
+	/** File name. Not null-terminated. */
+	char name[];
+
+} a1fs_dirent;
+
+static_assert(sizeof(a1fs_dirent) == 12, "invalid dirent size");
+
+/** Convert a file mode to the type stored in a1fs_dirent. */
+#define A1FS_DT(mode) (((mode) & S_IFMT) >> 12)
+
+
+/**
+ * Hash of a file name, used to place entries in the directory index. This is
+ * part of the on-disk format (32-bit FNV-1a) and must not be changed.
+ */
+static inline uint32_t a1fs_name_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Directory index (htree) entry. Index entries in a node are sorted by hash;
+ * an entry covers the names whose hash is >= its hash and < the hash of the
+ * next entry. The first entry of the root always has hash 0.
+ */
+typedef struct a1fs_dx_entry {
+	/** Lowest name hash covered by the block. */
+	uint32_t hash;
+	uint32_t reserved;
+	/** Child index node (level > 0) or dentry block (level 0). */
+	a1fs_blk_t block;
+
+} a1fs_dx_entry;
+
+/**
+ * Directory index node. The root is referenced by dx_root in the directory
+ * inode. Leaves are ordinary dentry blocks; every index and leaf block is also
+ * part of the directory's extents, so they are freed along with it.
+ */
+typedef struct a1fs_dx_node {
+	/** Number of entries in use. */
+	uint16_t count;
+	/** 0 if the entries point to dentry blocks; otherwise the node height. */
+	uint16_t level;
+	uint32_t reserved;
+	/** Entries sorted by hash. */
+	a1fs_dx_entry entries[];
+
+} a1fs_dx_node;
+
+/** Maximum number of entries in a directory index node. */
+#define A1FS_DX_LIMIT ((A1FS_BLOCK_SIZE - sizeof(a1fs_dx_node)) / sizeof(a1fs_dx_entry))
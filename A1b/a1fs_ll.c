@@ -0,0 +1,801 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs low-level driver implementation.
+ *
+ * The low-level FUSE driver. The kernel names files and directories by node
+ * ID instead of by path, so requests go straight to the inode: there are no
+ * path walks here, and libfuse doesn't have to build paths either. Node IDs
+ * are inode numbers plus one, since the FUSE root is node 1 and the a1fs root
+ * directory is inode 0. The file system operations are shared with the
+ * high-level driver (a1fs.c) and the on-disk format is the same.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Using 2.9.x FUSE API
+#define FUSE_USE_VERSION 29
+#include <fuse_lowlevel.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+#include "fsops.h"
+#include "options.h"
+
+//NOTE: the kernel counts the references it holds to every node, adding one
+// for each reply that carries an entry (lookup, mkdir, create) and dropping
+// them with forget(). A file or directory that is removed while the kernel
+// still refers to it (e.g. because it is open) is kept as an orphan until the
+// last reference is forgotten, so that it can still be read and written; the
+// high-level API gets the same effect by renaming open files instead of
+// removing them. An orphan has no links left, so its link count on disk is
+// 0, but nothing frees it after a crash: a crash leaks it.
+//
+// The kernel holds the lock of a directory while it looks up, adds or removes
+// names in it, so a name can't be looked up again once it has been removed
+// and an orphan can't gain references.
+
+
+/** How long the kernel may cache attributes and names, in seconds. Nothing
+ * changes them behind its back. */
+#define A1FS_LL_TIMEOUT 1.0
+
+/** State of the low-level driver, passed to libfuse as the user data. */
+typedef struct a1fs_ll {
+	fs_ctx fs;
+
+	/** Protects the lookup counts and the orphan flags. */
+	pthread_mutex_t lock;
+	/** The number of references the kernel holds to each inode. */
+	uint64_t *nlookup;
+	/** Whether each inode has been removed but is still referred to. */
+	bool *orphan;
+	/** Whether a1fs_ll_destroy() has run. */
+	bool destroyed;
+} a1fs_ll;
+
+/** State of an open directory: its entries in the format of the kernel,
+ * built when it is read from the start and handed out in slices. */
+typedef struct a1fs_ll_dir {
+	char *buf;
+	size_t size;
+	size_t cap;
+} a1fs_ll_dir;
+
+static inline a1fs_ino_t node_ino(fuse_ino_t node)
+{
+	return node - FUSE_ROOT_ID + A1FS_ROOT_INO;
+}
+
+static inline fuse_ino_t ino_node(a1fs_ino_t ino)
+{
+	return ino - A1FS_ROOT_INO + FUSE_ROOT_ID;
+}
+
+/** Get the driver state. */
+static a1fs_ll *get_ll(fuse_req_t req)
+{
+	return (a1fs_ll*)fuse_req_userdata(req);
+}
+
+/** Get the state of an open directory. */
+static a1fs_ll_dir *get_dir(struct fuse_file_info *fi)
+{
+	return (a1fs_ll_dir*)(uintptr_t)fi->fh;
+}
+
+
+/** Count a reference to an inode handed to the kernel. */
+static void ll_ref(a1fs_ll *ll, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&ll->lock);
+	ll->nlookup[ino]++;
+	pthread_mutex_unlock(&ll->lock);
+}
+
+/** Drop references to an inode, freeing it if it is an orphan and that was
+ * the last one. */
+static void ll_unref(a1fs_ll *ll, a1fs_ino_t ino, uint64_t count)
+{
+	pthread_mutex_lock(&ll->lock);
+	ll->nlookup[ino] -= (count < ll->nlookup[ino]) ? count : ll->nlookup[ino];
+	bool evict = ll->orphan[ino] && ll->nlookup[ino] == 0;
+	if (evict) {
+		ll->orphan[ino] = false;
+	}
+	pthread_mutex_unlock(&ll->lock);
+	if (evict) {
+		fsop_evict(&ll->fs, ino);
+	}
+}
+
+/** Free an inode that has just been removed, or make it an orphan if the
+ * kernel still refers to it. A1FS_ROOT_INO stands for no inode. */
+static void ll_removed(a1fs_ll *ll, a1fs_ino_t ino)
+{
+	if (ino == A1FS_ROOT_INO) {
+		return;
+	}
+	pthread_mutex_lock(&ll->lock);
+	bool evict = ll->nlookup[ino] == 0;
+	if (!evict) {
+		ll->orphan[ino] = true;
+	}
+	pthread_mutex_unlock(&ll->lock);
+	if (evict) {
+		fsop_evict(&ll->fs, ino);
+	}
+}
+
+/**
+ * Fill in the entry for an inode to reply with, and count the reference the
+ * reply hands to the kernel.
+ *
+ * @param ll   the driver state.
+ * @param ino  the inode number.
+ * @param e    the entry that receives the result.
+ * @return     0 on success; -errno on error, with no reference counted.
+ */
+static int ll_entry(a1fs_ll *ll, a1fs_ino_t ino, struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(*e));
+	ll_ref(ll, ino);
+	int ret = fsop_getattr(&ll->fs, ino, &e->attr);
+	if (ret != 0) {
+		ll_unref(ll, ino, 1);
+		return ret;
+	}
+	e->ino = ino_node(ino);
+	e->attr.st_ino = e->ino;
+	e->attr_timeout = A1FS_LL_TIMEOUT;
+	e->entry_timeout = A1FS_LL_TIMEOUT;
+	return 0;
+}
+
+/** Reply with the entry for an inode; the reference is dropped again if the
+ * reply doesn't reach the kernel. */
+static void ll_reply_entry(fuse_req_t req, a1fs_ll *ll, a1fs_ino_t ino)
+{
+	struct fuse_entry_param e;
+	int ret = ll_entry(ll, ino, &e);
+	if (ret != 0) {
+		fuse_reply_err(req, -ret);
+	} else if (fuse_reply_entry(req, &e) != 0) {
+		ll_unref(ll, ino, 1);
+	}
+}
+
+
+/**
+ * Start the background work of the file system. Called once the kernel has
+ * connected, after the driver has forked into the background.
+ *
+ * @param userdata  the driver state.
+ * @param conn      unused.
+ */
+static void a1fs_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	(void)conn;// unused
+	fsop_start(&((a1fs_ll*)userdata)->fs);
+}
+
+/**
+ * Cleanup the file system. Called when the file system is unmounted.
+ *
+ * The kernel doesn't forget the nodes it still refers to at unmount, so the
+ * orphans are freed here. libfuse only calls it if the kernel has connected;
+ * otherwise main() does.
+ *
+ * @param userdata  the driver state.
+ */
+static void a1fs_ll_destroy(void *userdata)
+{
+	a1fs_ll *ll = (a1fs_ll*)userdata;
+	uint64_t count = ((a1fs_superblock*)ll->fs.image)->inodes_count;
+	for (a1fs_ino_t ino = 0; ino < count; ino++) {
+		if (ll->orphan[ino]) {
+			ll->orphan[ino] = false;
+			fsop_evict(&ll->fs, ino);
+		}
+	}
+	fsop_destroy(&ll->fs);
+	ll->destroyed = true;
+}
+
+/**
+ * Look up a name in a directory and reply with its entry.
+ *
+ * @param req     the request.
+ * @param parent  node ID of the directory.
+ * @param name    the name to look up.
+ */
+static void a1fs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	a1fs_ll *ll = get_ll(req);
+
+	a1fs_ino_t ino;
+	int ret = fsop_lookup(&ll->fs, node_ino(parent), name, strlen(name), &ino);
+	if (ret != 0) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	ll_reply_entry(req, ll, ino);
+}
+
+/**
+ * Drop references to a node.
+ *
+ * @param req      the request; has no reply.
+ * @param node     node ID of the file or directory.
+ * @param nlookup  the number of references to drop.
+ */
+static void a1fs_ll_forget(fuse_req_t req, fuse_ino_t node, unsigned long nlookup)
+{
+	ll_unref(get_ll(req), node_ino(node), nlookup);
+	fuse_reply_none(req);
+}
+
+/**
+ * Drop references to several nodes at once.
+ *
+ * @param req      the request; has no reply.
+ * @param count    the number of nodes.
+ * @param forgets  the nodes and the number of references to drop from each.
+ */
+static void a1fs_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+	a1fs_ll *ll = get_ll(req);
+	for (size_t i = 0; i < count; i++) {
+		ll_unref(ll, node_ino(forgets[i].ino), forgets[i].nlookup);
+	}
+	fuse_reply_none(req);
+}
+
+/**
+ * Get file or directory attributes. See a1fs_getattr() in a1fs.c.
+ *
+ * @param req   the request.
+ * @param node  node ID of the file or directory.
+ * @param fi    unused.
+ */
+static void a1fs_ll_getattr(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	struct stat st;
+	int ret = fsop_getattr(&get_ll(req)->fs, node_ino(node), &st);
+	if (ret != 0) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	st.st_ino = node;
+	fuse_reply_attr(req, &st, A1FS_LL_TIMEOUT);
+}
+
+/**
+ * Change file or directory attributes: the size (truncate() and ftruncate())
+ * and the modification time (utimensat()). The access time is ignored, as in
+ * the high-level driver, which has no chmod() or chown() either.
+ *
+ * @param req     the request.
+ * @param node    node ID of the file or directory.
+ * @param attr    the new attributes.
+ * @param to_set  FUSE_SET_ATTR_* bits of the attributes to change.
+ * @param fi      unused.
+ */
+static void a1fs_ll_setattr(fuse_req_t req, fuse_ino_t node, struct stat *attr, int to_set,
+                            struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	fs_ctx *fs = &get_ll(req)->fs;
+	a1fs_ino_t ino = node_ino(node);
+
+	int ret = 0;
+	if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+		ret = -ENOSYS;
+	}
+	if (ret == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+		ret = fsop_truncate(fs, ino, attr->st_size);
+	}
+	if (ret == 0 && (to_set & FUSE_SET_ATTR_MTIME)) {
+		ret = fsop_utimens(fs, ino, (to_set & FUSE_SET_ATTR_MTIME_NOW) ? NULL : &attr->st_mtim);
+	}
+	struct stat st;
+	if (ret == 0) {
+		ret = fsop_getattr(fs, ino, &st);
+	}
+	if (ret != 0) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	st.st_ino = node;
+	fuse_reply_attr(req, &st, A1FS_LL_TIMEOUT);
+}
+
+/**
+ * Create a directory and reply with its entry.
+ *
+ * @param req     the request.
+ * @param parent  node ID of the parent directory.
+ * @param name    the name of the new directory.
+ * @param mode    file mode bits.
+ */
+static void a1fs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	a1fs_ll *ll = get_ll(req);
+
+	a1fs_ino_t ino;
+	int ret = fsop_mkdir(&ll->fs, node_ino(parent), name, strlen(name), mode, &ino);
+	if (ret != 0) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	ll_reply_entry(req, ll, ino);
+}
+
+/**
+ * Remove a file.
+ *
+ * @param req     the request.
+ * @param parent  node ID of the parent directory.
+ * @param name    the name of the file.
+ */
+static void a1fs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	a1fs_ll *ll = get_ll(req);
+
+	a1fs_ino_t orphan = A1FS_ROOT_INO;
+	int ret = fsop_unlink(&ll->fs, node_ino(parent), name, strlen(name), &orphan);
+	if (ret == 0) {
+		ll_removed(ll, orphan);
+	}
+	fuse_reply_err(req, -ret);
+}
+
+/**
+ * Remove an empty directory.
+ *
+ * @param req     the request.
+ * @param parent  node ID of the parent directory.
+ * @param name    the name of the directory.
+ */
+static void a1fs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	a1fs_ll *ll = get_ll(req);
+
+	a1fs_ino_t orphan = A1FS_ROOT_INO;
+	int ret = fsop_rmdir(&ll->fs, node_ino(parent), name, strlen(name), &orphan);
+	if (ret == 0) {
+		ll_removed(ll, orphan);
+	}
+	fuse_reply_err(req, -ret);
+}
+
+/**
+ * Rename a file or directory, replacing the destination if it exists. The
+ * kernel has already checked that a directory isn't moved under itself and
+ * that the types of the source and the destination match.
+ *
+ * @param req        the request.
+ * @param parent     node ID of the original parent directory.
+ * @param name       the original name.
+ * @param newparent  node ID of the new parent directory.
+ * @param newname    the new name.
+ */
+static void a1fs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                           fuse_ino_t newparent, const char *newname)
+{
+	a1fs_ll *ll = get_ll(req);
+
+	a1fs_ino_t orphan = A1FS_ROOT_INO;
+	int ret = fsop_rename(&ll->fs, node_ino(parent), name, strlen(name),
+	                      node_ino(newparent), newname, strlen(newname), &orphan);
+	if (ret == 0) {
+		ll_removed(ll, orphan);
+	}
+	fuse_reply_err(req, -ret);
+}
+
+/**
+ * Open a file.
+ *
+ * @param req   the request.
+ * @param node  node ID of the file.
+ * @param fi    receives the state of the open file.
+ */
+static void a1fs_ll_open(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	int ret = fsop_open(&get_ll(req)->fs, node_ino(node), fi);
+	if (ret != 0) {
+		fuse_reply_err(req, -ret);
+	} else if (fuse_reply_open(req, fi) != 0) {
+		fsop_release(fi);
+	}
+}
+
+/**
+ * Create a file, open it, and reply with its entry.
+ *
+ * @param req     the request.
+ * @param parent  node ID of the parent directory.
+ * @param name    the name of the new file.
+ * @param mode    file mode bits.
+ * @param fi      receives the state of the new open file.
+ */
+static void a1fs_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                           struct fuse_file_info *fi)
+{
+	a1fs_ll *ll = get_ll(req);
+
+	a1fs_ino_t ino;
+	int ret = fsop_create(&ll->fs, node_ino(parent), name, strlen(name), mode, fi, &ino);
+	if (ret != 0) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	struct fuse_entry_param e;
+	ret = ll_entry(ll, ino, &e);
+	if (ret != 0) {
+		fsop_release(fi);
+		fuse_reply_err(req, -ret);
+	} else if (fuse_reply_create(req, &e, fi) != 0) {
+		fsop_release(fi);
+		ll_unref(ll, ino, 1);
+	}
+}
+
+/**
+ * Release an open file.
+ *
+ * @param req   the request.
+ * @param node  unused.
+ * @param fi    the state of the open file.
+ */
+static void a1fs_ll_release(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	fsop_release(fi);
+	fuse_reply_err(req, 0);
+}
+
+/** Callback for fsop_read_iov(): reply with the data where it is. */
+static void read_reply(void *arg, const struct iovec *iov, int count)
+{
+	fuse_reply_iov((fuse_req_t)arg, iov, count);
+}
+
+/**
+ * Read data from a file. See a1fs_read() in a1fs.c.
+ *
+ * The reply is written to the kernel straight from the image while the file is
+ * locked, without copying the data into a buffer first.
+ *
+ * @param req   the request.
+ * @param node  unused.
+ * @param size  number of bytes requested.
+ * @param off   offset from the beginning of the file to read from.
+ * @param fi    the state of the open file.
+ */
+static void a1fs_ll_read(fuse_req_t req, fuse_ino_t node, size_t size, off_t off,
+                         struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	int ret = fsop_read_iov(&get_ll(req)->fs, fi, size, off, read_reply, req);
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+	}
+}
+
+/**
+ * Write data to a file. See a1fs_write() in a1fs.c.
+ *
+ * With -o splice_read, the data may still be in a pipe, and is read from it
+ * straight into the file's blocks.
+ *
+ * @param req   the request.
+ * @param node  unused.
+ * @param bufv  the data.
+ * @param off   offset from the beginning of the file to write to.
+ * @param fi    the state of the open file.
+ */
+static void a1fs_ll_write_buf(fuse_req_t req, fuse_ino_t node, struct fuse_bufvec *bufv,
+                              off_t off, struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	int ret = fsop_write_buf(&get_ll(req)->fs, fi, bufv, off);
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+	} else {
+		fuse_reply_write(req, ret);
+	}
+}
+
+/**
+ * Flush a file on close. See a1fs_flush() in a1fs.c.
+ *
+ * @param req   the request.
+ * @param node  unused.
+ * @param fi    the state of the open file.
+ */
+static void a1fs_ll_flush(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	fuse_reply_err(req, -fsop_flush(&get_ll(req)->fs, fi));
+}
+
+/**
+ * Synchronize file contents. See a1fs_fsync() in a1fs.c.
+ *
+ * @param req       the request.
+ * @param node      unused.
+ * @param datasync  unused.
+ * @param fi        the state of the open file.
+ */
+static void a1fs_ll_fsync(fuse_req_t req, fuse_ino_t node, int datasync, struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	(void)datasync;// unused
+	fuse_reply_err(req, -fsop_fsync(&get_ll(req)->fs, fi));
+}
+
+/**
+ * Preallocate space for a file or punch a hole in it. See a1fs_fallocate()
+ * in a1fs.c.
+ *
+ * @param req     the request.
+ * @param node    unused.
+ * @param mode    the fallocate() mode.
+ * @param offset  offset of the start of the range.
+ * @param length  length of the range.
+ * @param fi      the state of the open file.
+ */
+static void a1fs_ll_fallocate(fuse_req_t req, fuse_ino_t node, int mode, off_t offset,
+                              off_t length, struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	fuse_reply_err(req, -fsop_fallocate(&get_ll(req)->fs, fi, mode, offset, length));
+}
+
+/**
+ * Open a directory. Its entries are read when it is first read from.
+ *
+ * @param req   the request.
+ * @param node  unused.
+ * @param fi    receives the state of the open directory.
+ */
+static void a1fs_ll_opendir(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	a1fs_ll_dir *dir = calloc(1, sizeof(a1fs_ll_dir));
+	if (dir == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	fi->fh = (uint64_t)(uintptr_t)dir;
+	if (fuse_reply_open(req, fi) != 0) {
+		free(dir);
+	}
+}
+
+/** State passed to readdir_entry() through fsop_readdir(). */
+typedef struct readdir_state {
+	fuse_req_t req;
+	a1fs_ll_dir *dir;
+} readdir_state;
+
+static int readdir_entry(const char *name, size_t len, a1fs_ino_t ino, unsigned int type, void *arg)
+{
+	readdir_state *state = (readdir_state*)arg;
+	a1fs_ll_dir *dir = state->dir;
+	char buf[A1FS_NAME_MAX];
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+
+	size_t need = fuse_add_direntry(state->req, NULL, 0, buf, NULL, 0);
+	if (dir->size + need > dir->cap) {
+		size_t cap = (dir->cap > 0) ? dir->cap : 4096;
+		while (dir->size + need > cap) {
+			cap *= 2;
+		}
+		char *grown = realloc(dir->buf, cap);
+		if (grown == NULL) {
+			return -ENOMEM;
+		}
+		dir->buf = grown;
+		dir->cap = cap;
+	}
+
+	// Compact entries carry the file type; the kernel asks for it otherwise.
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	st.st_ino = ino_node(ino);
+	st.st_mode = type << 12;
+	fuse_add_direntry(state->req, dir->buf + dir->size, need, buf, &st, dir->size + need);
+	dir->size += need;
+	return 0;
+}
+
+/**
+ * Read a directory. The entries are read into the state of the open directory
+ * when it is read from the start, and handed out from there; the offset of an
+ * entry is where the next one starts.
+ *
+ * @param req   the request.
+ * @param node  node ID of the directory.
+ * @param size  the maximum number of bytes to reply with.
+ * @param off   offset of the first entry to reply with.
+ * @param fi    the state of the open directory.
+ */
+static void a1fs_ll_readdir(fuse_req_t req, fuse_ino_t node, size_t size, off_t off,
+                            struct fuse_file_info *fi)
+{
+	a1fs_ll_dir *dir = get_dir(fi);
+	if (off == 0) {
+		dir->size = 0;
+		readdir_state state = { req, dir };
+		int ret = fsop_readdir(&get_ll(req)->fs, node_ino(node), readdir_entry, &state);
+		if (ret != 0) {
+			dir->size = 0;
+			fuse_reply_err(req, -ret);
+			return;
+		}
+	}
+	if ((size_t)off >= dir->size) {
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+	if (size > dir->size - off) {
+		size = dir->size - off;
+	}
+	fuse_reply_buf(req, dir->buf + off, size);
+}
+
+/**
+ * Release an open directory.
+ *
+ * @param req   the request.
+ * @param node  unused.
+ * @param fi    the state of the open directory.
+ */
+static void a1fs_ll_releasedir(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	(void)node;// unused
+	a1fs_ll_dir *dir = get_dir(fi);
+	free(dir->buf);
+	free(dir);
+	fuse_reply_err(req, 0);
+}
+
+/**
+ * Get file system statistics. See a1fs_statfs() in a1fs.c.
+ *
+ * @param req   the request.
+ * @param node  unused.
+ */
+static void a1fs_ll_statfs(fuse_req_t req, fuse_ino_t node)
+{
+	(void)node;// unused
+	struct statvfs st;
+	fsop_statfs(&get_ll(req)->fs, &st);
+	fuse_reply_statfs(req, &st);
+}
+
+
+static struct fuse_lowlevel_ops a1fs_ll_ops = {
+	.init         = a1fs_ll_init,
+	.destroy      = a1fs_ll_destroy,
+	.lookup       = a1fs_ll_lookup,
+	.forget       = a1fs_ll_forget,
+	.forget_multi = a1fs_ll_forget_multi,
+	.getattr      = a1fs_ll_getattr,
+	.setattr      = a1fs_ll_setattr,
+	.mkdir        = a1fs_ll_mkdir,
+	.unlink       = a1fs_ll_unlink,
+	.rmdir        = a1fs_ll_rmdir,
+	.rename       = a1fs_ll_rename,
+	.open         = a1fs_ll_open,
+	.create       = a1fs_ll_create,
+	.release      = a1fs_ll_release,
+	.read         = a1fs_ll_read,
+	.write_buf    = a1fs_ll_write_buf,
+	.flush        = a1fs_ll_flush,
+	.fsync        = a1fs_ll_fsync,
+	.fallocate    = a1fs_ll_fallocate,
+	.opendir      = a1fs_ll_opendir,
+	.readdir      = a1fs_ll_readdir,
+	.releasedir   = a1fs_ll_releasedir,
+	.statfs       = a1fs_ll_statfs,
+};
+
+/**
+ * Set up the lookup counts and orphan flags for every inode in the image.
+ *
+ * @param ll  the driver state, with the file system initialized.
+ * @return    true on success; false if out of memory.
+ */
+static bool ll_init_refs(a1fs_ll *ll)
+{
+	uint64_t count = ((a1fs_superblock*)ll->fs.image)->inodes_count;
+	ll->nlookup = calloc(count, sizeof(uint64_t));
+	ll->orphan = calloc(count, sizeof(bool));
+	if (ll->nlookup == NULL || ll->orphan == NULL) {
+		free(ll->nlookup);
+		free(ll->orphan);
+		return false;
+	}
+	pthread_mutex_init(&ll->lock, NULL);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	a1fs_opts opts = {0};// defaults are all 0
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	if (!a1fs_opt_parse(&args, &opts)) return 1;
+
+	// fuse_parse_cmdline() prints the FUSE options for -h, and the FUSE
+	// version for -V.
+	if (opts.help || opts.version) {
+		fuse_parse_cmdline(&args, NULL, NULL, NULL);
+		fuse_opt_free_args(&args);
+		return 0;
+	}
+
+	a1fs_ll ll = {0};
+	if (!fsop_init(&ll.fs, &opts)) {
+		fprintf(stderr, "Failed to mount the file system\n");
+		return 1;
+	}
+	if (!ll_init_refs(&ll)) {
+		fprintf(stderr, "Failed to mount the file system\n");
+		fsop_destroy(&ll.fs);
+		return 1;
+	}
+
+	int ret = -1;
+	char *mountpoint;
+	int multithreaded, foreground;
+	struct fuse_chan *ch;
+	if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != -1 &&
+	    (ch = fuse_mount(mountpoint, &args)) != NULL) {
+		struct fuse_session *se = fuse_lowlevel_new(&args, &a1fs_ll_ops, sizeof(a1fs_ll_ops), &ll);
+		if (se != NULL) {
+			if (fuse_set_signal_handlers(se) != -1) {
+				fuse_session_add_chan(se, ch);
+				if (fuse_daemonize(foreground) != -1) {
+					ret = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+				}
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint, ch);
+		free(mountpoint);
+	}
+	fuse_opt_free_args(&args);
+
+	// Mounting failed or the kernel never connected.
+	if (!ll.destroyed) {
+		a1fs_ll_destroy(&ll);
+	}
+	pthread_mutex_destroy(&ll.lock);
+	free(ll.nlookup);
+	free(ll.orphan);
+	return (ret == 0) ? 0 : 1;
+}
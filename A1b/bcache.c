@@ -0,0 +1,321 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Buffer cache implementation.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "bcache.h"
+#include "util.h"
+
+
+static bcache_entry **bucket_of(bcache *bc, uint64_t blk)
+{
+	return &bc->buckets[(blk ^ (blk >> 17)) & (bc->nbuckets - 1)];
+}
+
+static bcache_entry *find(bcache *bc, uint64_t blk)
+{
+	bcache_entry *e = *bucket_of(bc, blk);
+	while (e != NULL && e->blk != blk) e = e->hnext;
+	return e;
+}
+
+static void hash_remove(bcache *bc, bcache_entry *e)
+{
+	bcache_entry **link = bucket_of(bc, e->blk);
+	while (*link != e) link = &(*link)->hnext;
+	*link = e->hnext;
+}
+
+static void list_remove(bcache *bc, bcache_entry *e)
+{
+	bcache_list *l = &bc->lists[e->list];
+	if (e->prev) e->prev->next = e->next;
+	else l->head = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else l->tail = e->prev;
+	e->prev = e->next = NULL;
+	l->count--;
+}
+
+/** Put an entry at the most recently used end of a list. */
+static void list_push(bcache *bc, bcache_entry *e, int list)
+{
+	bcache_list *l = &bc->lists[list];
+	e->list = list;
+	e->prev = NULL;
+	e->next = l->head;
+	if (l->head) l->head->prev = e;
+	l->head = e;
+	if (!l->tail) l->tail = e;
+	l->count++;
+}
+
+/** Remove an entry from the cache altogether. */
+static void drop(bcache *bc, bcache_entry *e)
+{
+	list_remove(bc, e);
+	hash_remove(bc, e);
+	free(e->data);
+	free(e);
+}
+
+static int write_back(bcache *bc, bcache_entry *e)
+{
+	ssize_t n = pwrite(bc->fd, e->data, A1FS_BLOCK_SIZE, e->blk * A1FS_BLOCK_SIZE);
+	if (n != A1FS_BLOCK_SIZE) {
+		return (n < 0) ? -errno : -EIO;
+	}
+	e->dirty = false;
+	bc->writes++;
+	return 0;
+}
+
+/**
+ * Evict the least recently used block of T1 or T2 to the corresponding ghost
+ * list (ARC's REPLACE) and take its buffer.
+ *
+ * @param in_b2  whether the block being brought in was found on B2.
+ * @param buf    receives the buffer of the evicted block.
+ * @return       0 on success; -errno if writing back the evicted block failed.
+ */
+static int replace(bcache *bc, bool in_b2, char **buf)
+{
+	size_t t1 = bc->lists[BCACHE_T1].count;
+	bcache_entry *victim;
+	int ghost;
+	if (t1 > 0 && (t1 > bc->target || (in_b2 && t1 == bc->target) || bc->lists[BCACHE_T2].count == 0)) {
+		victim = bc->lists[BCACHE_T1].tail;
+		ghost = BCACHE_B1;
+	} else {
+		victim = bc->lists[BCACHE_T2].tail;
+		ghost = BCACHE_B2;
+	}
+	if (victim->dirty) {
+		int ret = write_back(bc, victim);
+		if (ret != 0) return ret;
+	}
+	*buf = victim->data;
+	victim->data = NULL;
+	list_remove(bc, victim);
+	list_push(bc, victim, ghost);
+	return 0;
+}
+
+/** Check if the cache is full, i.e. a new block needs a buffer from replace(). */
+static bool cache_full(bcache *bc)
+{
+	return bc->lists[BCACHE_T1].count + bc->lists[BCACHE_T2].count >= bc->capacity;
+}
+
+/**
+ * Get the cached copy of a block, bringing it into the cache if needed and
+ * adapting the target size of T1 as ARC does.
+ *
+ * @param blk   the block.
+ * @param fill  whether to read the contents of a block that isn't cached (not
+ *              needed if all of it is about to be overwritten).
+ * @param out   receives the entry of the block.
+ * @return      0 on success; -errno on error.
+ */
+static int get_block(bcache *bc, uint64_t blk, bool fill, bcache_entry **out)
+{
+	bcache_list *lists = bc->lists;
+	bcache_entry *e = find(bc, blk);
+	if (e != NULL && e->data != NULL) {
+		list_remove(bc, e);
+		list_push(bc, e, BCACHE_T2);
+		bc->hits++;
+		*out = e;
+		return 0;
+	}
+	bc->misses++;
+
+	char *buf = NULL;
+	int ret = 0;
+	bool ghost_hit = (e != NULL);
+	if (e != NULL && e->list == BCACHE_B1) {
+		size_t delta = lists[BCACHE_B2].count / lists[BCACHE_B1].count;
+		bc->target += (delta > 0) ? delta : 1;
+		if (bc->target > bc->capacity) bc->target = bc->capacity;
+		if (cache_full(bc)) ret = replace(bc, false, &buf);
+	} else if (e != NULL) {
+		size_t delta = lists[BCACHE_B1].count / lists[BCACHE_B2].count;
+		if (delta == 0) delta = 1;
+		bc->target = (bc->target > delta) ? bc->target - delta : 0;
+		if (cache_full(bc)) ret = replace(bc, true, &buf);
+	} else if (lists[BCACHE_T1].count + lists[BCACHE_B1].count >= bc->capacity) {
+		if (lists[BCACHE_T1].count < bc->capacity) {
+			drop(bc, lists[BCACHE_B1].tail);
+			if (cache_full(bc)) ret = replace(bc, false, &buf);
+		} else {
+			// T1 takes up the whole cache: evict its LRU block for good.
+			bcache_entry *victim = lists[BCACHE_T1].tail;
+			ret = victim->dirty ? write_back(bc, victim) : 0;
+			if (ret == 0) {
+				buf = victim->data;
+				victim->data = NULL;
+				drop(bc, victim);
+			}
+		}
+	} else {
+		size_t total = lists[0].count + lists[1].count + lists[2].count + lists[3].count;
+		if (total >= 2 * bc->capacity) drop(bc, lists[BCACHE_B2].tail);
+		if (cache_full(bc)) ret = replace(bc, false, &buf);
+	}
+	if (ret != 0) return ret;
+
+	if (buf == NULL) {
+		buf = malloc(A1FS_BLOCK_SIZE);
+		if (buf == NULL) return -ENOMEM;
+	}
+	if (e == NULL) {
+		e = calloc(1, sizeof(bcache_entry));
+		if (e == NULL) {
+			free(buf);
+			return -ENOMEM;
+		}
+		e->blk = blk;
+		bcache_entry **bucket = bucket_of(bc, blk);
+		e->hnext = *bucket;
+		*bucket = e;
+	} else {
+		list_remove(bc, e);
+	}
+	e->data = buf;
+	e->dirty = false;
+	list_push(bc, e, ghost_hit ? BCACHE_T2 : BCACHE_T1);
+
+	if (fill) {
+		ssize_t n = pread(bc->fd, buf, A1FS_BLOCK_SIZE, blk * A1FS_BLOCK_SIZE);
+		if (n != A1FS_BLOCK_SIZE) {
+			ret = (n < 0) ? -errno : -EIO;
+			drop(bc, e);
+			return ret;
+		}
+	}
+	*out = e;
+	return 0;
+}
+
+
+bool bcache_init(bcache *bc, int fd, size_t capacity)
+{
+	memset(bc, 0, sizeof(*bc));
+	bc->fd = fd;
+	bc->capacity = (capacity > 0) ? capacity : 1;
+	// Up to 2 * capacity entries with the ghosts.
+	bc->nbuckets = 1;
+	while (bc->nbuckets < 2 * bc->capacity) bc->nbuckets *= 2;
+	bc->buckets = calloc(bc->nbuckets, sizeof(bcache_entry*));
+	if (bc->buckets == NULL) return false;
+	pthread_mutex_init(&bc->lock, NULL);
+	return true;
+}
+
+void bcache_destroy(bcache *bc)
+{
+	if (bc->buckets == NULL) return;
+	for (int l = 0; l < 4; l++) {
+		while (bc->lists[l].head != NULL) drop(bc, bc->lists[l].head);
+	}
+	free(bc->buckets);
+	bc->buckets = NULL;
+	pthread_mutex_destroy(&bc->lock);
+}
+
+int bcache_read(bcache *bc, uint64_t blk, size_t off, void *buf, size_t len)
+{
+	assert(off + len <= A1FS_BLOCK_SIZE);
+	pthread_mutex_lock(&bc->lock);
+	bcache_entry *e;
+	int ret = get_block(bc, blk, true, &e);
+	if (ret == 0) memcpy(buf, e->data + off, len);
+	pthread_mutex_unlock(&bc->lock);
+	return ret;
+}
+
+int bcache_write(bcache *bc, uint64_t blk, size_t off, const void *buf, size_t len)
+{
+	assert(off + len <= A1FS_BLOCK_SIZE);
+	pthread_mutex_lock(&bc->lock);
+	bcache_entry *e;
+	int ret = get_block(bc, blk, len < A1FS_BLOCK_SIZE, &e);
+	if (ret == 0) {
+		if (buf != NULL) memcpy(e->data + off, buf, len);
+		else memset(e->data + off, 0, len);
+		e->dirty = true;
+	}
+	pthread_mutex_unlock(&bc->lock);
+	return ret;
+}
+
+/**
+ * Call fn on every cached block (not the ghosts) among count blocks starting
+ * at blk, looking them up one by one or walking T1 and T2, whichever is
+ * shorter. fn may drop the entry. Stops at the first error.
+ */
+static int for_each_cached(bcache *bc, uint64_t blk, uint64_t count, int (*fn)(bcache *, bcache_entry *))
+{
+	int ret = 0;
+	if (count <= bc->lists[BCACHE_T1].count + bc->lists[BCACHE_T2].count) {
+		for (uint64_t b = blk; b < blk + count && ret == 0; b++) {
+			bcache_entry *e = find(bc, b);
+			if (e != NULL && e->data != NULL) ret = fn(bc, e);
+		}
+		return ret;
+	}
+	for (int l = BCACHE_T1; l <= BCACHE_T2; l++) {
+		bcache_entry *e = bc->lists[l].head;
+		while (e != NULL && ret == 0) {
+			bcache_entry *next = e->next;
+			if (e->blk >= blk && e->blk < blk + count) ret = fn(bc, e);
+			e = next;
+		}
+	}
+	return ret;
+}
+
+static int flush_one(bcache *bc, bcache_entry *e)
+{
+	return e->dirty ? write_back(bc, e) : 0;
+}
+
+static int drop_one(bcache *bc, bcache_entry *e)
+{
+	drop(bc, e);
+	return 0;
+}
+
+int bcache_flush(bcache *bc, uint64_t blk, uint64_t count)
+{
+	pthread_mutex_lock(&bc->lock);
+	int ret = for_each_cached(bc, blk, count, flush_one);
+	pthread_mutex_unlock(&bc->lock);
+	return ret;
+}
+
+void bcache_invalidate(bcache *bc, uint64_t blk, uint64_t count)
+{
+	pthread_mutex_lock(&bc->lock);
+	for_each_cached(bc, blk, count, drop_one);
+	pthread_mutex_unlock(&bc->lock);
+}
@@ -0,0 +1,134 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Buffer cache header file.
+ *
+ * A cache of 4 KiB blocks of the image file, read with pread() and written
+ * back with pwrite(), that holds at most a fixed number of blocks. Blocks are
+ * replaced with ARC (adaptive replacement cache, Megiddo & Modha): T1 holds
+ * blocks used once recently and T2 blocks used at least twice; the ghost
+ * lists B1 and B2 remember the blocks recently evicted from T1 and T2 (without
+ * their data), and a hit in one of them moves the target size of T1 towards
+ * the list that would have kept the block. A scan of blocks used only once
+ * therefore can't push out the blocks that are used over and over.
+ *
+ * Changed blocks are marked dirty and are written back when they are evicted
+ * or flushed. All the functions take the cache lock, which is a leaf lock.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Default size of the buffer cache in MiB. */
+#define BCACHE_SIZE_MB 64
+
+
+/** The lists a cached block can be on. */
+enum { BCACHE_T1, BCACHE_T2, BCACHE_B1, BCACHE_B2 };
+
+/** A cached block, or a ghost entry on B1 or B2. */
+typedef struct bcache_entry {
+	/** Next entry in the same hash bucket. */
+	struct bcache_entry *hnext;
+	/** Neighbours in its list (most recently used at the head). */
+	struct bcache_entry *prev, *next;
+
+	/** Block number in the image file. */
+	uint64_t blk;
+	/** The list the entry is on. */
+	int list;
+	/** Whether the data has changed since it was read or written back. */
+	bool dirty;
+	/** Contents of the block; NULL for ghost entries. */
+	char *data;
+
+} bcache_entry;
+
+/** One of the ARC lists. */
+typedef struct bcache_list {
+	bcache_entry *head, *tail;
+	size_t count;
+} bcache_list;
+
+/** Buffer cache of an image file. */
+typedef struct bcache {
+	/** The image file. */
+	int fd;
+
+	/** Hash buckets of all the entries, ghosts included; the number of
+	 * buckets is a power of 2. */
+	bcache_entry **buckets;
+	size_t nbuckets;
+
+	/** T1, T2, B1 and B2. */
+	bcache_list lists[4];
+	/** Maximum number of cached blocks (c), and the target size of T1 (p). */
+	size_t capacity;
+	size_t target;
+
+	pthread_mutex_t lock;
+
+	/** Statistics. */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t writes;
+
+} bcache;
+
+
+/**
+ * Initialize the buffer cache.
+ *
+ * @param bc        pointer to the cache to initialize.
+ * @param fd        the image file, open for reading and writing.
+ * @param capacity  maximum number of blocks kept in the cache.
+ * @return          true on success; false if out of memory.
+ */
+bool bcache_init(bcache *bc, int fd, size_t capacity);
+
+/** Free all the memory used by the cache. Dirty blocks are not written back. */
+void bcache_destroy(bcache *bc);
+
+/**
+ * Read len bytes at offset off of block blk into buf; the range must be within
+ * the block.
+ *
+ * @return  0 on success; -errno if reading the block failed.
+ */
+int bcache_read(bcache *bc, uint64_t blk, size_t off, void *buf, size_t len);
+
+/**
+ * Write len bytes from buf (zeros if buf is NULL) at offset off of block blk;
+ * the range must be within the block. The block is read first unless all of
+ * it is written.
+ *
+ * @return  0 on success; -errno if reading or evicting a block failed.
+ */
+int bcache_write(bcache *bc, uint64_t blk, size_t off, const void *buf, size_t len);
+
+/**
+ * Write back the dirty cached blocks among count blocks starting at blk.
+ *
+ * @return  0 on success; -errno if writing failed.
+ */
+int bcache_flush(bcache *bc, uint64_t blk, uint64_t count);
+
+/** Drop the cached blocks among count blocks starting at blk, even if dirty. */
+void bcache_invalidate(bcache *bc, uint64_t blk, uint64_t count);
@@ -0,0 +1,163 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap scan microbenchmark.
+ *
+ * Compares the old way of finding a free block (test one bit at a time from
+ * the start of the bitmap, as find_available_space() did) with bitmap_find()
+ * starting at a rotating hint, as the block allocator does. The bitmap is
+ * that of a 4 GiB image (1M blocks) that is 90% full. Each iteration
+ * allocates one block and frees a random used block, so the bitmap stays 90%
+ * full.
+ *
+ * Usage: ./bench_bitmap [iterations]
+ *
+ * Build it with optimizations for meaningful numbers: CFLAGS=-O2 make bench
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitmap.h"
+
+
+/** Number of bits in the bitmap: the blocks of a 4 GiB image. */
+#define NBITS (1024 * 1024)
+
+/** Number of used bits. */
+#define NUSED (NBITS / 10 * 9)
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void set_bit(unsigned char *bm, uint64_t i, bool value)
+{
+	if (value) bm[i / 8] |= 1 << (i % 8);
+	else bm[i / 8] &= ~(1 << (i % 8));
+}
+
+/** Find the first free bit one bit at a time, as the old allocator did. */
+static uint64_t scan_bits(const unsigned char *bm)
+{
+	for (uint64_t i = 0; i < NBITS; i++) {
+		if (!bitmap_get(bm, i)) return i;
+	}
+	return NBITS;
+}
+
+/** Fill the bitmap: NUSED bits at the front, or scattered at random. */
+static void fill(unsigned char *bm, bool scattered)
+{
+	memset(bm, 0, NBITS / 8);
+	if (!scattered) {
+		bitmap_set_range(bm, 0, NUSED, true);
+		return;
+	}
+	srand(369);
+	for (uint64_t used = 0; used < NUSED; ) {
+		uint64_t i = (uint64_t)rand() % NBITS;
+		if (!bitmap_get(bm, i)) {
+			set_bit(bm, i, true);
+			used++;
+		}
+	}
+}
+
+/**
+ * Allocate and free a block iterations times.
+ *
+ * @param bm      the bitmap.
+ * @param hinted  true to use bitmap_find_wrap() from a rotating hint; false
+ *                to scan one bit at a time from the start.
+ * @return        average time of an allocation in microseconds.
+ */
+static double run(unsigned char *bm, bool hinted, int iterations)
+{
+	uint64_t hint = 0;
+	double total = 0;
+	srand(1);
+	for (int n = 0; n < iterations; n++) {
+		double start = now();
+		uint64_t i = hinted ? bitmap_find_wrap(bm, hint, NBITS, false) : scan_bits(bm);
+		total += now() - start;
+		if (i == NBITS) break;
+		set_bit(bm, i, true);
+		hint = i + 1;
+
+		// Free a random used block (not timed)
+		uint64_t j;
+		do {
+			j = (uint64_t)rand() % NBITS;
+		} while (!bitmap_get(bm, j));
+		set_bit(bm, j, false);
+	}
+	return total / iterations * 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+	if (iterations <= 0) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+	unsigned char *bm = malloc(NBITS / 8);
+	if (bm == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%d iterations, %d-bit bitmap, 90%% full\n", iterations, NBITS);
+	for (int scattered = 0; scattered <= 1; scattered++) {
+		fill(bm, scattered);
+		double bits = run(bm, false, iterations);
+		fill(bm, scattered);
+		double words = run(bm, true, iterations);
+		printf("used blocks %-9s bit scan %9.3f us, bitmap_find %7.3f us per allocation\n",
+		       scattered ? "at random" : "in front", bits, words);
+	}
+
+	// A cold scan from the start past all the used bits, as after a mount
+	fill(bm, false);
+	int reps = iterations * 10;
+	double start = now();
+	uint64_t sum = 0;
+	for (int n = 0; n < reps; n++) {
+		sum += bitmap_find(bm, 0, NBITS, false);
+	}
+	double scan = (now() - start) / reps * 1e6;
+#ifdef __SSE2__
+	const char *kind = "SSE2";
+#else
+	const char *kind = "64-bit words";
+#endif
+	printf("cold scan past %d used bits: %.3f us (%s)\n", NUSED, scan, kind);
+
+	free(bm);
+	if (sum != (uint64_t)reps * NUSED) {
+		fprintf(stderr, "bitmap_find() returned the wrong bit\n");
+		return 1;
+	}
+	return 0;
+}
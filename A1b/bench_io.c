@@ -0,0 +1,285 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Read and write throughput benchmark.
+ *
+ * Compares the copying read and write paths with the zero-copy ones the
+ * low-level driver uses, through the fsops layer and without a kernel:
+ *
+ * - read: fsop_read() into a buffer that is then replied, against
+ *   fsop_read_iov() replying from the image itself (as fuse_reply_iov()
+ *   does). A reply is a writev() of a 16-byte header and the data into a
+ *   pipe that another thread drains, standing in for /dev/fuse.
+ * - write: the request is in a pipe, standing in for /dev/fuse with
+ *   splice_read. It is read into a buffer and passed to fsop_write(), against
+ *   fsop_write_buf() reading it from the pipe straight into the file.
+ *
+ * Each test goes sequentially over a 48 MiB file, best of 5 runs.
+ *
+ * Usage: ./bench_io image [passes]
+ *
+ * The image must be freshly formatted with mkfs.a1fs (at least 64 MiB). Build
+ * with CFLAGS=-O2 make bench.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Using 2.9.x FUSE API
+#define FUSE_USE_VERSION 29
+#include <fuse_common.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+#include "fsops.h"
+#include "options.h"
+
+
+// <fcntl.h> only has this with _GNU_SOURCE, whose readahead() would clash
+// with readahead.h
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+
+/** Size of the file. */
+#define FILE_SIZE (48 << 20)
+
+/** Size of a FUSE reply header. */
+#define HEADER_SIZE 16
+
+/** Largest request; pipes are made this large. */
+#define MAX_REQUEST (1 << 20)
+
+
+/** Reply pipe: written by reply(), drained by drain(). */
+static int reply_pipe[2];
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *drain(void *arg)
+{
+	(void)arg;
+	static char buf[MAX_REQUEST];
+	while (read(reply_pipe[0], buf, sizeof(buf)) > 0);
+	return NULL;
+}
+
+/** Write a reply: a header followed by the data in count pieces. */
+static void reply(void *arg, const struct iovec *iov, int count)
+{
+	int *error = (int*)arg;
+	static char header[HEADER_SIZE];
+	struct iovec v[FSOP_IOV_MAX + 1];
+	v[0].iov_base = header;
+	v[0].iov_len = HEADER_SIZE;
+	memcpy(v + 1, iov, count * sizeof(*iov));
+
+	size_t size = 0;
+	for (int i = 0; i <= count; i++) size += v[i].iov_len;
+	if (writev(reply_pipe[1], v, count + 1) != (ssize_t)size) *error = -EIO;
+}
+
+/** Write size bytes into a pipe. */
+static bool fill_pipe(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n <= 0) return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+/** Read size bytes from a pipe. */
+static bool read_pipe(int fd, char *buf, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = read(fd, buf, size);
+		if (n <= 0) return false;
+		buf += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * Read the whole file passes times, size bytes at a time.
+ *
+ * @param iov  true to use fsop_read_iov(); false to use fsop_read().
+ * @return     the time it took in seconds; negative on error.
+ */
+static double run_reads(fs_ctx *fs, struct fuse_file_info *fi, size_t size, bool iov, int passes)
+{
+	int error = 0;
+	double start = now();
+	for (int p = 0; p < passes && error == 0; p++) {
+		for (off_t off = 0; off < FILE_SIZE && error == 0; off += size) {
+			if (iov) {
+				int ret = fsop_read_iov(fs, fi, size, off, reply, &error);
+				if (ret != 0) error = ret;
+				continue;
+			}
+			// A fresh buffer for every request, as libfuse allocates one
+			char *buf = malloc(size);
+			int ret = (buf != NULL) ? fsop_read(fs, fi, buf, size, off) : -ENOMEM;
+			if (ret >= 0) {
+				struct iovec v = { buf, ret };
+				reply(&error, &v, 1);
+			} else {
+				error = ret;
+			}
+			free(buf);
+		}
+	}
+	if (error != 0) {
+		fprintf(stderr, "read failed: %s\n", strerror(-error));
+		return -1;
+	}
+	return now() - start;
+}
+
+/**
+ * Overwrite the whole file passes times, size bytes at a time, with each
+ * request coming from a pipe.
+ *
+ * @param splice  true to use fsop_write_buf() on the pipe; false to read the
+ *                request into a buffer and use fsop_write().
+ * @return        the time it took in seconds; negative on error.
+ */
+static double run_writes(fs_ctx *fs, struct fuse_file_info *fi, size_t size, bool splice,
+                         int passes, const char *data, int pipe_fd[2])
+{
+	char *buf = malloc(size);
+	if (buf == NULL) return -1;
+
+	int ret = 0;
+	double start = now();
+	for (int p = 0; p < passes && ret >= 0; p++) {
+		for (off_t off = 0; off < FILE_SIZE && ret >= 0; off += size) {
+			if (!fill_pipe(pipe_fd[1], data, size)) {
+				ret = -EIO;
+				break;
+			}
+			if (splice) {
+				struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+				bufv.buf[0].flags = FUSE_BUF_IS_FD;
+				bufv.buf[0].fd = pipe_fd[0];
+				ret = fsop_write_buf(fs, fi, &bufv, off);
+			} else {
+				ret = read_pipe(pipe_fd[0], buf, size) ? fsop_write(fs, fi, buf, size, off) : -EIO;
+			}
+			if (ret >= 0 && (size_t)ret != size) ret = -EIO;
+		}
+	}
+	free(buf);
+	if (ret < 0) {
+		fprintf(stderr, "write failed: %s\n", strerror(-ret));
+		return -1;
+	}
+	return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s image [passes]\n", argv[0]);
+		return 1;
+	}
+	int passes = (argc > 2) ? atoi(argv[2]) : 10;
+	if (passes < 1) passes = 1;
+
+	static fs_ctx fs;
+	a1fs_opts opts = {0};// defaults are all 0, except:
+	opts.img_path = argv[1];
+	opts.noreadahead = 1;
+	if (!fsop_init(&fs, &opts)) {
+		fprintf(stderr, "Failed to mount the file system\n");
+		return 1;
+	}
+	fsop_start(&fs);
+
+	int ret = 1;
+	struct fuse_file_info fi = {0};
+	bool created = false;
+	int request_pipe[2] = { -1, -1 };
+	char *data = malloc(FILE_SIZE);
+	if (data == NULL || pipe(reply_pipe) != 0 || pipe(request_pipe) != 0) {
+		perror("bench_io");
+		goto end;
+	}
+	if (fcntl(reply_pipe[1], F_SETPIPE_SZ, MAX_REQUEST) < MAX_REQUEST ||
+	    fcntl(request_pipe[1], F_SETPIPE_SZ, MAX_REQUEST) < MAX_REQUEST) {
+		fprintf(stderr, "Can't make pipes of %d bytes\n", MAX_REQUEST);
+		goto end;
+	}
+	pthread_t drainer;
+	if (pthread_create(&drainer, NULL, drain, NULL) != 0) {
+		fprintf(stderr, "Can't start the reply thread\n");
+		goto end;
+	}
+
+	memset(data, 'x', FILE_SIZE);
+	int err = fsop_create(&fs, A1FS_ROOT_INO, "file", 4, S_IFREG | 0644, &fi, NULL);
+	created = (err == 0);
+	if (err == 0) {
+		err = fsop_write(&fs, &fi, data, FILE_SIZE, 0);
+		err = (err == FILE_SIZE) ? fsop_flush(&fs, &fi) : ((err < 0) ? err : -ENOSPC);
+	}
+	if (err != 0) {
+		fprintf(stderr, "Failed to set up the image: %s\n", strerror(-err));
+		goto end;
+	}
+
+	printf("%d MiB file, %d passes, best of 5\n", FILE_SIZE >> 20, passes);
+	static const size_t sizes[] = { 128 << 10, MAX_REQUEST };
+	for (int s = 0; s < 2; s++) {
+		size_t size = sizes[s];
+		for (int test = 0; test < 4; test++) {
+			bool zero_copy = test % 2;
+			double best = -1;
+			for (int rep = 0; rep < 5; rep++) {
+				double t = (test < 2) ? run_reads(&fs, &fi, size, zero_copy, passes)
+				                      : run_writes(&fs, &fi, size, zero_copy, passes, data, request_pipe);
+				if (t < 0) goto end;
+				if (best < 0 || t < best) best = t;
+			}
+			static const char *names[] = { "read memcpy", "read iov", "write memcpy", "write_buf" };
+			printf("%5zu KiB %-12s %6.2f GiB/s\n", size >> 10, names[test],
+			       (double)FILE_SIZE * passes / best / (1 << 30));
+		}
+	}
+	ret = 0;
+
+end:
+	// The reply thread is left blocked on its pipe; exiting ends it.
+	if (created) fsop_release(&fi);
+	fsop_destroy(&fs);
+	free(data);
+	return ret;
+}
@@ -0,0 +1,269 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Multithreaded scaling benchmark.
+ *
+ * Runs the file system operations from 1, 2, 4, ... threads at once, the way
+ * the multithreaded FUSE loop calls them, and reports the total throughput:
+ *
+ * - read: every thread reads the same 16 MiB file 128 KiB at a time, so they
+ *   all share the file's inode lock and its cached extent map;
+ * - lookup: every thread resolves paths of files in one directory and gets
+ *   their attributes, going through the dentry cache and the inode locks.
+ *
+ * Throughput can only grow with the threads up to the number of CPUs, which
+ * is printed first; past that the threads take turns on the same CPUs.
+ *
+ * Usage: ./bench_scale image [max_threads] [seconds]
+ *
+ * The image must be freshly formatted with mkfs.a1fs (at least 32 MiB and
+ * 128 inodes). Build with CFLAGS=-O2 make bench.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Using 2.9.x FUSE API
+#define FUSE_USE_VERSION 29
+#include <fuse_common.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+#include "fsops.h"
+#include "options.h"
+
+
+/** Size of the file that is read. */
+#define FILE_SIZE (16 << 20)
+
+/** Size of each read. */
+#define READ_SIZE (128 << 10)
+
+/** Number of files that are looked up. */
+#define NFILES 100
+
+/** Maximum number of threads. */
+#define MAX_THREADS 64
+
+
+/** State shared by the benchmark threads. */
+typedef struct bench {
+	fs_ctx fs;
+	/** Inode number of the file that is read. */
+	a1fs_ino_t ino;
+	/** How long each run lasts, in seconds. */
+	double seconds;
+	/** Lets the threads of a run start together. */
+	pthread_barrier_t barrier;
+	/** True to run lookups; false to run reads. */
+	bool lookup;
+} bench;
+
+/** State of one benchmark thread. */
+typedef struct worker {
+	bench *b;
+	pthread_t thread;
+	/** Number of operations done. */
+	unsigned long ops;
+	/** First error seen; 0 if none. */
+	int error;
+} worker;
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *run_reads(worker *w)
+{
+	bench *b = w->b;
+	char *buf = malloc(READ_SIZE);
+	struct fuse_file_info fi = {0};
+	if (buf == NULL) {
+		w->error = -ENOMEM;
+	} else {
+		w->error = fsop_open(&b->fs, b->ino, &fi);
+	}
+	pthread_barrier_wait(&b->barrier);
+	if (w->error != 0) {
+		free(buf);
+		return NULL;
+	}
+
+	double end = now() + b->seconds;
+	off_t offset = 0;
+	while (now() < end) {
+		int ret = fsop_read(&b->fs, &fi, buf, READ_SIZE, offset);
+		if (ret != READ_SIZE) {
+			w->error = (ret < 0) ? ret : -EIO;
+			break;
+		}
+		w->ops++;
+		offset = (offset + READ_SIZE) % FILE_SIZE;
+	}
+	fsop_release(&fi);
+	free(buf);
+	return NULL;
+}
+
+static void *run_lookups(worker *w)
+{
+	bench *b = w->b;
+	pthread_barrier_wait(&b->barrier);
+
+	double end = now() + b->seconds;
+	unsigned int i = 0;
+	while (now() < end) {
+		char path[32];
+		snprintf(path, sizeof(path), "/dir/file%u", i++ % NFILES);
+		a1fs_ino_t ino;
+		struct stat st;
+		int ret = fsop_path_lookup(&b->fs, path, &ino);
+		if (ret == 0) ret = fsop_getattr(&b->fs, ino, &st);
+		if (ret != 0) {
+			w->error = ret;
+			break;
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+static void *worker_main(void *arg)
+{
+	worker *w = (worker*)arg;
+	return w->b->lookup ? run_lookups(w) : run_reads(w);
+}
+
+/**
+ * Run one workload from n threads at once.
+ *
+ * @return  total operations per second; negative on error.
+ */
+static double run(bench *b, int n)
+{
+	worker workers[MAX_THREADS] = {{0}};
+	pthread_barrier_init(&b->barrier, NULL, n + 1);
+	int started = 0;
+	for (; started < n; started++) {
+		workers[started].b = b;
+		if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0) {
+			break;
+		}
+	}
+	if (started < n) {
+		// The barrier can't be passed any more; nothing was measured.
+		fprintf(stderr, "Failed to start %d threads\n", n);
+		exit(1);
+	}
+
+	pthread_barrier_wait(&b->barrier);
+	double start = now();
+	unsigned long ops = 0;
+	int error = 0;
+	for (int i = 0; i < n; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+		if (workers[i].error != 0) error = workers[i].error;
+	}
+	double elapsed = now() - start;
+	pthread_barrier_destroy(&b->barrier);
+
+	if (error != 0) {
+		fprintf(stderr, "%s failed: %s\n", b->lookup ? "lookup" : "read", strerror(-error));
+		return -1;
+	}
+	return ops / elapsed;
+}
+
+/** Create the file that is read and the files that are looked up. */
+static bool setup(bench *b)
+{
+	char *data = malloc(FILE_SIZE);
+	if (data == NULL) return false;
+	memset(data, 'x', FILE_SIZE);
+
+	struct fuse_file_info fi = {0};
+	int ret = fsop_create(&b->fs, A1FS_ROOT_INO, "file", 4, S_IFREG | 0644, &fi, &b->ino);
+	if (ret == 0) {
+		ret = fsop_write(&b->fs, &fi, data, FILE_SIZE, 0);
+		ret = (ret == FILE_SIZE) ? fsop_flush(&b->fs, &fi) : ((ret < 0) ? ret : -ENOSPC);
+		fsop_release(&fi);
+	}
+	free(data);
+
+	a1fs_ino_t dir;
+	if (ret == 0) ret = fsop_mkdir(&b->fs, A1FS_ROOT_INO, "dir", 3, 0755, &dir);
+	for (int i = 0; ret == 0 && i < NFILES; i++) {
+		char name[16];
+		int len = snprintf(name, sizeof(name), "file%d", i);
+		ret = fsop_create(&b->fs, dir, name, len, S_IFREG | 0644, &fi, NULL);
+		if (ret == 0) fsop_release(&fi);
+	}
+	if (ret != 0) {
+		fprintf(stderr, "Failed to set up the image: %s\n", strerror(-ret));
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s image [max_threads] [seconds]\n", argv[0]);
+		return 1;
+	}
+	int max_threads = (argc > 2) ? atoi(argv[2]) : 8;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "max_threads must be between 1 and %d\n", MAX_THREADS);
+		return 1;
+	}
+
+	static bench b;
+	b.seconds = (argc > 3) ? atof(argv[3]) : 1.0;
+	a1fs_opts opts = {0};// defaults are all 0
+	opts.img_path = argv[1];
+	if (!fsop_init(&b.fs, &opts)) {
+		fprintf(stderr, "Failed to mount the file system\n");
+		return 1;
+	}
+	fsop_start(&b.fs);
+	int ret = 1;
+	if (!setup(&b)) goto end;
+
+	printf("%ld CPUs online\n", sysconf(_SC_NPROCESSORS_ONLN));
+	printf("threads     read GiB/s   lookups/s\n");
+	for (int n = 1; n <= max_threads; n *= 2) {
+		b.lookup = false;
+		double reads = run(&b, n);
+		b.lookup = true;
+		double lookups = run(&b, n);
+		if (reads < 0 || lookups < 0) goto end;
+		printf("%7d %14.2f %11.0f\n", n, reads * READ_SIZE / (1 << 30), lookups);
+	}
+	ret = 0;
+
+end:
+	fsop_destroy(&b.fs);
+	return ret;
+}
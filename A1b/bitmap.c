@@ -0,0 +1,100 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap operations implementation.
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bitmap.h"
+
+
+/** Load the 64-bit word that holds bits [64 * (i / 64), 64 * (i / 64) + 64). */
+static inline uint64_t load_word(const unsigned char *bytes, uint64_t i)
+{
+	uint64_t w;
+	memcpy(&w, bytes + (i / 64) * 8, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+
+uint64_t bitmap_find(const void *bm, uint64_t from, uint64_t limit, bool value)
+{
+	const unsigned char *bytes = (const unsigned char*)bm;
+	// Flip the words when looking for 0s so that the bits of interest are 1s
+	uint64_t flip = value ? 0 : ~(uint64_t)0;
+
+	uint64_t i = from;
+	while (i < limit) {
+		uint64_t w = (load_word(bytes, i) ^ flip) >> (i % 64);
+		if (w != 0) {
+			i += __builtin_ctzll(w);
+			return (i < limit) ? i : limit;
+		}
+		i = (i / 64 + 1) * 64;
+
+#ifdef __SSE2__
+		// Skip long runs of non-matching bits 128 at a time
+		const __m128i skip = _mm_set1_epi8(value ? 0 : -1);
+		while (i + 128 <= limit) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(bytes + i / 8));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, skip)) != 0xFFFF) break;
+			i += 128;
+		}
+#endif
+	}
+	return limit;
+}
+
+uint64_t bitmap_find_wrap(const void *bm, uint64_t from, uint64_t limit,
+                          bool value)
+{
+	if (from >= limit) from = 0;
+	uint64_t i = bitmap_find(bm, from, limit, value);
+	if (i == limit && from > 0) {
+		i = bitmap_find(bm, 0, from, value);
+		if (i == from) i = limit;
+	}
+	return i;
+}
+
+void bitmap_set_range(void *bm, uint64_t start, uint64_t count, bool value)
+{
+	unsigned char *bytes = (unsigned char*)bm;
+	uint64_t end = start + count;
+
+	// Leading bits up to a byte boundary, whole bytes, then trailing bits
+	while (start < end && start % 8 != 0) {
+		if (value) bytes[start / 8] |= 1 << (start % 8);
+		else bytes[start / 8] &= ~(1 << (start % 8));
+		start++;
+	}
+	if (end - start >= 8) {
+		memset(bytes + start / 8, value ? 0xFF : 0, (end - start) / 8);
+		start += (end - start) / 8 * 8;
+	}
+	while (start < end) {
+		if (value) bytes[start / 8] |= 1 << (start % 8);
+		else bytes[start / 8] &= ~(1 << (start % 8));
+		start++;
+	}
+}
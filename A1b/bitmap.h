@@ -0,0 +1,58 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap operations header file.
+ *
+ * Bit i of a bitmap is bit (i % 8) of byte (i / 8), as in the on-disk block
+ * and inode bitmaps. The functions below work on whole 64-bit words wherever
+ * they can, so that runs of used or free bits are skipped 64 at a time.
+ * Bitmaps must be padded to a whole number of 64-bit words (the on-disk ones
+ * take up whole blocks).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Get the value of bit i. */
+static inline bool bitmap_get(const void *bm, uint64_t i)
+{
+	return (((const unsigned char*)bm)[i / 8] >> (i % 8)) & 1;
+}
+
+/**
+ * Find the first bit with the given value in [from, limit).
+ *
+ * @param bm     the bitmap.
+ * @param from   index of the first bit to look at.
+ * @param limit  one past the index of the last bit to look at.
+ * @param value  the value to look for.
+ * @return       the index of the bit; limit if there is no such bit.
+ */
+uint64_t bitmap_find(const void *bm, uint64_t from, uint64_t limit, bool value);
+
+/**
+ * Find the first bit with the given value in [from, limit), then in
+ * [0, from) if there is none.
+ *
+ * @return  the index of the bit; limit if there is no such bit.
+ */
+uint64_t bitmap_find_wrap(const void *bm, uint64_t from, uint64_t limit,
+                          bool value);
+
+/** Set count bits starting at bit start to the given value. */
+void bitmap_set_range(void *bm, uint64_t start, uint64_t count, bool value);
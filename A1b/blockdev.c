@@ -0,0 +1,162 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block layer implementation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "blockdev.h"
+
+
+/** Sync count blocks starting at blk of the mapped image. */
+static int sync_mapped(blockdev *bd, uint64_t blk, uint64_t count)
+{
+	if (msync((char*)bd->image + blk * A1FS_BLOCK_SIZE, count * A1FS_BLOCK_SIZE, MS_SYNC) < 0) {
+		return -errno;
+	}
+	return 0;
+}
+
+
+static int mmap_read(blockdev *bd, uint64_t pos, void *buf, size_t len)
+{
+	memcpy(buf, (char*)bd->image + pos, len);
+	return 0;
+}
+
+static int mmap_write(blockdev *bd, uint64_t pos, const void *buf, size_t len)
+{
+	if (buf != NULL) memcpy((char*)bd->image + pos, buf, len);
+	else memset((char*)bd->image + pos, 0, len);
+	return 0;
+}
+
+static void mmap_invalidate(blockdev *bd, uint64_t blk, uint64_t count)
+{
+	(void)bd;// unused
+	(void)blk;// unused
+	(void)count;// unused
+}
+
+static void mmap_destroy(blockdev *bd)
+{
+	(void)bd;// unused
+}
+
+static const blockdev_ops mmap_ops = {
+	.read       = mmap_read,
+	.write      = mmap_write,
+	.sync       = sync_mapped,
+	.invalidate = mmap_invalidate,
+	.destroy    = mmap_destroy,
+};
+
+void blockdev_open_mmap(blockdev *bd, void *image, size_t size)
+{
+	memset(bd, 0, sizeof(*bd));
+	bd->ops = &mmap_ops;
+	bd->image = image;
+	bd->size = size;
+	bd->fd = -1;
+}
+
+
+/** Split [pos, pos + len) into pieces within one block and read or write each through the cache. */
+static int for_each_piece(blockdev *bd, uint64_t pos, size_t len, const char *buf, char *dst, bool write)
+{
+	size_t done = 0;
+	while (done < len) {
+		uint64_t blk = (pos + done) / A1FS_BLOCK_SIZE;
+		size_t off = (pos + done) % A1FS_BLOCK_SIZE;
+		size_t n = A1FS_BLOCK_SIZE - off;
+		if (n > len - done) n = len - done;
+		int ret = write ? bcache_write(&bd->cache, blk, off, (buf != NULL) ? buf + done : NULL, n)
+		                : bcache_read(&bd->cache, blk, off, dst + done, n);
+		if (ret != 0) return ret;
+		done += n;
+	}
+	return 0;
+}
+
+static int pread_read(blockdev *bd, uint64_t pos, void *buf, size_t len)
+{
+	return for_each_piece(bd, pos, len, NULL, (char*)buf, false);
+}
+
+static int pread_write(blockdev *bd, uint64_t pos, const void *buf, size_t len)
+{
+	return for_each_piece(bd, pos, len, (const char*)buf, NULL, true);
+}
+
+/**
+ * Write back the cached blocks, then sync the range of the mapping: msync()
+ * writes out all the dirty pages of the file in the range, including the ones
+ * written with pwrite().
+ */
+static int pread_sync(blockdev *bd, uint64_t blk, uint64_t count)
+{
+	int ret = bcache_flush(&bd->cache, blk, count);
+	int ret2 = sync_mapped(bd, blk, count);
+	return (ret != 0) ? ret : ret2;
+}
+
+static void pread_invalidate(blockdev *bd, uint64_t blk, uint64_t count)
+{
+	bcache_invalidate(&bd->cache, blk, count);
+}
+
+static void pread_destroy(blockdev *bd)
+{
+	int ret = bcache_flush(&bd->cache, 0, bd->size / A1FS_BLOCK_SIZE);
+	if (ret != 0) {
+		fprintf(stderr, "a1fs: failed to write back the buffer cache: %s\n", strerror(-ret));
+	}
+	bcache_destroy(&bd->cache);
+	close(bd->fd);
+	bd->fd = -1;
+}
+
+static const blockdev_ops pread_ops = {
+	.read       = pread_read,
+	.write      = pread_write,
+	.sync       = pread_sync,
+	.invalidate = pread_invalidate,
+	.destroy    = pread_destroy,
+};
+
+bool blockdev_open_pread(blockdev *bd, void *image, size_t size, const char *path, size_t cache_size)
+{
+	memset(bd, 0, sizeof(*bd));
+	bd->ops = &pread_ops;
+	bd->image = image;
+	bd->size = size;
+	bd->fd = open(path, O_RDWR);
+	if (bd->fd < 0) {
+		perror(path);
+		return false;
+	}
+	if (!bcache_init(&bd->cache, bd->fd, cache_size / A1FS_BLOCK_SIZE)) {
+		close(bd->fd);
+		return false;
+	}
+	return true;
+}
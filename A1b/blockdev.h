@@ -0,0 +1,115 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block layer header file.
+ *
+ * File data is read and written through a block device, which has one of two
+ * backends:
+ *  - mmap: copies to and from the mapped image, so that I/O is done by page
+ *    faults and the kernel's writeback (the default);
+ *  - pread: reads and writes the image file with pread()/pwrite() through a
+ *    buffer cache of a fixed size (see bcache.h), so that the memory used for
+ *    file data is bounded and faults don't stall the file system threads.
+ *
+ * Metadata (the superblock, bitmaps, inodes, directory, index and indirect
+ * blocks) is always accessed in place in the mapped image, so it stays
+ * resident and never competes with file data for the buffer cache. Since both
+ * go through the page cache of the same file, the two views are coherent.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bcache.h"
+
+
+typedef struct blockdev blockdev;
+
+/** Operations of a block device backend. */
+typedef struct blockdev_ops {
+	/** Read len bytes at byte offset pos of the image; 0 or -errno. */
+	int (*read)(blockdev *bd, uint64_t pos, void *buf, size_t len);
+	/** Write len bytes (zeros if buf is NULL) at byte offset pos; 0 or -errno. */
+	int (*write)(blockdev *bd, uint64_t pos, const void *buf, size_t len);
+	/** Sync count blocks starting at block blk to disk; 0 or -errno. */
+	int (*sync)(blockdev *bd, uint64_t blk, uint64_t count);
+	/** Forget whatever is buffered for count blocks starting at blk (e.g.
+	 * because they have been freed). */
+	void (*invalidate)(blockdev *bd, uint64_t blk, uint64_t count);
+	/** Write out everything buffered and free the backend's resources. */
+	void (*destroy)(blockdev *bd);
+} blockdev_ops;
+
+/** Block device over the image of a mounted file system. */
+struct blockdev {
+	const blockdev_ops *ops;
+	/** The mapped image and its size in bytes. */
+	void *image;
+	size_t size;
+
+	/** pread backend: the image file and the buffer cache. */
+	int fd;
+	bcache cache;
+};
+
+
+/**
+ * Open the block device with the mmap backend.
+ *
+ * @param bd     pointer to the block device to initialize.
+ * @param image  pointer to the start of the image.
+ * @param size   image size in bytes.
+ */
+void blockdev_open_mmap(blockdev *bd, void *image, size_t size);
+
+/**
+ * Open the block device with the pread backend.
+ *
+ * @param bd          pointer to the block device to initialize.
+ * @param image       pointer to the start of the image.
+ * @param size        image size in bytes.
+ * @param path        path of the image file.
+ * @param cache_size  size of the buffer cache in bytes.
+ * @return            true on success; false on failure.
+ */
+bool blockdev_open_pread(blockdev *bd, void *image, size_t size, const char *path, size_t cache_size);
+
+static inline int blockdev_read(blockdev *bd, uint64_t pos, void *buf, size_t len)
+{
+	return bd->ops->read(bd, pos, buf, len);
+}
+
+static inline int blockdev_write(blockdev *bd, uint64_t pos, const void *buf, size_t len)
+{
+	return bd->ops->write(bd, pos, buf, len);
+}
+
+static inline int blockdev_sync(blockdev *bd, uint64_t blk, uint64_t count)
+{
+	return bd->ops->sync(bd, blk, count);
+}
+
+static inline void blockdev_invalidate(blockdev *bd, uint64_t blk, uint64_t count)
+{
+	bd->ops->invalidate(bd, blk, count);
+}
+
+static inline void blockdev_close(blockdev *bd)
+{
+	bd->ops->destroy(bd);
+}
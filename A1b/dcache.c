@@ -0,0 +1,168 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entry cache implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcache.h"
+#include "util.h"
+
+
+uint32_t dcache_hash(a1fs_ino_t parent, const char *name, size_t len)
+{
+	uint32_t h = 2166136261u ^ parent;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static dcache_entry **bucket_of(dcache *dc, uint32_t hash)
+{
+	return &dc->buckets[hash & (dc->nbuckets - 1)];
+}
+
+/** Find the entry and the link pointing to it in its hash bucket. */
+static dcache_entry **find_link(dcache *dc, uint32_t hash, a1fs_ino_t parent,
+                                const char *name, size_t len)
+{
+	dcache_entry **link = bucket_of(dc, hash);
+	for (; *link != NULL; link = &(*link)->hnext) {
+		dcache_entry *e = *link;
+		if (e->hash == hash && e->parent == parent && e->len == len &&
+		    memcmp(e->name, name, len) == 0)
+		{
+			return link;
+		}
+	}
+	return link;
+}
+
+static void lru_unlink(dcache *dc, dcache_entry *e)
+{
+	if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+	else dc->lru_head = e->lru_next;
+	if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+	else dc->lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(dcache *dc, dcache_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = dc->lru_head;
+	if (dc->lru_head) dc->lru_head->lru_prev = e;
+	dc->lru_head = e;
+	if (!dc->lru_tail) dc->lru_tail = e;
+}
+
+/** Unlink the entry at *link from both the hash bucket and the LRU list. */
+static void remove_at(dcache *dc, dcache_entry **link)
+{
+	dcache_entry *e = *link;
+	*link = e->hnext;
+	lru_unlink(dc, e);
+	dc->count--;
+	free(e);
+}
+
+
+bool dcache_init(dcache *dc, size_t nbuckets, size_t max_entries)
+{
+	assert(is_powerof2(nbuckets));
+	memset(dc, 0, sizeof(*dc));
+	dc->buckets = calloc(nbuckets, sizeof(dcache_entry*));
+	if (dc->buckets == NULL) return false;
+	dc->nbuckets = nbuckets;
+	dc->max_entries = max_entries;
+	return true;
+}
+
+void dcache_destroy(dcache *dc)
+{
+	dcache_entry *e = dc->lru_head;
+	while (e != NULL) {
+		dcache_entry *next = e->lru_next;
+		free(e);
+		e = next;
+	}
+	free(dc->buckets);
+	dc->buckets = NULL;
+	dc->lru_head = dc->lru_tail = NULL;
+	dc->count = 0;
+}
+
+bool dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t *ino)
+{
+	uint32_t hash = dcache_hash(parent, name, len);
+	dcache_entry *e = *find_link(dc, hash, parent, name, len);
+	if (e == NULL) {
+		dc->misses++;
+		return false;
+	}
+
+	// Move to the front of the LRU list
+	if (e != dc->lru_head) {
+		lru_unlink(dc, e);
+		lru_push_front(dc, e);
+	}
+	dc->hits++;
+	*ino = e->ino;
+	return true;
+}
+
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t ino)
+{
+	uint32_t hash = dcache_hash(parent, name, len);
+	dcache_entry **link = find_link(dc, hash, parent, name, len);
+	if (*link != NULL) {
+		(*link)->ino = ino;
+		return;
+	}
+
+	dcache_entry *e = malloc(sizeof(dcache_entry) + len + 1);
+	if (e == NULL) return;
+	e->hash = hash;
+	e->parent = parent;
+	e->ino = ino;
+	e->len = len;
+	memcpy(e->name, name, len);
+	e->name[len] = '\0';
+
+	e->hnext = NULL;
+	*link = e;
+	lru_push_front(dc, e);
+	dc->count++;
+
+	// Evict the least recently used entry if over the limit
+	if (dc->count > dc->max_entries) {
+		dcache_entry *victim = dc->lru_tail;
+		remove_at(dc, find_link(dc, victim->hash, victim->parent, victim->name,
+		                        victim->len));
+	}
+}
+
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name, size_t len)
+{
+	uint32_t hash = dcache_hash(parent, name, len);
+	dcache_entry **link = find_link(dc, hash, parent, name, len);
+	if (*link != NULL) remove_at(dc, link);
+}
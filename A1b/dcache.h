@@ -0,0 +1,114 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entry cache header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default number of hash buckets in the dentry cache. Must be a power of 2. */
+#define DCACHE_BUCKETS 4096
+
+/** Default maximum number of cached entries before LRU eviction kicks in. */
+#define DCACHE_MAX_ENTRIES 65536
+
+
+/** A cached (parent directory, name) -> inode mapping. */
+typedef struct dcache_entry {
+	/** Next entry in the same hash bucket. */
+	struct dcache_entry *hnext;
+	/** Neighbours in the LRU list (most recently used at the head). */
+	struct dcache_entry *lru_prev, *lru_next;
+
+	/** Hash of (parent, name). */
+	uint32_t hash;
+	/** Inode number of the parent directory. */
+	a1fs_ino_t parent;
+	/** Inode number the name resolves to. */
+	a1fs_ino_t ino;
+	/** Length of the name, not including the null terminator. */
+	size_t len;
+	/** Name of the entry. A null-terminated string. */
+	char name[];
+
+} dcache_entry;
+
+/** Directory entry cache. */
+typedef struct dcache {
+	/** Hash buckets; the number of buckets is a power of 2. */
+	dcache_entry **buckets;
+	size_t nbuckets;
+
+	/** LRU list head (most recently used) and tail (least recently used). */
+	dcache_entry *lru_head, *lru_tail;
+	/** Number of cached entries and the eviction threshold. */
+	size_t count;
+	size_t max_entries;
+
+	/** Statistics. */
+	uint64_t hits;
+	uint64_t misses;
+
+} dcache;
+
+
+/**
+ * Initialize the dentry cache.
+ *
+ * @param dc           pointer to the cache to initialize.
+ * @param nbuckets     number of hash buckets (must be a power of 2).
+ * @param max_entries  maximum number of entries kept in the cache.
+ * @return             true on success; false if out of memory.
+ */
+bool dcache_init(dcache *dc, size_t nbuckets, size_t max_entries);
+
+/** Free all the memory used by the dentry cache. */
+void dcache_destroy(dcache *dc);
+
+/** FNV-1a hash of a name, seeded with the parent directory inode number. */
+uint32_t dcache_hash(a1fs_ino_t parent, const char *name, size_t len);
+
+/**
+ * Look up the inode number for a name in a directory.
+ *
+ * Updates the hit/miss counters.
+ *
+ * @param dc      the cache.
+ * @param parent  inode number of the parent directory.
+ * @param name    the name to look up (not necessarily null-terminated).
+ * @param len     length of the name.
+ * @param ino     pointer to the variable that receives the inode number.
+ * @return        true on a cache hit; false on a miss.
+ */
+bool dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t *ino);
+
+/**
+ * Add (or update) a mapping. Evicts the least recently used entry if the cache
+ * is full. Failing to allocate memory is not an error - the entry is simply not
+ * cached.
+ */
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name, size_t len,
+                   a1fs_ino_t ino);
+
+/** Remove the mapping for a name in a directory, if it is cached. */
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name, size_t len);
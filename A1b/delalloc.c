@@ -0,0 +1,128 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Delayed allocation buffers implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "delalloc.h"
+#include "util.h"
+
+
+static delalloc_buf **find_link(delalloc *da, a1fs_ino_t ino)
+{
+	delalloc_buf **link = &da->buckets[ino & (da->nbuckets - 1)];
+	while (*link != NULL && (*link)->ino != ino) link = &(*link)->hnext;
+	return link;
+}
+
+static void remove_at(delalloc *da, delalloc_buf **link)
+{
+	delalloc_buf *b = *link;
+	*link = b->hnext;
+	da->count--;
+	da->bytes -= b->len;
+	da->reserved -= b->reserved;
+	free(b->data);
+	free(b);
+}
+
+
+bool delalloc_init(delalloc *da, size_t nbuckets, size_t max_bytes)
+{
+	assert(is_powerof2(nbuckets));
+	memset(da, 0, sizeof(*da));
+	da->buckets = calloc(nbuckets, sizeof(delalloc_buf*));
+	if (da->buckets == NULL) return false;
+	da->nbuckets = nbuckets;
+	da->max_bytes = max_bytes;
+	return true;
+}
+
+void delalloc_destroy(delalloc *da)
+{
+	for (size_t i = 0; da->buckets != NULL && i < da->nbuckets; i++) {
+		while (da->buckets[i] != NULL) remove_at(da, &da->buckets[i]);
+	}
+	free(da->buckets);
+	da->buckets = NULL;
+}
+
+delalloc_buf *delalloc_get(delalloc *da, a1fs_ino_t ino)
+{
+	return *find_link(da, ino);
+}
+
+delalloc_buf *delalloc_any(delalloc *da)
+{
+	if (da->count == 0) return NULL;
+	for (size_t i = 0; i < da->nbuckets; i++) {
+		if (da->buckets[i] != NULL) return da->buckets[i];
+	}
+	return NULL;
+}
+
+size_t delalloc_list(delalloc *da, a1fs_ino_t *inos, size_t max)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < da->nbuckets && n < max; i++) {
+		for (delalloc_buf *b = da->buckets[i]; b != NULL && n < max; b = b->hnext) {
+			inos[n++] = b->ino;
+		}
+	}
+	return n;
+}
+
+delalloc_buf *delalloc_append(delalloc *da, a1fs_ino_t ino, uint64_t start,
+                              const char *buf, size_t size)
+{
+	delalloc_buf **link = find_link(da, ino);
+	delalloc_buf *b = *link;
+	if (b == NULL) {
+		b = calloc(1, sizeof(delalloc_buf));
+		if (b == NULL) return NULL;
+		b->ino = ino;
+		b->start = start;
+		b->hnext = *link;
+		*link = b;
+		da->count++;
+	}
+
+	// Grow the buffer geometrically so that small appends stay cheap
+	if (b->len + size > b->cap) {
+		size_t cap = (b->cap > 0) ? b->cap : A1FS_BLOCK_SIZE;
+		while (cap < b->len + size) cap *= 2;
+		char *data = realloc(b->data, cap);
+		if (data == NULL) {
+			if (b->len == 0) remove_at(da, find_link(da, ino));
+			return NULL;
+		}
+		b->data = data;
+		b->cap = cap;
+	}
+
+	memcpy(b->data + b->len, buf, size);
+	b->len += size;
+	da->bytes += size;
+	return b;
+}
+
+void delalloc_remove(delalloc *da, a1fs_ino_t ino)
+{
+	delalloc_buf **link = find_link(da, ino);
+	if (*link != NULL) remove_at(da, link);
+}
@@ -0,0 +1,122 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Delayed allocation buffers header file.
+ *
+ * With delayed allocation, data appended to a file is kept in a memory buffer
+ * instead of being written to newly allocated blocks right away. The buffer
+ * holds the bytes [start, start + len) of the file, where start was the file
+ * size when buffering began; the blocks for them are allocated all at once
+ * when the buffer is flushed, so each flush can get a single extent.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default number of hash buckets. Must be a power of 2. */
+#define DELALLOC_BUCKETS 64
+
+/** Default bound on the total number of buffered bytes (in MiB). */
+#define DELALLOC_MAX_MB 64
+
+
+/** Buffered appended data of one file. */
+typedef struct delalloc_buf {
+	/** Next buffer in the same hash bucket. */
+	struct delalloc_buf *hnext;
+
+	/** Inode number of the file. */
+	a1fs_ino_t ino;
+	/** Offset in the file of the first buffered byte. */
+	uint64_t start;
+	/** Buffered data, its length and the allocated capacity. */
+	char *data;
+	size_t len;
+	size_t cap;
+	/** Number of data blocks reserved for the buffered data. */
+	uint64_t reserved;
+
+} delalloc_buf;
+
+/** Delayed allocation buffers of all the files with pending appends. */
+typedef struct delalloc {
+	/** Hash buckets; the number of buckets is a power of 2. */
+	delalloc_buf **buckets;
+	size_t nbuckets;
+
+	/** Number of buffers, total buffered bytes and the bound on it. */
+	size_t count;
+	size_t bytes;
+	size_t max_bytes;
+	/** Total number of data blocks reserved by all the buffers. */
+	uint64_t reserved;
+
+	/** Statistics. */
+	uint64_t flushes;
+
+} delalloc;
+
+
+/**
+ * Initialize the delayed allocation buffers.
+ *
+ * @param da         pointer to the buffers to initialize.
+ * @param nbuckets   number of hash buckets (must be a power of 2).
+ * @param max_bytes  bound on the total number of buffered bytes.
+ * @return           true on success; false if out of memory.
+ */
+bool delalloc_init(delalloc *da, size_t nbuckets, size_t max_bytes);
+
+/** Free all the buffers; buffered data is discarded. */
+void delalloc_destroy(delalloc *da);
+
+/** Get the buffer of a file; NULL if it has none. */
+delalloc_buf *delalloc_get(delalloc *da, a1fs_ino_t ino);
+
+/** Get any buffer; NULL if there are none. */
+delalloc_buf *delalloc_any(delalloc *da);
+
+/**
+ * List the files that have buffers.
+ *
+ * @param da    the buffers.
+ * @param inos  array that receives the inode numbers.
+ * @param max   size of the array.
+ * @return      the number of inode numbers stored.
+ */
+size_t delalloc_list(delalloc *da, a1fs_ino_t *inos, size_t max);
+
+/**
+ * Append data to the buffer of a file, creating the buffer if needed.
+ *
+ * @param da     the buffers.
+ * @param ino    inode number of the file.
+ * @param start  offset in the file of the data if a new buffer is created;
+ *               otherwise the data must go right after the buffered data.
+ * @param buf    the data.
+ * @param size   data size.
+ * @return       the buffer; NULL if out of memory.
+ */
+delalloc_buf *delalloc_append(delalloc *da, a1fs_ino_t ino, uint64_t start,
+                              const char *buf, size_t size);
+
+/** Free the buffer of a file, if it has one; buffered data is discarded. */
+void delalloc_remove(delalloc *da, a1fs_ino_t ino);
@@ -0,0 +1,301 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Dentry block operations implementation.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dentry.h"
+#include "util.h"
+
+
+/** Maximum number of entries in a dentry block of either format. */
+#define DBLK_MAX_ENTRIES (A1FS_BLOCK_SIZE / sizeof(a1fs_dirent))
+
+/** Number of entries in a fixed format dentry block. */
+#define DBLK_DENTRIES (A1FS_BLOCK_SIZE / sizeof(a1fs_dentry))
+
+
+static bool dentry_unused(const a1fs_dentry *entry)
+{
+	return entry->ino == 0 && entry->name[0] == '\0';
+}
+
+static a1fs_dirent *dirent_at(void *block, size_t off)
+{
+	return (a1fs_dirent*)((char*)block + off);
+}
+
+/** Size of a record that holds a name of the given length. */
+static size_t dirent_size(size_t len)
+{
+	return align_up(sizeof(a1fs_dirent) + len, 4);
+}
+
+/** Free space at the end of a record that can hold a new entry. */
+static size_t dirent_slack(const a1fs_dirent *d)
+{
+	return (d->name_len == 0) ? d->rec_len : d->rec_len - dirent_size(d->name_len);
+}
+
+static int compare_hash(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+
+size_t dentry_size(size_t len, bool compact)
+{
+	return compact ? dirent_size(len) : sizeof(a1fs_dentry);
+}
+
+void dblk_init(void *block, bool compact)
+{
+	memset(block, 0, A1FS_BLOCK_SIZE);
+	if (compact) dirent_at(block, 0)->rec_len = A1FS_BLOCK_SIZE;
+}
+
+void *dblk_find(void *block, bool compact, const char *name, size_t len,
+                uint32_t hash, void **free_slot)
+{
+	if (!compact) {
+		a1fs_dentry *entries = (a1fs_dentry*)block;
+		for (size_t k = 0; k < DBLK_DENTRIES; k++) {
+			if (dentry_unused(&entries[k])) {
+				if (free_slot && !*free_slot) *free_slot = &entries[k];
+				continue;
+			}
+			if (strncmp(entries[k].name, name, len) == 0 &&
+			    entries[k].name[len] == '\0')
+			{
+				return &entries[k];
+			}
+		}
+		return NULL;
+	}
+
+	size_t need = dirent_size(len);
+	for (size_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+		a1fs_dirent *d = dirent_at(block, off);
+		// Compare the hash first; names are only compared on a hash match
+		if (d->name_len == len && d->hash == hash &&
+		    memcmp(d->name, name, len) == 0)
+		{
+			return d;
+		}
+		if (free_slot && !*free_slot && dirent_slack(d) >= need) *free_slot = d;
+
+		if (d->rec_len == 0) break;// corrupted block
+		off += d->rec_len;
+	}
+	return NULL;
+}
+
+void *dblk_find_space(void *block, bool compact, size_t len)
+{
+	if (!compact) {
+		a1fs_dentry *entries = (a1fs_dentry*)block;
+		for (size_t k = 0; k < DBLK_DENTRIES; k++) {
+			if (dentry_unused(&entries[k])) return &entries[k];
+		}
+		return NULL;
+	}
+
+	size_t need = dirent_size(len);
+	for (size_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+		a1fs_dirent *d = dirent_at(block, off);
+		if (dirent_slack(d) >= need) return d;
+		if (d->rec_len == 0) break;// corrupted block
+		off += d->rec_len;
+	}
+	return NULL;
+}
+
+void *dblk_insert(void *slot, bool compact, const char *name, size_t len,
+                  uint32_t hash, a1fs_ino_t ino, unsigned int type)
+{
+	if (!compact) {
+		a1fs_dentry *entry = (a1fs_dentry*)slot;
+		memcpy(entry->name, name, len);
+		entry->name[len] = '\0';
+		entry->ino = ino;
+		return entry;
+	}
+
+	a1fs_dirent *d = (a1fs_dirent*)slot;
+	// Carve the new record out of the free space after a used one
+	if (d->name_len != 0) {
+		size_t used = dirent_size(d->name_len);
+		a1fs_dirent *next = (a1fs_dirent*)((char*)d + used);
+		next->rec_len = d->rec_len - used;
+		d->rec_len = used;
+		d = next;
+	}
+	d->ino = ino;
+	d->name_len = len;
+	d->type = type;
+	d->hash = hash;
+	memcpy(d->name, name, len);
+	return d;
+}
+
+void dblk_remove(void *entry, bool compact)
+{
+	if (!compact) {
+		memset(entry, 0, sizeof(a1fs_dentry));
+		return;
+	}
+
+	// Blocks are block-aligned in memory, so the start of the block is known
+	a1fs_dirent *d = (a1fs_dirent*)entry;
+	void *block = (void*)((uintptr_t)entry & ~(uintptr_t)(A1FS_BLOCK_SIZE - 1));
+	a1fs_dirent *prev = NULL;
+	for (a1fs_dirent *p = dirent_at(block, 0); p != d;
+	     p = (a1fs_dirent*)((char*)p + p->rec_len))
+	{
+		prev = p;
+	}
+
+	if (prev != NULL) {
+		prev->rec_len += d->rec_len;
+	} else {
+		d->ino = 0;
+		d->name_len = 0;
+		d->type = 0;
+		d->hash = 0;
+	}
+}
+
+a1fs_ino_t dentry_ino(const void *entry, bool compact)
+{
+	return compact ? ((const a1fs_dirent*)entry)->ino
+	               : ((const a1fs_dentry*)entry)->ino;
+}
+
+void dentry_set_ino(void *entry, bool compact, a1fs_ino_t ino,
+                    unsigned int type)
+{
+	if (compact) {
+		((a1fs_dirent*)entry)->ino = ino;
+		((a1fs_dirent*)entry)->type = type;
+	} else {
+		((a1fs_dentry*)entry)->ino = ino;
+	}
+}
+
+int dblk_for_each(void *block, bool compact, dentry_fn fn, void *arg)
+{
+	if (!compact) {
+		a1fs_dentry *entries = (a1fs_dentry*)block;
+		for (size_t k = 0; k < DBLK_DENTRIES; k++) {
+			if (dentry_unused(&entries[k])) continue;
+			int ret = fn(entries[k].name, strlen(entries[k].name),
+			             entries[k].ino, 0, arg);
+			if (ret != 0) return ret;
+		}
+		return 0;
+	}
+
+	for (size_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+		a1fs_dirent *d = dirent_at(block, off);
+		if (d->name_len != 0) {
+			int ret = fn(d->name, d->name_len, d->ino, d->type, arg);
+			if (ret != 0) return ret;
+		}
+		if (d->rec_len == 0) break;// corrupted block
+		off += d->rec_len;
+	}
+	return 0;
+}
+
+/** Collect the name hashes of all the entries in a dentry block. */
+static size_t dblk_hashes(void *block, bool compact, uint32_t *hashes)
+{
+	size_t n = 0;
+	if (!compact) {
+		a1fs_dentry *entries = (a1fs_dentry*)block;
+		for (size_t k = 0; k < DBLK_DENTRIES; k++) {
+			if (dentry_unused(&entries[k])) continue;
+			hashes[n++] = a1fs_name_hash(entries[k].name, strlen(entries[k].name));
+		}
+		return n;
+	}
+
+	for (size_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+		a1fs_dirent *d = dirent_at(block, off);
+		if (d->name_len != 0) hashes[n++] = d->hash;
+		if (d->rec_len == 0) break;// corrupted block
+		off += d->rec_len;
+	}
+	return n;
+}
+
+int dblk_split(void *block, void *new_block, bool compact, uint32_t *split)
+{
+	uint32_t hashes[DBLK_MAX_ENTRIES];
+	size_t n = dblk_hashes(block, compact, hashes);
+	if (n < 2) return -ENOSPC;
+	qsort(hashes, n, sizeof(uint32_t), compare_hash);
+
+	// Pick the split point closest to the median that separates two hashes
+	size_t mid = 0;
+	for (size_t d = 0; mid == 0 && (n/2 + d < n || d < n/2); d++) {
+		size_t hi = n/2 + d;
+		size_t lo = n/2 - d;
+		if (hi < n && hashes[hi] != hashes[hi - 1]) {
+			mid = hi;
+		} else if (d < n/2 && hashes[lo] != hashes[lo - 1]) {
+			mid = lo;
+		}
+	}
+	if (mid == 0) return -ENOSPC;
+	*split = hashes[mid];
+
+	dblk_init(new_block, compact);
+	if (!compact) {
+		a1fs_dentry *entries = (a1fs_dentry*)block;
+		a1fs_dentry *new_entries = (a1fs_dentry*)new_block;
+		size_t moved = 0;
+		for (size_t k = 0; k < DBLK_DENTRIES; k++) {
+			if (dentry_unused(&entries[k])) continue;
+			if (a1fs_name_hash(entries[k].name, strlen(entries[k].name)) >= *split) {
+				new_entries[moved++] = entries[k];
+				memset(&entries[k], 0, sizeof(a1fs_dentry));
+			}
+		}
+		return 0;
+	}
+
+	// Repack both halves; this also coalesces the free space in the old block
+	char old[A1FS_BLOCK_SIZE];
+	memcpy(old, block, A1FS_BLOCK_SIZE);
+	dblk_init(block, compact);
+	for (size_t off = 0; off < A1FS_BLOCK_SIZE; ) {
+		a1fs_dirent *d = dirent_at(old, off);
+		if (d->name_len != 0) {
+			void *dst = (d->hash >= *split) ? new_block : block;
+			void *slot = dblk_find_space(dst, compact, d->name_len);
+			dblk_insert(slot, compact, d->name, d->name_len, d->hash, d->ino, d->type);
+		}
+		if (d->rec_len == 0) break;// corrupted block
+		off += d->rec_len;
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Dentry block operations header file.
+ *
+ * A dentry block holds either fixed size a1fs_dentry entries or variable
+ * length a1fs_dirent records, depending on whether the file system has the
+ * A1FS_FEATURE_COMPACT_DENTRY feature. The functions below hide the
+ * difference; every one of them takes the format as its "compact" argument.
+ * Entries are referred to by a pointer into the block.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/**
+ * Callback for dblk_for_each(); a non-zero return value stops the walk.
+ *
+ * @param name  the name of the entry (not null-terminated).
+ * @param len   the length of the name.
+ * @param ino   the inode number of the entry.
+ * @param type  the A1FS_DT() file type; 0 if the format doesn't store it.
+ * @param arg   the argument passed to dblk_for_each().
+ */
+typedef int (*dentry_fn)(const char *name, size_t len, a1fs_ino_t ino,
+                         unsigned int type, void *arg);
+
+
+/** Space used in a directory by an entry whose name is len bytes long. */
+size_t dentry_size(size_t len, bool compact);
+
+/** Initialize an empty dentry block. */
+void dblk_init(void *block, bool compact);
+
+/**
+ * Scan a dentry block for the entry with the given name.
+ *
+ * @param block      the dentry block.
+ * @param compact    the dentry format.
+ * @param name       the name to look for (not necessarily null-terminated).
+ * @param len        the length of the name.
+ * @param hash       a1fs_name_hash() of the name.
+ * @param free_slot  if not NULL and *free_slot is NULL, set to the first place
+ *                   seen during the scan that can hold an entry for the name.
+ * @return           the matching entry; NULL if there is no such entry.
+ */
+void *dblk_find(void *block, bool compact, const char *name, size_t len,
+                uint32_t hash, void **free_slot);
+
+/** Find a place in a dentry block for an entry whose name is len bytes long. */
+void *dblk_find_space(void *block, bool compact, size_t len);
+
+/**
+ * Store a new entry at a place returned by dblk_find() or dblk_find_space().
+ *
+ * @return  the new entry.
+ */
+void *dblk_insert(void *slot, bool compact, const char *name, size_t len,
+                  uint32_t hash, a1fs_ino_t ino, unsigned int type);
+
+/** Remove an entry from its dentry block. */
+void dblk_remove(void *entry, bool compact);
+
+/** Get the inode number of an entry. */
+a1fs_ino_t dentry_ino(const void *entry, bool compact);
+
+/** Point an existing entry at another inode. */
+void dentry_set_ino(void *entry, bool compact, a1fs_ino_t ino,
+                    unsigned int type);
+
+/**
+ * Call fn for every entry in a dentry block until it returns non-zero.
+ *
+ * @return  0 if all entries were visited; otherwise the value returned by fn.
+ */
+int dblk_for_each(void *block, bool compact, dentry_fn fn, void *arg);
+
+/**
+ * Move the upper half (by name hash) of the entries of a full dentry block
+ * into another block, which is initialized first. Entries with equal hashes
+ * always stay in the same block.
+ *
+ * @param block      the full block.
+ * @param new_block  the block that receives the moved entries.
+ * @param compact    the dentry format.
+ * @param split      receives the lowest hash moved into new_block.
+ * @return           0 on success; -ENOSPC if all the entries have the same hash.
+ */
+int dblk_split(void *block, void *new_block, bool compact, uint32_t *split);
@@ -0,0 +1,168 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Extent map cache implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "extmap.h"
+#include "util.h"
+
+
+static extmap_entry **bucket_of(extmap *em, a1fs_ino_t ino)
+{
+	return &em->buckets[ino & (em->nbuckets - 1)];
+}
+
+/** Find the map of a file and the link pointing to it in its hash bucket. */
+static extmap_entry **find_link(extmap *em, a1fs_ino_t ino)
+{
+	extmap_entry **link = bucket_of(em, ino);
+	while (*link != NULL && (*link)->ino != ino) link = &(*link)->hnext;
+	return link;
+}
+
+static void lru_unlink(extmap *em, extmap_entry *e)
+{
+	if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+	else em->lru_head = e->lru_next;
+	if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+	else em->lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(extmap *em, extmap_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = em->lru_head;
+	if (em->lru_head) em->lru_head->lru_prev = e;
+	em->lru_head = e;
+	if (!em->lru_tail) em->lru_tail = e;
+}
+
+/** Unlink the map at *link from both the hash bucket and the LRU list. */
+static void remove_at(extmap *em, extmap_entry **link)
+{
+	extmap_entry *e = *link;
+	*link = e->hnext;
+	lru_unlink(em, e);
+	em->count--;
+	free(e);
+}
+
+
+bool extmap_init(extmap *em, size_t nbuckets, size_t max_entries)
+{
+	assert(is_powerof2(nbuckets));
+	memset(em, 0, sizeof(*em));
+	em->buckets = calloc(nbuckets, sizeof(extmap_entry*));
+	if (em->buckets == NULL) return false;
+	em->nbuckets = nbuckets;
+	em->max_entries = max_entries;
+	return true;
+}
+
+void extmap_destroy(extmap *em)
+{
+	extmap_entry *e = em->lru_head;
+	while (e != NULL) {
+		extmap_entry *next = e->lru_next;
+		free(e);
+		e = next;
+	}
+	free(em->buckets);
+	em->buckets = NULL;
+	em->lru_head = em->lru_tail = NULL;
+	em->count = 0;
+}
+
+extmap_entry *extmap_peek(extmap *em, a1fs_ino_t ino)
+{
+	return *find_link(em, ino);
+}
+
+extmap_entry *extmap_lookup(extmap *em, a1fs_ino_t ino)
+{
+	extmap_entry *e = *find_link(em, ino);
+	if (e == NULL) {
+		em->misses++;
+		return NULL;
+	}
+
+	// Move to the front of the LRU list
+	if (e != em->lru_head) {
+		lru_unlink(em, e);
+		lru_push_front(em, e);
+	}
+	em->hits++;
+	return e;
+}
+
+extmap_entry *extmap_insert(extmap *em, a1fs_ino_t ino)
+{
+	extmap_entry **link = find_link(em, ino);
+	if (*link != NULL) remove_at(em, link);
+
+	extmap_entry *e = malloc(sizeof(extmap_entry));
+	if (e == NULL) return NULL;
+	e->ino = ino;
+	e->count = 0;
+
+	e->hnext = *bucket_of(em, ino);
+	*bucket_of(em, ino) = e;
+	lru_push_front(em, e);
+	em->count++;
+
+	// Evict the least recently used map if over the limit
+	if (em->count > em->max_entries) {
+		remove_at(em, find_link(em, em->lru_tail->ino));
+	}
+	return e;
+}
+
+void extmap_remove(extmap *em, a1fs_ino_t ino)
+{
+	extmap_entry **link = find_link(em, ino);
+	if (*link != NULL) remove_at(em, link);
+}
+
+void extmap_set(extmap_entry *e, uint32_t i, uint64_t count)
+{
+	assert(i <= e->count);
+	if (count == 0) {
+		e->count = i;
+		return;
+	}
+	e->ends[i] = ((i > 0) ? e->ends[i - 1] : 0) + count;
+	e->count = i + 1;
+}
+
+int extmap_find(const extmap_entry *e, uint64_t blk, uint64_t *off)
+{
+	// Find the first extent that ends after blk
+	uint32_t lo = 0;
+	uint32_t hi = e->count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (e->ends[mid] > blk) hi = mid;
+		else lo = mid + 1;
+	}
+	if (lo == e->count) return -1;
+
+	*off = blk - ((lo > 0) ? e->ends[lo - 1] : 0);
+	return lo;
+}
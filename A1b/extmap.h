@@ -0,0 +1,132 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Extent map cache header file.
+ *
+ * An extent map holds the cumulative logical block offsets of the extents of a
+ * file, so that the extent holding a given file block can be found by binary
+ * search instead of by walking the inode and its indirect block.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default number of hash buckets in the extent map cache. Must be a power of 2. */
+#define EXTMAP_BUCKETS 256
+
+/** Default maximum number of cached extent maps before LRU eviction kicks in. */
+#define EXTMAP_MAX_ENTRIES 1024
+
+/** Maximum number of extents of a file: the direct slots plus the indirect block. */
+#define EXTMAP_MAX_EXTENTS (A1FS_IND_BLOCK + A1FS_NUM_EXTENTS)
+
+
+/** The extent map of one file. */
+typedef struct extmap_entry {
+	/** Next entry in the same hash bucket. */
+	struct extmap_entry *hnext;
+	/** Neighbours in the LRU list (most recently used at the head). */
+	struct extmap_entry *lru_prev, *lru_next;
+
+	/** Inode number of the file. */
+	a1fs_ino_t ino;
+	/** Number of extents. */
+	uint32_t count;
+	/** ends[i] is the number of file blocks in extents 0 to i. */
+	uint64_t ends[EXTMAP_MAX_EXTENTS];
+
+} extmap_entry;
+
+/** Cache of extent maps of recently used files. */
+typedef struct extmap {
+	/** Hash buckets; the number of buckets is a power of 2. */
+	extmap_entry **buckets;
+	size_t nbuckets;
+
+	/** LRU list head (most recently used) and tail (least recently used). */
+	extmap_entry *lru_head, *lru_tail;
+	/** Number of cached maps and the eviction threshold. */
+	size_t count;
+	size_t max_entries;
+
+	/** Statistics. */
+	uint64_t hits;
+	uint64_t misses;
+
+} extmap;
+
+
+/**
+ * Initialize the extent map cache.
+ *
+ * @param em           pointer to the cache to initialize.
+ * @param nbuckets     number of hash buckets (must be a power of 2).
+ * @param max_entries  maximum number of maps kept in the cache.
+ * @return             true on success; false if out of memory.
+ */
+bool extmap_init(extmap *em, size_t nbuckets, size_t max_entries);
+
+/** Free all the memory used by the extent map cache. */
+void extmap_destroy(extmap *em);
+
+/**
+ * Get the cached map of a file. Updates the hit/miss counters.
+ *
+ * @return  the map; NULL on a miss.
+ */
+extmap_entry *extmap_lookup(extmap *em, a1fs_ino_t ino);
+
+/**
+ * Add an empty map for a file, evicting the least recently used map if the
+ * cache is full.
+ *
+ * @return  the new map; NULL if out of memory.
+ */
+extmap_entry *extmap_insert(extmap *em, a1fs_ino_t ino);
+
+/** Remove the map of a file (e.g. when it is freed), if it is cached. */
+void extmap_remove(extmap *em, a1fs_ino_t ino);
+
+/** Same as extmap_lookup(), but doesn't touch the LRU list or the counters. */
+extmap_entry *extmap_peek(extmap *em, a1fs_ino_t ino);
+
+/**
+ * Set the number of blocks in extent i of a map and drop all the extents after
+ * it; i can be at most one past the last extent. A count of 0 drops extent i
+ * as well.
+ */
+void extmap_set(extmap_entry *e, uint32_t i, uint64_t count);
+
+/**
+ * Find the extent holding a file block by binary search.
+ *
+ * @param e    the map.
+ * @param blk  the block number within the file.
+ * @param off  receives the position of the block within the extent.
+ * @return     the index of the extent; -1 if blk is past the last extent.
+ */
+int extmap_find(const extmap_entry *e, uint64_t blk, uint64_t *off);
+
+/** Total number of blocks in the extents of a map. */
+static inline uint64_t extmap_blocks(const extmap_entry *e)
+{
+	return (e->count > 0) ? e->ends[e->count - 1] : 0;
+}
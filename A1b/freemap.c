@@ -0,0 +1,337 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Free extent index implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "freemap.h"
+
+
+/** Tree indices: by start block and by (length, start block). */
+enum { BY_START = 0, BY_COUNT = 1 };
+
+
+static bool node_less(int t, const freemap_node *a, const freemap_node *b)
+{
+	if (t == BY_COUNT && a->count != b->count) return a->count < b->count;
+	return a->start < b->start;
+}
+
+static uint64_t max_count(const freemap_node *n)
+{
+	return (n != NULL) ? n->max_count : 0;
+}
+
+/** Recompute the longest run in the start subtree rooted at n. */
+static void update(int t, freemap_node *n)
+{
+	if (t != BY_START) return;
+	uint64_t m = n->count;
+	if (max_count(n->left[t]) > m) m = max_count(n->left[t]);
+	if (max_count(n->right[t]) > m) m = max_count(n->right[t]);
+	n->max_count = m;
+}
+
+/** Split tree t into the nodes ordered before key (*l) and the rest (*r). */
+static void split(int t, freemap_node *n, const freemap_node *key,
+                  freemap_node **l, freemap_node **r)
+{
+	if (n == NULL) {
+		*l = *r = NULL;
+		return;
+	}
+	if (node_less(t, n, key)) {
+		split(t, n->right[t], key, &n->right[t], r);
+		*l = n;
+	} else {
+		split(t, n->left[t], key, l, &n->left[t]);
+		*r = n;
+	}
+	update(t, n);
+}
+
+/** Join two trees where all the nodes of a are ordered before those of b. */
+static freemap_node *merge(int t, freemap_node *a, freemap_node *b)
+{
+	if (a == NULL) return b;
+	if (b == NULL) return a;
+	if (a->prio > b->prio) {
+		a->right[t] = merge(t, a->right[t], b);
+		update(t, a);
+		return a;
+	}
+	b->left[t] = merge(t, a, b->left[t]);
+	update(t, b);
+	return b;
+}
+
+static void tree_insert(freemap *fm, int t, freemap_node *n)
+{
+	n->left[t] = n->right[t] = NULL;
+	update(t, n);
+	freemap_node *l, *r;
+	split(t, fm->root[t], n, &l, &r);
+	fm->root[t] = merge(t, merge(t, l, n), r);
+}
+
+static freemap_node *tree_remove(int t, freemap_node *root, freemap_node *n)
+{
+	if (root == n) return merge(t, n->left[t], n->right[t]);
+	if (node_less(t, n, root)) root->left[t] = tree_remove(t, root->left[t], n);
+	else root->right[t] = tree_remove(t, root->right[t], n);
+	update(t, root);
+	return root;
+}
+
+static void link_node(freemap *fm, freemap_node *n)
+{
+	tree_insert(fm, BY_START, n);
+	tree_insert(fm, BY_COUNT, n);
+}
+
+static void unlink_node(freemap *fm, freemap_node *n)
+{
+	fm->root[BY_START] = tree_remove(BY_START, fm->root[BY_START], n);
+	fm->root[BY_COUNT] = tree_remove(BY_COUNT, fm->root[BY_COUNT], n);
+}
+
+/** Change the run held by a node, moving it to its new place in both trees. */
+static void rekey(freemap *fm, freemap_node *n, uint64_t start, uint64_t count)
+{
+	unlink_node(fm, n);
+	n->start = start;
+	n->count = count;
+	link_node(fm, n);
+}
+
+static freemap_node *new_node(freemap *fm, uint64_t start, uint64_t count)
+{
+	freemap_node *n = malloc(sizeof(freemap_node));
+	if (n == NULL) {
+		fm->stale = true;
+		return NULL;
+	}
+	// xorshift32
+	fm->seed ^= fm->seed << 13;
+	fm->seed ^= fm->seed >> 17;
+	fm->seed ^= fm->seed << 5;
+	n->prio = fm->seed;
+	n->start = start;
+	n->count = count;
+	link_node(fm, n);
+	fm->nruns++;
+	return n;
+}
+
+static void free_node(freemap *fm, freemap_node *n)
+{
+	unlink_node(fm, n);
+	fm->nruns--;
+	free(n);
+}
+
+static void free_tree(freemap_node *n)
+{
+	if (n == NULL) return;
+	free_tree(n->left[BY_START]);
+	free_tree(n->right[BY_START]);
+	free(n);
+}
+
+/** Find the run with the greatest start block that is at most blk. */
+static freemap_node *find_floor(const freemap *fm, uint64_t blk)
+{
+	freemap_node *best = NULL;
+	for (freemap_node *n = fm->root[BY_START]; n != NULL; ) {
+		if (n->start <= blk) {
+			best = n;
+			n = n->right[BY_START];
+		} else {
+			n = n->left[BY_START];
+		}
+	}
+	return best;
+}
+
+static const freemap_node *first_fit(const freemap_node *n, uint64_t from,
+                                     uint64_t count)
+{
+	if (n == NULL || n->max_count < count) return NULL;
+	if (n->start >= from) {
+		const freemap_node *r = first_fit(n->left[BY_START], from, count);
+		if (r != NULL) return r;
+		if (n->count >= count) return n;
+	}
+	return first_fit(n->right[BY_START], from, count);
+}
+
+
+void freemap_init(freemap *fm)
+{
+	memset(fm, 0, sizeof(*fm));
+	fm->seed = 2463534242u;
+}
+
+/** Drop all the runs in the index (but not the pending ones). */
+static void clear(freemap *fm)
+{
+	free_tree(fm->root[BY_START]);
+	fm->root[BY_START] = fm->root[BY_COUNT] = NULL;
+	fm->nruns = 0;
+	fm->free_blocks = 0;
+}
+
+void freemap_destroy(freemap *fm)
+{
+	clear(fm);
+	free(fm->pending);
+	fm->pending = NULL;
+	fm->npending = fm->pending_cap = 0;
+	fm->pending_blocks = 0;
+}
+
+bool freemap_build(freemap *fm, const void *bm, uint64_t nbits)
+{
+	clear(fm);
+	fm->stale = false;
+	for (uint64_t pos = 0; pos < nbits; ) {
+		uint64_t start = bitmap_find(bm, pos, nbits, false);
+		if (start == nbits) break;
+		uint64_t end = bitmap_find(bm, start, nbits, true);
+		if (new_node(fm, start, end - start) == NULL) return false;
+		fm->free_blocks += end - start;
+		pos = end;
+	}
+	for (size_t i = 0; i < fm->npending; i++) {
+		if (!freemap_remove(fm, fm->pending[i].start, fm->pending[i].count)) return false;
+	}
+	return true;
+}
+
+bool freemap_defer(freemap *fm, uint64_t start, uint64_t count, uint64_t seq)
+{
+	if (fm->npending == fm->pending_cap) {
+		size_t new_cap = (fm->pending_cap > 0) ? fm->pending_cap * 2 : 64;
+		freemap_run *p = realloc(fm->pending, new_cap * sizeof(freemap_run));
+		if (p == NULL) return false;
+		fm->pending = p;
+		fm->pending_cap = new_cap;
+	}
+	fm->pending[fm->npending++] = (freemap_run){ start, count, seq };
+	fm->pending_blocks += count;
+	return true;
+}
+
+bool freemap_settle(freemap *fm, uint64_t seq)
+{
+	bool ok = true;
+	size_t n = 0;
+	for (size_t i = 0; i < fm->npending; i++) {
+		freemap_run *r = &fm->pending[i];
+		if (r->seq >= seq) {
+			fm->pending[n++] = *r;
+			continue;
+		}
+		fm->pending_blocks -= r->count;
+		// A stale index is rebuilt from the bitmap, which has the run anyway.
+		if (ok && !fm->stale && !freemap_insert(fm, r->start, r->count)) ok = false;
+	}
+	fm->npending = n;
+	return ok;
+}
+
+bool freemap_insert(freemap *fm, uint64_t start, uint64_t count)
+{
+	freemap_node *prev = find_floor(fm, start);
+	if (prev != NULL && prev->start + prev->count != start) prev = NULL;
+	freemap_node *next = find_floor(fm, start + count);
+	if (next != NULL && next->start != start + count) next = NULL;
+
+	if (prev != NULL && next != NULL) {
+		uint64_t total = prev->count + count + next->count;
+		free_node(fm, next);
+		rekey(fm, prev, prev->start, total);
+	} else if (prev != NULL) {
+		rekey(fm, prev, prev->start, prev->count + count);
+	} else if (next != NULL) {
+		rekey(fm, next, start, next->count + count);
+	} else if (new_node(fm, start, count) == NULL) {
+		return false;
+	}
+	fm->free_blocks += count;
+	return true;
+}
+
+bool freemap_remove(freemap *fm, uint64_t start, uint64_t count)
+{
+	freemap_node *n = find_floor(fm, start);
+	if (n == NULL || start + count > n->start + n->count) {
+		// The index doesn't match the bitmap
+		fm->stale = true;
+		return false;
+	}
+
+	uint64_t head = start - n->start;
+	uint64_t tail = n->start + n->count - (start + count);
+	if (head == 0 && tail == 0) {
+		free_node(fm, n);
+	} else if (head == 0) {
+		rekey(fm, n, start + count, tail);
+	} else if (tail == 0) {
+		rekey(fm, n, n->start, head);
+	} else {
+		if (new_node(fm, start + count, tail) == NULL) return false;
+		rekey(fm, n, n->start, head);
+	}
+	fm->free_blocks -= count;
+	return true;
+}
+
+const freemap_node *freemap_find(const freemap *fm, uint64_t blk)
+{
+	const freemap_node *n = find_floor(fm, blk);
+	return (n != NULL && blk < n->start + n->count) ? n : NULL;
+}
+
+const freemap_node *freemap_first_fit(const freemap *fm, uint64_t from,
+                                      uint64_t count)
+{
+	return first_fit(fm->root[BY_START], from, count);
+}
+
+const freemap_node *freemap_best_fit(const freemap *fm, uint64_t count)
+{
+	const freemap_node *best = NULL;
+	for (const freemap_node *n = fm->root[BY_COUNT]; n != NULL; ) {
+		if (n->count >= count) {
+			best = n;
+			n = n->left[BY_COUNT];
+		} else {
+			n = n->right[BY_COUNT];
+		}
+	}
+	return best;
+}
+
+const freemap_node *freemap_largest(const freemap *fm)
+{
+	const freemap_node *n = fm->root[BY_COUNT];
+	while (n != NULL && n->right[BY_COUNT] != NULL) n = n->right[BY_COUNT];
+	return n;
+}
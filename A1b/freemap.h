@@ -0,0 +1,144 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Free extent index header file.
+ *
+ * The free extent index holds the runs of free data blocks in two balanced
+ * trees (treaps): one ordered by start block and one ordered by length. The
+ * start tree also keeps the longest run in every subtree, so that the first
+ * run of at least N blocks after a given block can be found in O(log n), as
+ * can the smallest run of at least N blocks anywhere.
+ *
+ * The block bitmap stays the authority on which blocks are free. If the index
+ * can't be updated because memory runs out, it is marked stale and must be
+ * rebuilt from the bitmap before it is used again.
+ *
+ * In images with a journal, blocks freed by a transaction are held back until
+ * it commits: until then, the metadata in the image still points to them, and
+ * file data written to them would go to disk right away.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** A run of free blocks; linked into both trees. */
+typedef struct freemap_node {
+	/** Children in the start tree [0] and in the length tree [1]. */
+	struct freemap_node *left[2], *right[2];
+	/** Heap priority (shared by both trees). */
+	uint32_t prio;
+
+	uint64_t start;
+	uint64_t count;
+	/** Longest run in the subtree of the start tree rooted here. */
+	uint64_t max_count;
+
+} freemap_node;
+
+/** A run of blocks freed by a journal transaction. */
+typedef struct freemap_run {
+	uint64_t start;
+	uint64_t count;
+	/** Sequence number of the transaction. */
+	uint64_t seq;
+
+} freemap_run;
+
+/** Free extent index. */
+typedef struct freemap {
+	/** Roots of the start tree [0] and of the length tree [1]. */
+	freemap_node *root[2];
+
+	/** Number of free runs and free blocks in the index. */
+	size_t nruns;
+	uint64_t free_blocks;
+
+	/** Runs freed by transactions that haven't committed yet, which are not
+	 * in the index, and the number of blocks in them. */
+	freemap_run *pending;
+	size_t npending;
+	size_t pending_cap;
+	uint64_t pending_blocks;
+
+	/** Set if an update failed; the index must be rebuilt before it is used. */
+	bool stale;
+	/** State of the priority generator. */
+	uint32_t seed;
+
+} freemap;
+
+
+/** Initialize an empty free extent index. */
+void freemap_init(freemap *fm);
+
+/** Free all the memory used by the free extent index. */
+void freemap_destroy(freemap *fm);
+
+/**
+ * Rebuild the index from a block bitmap, leaving out the pending runs.
+ *
+ * @param fm     the index.
+ * @param bm     the bitmap (see bitmap.h).
+ * @param nbits  number of blocks covered by the bitmap.
+ * @return       true on success; false if out of memory (the index is stale).
+ */
+bool freemap_build(freemap *fm, const void *bm, uint64_t nbits);
+
+/**
+ * Add a run of newly freed blocks, merging it with its neighbours.
+ *
+ * @return  true on success; false if out of memory (the index is stale).
+ */
+bool freemap_insert(freemap *fm, uint64_t start, uint64_t count);
+
+/**
+ * Hold back a run of blocks freed by journal transaction seq until it commits.
+ *
+ * @return  true on success; false if out of memory (the run is not added).
+ */
+bool freemap_defer(freemap *fm, uint64_t start, uint64_t count, uint64_t seq);
+
+/**
+ * Add the pending runs freed by the transactions before seq (the ones that
+ * have committed) to the index.
+ *
+ * @return  true on success; false if out of memory (the index is stale).
+ */
+bool freemap_settle(freemap *fm, uint64_t seq);
+
+/**
+ * Remove a run of newly allocated blocks. The run must lie within a single
+ * free run in the index.
+ *
+ * @return  true on success; false if out of memory (the index is stale).
+ */
+bool freemap_remove(freemap *fm, uint64_t start, uint64_t count);
+
+/** Get the free run that contains block blk; NULL if blk isn't free. */
+const freemap_node *freemap_find(const freemap *fm, uint64_t blk);
+
+/** Get the first free run at or after block from with at least count blocks. */
+const freemap_node *freemap_first_fit(const freemap *fm, uint64_t from,
+                                      uint64_t count);
+
+/** Get the smallest free run with at least count blocks. */
+const freemap_node *freemap_best_fit(const freemap *fm, uint64_t count);
+
+/** Get the longest free run; NULL if there are no free blocks. */
+const freemap_node *freemap_largest(const freemap *fm);
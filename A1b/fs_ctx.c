@@ -16,22 +16,199 @@
  * CSC369 Assignment 1 - File system runtime context implementation.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "a1fs.h"
 #include "fs_ctx.h"
+#include "map.h"
 
 
+/** Free the first n cache shards. */
+static void caches_destroy(fs_ctx *fs, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		cache_shard *c = &fs->caches[i];
+		extmap_destroy(&c->extmap);
+		dcache_destroy(&c->dcache);
+		pthread_mutex_destroy(&c->lock);
+	}
+}
+
+/** Set up the cache shards, each with its share of the cache sizes. */
+static bool caches_init(fs_ctx *fs)
+{
+	for (size_t i = 0; i < CACHE_SHARDS; i++) {
+		cache_shard *c = &fs->caches[i];
+		if (!dcache_init(&c->dcache, DCACHE_BUCKETS / CACHE_SHARDS,
+		                 DCACHE_MAX_ENTRIES / CACHE_SHARDS))
+		{
+			caches_destroy(fs, i);
+			return false;
+		}
+		if (!extmap_init(&c->extmap, EXTMAP_BUCKETS / CACHE_SHARDS,
+		                 EXTMAP_MAX_ENTRIES / CACHE_SHARDS))
+		{
+			dcache_destroy(&c->dcache);
+			caches_destroy(fs, i);
+			return false;
+		}
+		pthread_mutex_init(&c->lock, NULL);
+	}
+	return true;
+}
+
 bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, a1fs_opts *opts)
 {
 	fs->image = image;
+	fs->shared = image;
 	fs->size = size;
 	fs->opts = opts;
 
-	//TODO: check if the file system image can be mounted and initialize its
-	// runtime state
+	const a1fs_superblock *sb = (const a1fs_superblock*)image;
+	if (sb->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image does not contain a1fs\n");
+		return false;
+	}
+	if (sb->features & ~A1FS_FEATURES_SUPPORTED) {
+		fprintf(stderr, "Image uses unsupported features 0x%x\n",
+		        sb->features & ~A1FS_FEATURES_SUPPORTED);
+		return false;
+	}
+	if ((sb->features & A1FS_FEATURES_REQUIRED) != A1FS_FEATURES_REQUIRED) {
+		fprintf(stderr, "Image uses 32-bit block numbers; reformat it with mkfs.a1fs\n");
+		return false;
+	}
+
+	int replayed = journal_replay(image, size);
+	if (replayed < 0) {
+		fprintf(stderr, "Invalid journal\n");
+		return false;
+	}
+	if (replayed > 0 && opts->verbose) {
+		fprintf(stderr, "journal: replayed %d transactions\n", replayed);
+	}
+	if (sb->features & A1FS_FEATURE_JOURNAL) {
+		fs->image = map_file_view(opts->img_path, size);
+		if (fs->image == NULL) {
+			return false;
+		}
+		sb = (const a1fs_superblock*)fs->image;
+	}
+
+	if (sb->features & A1FS_FEATURE_GROUPS) {
+		if (sb->groups_count == 0 || sb->blocks_per_group == 0 || sb->inodes_per_group == 0) {
+			fprintf(stderr, "Invalid allocation group layout\n");
+			goto err_groups;
+		}
+		fs->groups = (a1fs_group_desc*)((char*)fs->image + A1FS_BLOCK_SIZE * sb->group_table);
+		fs->groups_count = sb->groups_count;
+		fs->blocks_per_group = sb->blocks_per_group;
+		fs->inodes_per_group = sb->inodes_per_group;
+	} else {
+		// The descriptor counts are 32-bit.
+		if (sb->blocks_count > UINT32_MAX) {
+			fprintf(stderr, "Image without allocation groups is too large\n");
+			goto err_groups;
+		}
+		fs->single_group = (a1fs_group_desc){
+			.free_blocks_count = sb->free_blocks_count,
+			.free_inodes_count = sb->free_inodes_count,
+		};
+		fs->groups = &fs->single_group;
+		fs->groups_count = 1;
+		fs->blocks_per_group = sb->blocks_count;
+		fs->inodes_per_group = sb->inodes_count;
+	}
+
+	// Each step that fails undoes the ones before it, in reverse order.
+	if (!caches_init(fs)) {
+		goto err_groups;
+	}
+
+	size_t delalloc_max = (opts->delalloc_max > 0) ? opts->delalloc_max : DELALLOC_MAX_MB;
+	if (!delalloc_init(&fs->delalloc, DELALLOC_BUCKETS, delalloc_max << 20)) {
+		goto err_delalloc;
+	}
+
+	freemap_init(&fs->freemap);
+	const unsigned char *block_bitmap = (const unsigned char*)fs->image + A1FS_BLOCK_SIZE * sb->block_bitmap;
+	if (!freemap_build(&fs->freemap, block_bitmap, sb->blocks_count)) {
+		fprintf(stderr, "Out of memory building the free extent index\n");
+		goto err_freemap;
+	}
+
+	fs->extent_gens = calloc(sb->inodes_count, sizeof(uint32_t));
+	if (fs->extent_gens == NULL) {
+		goto err_inodes;
+	}
+	unsigned int interval = (opts->commit_interval > 0) ? opts->commit_interval : JOURNAL_COMMIT_INTERVAL;
+	if (!journal_init(&fs->journal, image, fs->image, size, interval)) {
+		fprintf(stderr, "Out of memory setting up the journal\n");
+		goto err_inodes;
+	}
+	if (opts->pread) {
+		size_t cache_size = (opts->cache_size > 0) ? opts->cache_size : BCACHE_SIZE_MB;
+		if (!blockdev_open_pread(&fs->bdev, image, size, opts->img_path, cache_size << 20)) {
+			goto err_blockdev;
+		}
+	} else {
+		blockdev_open_mmap(&fs->bdev, image, size);
+	}
+	unsigned int age = (opts->writeback_age > 0) ? opts->writeback_age : WRITEBACK_AGE;
+	size_t writeback_max = (opts->writeback_max > 0) ? opts->writeback_max : WRITEBACK_MAX_MB;
+	if (!writeback_init(&fs->writeback, &fs->bdev, age, (writeback_max << 20) / A1FS_BLOCK_SIZE)) {
+		fprintf(stderr, "Out of memory setting up writeback\n");
+		goto err_writeback;
+	}
+	uint64_t readahead_max = opts->noreadahead ? 0 :
+	                         (opts->readahead_max > 0) ? opts->readahead_max : READAHEAD_MAX_KB;
+	readahead_init(&fs->readahead, readahead_max << 10);
+
+	ilock_init(&fs->inode_locks);
+	pthread_mutex_init(&fs->rename_lock, NULL);
+	pthread_mutex_init(&fs->alloc_lock, NULL);
 	return true;
+
+err_writeback:
+	blockdev_close(&fs->bdev);
+err_blockdev:
+	journal_destroy(&fs->journal);
+err_inodes:
+	free(fs->extent_gens);
+err_freemap:
+	freemap_destroy(&fs->freemap);
+	delalloc_destroy(&fs->delalloc);
+err_delalloc:
+	caches_destroy(fs, CACHE_SHARDS);
+err_groups:
+	if (fs->image != fs->shared) {
+		munmap(fs->image, size);
+	}
+	return false;
 }
 
 void fs_ctx_destroy(fs_ctx *fs)
 {
-	//TODO: cleanup any resources allocated in fs_ctx_init()
-	(void)fs;
+	// Its thread reads file extents, so it is stopped before anything else.
+	readahead_destroy(&fs->readahead);
+	// Commits and checkpoints whatever is left, so it goes first.
+	journal_destroy(&fs->journal);
+	writeback_destroy(&fs->writeback);
+	// Writes back whatever the buffer cache holds.
+	blockdev_close(&fs->bdev);
+
+	ilock_destroy(&fs->inode_locks);
+	free(fs->extent_gens);
+	pthread_mutex_destroy(&fs->alloc_lock);
+	pthread_mutex_destroy(&fs->rename_lock);
+
+	freemap_destroy(&fs->freemap);
+	delalloc_destroy(&fs->delalloc);
+	caches_destroy(fs, CACHE_SHARDS);
+	// Whatever the journal didn't commit is dropped along with the view.
+	if (fs->image != fs->shared) {
+		munmap(fs->image, fs->size);
+	}
 }
@@ -18,22 +18,99 @@
 
 #pragma once
 
+#include <pthread.h>
 #include <stddef.h>
 
+#include "a1fs.h"
+#include "blockdev.h"
+#include "dcache.h"
+#include "delalloc.h"
+#include "extmap.h"
+#include "freemap.h"
+#include "ilock.h"
+#include "journal.h"
 #include "options.h"
+#include "readahead.h"
+#include "writeback.h"
+
+
+/** Number of shards of the dentry and extent map caches. Must be a power of 2. */
+#define CACHE_SHARDS 16
+
+/**
+ * A slice of the dentry and extent map caches with its own lock. A name goes to
+ * the shard picked by its dentry cache hash, a file's extent map to the shard
+ * picked by its inode number, so lookups of unrelated names and files don't
+ * wait for each other even though every hit updates the LRU lists.
+ */
+typedef struct cache_shard {
+	/** Protects the two caches of the shard. */
+	pthread_mutex_t lock;
+	/** Cache of (parent directory, name) -> inode number lookups. */
+	dcache dcache;
+	/** Cache of the extent maps of recently used files. */
+	extmap extmap;
+
+} cache_shard;
 
 
 /**
  * Mounted file system runtime state - "fs context".
  */
 typedef struct fs_ctx {
-	/** Pointer to the start of the image. */
+	/** Pointer to the start of the image as metadata is read and changed
+	 * through it. In images with a journal, it is a private copy-on-write
+	 * view, so that metadata changes reach the image file only once the
+	 * journal has committed them; otherwise it is the same as shared. */
 	void *image;
+	/** The shared mapping of the image, through which file data is read and
+	 * written and the journal copies committed metadata in place. */
+	void *shared;
 	/** Image size in bytes. */
 	size_t size;
 	/** Command line options. */
 	a1fs_opts *opts;
 
+	/** The dentry and extent map caches. */
+	cache_shard caches[CACHE_SHARDS];
+
+	/** Buffered appends that have no blocks allocated yet (--delalloc). */
+	delalloc delalloc;
+	/** Index of the runs of free data blocks, built from the block bitmap. */
+	freemap freemap;
+	/** Allocation group descriptors, their number and size. Images formatted
+	 * without A1FS_FEATURE_GROUPS get a single group kept in single_group. */
+	a1fs_group_desc *groups;
+	uint32_t groups_count;
+	uint64_t blocks_per_group;
+	uint32_t inodes_per_group;
+	a1fs_group_desc single_group;
+
+	/** The reader/writer locks of the inodes in use. A directory's lock
+	 * protects its entries, a file's lock its data, size and extents. */
+	ilock_table inode_locks;
+	/** One counter per inode, bumped under the inode's lock whenever the
+	 * extents of the file change. Extent cursors cached in open file handles
+	 * are only valid while it stays the same. */
+	uint32_t *extent_gens;
+	/** Held by rename while it locks two directories, so that no other thread
+	 * ever holds the locks of two unrelated directories at once. */
+	pthread_mutex_t rename_lock;
+	/** Protects the block and inode bitmaps, the superblock counters, the group
+	 * descriptors, the free extent index and the delayed allocation buffers. */
+	pthread_mutex_t alloc_lock;
+
+	/** Journal of the metadata changes (A1FS_FEATURE_JOURNAL). */
+	journal journal;
+	/** Block layer that file data is read and written through. */
+	blockdev bdev;
+	/** Blocks changed in memory but not synced yet. In images with a journal,
+	 * only file data; the journal takes care of the metadata. */
+	writeback writeback;
+	/** Prefetches the data that reads through open files are likely to ask
+	 * for next. */
+	readahead readahead;
+
 	//TODO: useful runtime state of the mounted file system should be cached
 	// here (NOT in global variables in a1fs.c)
 
@@ -42,8 +119,11 @@ typedef struct fs_ctx {
 /**
  * Initialize file system context.
  *
+ * Replays the journal, if the image has one, before anything else looks at the
+ * metadata, then maps the view that metadata is changed through.
+ *
  * @param fs     pointer to the context to initialize.
- * @param image  pointer to the start of the image.
+ * @param image  pointer to the start of the image (a shared mapping).
  * @param size   image size in bytes.
  * @param opts   command line options.
  * @return       true on success; false on failure (e.g. invalid superblock).
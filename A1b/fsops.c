@@ -0,0 +1,3869 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs file system operations.
+ *
+ * The operations are shared by both drivers: a1fs.c (the high-level,
+ * path-based FUSE API) and a1fs_ll.c (the low-level, inode-based one). They
+ * take inode numbers, and names within a directory; only the few functions
+ * that the high-level driver needs to resolve paths look at whole paths.
+ */
+
+#include <errno.h>
+#include <linux/falloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Using 2.9.x FUSE API; for struct fuse_file_info and FUSE buffers
+#define FUSE_USE_VERSION 29
+#include <fuse_common.h>
+
+#include "a1fs.h"
+#include "bitmap.h"
+#include "blockdev.h"
+#include "dentry.h"
+#include "fs_ctx.h"
+#include "fsops.h"
+#include "journal.h"
+#include "mappolicy.h"
+#include "options.h"
+#include "map.h"
+#include "readahead.h"
+#include "util.h"
+#include "writeback.h"
+
+//NOTE: a1fs runs under the multithreaded FUSE loop. Every inode has a
+// reader/writer lock: a directory's lock protects its entries and a file's
+// lock its data, size and extents. Path walks only hold the lock of each
+// directory while looking up one name in it. The allocator state is behind
+// fs->alloc_lock and each shard of the caches behind its own lock; these are
+// taken last and never two at a time. Locks are taken in this order:
+//   1. fs->rename_lock (only by rename);
+//   2. directories, ancestors before descendants; two unrelated directories
+//      only under fs->rename_lock, the lower inode number first;
+//   3. the file being operated on;
+//   4. fs->alloc_lock or the lock of one cache shard.
+// Relieving delayed allocation memory pressure also locks other files, but
+// only with a try-lock that gives up instead of waiting.
+//
+//NOTE: every operation that changes metadata (the superblock, group
+// descriptors, bitmaps, inodes, directory and indirect blocks) runs as a
+// journal handle, started before taking any of the locks above, and marks
+// what it changes with meta_dirty(). Metadata goes through fs->image, which
+// in images with a journal is a private view that only commits reach the image
+// file from. File data is not journaled; it goes through fs->shared (see
+// file_block()), and writes to it are marked for writeback with
+// writeback_dirty().
+
+
+bool fsop_init(fs_ctx *fs, a1fs_opts *opts)
+{
+	// Nothing to initialize if only printing help or version
+	if (opts->help || opts->version) return true;
+
+	size_t size;
+	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size);
+	if (!image) return false;
+
+	return fs_ctx_init(fs, image, size, opts);
+}
+
+static void readahead_fetch(void *arg, a1fs_ino_t ino, uint64_t off, uint64_t len);
+
+void fsop_start(fs_ctx *fs)
+{
+	mappolicy_apply(fs->image, fs->shared, fs->size, fs->opts);
+	if (!journal_run(&fs->journal)) {
+		fprintf(stderr, "a1fs: failed to start the journal commit thread\n");
+	}
+	if (!writeback_run(&fs->writeback)) {
+		fprintf(stderr, "a1fs: failed to start the writeback thread\n");
+	}
+	if (!readahead_run(&fs->readahead, readahead_fetch, fs)) {
+		fprintf(stderr, "a1fs: failed to start the readahead thread\n");
+	}
+}
+
+static void file_flush_all(fs_ctx *fs);
+
+void fsop_destroy(fs_ctx *fs)
+{
+	if (fs->image) {
+		journal_start(&fs->journal);
+		file_flush_all(fs);
+		journal_stop(&fs->journal);
+		// Only the blocks that changed; the journal syncs the metadata.
+		if (fs->opts->sync) {
+			int ret = writeback_flush_all(&fs->writeback);
+			if (ret != 0) {
+				fprintf(stderr, "a1fs: writeback failed: %s\n", strerror(-ret));
+			}
+		}
+		if (fs->opts->verbose) {
+			uint64_t dc_hits = 0, dc_misses = 0, em_hits = 0, em_misses = 0;
+			for (int i = 0; i < CACHE_SHARDS; i++) {
+				dc_hits += fs->caches[i].dcache.hits;
+				dc_misses += fs->caches[i].dcache.misses;
+				em_hits += fs->caches[i].extmap.hits;
+				em_misses += fs->caches[i].extmap.misses;
+			}
+			fprintf(stderr, "dcache: %lu hits, %lu misses\n",
+			        (unsigned long)dc_hits, (unsigned long)dc_misses);
+			fprintf(stderr, "extmap: %lu hits, %lu misses\n",
+			        (unsigned long)em_hits, (unsigned long)em_misses);
+			const freemap_node *largest = freemap_largest(&fs->freemap);
+			fprintf(stderr, "freemap: %lu free blocks in %lu runs, largest run %lu\n",
+			        (unsigned long)fs->freemap.free_blocks, (unsigned long)fs->freemap.nruns,
+			        (largest != NULL) ? (unsigned long)largest->count : 0UL);
+			if (fs->opts->delalloc) {
+				fprintf(stderr, "delalloc: %lu flushes\n", (unsigned long)fs->delalloc.flushes);
+			}
+			if (fs->opts->pread) {
+				fprintf(stderr, "bcache: %lu hits, %lu misses, %lu blocks written\n",
+				        (unsigned long)fs->bdev.cache.hits, (unsigned long)fs->bdev.cache.misses,
+				        (unsigned long)fs->bdev.cache.writes);
+			}
+			fprintf(stderr, "writeback: %lu flushes, %lu blocks written\n",
+			        (unsigned long)fs->writeback.flushes, (unsigned long)fs->writeback.blocks_written);
+			const readahead *ra = &fs->readahead;
+			fprintf(stderr, "readahead: %lu reads, %lu hits (%.1f%%), %lu requests (%lu dropped), %lu KiB\n",
+			        (unsigned long)ra->reads, (unsigned long)ra->hits,
+			        (ra->reads > 0) ? 100.0 * ra->hits / ra->reads : 0.0,
+			        (unsigned long)ra->requests, (unsigned long)ra->dropped, (unsigned long)(ra->bytes >> 10));
+			if (fs->journal.span > 0) {
+				fprintf(stderr, "journal: %lu commits of %lu blocks, %lu checkpoints\n",
+				        (unsigned long)fs->journal.commits, (unsigned long)fs->journal.blocks_logged,
+				        (unsigned long)fs->journal.checkpoints);
+			}
+		}
+		fs_ctx_destroy(fs);
+		munmap(fs->shared, fs->size);
+	}
+}
+
+void fsop_statfs(fs_ctx *fs, struct statvfs *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->f_bsize   = A1FS_BLOCK_SIZE;
+	st->f_frsize  = A1FS_BLOCK_SIZE;
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	st->f_namemax = A1FS_NAME_MAX;
+	st->f_blocks = sb->size / A1FS_BLOCK_SIZE;
+	st->f_files = sb->inodes_count;
+	pthread_mutex_lock(&fs->alloc_lock);
+	st->f_bfree = sb->free_blocks_count - fs->delalloc.reserved;
+	st->f_ffree = sb->free_inodes_count;
+	pthread_mutex_unlock(&fs->alloc_lock);
+	st->f_bavail = st->f_bfree;
+	st->f_favail = st->f_ffree;
+}
+
+/**
+ * Set the bit at index in bm to the value value
+ * 
+ * @param bm		the bitmap
+ * @param index		the index of the bit
+ * @param value		the value to set the bit to
+ */
+void set_bm(unsigned char *bm, uint64_t index, char value){
+	if (value == 1){
+		bm[index / 8] |= 1 << (index % 8);
+	}
+	else {
+		bm[index / 8] &= ~(1 << (index % 8));
+	}
+}
+
+/**
+ * Get a pointer to the start of a block in the data region.
+ * 
+ * @param image		the disk image
+ * @param blk		the block index relative to the start of the data region
+ * @return			pointer to the block
+ */
+void *data_block(void *image, a1fs_blk_t blk){
+	a1fs_superblock *sb = (a1fs_superblock*)(image);
+	return image + (size_t)A1FS_BLOCK_SIZE * (sb->data_region + blk);
+}
+
+/**
+ * Get a pointer to a data block that holds file data. File data isn't
+ * journaled, so it goes through the shared mapping of the image rather than
+ * the metadata view.
+ *
+ * @param fs		the file system context
+ * @param blk		the block index relative to the start of the data region
+ * @return			pointer to the block
+ */
+static char *file_block(fs_ctx *fs, a1fs_blk_t blk){
+	return data_block(fs->shared, blk);
+}
+
+/** Check if files can have holes (A1FS_FEATURE_SPARSE). */
+static bool sparse_files(void *image){
+	return ((a1fs_superblock*)image)->features & A1FS_FEATURE_SPARSE;
+}
+
+/**
+ * Get a pointer to the i-th extent slot of an inode. Slots below A1FS_IND_BLOCK
+ * are stored in the inode itself, the rest are stored in the single indirect
+ * block, which must already be allocated.
+ * 
+ * @param image		the disk image
+ * @param inode		the inode
+ * @param i			the index of the extent slot
+ * @return			pointer to the extent
+ */
+a1fs_extent *get_extent(void *image, a1fs_inode *inode, int i){
+	if (i >= A1FS_IND_BLOCK){
+		a1fs_extent *indirect = (a1fs_extent*)data_block(image, (inode->extent)[A1FS_IND_BLOCK].start);
+		return indirect + (i - A1FS_IND_BLOCK);
+	}
+	return inode->extent + i;
+}
+
+/**
+ * Get the inode number of an inode in the inode table.
+ *
+ * @param image		the disk image
+ * @param inode		pointer to the inode inside the inode table
+ * @return			the inode number
+ */
+a1fs_ino_t inode_number(void *image, a1fs_inode *inode){
+	a1fs_superblock *sb = (a1fs_superblock*)(image);
+	a1fs_inode *inodes = (a1fs_inode*)(image + A1FS_BLOCK_SIZE * sb->inode_table);
+	return inode - inodes;
+}
+
+/**
+ * Get a pointer to the inode with the given number in the inode table.
+ *
+ * @param image		the disk image
+ * @param ino		the inode number
+ * @return			pointer to the inode
+ */
+a1fs_inode *inode_by_number(void *image, a1fs_ino_t ino){
+	a1fs_superblock *sb = (a1fs_superblock*)(image);
+	a1fs_inode *inodes = (a1fs_inode*)(image + A1FS_BLOCK_SIZE * sb->inode_table);
+	return inodes + ino;
+}
+
+/**
+ * Mark metadata in the image as changed: in the running journal transaction,
+ * or for writeback if the image has no journal.
+ *
+ * @param fs		the file system context
+ * @param ptr		the changed metadata
+ * @param len		its length in bytes
+ */
+static void meta_dirty(fs_ctx *fs, const void *ptr, size_t len){
+	if (fs->journal.span > 0){
+		journal_dirty(&fs->journal, ptr, len);
+	} else {
+		writeback_dirty(&fs->writeback, ptr, len);
+	}
+}
+
+/** Mark an inode as changed. */
+static void inode_dirty(fs_ctx *fs, a1fs_inode *inode){
+	meta_dirty(fs, inode, sizeof(a1fs_inode));
+}
+
+/** Mark the superblock and the descriptor of group g as changed. */
+static void group_dirty(fs_ctx *fs, uint32_t g){
+	meta_dirty(fs, fs->image, sizeof(a1fs_superblock));
+	// Images without groups keep their only descriptor in memory.
+	if (fs->groups != &fs->single_group){
+		meta_dirty(fs, &fs->groups[g], sizeof(a1fs_group_desc));
+	}
+}
+
+/** Mark count bits starting at bit start of a bitmap in the image as changed. */
+static void bitmap_dirty(fs_ctx *fs, unsigned char *bm, uint64_t start, uint64_t count){
+	meta_dirty(fs, bm + start / 8, (start + count - 1) / 8 - start / 8 + 1);
+}
+
+/**
+ * Lock an inode, shared for reading or exclusive for writing.
+ *
+ * @param fs		the file system context
+ * @param inode		the inode
+ * @param write		true to take the lock exclusively
+ */
+static void inode_lock(fs_ctx *fs, a1fs_inode *inode, bool write){
+	ilock_acquire(&fs->inode_locks, inode_number(fs->image, inode), write);
+}
+
+/**
+ * Lock an inode exclusively if that can be done without waiting. Unlike
+ * inode_lock(), it may be called out of the lock order.
+ *
+ * @param fs		the file system context
+ * @param ino		the inode number
+ * @return			true if the inode was locked
+ */
+static bool inode_trylock(fs_ctx *fs, a1fs_ino_t ino){
+	return ilock_try(&fs->inode_locks, ino, true);
+}
+
+/**
+ * Unlock an inode locked with inode_lock().
+ *
+ * @param fs		the file system context
+ * @param inode		the inode
+ */
+static void inode_unlock(fs_ctx *fs, a1fs_inode *inode){
+	ilock_release(&fs->inode_locks, inode_number(fs->image, inode));
+}
+
+/**
+ * Lock an inode given by number. The inode is checked once it is locked, since
+ * it may have been freed since its number was found. An orphan (removed, with
+ * no links left, but not freed yet) is still there.
+ * 
+ * @param fs		the file system context
+ * @param ino		the inode number
+ * @param inode		set to the inode
+ * @param write		true to lock the inode exclusively
+ * @return			0 on success, with the inode locked; -ENOENT if it has
+ * 					been freed
+ */
+static int inode_get_locked(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode **inode, bool write){
+	if (ino >= ((a1fs_superblock*)fs->image)->inodes_count){
+		return -ENOENT;
+	}
+	*inode = inode_by_number(fs->image, ino);
+	inode_lock(fs, *inode, write);
+	// free_inode() clears the whole inode, and every inode in use has a type.
+	if ((*inode)->mode == 0){
+		inode_unlock(fs, *inode);
+		return -ENOENT;
+	}
+	return 0;
+}
+
+/**
+ * Get the cache shard that holds the cached lookup of a name in a directory.
+ * 
+ * @param fs		the file system context
+ * @param parent	the inode number of the directory
+ * @param name		the name (not necessarily null-terminated)
+ * @param len		the length of the name
+ * @return			the shard
+ */
+static cache_shard *dcache_shard(fs_ctx *fs, a1fs_ino_t parent, const char *name, size_t len){
+	// The low bits of the hash pick the bucket within the shard.
+	return &fs->caches[(dcache_hash(parent, name, len) >> 16) & (CACHE_SHARDS - 1)];
+}
+
+/**
+ * Get the cache shard that holds the cached extent map of a file.
+ * 
+ * @param fs		the file system context
+ * @param ino		the inode number of the file
+ * @return			the shard
+ */
+static cache_shard *extmap_shard(fs_ctx *fs, a1fs_ino_t ino){
+	return &fs->caches[ino & (CACHE_SHARDS - 1)];
+}
+
+/** A position in the extents of a file, which are walked in file order. */
+typedef struct extent_cursor {
+	/** The extent slot (as for get_extent()); -1 before the first extent. */
+	int slot;
+	/** The extent in that slot; NULL past the last extent. */
+	a1fs_extent *extent;
+	/** Number of non-empty extents up to and including this one. */
+	int seen;
+	/** The block within the extent. */
+	a1fs_blk_t off;
+} extent_cursor;
+
+/**
+ * Move a cursor to the first block of the next non-empty extent.
+ * 
+ * @param image		the disk image
+ * @param inode		the file
+ * @param cur		the cursor
+ * @return			the next extent; NULL if there are no more extents
+ */
+a1fs_extent *extent_next(void *image, a1fs_inode *inode, extent_cursor *cur){
+	cur->extent = NULL;
+	cur->off = 0;
+	while (cur->seen < (int)inode->extents && ++cur->slot < A1FS_IND_BLOCK + A1FS_NUM_EXTENTS){
+		a1fs_extent *extent = get_extent(image, inode, cur->slot);
+		if (extent->count > 0){
+			cur->seen++;
+			cur->extent = extent;
+			break;
+		}
+	}
+	return cur->extent;
+}
+
+/**
+ * Get the extent map of a regular file, building it from the extents of the
+ * inode and caching it in fs if it is not cached yet. The extents of a file
+ * occupy the slots [0, inode->extents) in file order, so the index of an
+ * extent in the map is also its slot.
+ * 
+ * The caller must hold the lock of the file's cache shard.
+ * 
+ * @param fs		the file system context
+ * @param c			the file's cache shard (see extmap_shard())
+ * @param inode		the file
+ * @return			the map; NULL if out of memory
+ */
+static extmap_entry *file_extmap(fs_ctx *fs, cache_shard *c, a1fs_inode *inode){
+	a1fs_ino_t ino = inode_number(fs->image, inode);
+	extmap_entry *e = extmap_lookup(&c->extmap, ino);
+	if (e != NULL){
+		return e;
+	}
+
+	e = extmap_insert(&c->extmap, ino);
+	if (e != NULL){
+		for (int i = 0; i < inode->extents; i++){
+			extmap_set(e, i, get_extent(fs->image, inode, i)->count);
+		}
+	}
+	return e;
+}
+
+/**
+ * Mark the extents of a file as changed: the inode, and the indirect block if
+ * the file has one. Cursors cached in open file handles are invalidated.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ */
+static void file_extents_dirty(fs_ctx *fs, a1fs_inode *inode){
+	fs->extent_gens[inode_number(fs->image, inode)]++;
+	inode_dirty(fs, inode);
+	if ((inode->extent)[A1FS_IND_BLOCK].count > 0){
+		meta_dirty(fs, data_block(fs->image, (inode->extent)[A1FS_IND_BLOCK].start), A1FS_BLOCK_SIZE);
+	}
+}
+
+/**
+ * Bring the cached extent map of a file (if any) up to date after its extents
+ * from index first onwards have changed, and mark the extents as changed in
+ * the journal.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param first		the index of the first extent that changed
+ */
+static void file_extmap_sync(fs_ctx *fs, a1fs_inode *inode, int first){
+	file_extents_dirty(fs, inode);
+	a1fs_ino_t ino = inode_number(fs->image, inode);
+	cache_shard *c = extmap_shard(fs, ino);
+	pthread_mutex_lock(&c->lock);
+	extmap_entry *e = extmap_peek(&c->extmap, ino);
+	if (e == NULL || inode->extents == 0){
+		if (e != NULL){
+			extmap_set(e, 0, 0);
+		}
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+
+	int i = first;
+	if (i > (int)e->count){
+		i = e->count;
+	}
+	if (i > inode->extents - 1){
+		i = inode->extents - 1;
+	}
+	for (; i < inode->extents; i++){
+		extmap_set(e, i, get_extent(fs->image, inode, i)->count);
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+/**
+ * Translate a block number within a file into the extent that holds it, by a
+ * binary search of the file's extent map. If the map can't be allocated, the
+ * extent headers are walked instead.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param blk		the block number within the file
+ * @param cur		receives the position of the block
+ * @return			the extent; NULL if blk is past the last allocated block
+ */
+a1fs_extent *extent_seek(fs_ctx *fs, a1fs_inode *inode, uint64_t blk, extent_cursor *cur){
+	cache_shard *c = extmap_shard(fs, inode_number(fs->image, inode));
+	pthread_mutex_lock(&c->lock);
+	extmap_entry *e = file_extmap(fs, c, inode);
+	if (e != NULL){
+		uint64_t off;
+		int i = extmap_find(e, blk, &off);
+		pthread_mutex_unlock(&c->lock);
+		cur->slot = (i >= 0) ? i : (int)inode->extents;
+		cur->seen = cur->slot + (i >= 0);
+		cur->extent = (i >= 0) ? get_extent(fs->image, inode, i) : NULL;
+		cur->off = (i >= 0) ? off : 0;
+		return cur->extent;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	cur->slot = -1;
+	cur->seen = 0;
+	while (extent_next(fs->image, inode, cur) != NULL){
+		if (blk < cur->extent->count){
+			cur->off = blk;
+			break;
+		}
+		blk -= cur->extent->count;
+	}
+	return cur->extent;
+}
+
+/**
+ * Count the blocks held by a file. That is the number of blocks needed to hold
+ * its size, plus any blocks preallocated past the end of file by fallocate().
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @return			the number of blocks
+ */
+static uint64_t file_blocks(fs_ctx *fs, a1fs_inode *inode){
+	cache_shard *c = extmap_shard(fs, inode_number(fs->image, inode));
+	pthread_mutex_lock(&c->lock);
+	extmap_entry *e = file_extmap(fs, c, inode);
+	uint64_t count = (e != NULL) ? extmap_blocks(e) : 0;
+	pthread_mutex_unlock(&c->lock);
+	if (e != NULL){
+		return count;
+	}
+	for (int i = 0; i < inode->extents; i++){
+		count += get_extent(fs->image, inode, i)->count;
+	}
+	return count;
+}
+
+/**
+ * Copy between a buffer and a file's blocks, starting at a cursor, a whole run
+ * of contiguous blocks at a time. The cursor is advanced past the copied data.
+ * Written blocks are marked for writeback.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param cur		the position of the first block
+ * @param in_block	the offset into the first block; updated like cur
+ * @param dst		if not NULL, receives the data read from the file
+ * @param src		if dst is NULL, the data written to the file; NULL for zeros
+ * @param size		the number of bytes to copy
+ * @return			the number of bytes copied; less than size only if the end
+ * 					of the allocated blocks was reached or on an I/O error
+ */
+static size_t extent_copy(fs_ctx *fs, a1fs_inode *inode, extent_cursor *cur, size_t *in_block,
+                          char *dst, const char *src, size_t size){
+	size_t byte_count = 0;
+	while (byte_count < size && cur->extent != NULL){
+		size_t pos = (size_t)cur->off * A1FS_BLOCK_SIZE + *in_block;
+		size_t run = (size_t)cur->extent->count * A1FS_BLOCK_SIZE - pos;
+		if (run > size - byte_count){
+			run = size - byte_count;
+		}
+
+		// Holes read as zeros without touching the image. Callers only write
+		// zeros into them, so there is nothing to store.
+		if (cur->extent->start == A1FS_HOLE){
+			if (dst != NULL){
+				memset(dst + byte_count, 0, run);
+			}
+		} else {
+			char *data = file_block(fs, cur->extent->start + cur->off) + *in_block;
+			uint64_t at = data - (char*)fs->shared;
+			int ret;
+			if (dst != NULL){
+				ret = blockdev_read(&fs->bdev, at, dst + byte_count, run);
+			} else {
+				ret = blockdev_write(&fs->bdev, at, (src != NULL) ? src + byte_count : NULL, run);
+				writeback_dirty(&fs->writeback, data, run);
+			}
+			if (ret != 0){
+				fprintf(stderr, "a1fs: I/O error at block %lu: %s\n", (unsigned long)(at / A1FS_BLOCK_SIZE), strerror(-ret));
+				break;
+			}
+		}
+		byte_count += run;
+
+		pos += run;
+		if (pos == (size_t)cur->extent->count * A1FS_BLOCK_SIZE){
+			extent_next(fs->image, inode, cur);
+			*in_block = 0;
+		} else {
+			cur->off = pos / A1FS_BLOCK_SIZE;
+			*in_block = pos % A1FS_BLOCK_SIZE;
+		}
+	}
+	return byte_count;
+}
+
+/**
+ * Ask the kernel to read ahead the blocks that a read is about to copy from a
+ * file, a whole run of contiguous blocks at a time, so that the copy doesn't
+ * stop to fault in every page.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param cur		the position of the first block (a copy; not advanced)
+ * @param in_block	the offset into the first block
+ * @param size		the number of bytes to be read
+ */
+static void extent_prefetch(fs_ctx *fs, a1fs_inode *inode, extent_cursor cur, size_t in_block, size_t size){
+	size_t byte_count = 0;
+	while (byte_count < size && cur.extent != NULL){
+		size_t run = (size_t)(cur.extent->count - cur.off) * A1FS_BLOCK_SIZE - in_block;
+		if (run > size - byte_count){
+			run = size - byte_count;
+		}
+		if (cur.extent->start != A1FS_HOLE){
+			mappolicy_willneed(file_block(fs, cur.extent->start + cur.off) + in_block, run);
+		}
+		byte_count += run;
+		extent_next(fs->image, inode, &cur);
+		in_block = 0;
+	}
+}
+
+/**
+ * Prefetch a range of a file for the readahead thread. The file may have been
+ * truncated, removed or even replaced by a directory since the read that asked
+ * for it, so only what is still file data is prefetched.
+ * 
+ * @param arg		the file system context
+ * @param ino		the inode number of the file
+ * @param off		the offset of the range
+ * @param len		the length of the range
+ */
+static void readahead_fetch(void *arg, a1fs_ino_t ino, uint64_t off, uint64_t len){
+	fs_ctx *fs = (fs_ctx*)arg;
+	a1fs_inode *inode = inode_by_number(fs->image, ino);
+	inode_lock(fs, inode, false);
+	if (S_ISREG(inode->mode) && off < inode->size){
+		if (len > inode->size - off){
+			len = inode->size - off;
+		}
+		extent_cursor cur;
+		extent_seek(fs, inode, off / A1FS_BLOCK_SIZE, &cur);
+		extent_prefetch(fs, inode, cur, off % A1FS_BLOCK_SIZE, len);
+	}
+	inode_unlock(fs, inode);
+}
+
+/** Read from a file's blocks at a cursor; see extent_copy(). */
+size_t extent_read(fs_ctx *fs, a1fs_inode *inode, extent_cursor *cur, size_t *in_block, char *buf, size_t size){
+	return extent_copy(fs, inode, cur, in_block, buf, NULL, size);
+}
+
+/** Write to a file's blocks at a cursor (zeros if buf is NULL); see extent_copy(). */
+size_t extent_write(fs_ctx *fs, a1fs_inode *inode, extent_cursor *cur, size_t *in_block, const char *buf, size_t size){
+	return extent_copy(fs, inode, cur, in_block, NULL, buf, size);
+}
+
+/** Zeros that holes and unwritten blocks are mapped to by extent_map(). */
+static const char zero_run[16 * A1FS_BLOCK_SIZE];
+
+/**
+ * Append a range of memory to an I/O vector, extending the last entry if the
+ * range follows on from it.
+ * 
+ * @param iov		the I/O vector, of FSOP_IOV_MAX entries
+ * @param count		the number of entries in use; updated
+ * @param data		the memory; NULL for zeros
+ * @param len		the number of bytes
+ * @return			true on success; false if the vector is full
+ */
+static bool iov_append(struct iovec *iov, int *count, const char *data, size_t len){
+	while (len > 0){
+		size_t n = len;
+		if (data == NULL && n > sizeof(zero_run)){
+			n = sizeof(zero_run);
+		}
+		if (data != NULL && *count > 0 &&
+		    (const char*)iov[*count - 1].iov_base + iov[*count - 1].iov_len == data){
+			iov[*count - 1].iov_len += n;
+		} else {
+			if (*count == FSOP_IOV_MAX){
+				return false;
+			}
+			iov[*count].iov_base = (void*)((data != NULL) ? data : zero_run);
+			iov[*count].iov_len = n;
+			(*count)++;
+		}
+		if (data != NULL){
+			data += n;
+		}
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Map a range of a file's blocks to where they are in the image, starting at a
+ * cursor, a whole run of contiguous blocks at a time. Holes map to zeros. The
+ * cursor is advanced past the mapped data. Only for the memory mapped backend.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param cur		the position of the first block
+ * @param in_block	the offset into the first block; updated like cur
+ * @param size		the number of bytes to map
+ * @param iov		receives the mapping, of FSOP_IOV_MAX entries
+ * @param count		the number of entries in use; updated
+ * @return			the number of bytes mapped; less than size if the end of
+ * 					the allocated blocks was reached or iov is full
+ */
+static size_t extent_map(fs_ctx *fs, a1fs_inode *inode, extent_cursor *cur, size_t *in_block,
+                         size_t size, struct iovec *iov, int *count){
+	size_t byte_count = 0;
+	while (byte_count < size && cur->extent != NULL){
+		size_t pos = (size_t)cur->off * A1FS_BLOCK_SIZE + *in_block;
+		size_t run = (size_t)cur->extent->count * A1FS_BLOCK_SIZE - pos;
+		if (run > size - byte_count){
+			run = size - byte_count;
+		}
+
+		const char *data = NULL;
+		if (cur->extent->start != A1FS_HOLE){
+			data = file_block(fs, cur->extent->start + cur->off) + *in_block;
+		}
+		if (!iov_append(iov, count, data, run)){
+			break;
+		}
+		byte_count += run;
+
+		pos += run;
+		if (pos == (size_t)cur->extent->count * A1FS_BLOCK_SIZE){
+			extent_next(fs->image, inode, cur);
+			*in_block = 0;
+		} else {
+			cur->off = pos / A1FS_BLOCK_SIZE;
+			*in_block = pos % A1FS_BLOCK_SIZE;
+		}
+	}
+	return byte_count;
+}
+
+/**
+ * Copy data from a FUSE buffer (e.g. a pipe) straight into a file's blocks,
+ * starting at a cursor, a whole run of contiguous blocks at a time. The cursor
+ * is advanced past the copied data, and the buffer past the data taken from
+ * it. Written blocks are marked for writeback. Only for the memory mapped
+ * backend; the range must not have holes.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param cur		the position of the first block
+ * @param in_block	the offset into the first block; updated like cur
+ * @param src		the data
+ * @param size		the number of bytes to copy
+ * @return			the number of bytes copied; less than size only if the end
+ * 					of the allocated blocks was reached or on an I/O error
+ */
+static size_t extent_splice(fs_ctx *fs, a1fs_inode *inode, extent_cursor *cur, size_t *in_block,
+                            struct fuse_bufvec *src, size_t size){
+	size_t byte_count = 0;
+	while (byte_count < size && cur->extent != NULL && cur->extent->start != A1FS_HOLE){
+		size_t pos = (size_t)cur->off * A1FS_BLOCK_SIZE + *in_block;
+		size_t run = (size_t)cur->extent->count * A1FS_BLOCK_SIZE - pos;
+		if (run > size - byte_count){
+			run = size - byte_count;
+		}
+
+		char *data = file_block(fs, cur->extent->start + cur->off) + *in_block;
+		struct fuse_bufvec dst = FUSE_BUFVEC_INIT(run);
+		dst.buf[0].mem = data;
+		ssize_t ret = fuse_buf_copy(&dst, src, 0);
+		if (ret > 0){
+			writeback_dirty(&fs->writeback, data, ret);
+		}
+		if (ret != (ssize_t)run){
+			fprintf(stderr, "a1fs: I/O error at block %lu: %s\n",
+			        (unsigned long)((data - (char*)fs->shared) / A1FS_BLOCK_SIZE),
+			        (ret < 0) ? strerror(-ret) : "short copy");
+			break;
+		}
+		byte_count += run;
+
+		pos += run;
+		if (pos == (size_t)cur->extent->count * A1FS_BLOCK_SIZE){
+			extent_next(fs->image, inode, cur);
+			*in_block = 0;
+		} else {
+			cur->off = pos / A1FS_BLOCK_SIZE;
+			*in_block = pos % A1FS_BLOCK_SIZE;
+		}
+	}
+	return byte_count;
+}
+
+
+/** State of an open file or directory, kept in fi->fh. */
+typedef struct a1fs_handle {
+	/** Inode number, resolved from the path once when it was opened. */
+	a1fs_ino_t ino;
+
+	/** Protects the cached position; reads share the file's lock. */
+	pthread_mutex_t lock;
+	/** Where the last read or write through the handle ended: the offset in
+	 * the file and the cursor at it. Valid while cached is set and the extent
+	 * generation of the file is still gen. */
+	bool cached;
+	uint64_t pos;
+	extent_cursor cur;
+	uint32_t gen;
+
+	/** Recent reads through the handle and what was prefetched for them. */
+	ra_state ra;
+} a1fs_handle;
+
+/**
+ * Allocate the state of a newly opened file or directory and store it in
+ * fi->fh.
+ * 
+ * @param fi		the FUSE file info
+ * @param ino		the inode number of the file
+ * @return			0 on success; -ENOMEM if out of memory
+ */
+static int handle_open(struct fuse_file_info *fi, a1fs_ino_t ino){
+	a1fs_handle *handle = malloc(sizeof(a1fs_handle));
+	if (handle == NULL){
+		return -ENOMEM;
+	}
+	handle->ino = ino;
+	pthread_mutex_init(&handle->lock, NULL);
+	handle->cached = false;
+	ra_state_init(&handle->ra);
+	fi->fh = (uint64_t)(uintptr_t)handle;
+	return 0;
+}
+
+/** Get the state of an open file or directory. */
+static a1fs_handle *handle_get(struct fuse_file_info *fi){
+	return (a1fs_handle*)(uintptr_t)fi->fh;
+}
+
+/** Free the state of a file or directory that is being closed. */
+static void handle_close(struct fuse_file_info *fi){
+	a1fs_handle *handle = handle_get(fi);
+	if (handle != NULL){
+		ra_state_destroy(&handle->ra);
+		pthread_mutex_destroy(&handle->lock);
+		free(handle);
+		fi->fh = 0;
+	}
+}
+
+/**
+ * Lock the file or directory open through a handle. It stays linked while it
+ * is open, since the high-level FUSE API hides removed files that are still
+ * open instead of removing them, and the low-level driver keeps them until
+ * the kernel forgets them, but it is checked anyway.
+ * 
+ * @param fs		the file system context
+ * @param handle	the handle
+ * @param inode		receives the inode
+ * @param write		true for exclusive (write) access
+ * @return			0 on success; -ENOENT if it has been removed
+ */
+static int handle_lock(fs_ctx *fs, a1fs_handle *handle, a1fs_inode **inode, bool write){
+	return inode_get_locked(fs, handle->ino, inode, write);
+}
+
+/**
+ * Let the running journal transaction commit between two steps of an
+ * operation that is split across transactions (see journal_due()): unlock the
+ * file, finish the journal handle, start a new one and lock the file again.
+ * 
+ * @param fs		the file system context
+ * @param ino		the inode number of the file
+ * @param inode		the file, locked for writing; set to it again
+ * @return			0 on success; -ENOENT if the file has been freed in the
+ * 					meantime, in which case it is left unlocked
+ */
+static int file_restart(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode **inode){
+	inode_unlock(fs, *inode);
+	journal_stop(&fs->journal);
+	journal_start(&fs->journal);
+	return inode_get_locked(fs, ino, inode, true);
+}
+
+/**
+ * Position a cursor at an offset in a file for I/O through a handle. An I/O
+ * that starts where the last one through the handle ended picks up its cursor,
+ * unless the extents of the file have changed since; anything else seeks.
+ * Called with the file locked.
+ * 
+ * @param fs		the file system context
+ * @param handle	the handle; NULL to always seek
+ * @param inode		the file
+ * @param pos		the offset in the file
+ * @param cur		receives the position of the block holding pos
+ */
+static void handle_seek(fs_ctx *fs, a1fs_handle *handle, a1fs_inode *inode, uint64_t pos, extent_cursor *cur){
+	if (handle != NULL){
+		pthread_mutex_lock(&handle->lock);
+		bool hit = handle->cached && handle->pos == pos &&
+		           handle->gen == fs->extent_gens[handle->ino];
+		if (hit){
+			*cur = handle->cur;
+		}
+		pthread_mutex_unlock(&handle->lock);
+		if (hit){
+			return;
+		}
+	}
+	extent_seek(fs, inode, pos / A1FS_BLOCK_SIZE, cur);
+}
+
+/**
+ * Remember where an I/O through a handle ended, for the next one to pick up.
+ * Called with the file locked.
+ * 
+ * @param fs		the file system context
+ * @param handle	the handle; NULL to do nothing
+ * @param pos		the offset in the file where the I/O ended
+ * @param cur		the cursor at pos
+ */
+static void handle_save(fs_ctx *fs, a1fs_handle *handle, uint64_t pos, const extent_cursor *cur){
+	if (handle == NULL){
+		return;
+	}
+	pthread_mutex_lock(&handle->lock);
+	handle->cached = (cur->extent != NULL);
+	handle->pos = pos;
+	handle->cur = *cur;
+	handle->gen = fs->extent_gens[handle->ino];
+	pthread_mutex_unlock(&handle->lock);
+}
+
+
+/** Check whether the directories in the file system use a1fs_dirent records. */
+static bool compact_dentries(void *image){
+	return ((a1fs_superblock*)image)->features & A1FS_FEATURE_COMPACT_DENTRY;
+}
+
+/** Maximum depth of a directory index tree. */
+#define DX_MAX_DEPTH 4
+
+/** A step on the path from the root of a directory index down to a leaf. */
+typedef struct dx_frame {
+	/** The index node block. */
+	a1fs_blk_t blk;
+	/** The position of the entry that was followed. */
+	int pos;
+} dx_frame;
+
+/**
+ * Find the last entry in an index node whose hash is <= hash. The first entry
+ * of a node always covers the lowest hashes that can reach the node.
+ */
+static int dx_search(a1fs_dx_node *node, uint32_t hash){
+	int lo = 1;
+	int hi = node->count - 1;
+	int pos = 0;
+	while (lo <= hi){
+		int mid = lo + (hi - lo) / 2;
+		if ((node->entries)[mid].hash <= hash){
+			pos = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return pos;
+}
+
+/**
+ * Descend a directory index from the root to the leaf that covers hash.
+ * 
+ * @param image		the disk image
+ * @param dir		an indexed directory
+ * @param hash		the name hash
+ * @param frames	if not NULL, receives the path from the root (DX_MAX_DEPTH entries)
+ * @param depth		if not NULL, receives the number of index levels
+ * @return			the leaf dentry block
+ */
+static a1fs_blk_t dx_find_leaf(void *image, a1fs_inode *dir, uint32_t hash, dx_frame *frames, int *depth){
+	a1fs_blk_t blk = dir->dx_root;
+	for (int d = 0; ; d++){
+		a1fs_dx_node *node = (a1fs_dx_node*)data_block(image, blk);
+		int pos = dx_search(node, hash);
+		if (frames != NULL){
+			frames[d].blk = blk;
+			frames[d].pos = pos;
+		}
+		if (node->level == 0 || d + 1 == DX_MAX_DEPTH){
+			if (depth != NULL){
+				*depth = d + 1;
+			}
+			return (node->entries)[pos].block;
+		}
+		blk = (node->entries)[pos].block;
+	}
+}
+
+/**
+ * Scan the directory dir for the entry with the given name. Every block of the
+ * directory is visited at most once; for an indexed directory only the index
+ * path and the single leaf that covers the name's hash are read. While
+ * scanning, the first unused entry is remembered so that callers that insert a
+ * new entry do not need a second pass.
+ * 
+ * @param image		the disk image
+ * @param dir		the directory to scan
+ * @param name		the name to look for (not necessarily null-terminated)
+ * @param len		the length of the name
+ * @param free_slot	if not NULL, set to the first place seen during the scan
+ * 					that can hold an entry for name, or NULL if there was none
+ * @return			the matching entry; NULL if there is no such entry
+ */
+void *dir_scan(void *image, a1fs_inode *dir, const char *name, size_t len, void **free_slot){
+	bool compact = compact_dentries(image);
+	uint32_t hash = a1fs_name_hash(name, len);
+	if (free_slot != NULL){
+		*free_slot = NULL;
+	}
+
+	if (dir->flags & A1FS_INODE_INDEXED){
+		a1fs_blk_t leaf = dx_find_leaf(image, dir, hash, NULL, NULL);
+		return dblk_find(data_block(image, leaf), compact, name, len, hash, free_slot);
+	}
+
+	int extents_count = 0;
+	for (int i = 0; extents_count < dir->extents && i < A1FS_IND_BLOCK + A1FS_NUM_EXTENTS; i++){
+		a1fs_extent *curr_extent = get_extent(image, dir, i);
+		if (curr_extent->count == 0){
+			continue;
+		}
+		extents_count++;
+
+		// Loop through this entire extent (depending on extent length).
+		for (a1fs_blk_t j = 0; j < curr_extent->count; j++){
+			void *entry = dblk_find(data_block(image, curr_extent->start + j), compact, name, len, hash, free_slot);
+			if (entry != NULL){
+				return entry;
+			}
+		}
+	}
+	return NULL;
+}
+
+/** Callback for dir_for_each_block(); a non-zero return value stops the walk. */
+typedef int (*dentry_block_fn)(void *block, void *arg);
+
+/** Call fn for every leaf under the index node blk at the given depth. */
+static int dx_for_each_leaf(void *image, a1fs_blk_t blk, int depth, dentry_block_fn fn, void *arg){
+	a1fs_dx_node *node = (a1fs_dx_node*)data_block(image, blk);
+	for (int i = 0; i < node->count; i++){
+		a1fs_blk_t child = (node->entries)[i].block;
+		int ret;
+		if (node->level == 0 || depth + 1 == DX_MAX_DEPTH){
+			ret = fn(data_block(image, child), arg);
+		} else {
+			ret = dx_for_each_leaf(image, child, depth + 1, fn, arg);
+		}
+		if (ret != 0){
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Call fn for every dentry block of a directory until it returns non-zero.
+ * For an indexed directory only the leaves are visited, not the index nodes.
+ * 
+ * @param image		the disk image
+ * @param dir		the directory
+ * @param fn		the callback, given a dentry block and arg
+ * @param arg		passed through to fn
+ * @return			0 if all blocks were visited; otherwise the value returned by fn
+ */
+int dir_for_each_block(void *image, a1fs_inode *dir, dentry_block_fn fn, void *arg){
+	if (dir->flags & A1FS_INODE_INDEXED){
+		return dx_for_each_leaf(image, dir->dx_root, 0, fn, arg);
+	}
+
+	int extents_count = 0;
+	for (int i = 0; extents_count < dir->extents && i < A1FS_IND_BLOCK + A1FS_NUM_EXTENTS; i++){
+		a1fs_extent *curr_extent = get_extent(image, dir, i);
+		if (curr_extent->count == 0){
+			continue;
+		}
+		extents_count++;
+		for (a1fs_blk_t j = 0; j < curr_extent->count; j++){
+			int ret = fn(data_block(image, curr_extent->start + j), arg);
+			if (ret != 0){
+				return ret;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Find the inode given by name inside the directory dir. The dentry cache is
+ * checked first; the directory is only scanned on a cache miss, and the result
+ * is then added to the cache. Takes the directory's lock for reading.
+ * 
+ * @param fs		the file system context
+ * @param dir		the directory that should contain the entry
+ * @param name		the name of the entry (not necessarily null-terminated)
+ * @param len		the length of the name
+ * @param file		set to the inode of the entry on success
+ * @return			0 on success; -ENOENT if there is no such entry
+ */
+int dir_lookup(fs_ctx *fs, a1fs_inode *dir, const char *name, size_t len, a1fs_inode **file){
+	a1fs_ino_t dir_ino = inode_number(fs->image, dir);
+	a1fs_ino_t ino;
+	cache_shard *c = dcache_shard(fs, dir_ino, name, len);
+	inode_lock(fs, dir, false);
+	pthread_mutex_lock(&c->lock);
+	bool hit = dcache_lookup(&c->dcache, dir_ino, name, len, &ino);
+	pthread_mutex_unlock(&c->lock);
+	if (!hit){
+		void *entry = dir_scan(fs->image, dir, name, len, NULL);
+		if (entry == NULL){
+			inode_unlock(fs, dir);
+			return -ENOENT;
+		}
+		// Still under the directory's lock, so the entry can't go stale first.
+		ino = dentry_ino(entry, compact_dentries(fs->image));
+		pthread_mutex_lock(&c->lock);
+		dcache_insert(&c->dcache, dir_ino, name, len, ino);
+		pthread_mutex_unlock(&c->lock);
+	}
+	inode_unlock(fs, dir);
+	*file = inode_by_number(fs->image, ino);
+	return 0;
+}
+
+/**
+ * Walk all the components of path except for the last one. The path is
+ * tokenized in place in a single pass; nothing is copied.
+ * 
+ * @param fs		the file system context
+ * @param path		an absolute path
+ * @param parent	set to the directory containing the last component
+ * @param name		set to point to the last component inside path
+ * @param len		set to the length of the last component; 0 for "/"
+ * @return			0 on success; -ENOENT, -ENOTDIR or -ENAMETOOLONG on error
+ */
+static int walk_parent(fs_ctx *fs, const char *path, a1fs_inode **parent, const char **name, size_t *len){
+	a1fs_inode *dir = inode_by_number(fs->image, A1FS_ROOT_INO);
+	const char *p = path;
+	while (*p == '/'){
+		p++;
+	}
+
+	while (1){
+		const char *end = p;
+		while (*end != '\0' && *end != '/'){
+			end++;
+		}
+		size_t n = end - p;
+		if (n >= A1FS_NAME_MAX){
+			return -ENAMETOOLONG;
+		}
+		const char *next = end;
+		while (*next == '/'){
+			next++;
+		}
+
+		// This is the last component of the path.
+		if (*next == '\0'){
+			*parent = dir;
+			*name = p;
+			*len = n;
+			return 0;
+		}
+
+		// This is an intermediate directory in the path.
+		a1fs_inode *child;
+		int ret = dir_lookup(fs, dir, p, n, &child);
+		if (ret != 0){
+			return ret;
+		}
+		if (!S_ISDIR(child->mode)){
+			return -ENOTDIR;
+		}
+		dir = child;
+		p = next;
+	}
+}
+
+/**
+ * Find the inode given by path. Modifies file by setting it to the inode
+ * given by path.
+ * 
+ * @param fs		the file system context
+ * @param file		the inode struct to be modified
+ * @param path		the path of the inode
+ * @return 			0 on success; -errno on failure
+ */
+int inode_from_path(fs_ctx *fs, a1fs_inode **file, const char *path){
+	a1fs_inode *parent;
+	const char *name;
+	size_t len;
+	int ret = walk_parent(fs, path, &parent, &name, &len);
+	if (ret != 0){
+		return ret;
+	}
+	if (len == 0){
+		*file = parent;
+		return 0;
+	}
+	return dir_lookup(fs, parent, name, len, file);
+}
+
+int fsop_walk(fs_ctx *fs, const char *path, a1fs_ino_t *dir, const char **name, size_t *len){
+	a1fs_inode *parent;
+	int ret = walk_parent(fs, path, &parent, name, len);
+	if (ret == 0){
+		*dir = inode_number(fs->image, parent);
+	}
+	return ret;
+}
+
+int fsop_path_lookup(fs_ctx *fs, const char *path, a1fs_ino_t *ino){
+	a1fs_inode *file;
+	int ret = inode_from_path(fs, &file, path);
+	if (ret == 0){
+		*ino = inode_number(fs->image, file);
+	}
+	return ret;
+}
+
+int fsop_lookup(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, a1fs_ino_t *ino){
+	if (len >= A1FS_NAME_MAX){
+		return -ENAMETOOLONG;
+	}
+	a1fs_inode *parent = inode_by_number(fs->image, dir);
+	if (!S_ISDIR(parent->mode)){
+		return -ENOTDIR;
+	}
+	a1fs_inode *file;
+	int ret = dir_lookup(fs, parent, name, len, &file);
+	if (ret == 0){
+		*ino = inode_number(fs->image, file);
+	}
+	return ret;
+}
+
+/** Result of resolving a name for a namespace operation. */
+typedef struct a1fs_lookup {
+	/** The directory containing the name. */
+	a1fs_inode *parent;
+	/** The inode the name refers to; NULL if it doesn't exist. */
+	a1fs_inode *inode;
+	/** The directory entry of the name; NULL if it doesn't exist. */
+	void *dentry;
+	/** A place in the parent for a new entry; NULL if the parent is full. */
+	void *free_slot;
+	/** The name (the last path component; not null-terminated) and its length. */
+	const char *name;
+	size_t len;
+} a1fs_lookup;
+
+/**
+ * Find the parent directory for a namespace operation, without looking at the
+ * last path component yet (see path_scan()).
+ * 
+ * @param fs		the file system context
+ * @param path		an absolute path
+ * @param lookup	receives the parent and the last component
+ * @return			0 on success; -errno if a component of the path prefix
+ * 					can't be resolved
+ */
+static int path_walk(fs_ctx *fs, const char *path, a1fs_lookup *lookup){
+	int ret = walk_parent(fs, path, &lookup->parent, &lookup->name, &lookup->len);
+	lookup->inode = (ret == 0 && lookup->len == 0) ? lookup->parent : NULL;
+	lookup->dentry = NULL;
+	lookup->free_slot = NULL;
+	return ret;
+}
+
+/**
+ * Scan the parent directory found by path_walk() once, filling in both the
+ * entry for the last component (if it exists) and a free slot for it in the
+ * parent (if the entry doesn't exist). The caller must hold the parent's lock.
+ * 
+ * @param fs		the file system context
+ * @param lookup	the parent and the last component, as set by path_walk()
+ */
+static void path_scan(fs_ctx *fs, a1fs_lookup *lookup){
+	if (lookup->len == 0){
+		return;
+	}
+	lookup->dentry = dir_scan(fs->image, lookup->parent, lookup->name, lookup->len, &lookup->free_slot);
+	if (lookup->dentry != NULL){
+		lookup->inode = inode_by_number(fs->image, dentry_ino(lookup->dentry, compact_dentries(fs->image)));
+	}
+}
+
+/**
+ * Resolve a name in a directory for a namespace operation (create, mkdir,
+ * unlink, rmdir). Scans the directory once, returning both the entry for the
+ * name (if it exists) and a free slot for it (if the entry doesn't exist). On
+ * success, the directory is left locked for writing; the caller must unlock
+ * it. Fails with -ENOENT if the directory was removed before it could be
+ * locked.
+ * 
+ * @param fs		the file system context
+ * @param dir		the inode number of the directory
+ * @param name		the name (not necessarily null-terminated); empty for the
+ * 					directory itself
+ * @param len		the length of the name
+ * @param lookup	receives the result
+ * @return			0 on success (even if the name doesn't exist); -errno if
+ * 					the name is too long or dir isn't a directory, or
+ * 					-ENOENT if dir has been removed
+ */
+static int entry_resolve(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, a1fs_lookup *lookup){
+	if (len >= A1FS_NAME_MAX){
+		return -ENAMETOOLONG;
+	}
+	int ret = inode_get_locked(fs, dir, &lookup->parent, true);
+	if (ret != 0){
+		return ret;
+	}
+	if (!S_ISDIR(lookup->parent->mode)){
+		inode_unlock(fs, lookup->parent);
+		return -ENOTDIR;
+	}
+	// Nothing may be added to a directory that is an orphan.
+	if (lookup->parent->links == 0){
+		inode_unlock(fs, lookup->parent);
+		return -ENOENT;
+	}
+	lookup->inode = (len == 0) ? lookup->parent : NULL;
+	lookup->dentry = NULL;
+	lookup->free_slot = NULL;
+	lookup->name = name;
+	lookup->len = len;
+	path_scan(fs, lookup);
+	return 0;
+}
+
+
+/**
+ * Pick the allocation group for a new inode. A directory goes to the group
+ * with the most free blocks among those with at least the average number of
+ * free inodes, so that directory trees spread out over the disk; a file goes
+ * to the group of its parent directory, or to the next group with a free inode.
+ * The caller must hold fs->alloc_lock.
+ * 
+ * @param fs		the file system context
+ * @param parent	the inode number of the parent directory
+ * @param dir		whether the new inode is a directory
+ * @return			the group; fs->groups_count if there are no free inodes
+ */
+static uint32_t inode_group(fs_ctx *fs, a1fs_ino_t parent, bool dir){
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	uint32_t first = parent / fs->inodes_per_group;
+	uint32_t best = fs->groups_count;
+	if (dir){
+		uint32_t avg = sb->free_inodes_count / fs->groups_count;
+		for (uint32_t i = 0; i < fs->groups_count; i++){
+			uint32_t g = (first + i) % fs->groups_count;
+			a1fs_group_desc *desc = &fs->groups[g];
+			if (desc->free_inodes_count == 0 || desc->free_inodes_count < avg){
+				continue;
+			}
+			if (best == fs->groups_count || desc->free_blocks_count > fs->groups[best].free_blocks_count){
+				best = g;
+			}
+		}
+		if (best < fs->groups_count){
+			return best;
+		}
+	}
+	for (uint32_t i = 0; i < fs->groups_count; i++){
+		uint32_t g = (first + i) % fs->groups_count;
+		if (fs->groups[g].free_inodes_count > 0){
+			return g;
+		}
+	}
+	return fs->groups_count;
+}
+
+/**
+ * Allocate a free inode. Only the inode bitmap slice of the chosen group is
+ * scanned, starting from the first inode of the group that may be free. The
+ * inode itself is not initialized.
+ * 
+ * @param fs		the file system context
+ * @param parent	the inode number of the parent directory
+ * @param dir		whether the new inode is a directory
+ * @return			the inode number; -1 if there are no free inodes
+ */
+static int64_t alloc_inode(fs_ctx *fs, a1fs_ino_t parent, bool dir){
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	unsigned char *inode_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * sb->inode_bitmap));
+	pthread_mutex_lock(&fs->alloc_lock);
+	uint32_t g = inode_group(fs, parent, dir);
+	if (g == fs->groups_count){
+		pthread_mutex_unlock(&fs->alloc_lock);
+		return -1;
+	}
+
+	a1fs_group_desc *desc = &fs->groups[g];
+	uint64_t first = (uint64_t)g * fs->inodes_per_group;
+	uint64_t end = first + fs->inodes_per_group;
+	if (end > sb->inodes_count){
+		end = sb->inodes_count;
+	}
+	uint64_t ino = bitmap_find(inode_bitmap, first + desc->first_free_inode, end, false);
+	assert(ino < end);
+	set_bm(inode_bitmap, ino, 1);
+	sb->free_inodes_count -= 1;
+	desc->free_inodes_count -= 1;
+	desc->first_free_inode = ino + 1 - first;
+	if (dir){
+		desc->used_dirs_count += 1;
+	}
+	bitmap_dirty(fs, inode_bitmap, ino, 1);
+	group_dirty(fs, g);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	return (int64_t)ino;
+}
+
+/**
+ * Initialize a new inode to the default parameters and provided mode
+ * 
+ * @param inode		the inode to be modified
+ * @param mode		the mode for the inode
+ */
+void init_inode(a1fs_inode *inode, mode_t mode){
+	inode->mode = mode;
+	inode->size = 0; 									
+	inode->links = 1;									
+	inode->extents = 0;	
+	inode->flags = 0;
+	inode->dx_root = 0;
+
+	// Initialize the extents to be empty (count = 0).
+	for (int i = 0; i < A1FS_EXTENTS_LENGTH; i ++){
+		(inode->extent)[i].count = 0;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &inode->mtime);
+}
+
+/**
+ * Make sure the free extent index matches the block bitmap, rebuilding it if
+ * an earlier update failed.
+ * 
+ * @param fs		the file system context
+ * @return			true on success; false if out of memory
+ */
+static bool freemap_ready(fs_ctx *fs){
+	if (fs->freemap.stale){
+		a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+		unsigned char *block_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * sb->block_bitmap));
+		return freemap_build(&fs->freemap, block_bitmap, sb->blocks_count);
+	}
+	return true;
+}
+
+/** Get the allocation group of a data block (or of the block past the end). */
+static uint32_t block_group(fs_ctx *fs, a1fs_blk_t blk){
+	uint32_t g = blk / fs->blocks_per_group;
+	return (g < fs->groups_count) ? g : fs->groups_count - 1;
+}
+
+/**
+ * Update the free block counts of the groups that a run of blocks spans. The
+ * caller must hold fs->alloc_lock.
+ * 
+ * @param fs		the file system context
+ * @param start		the first block
+ * @param count		the number of blocks
+ * @param used		true if the blocks were allocated; false if they were freed
+ */
+static void group_count_blocks(fs_ctx *fs, a1fs_blk_t start, a1fs_blk_t count, bool used){
+	while (count > 0){
+		uint32_t g = start / fs->blocks_per_group;
+		uint64_t n = (uint64_t)(g + 1) * fs->blocks_per_group - start;
+		if (n > count){
+			n = count;
+		}
+		if (used){
+			fs->groups[g].free_blocks_count -= n;
+		} else {
+			fs->groups[g].free_blocks_count += n;
+		}
+		group_dirty(fs, g);
+		start += n;
+		count -= n;
+	}
+}
+
+/**
+ * Find a free run of blocks for an allocation of count blocks: the first run of
+ * at least count blocks at or after goal in the goal's group, failing that the
+ * first such run in the next group that has enough free blocks, then the
+ * smallest run of at least count blocks anywhere, and failing that the longest
+ * free run. The group descriptors rule out groups without looking at them.
+ * 
+ * @param fs		the file system context
+ * @param goal		the preferred first block
+ * @param count		the number of blocks wanted
+ * @param run		receives the run, at most count blocks long
+ * @return			true on success; false if there are no free blocks
+ */
+static bool find_free_run(fs_ctx *fs, a1fs_blk_t goal, uint64_t count, a1fs_extent *run){
+	const freemap_node *free_run = NULL;
+	uint32_t first = block_group(fs, goal);
+	for (uint32_t i = 0; i < fs->groups_count && free_run == NULL; i++){
+		uint32_t g = (first + i) % fs->groups_count;
+		if (fs->groups[g].free_blocks_count < count){
+			continue;
+		}
+		uint64_t from = (i == 0) ? goal : (uint64_t)g * fs->blocks_per_group;
+		free_run = freemap_first_fit(&fs->freemap, from, count);
+		if (free_run != NULL && free_run->start / fs->blocks_per_group != g){
+			free_run = NULL;
+		}
+	}
+	if (free_run == NULL){
+		free_run = freemap_best_fit(&fs->freemap, count);
+	}
+	if (free_run == NULL){
+		free_run = freemap_largest(&fs->freemap);
+	}
+	if (free_run == NULL){
+		return false;
+	}
+	run->start = free_run->start;
+	run->count = (free_run->count < count) ? free_run->count : count;
+	return true;
+}
+
+/**
+ * Get the preferred first block for the data of a file that has no block to
+ * continue from: the start of the group its inode is in, so that files end up
+ * near their inodes and their siblings.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @return			the goal block for allocate_blocks()
+ */
+static a1fs_blk_t file_goal(fs_ctx *fs, a1fs_inode *inode){
+	uint32_t g = inode_number(fs->image, inode) / fs->inodes_per_group;
+	return (a1fs_blk_t)g * fs->blocks_per_group;
+}
+
+/**
+ * Mark a run of blocks free. The blocks are revoked from the journal, so that
+ * replaying it can't overwrite whatever they hold next. Blocks that were in
+ * use before the running transaction can only be allocated again once it has
+ * committed (see freemap.h). The caller must hold fs->alloc_lock.
+ * 
+ * @param fs		the file system context
+ * @param start		the first block
+ * @param count		the number of blocks
+ * @param defer		whether the blocks were in use before the running
+ * 					transaction
+ */
+static void release_blocks(fs_ctx *fs, a1fs_blk_t start, a1fs_blk_t count, bool defer){
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	unsigned char *block_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * sb->block_bitmap));
+	bitmap_set_range(block_bitmap, start, count, false);
+	bitmap_dirty(fs, block_bitmap, start, count);
+	sb->free_blocks_count += count;
+	group_count_blocks(fs, start, count, false);
+	journal_revoke(&fs->journal, (uint64_t)sb->data_region + start, count);
+	// Out of memory: the blocks can be reused right away, as without a journal.
+	if (defer && fs->journal.span > 0 &&
+	    freemap_defer(&fs->freemap, start, count, journal_seq(&fs->journal))){
+		return;
+	}
+	if (!fs->freemap.stale){
+		freemap_insert(&fs->freemap, start, count);
+	}
+}
+
+/**
+ * Free a run of blocks. Their contents are left as they are; blocks are zeroed
+ * where they are allocated, so freeing costs nothing per byte.
+ * 
+ * @param fs		the file system context
+ * @param start		the first block
+ * @param count		the number of blocks
+ */
+void free_blocks(fs_ctx *fs, a1fs_blk_t start, a1fs_blk_t count){
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	// Buffered file data must not be written over whatever the blocks hold next.
+	blockdev_invalidate(&fs->bdev, (uint64_t)sb->data_region + start, count);
+	pthread_mutex_lock(&fs->alloc_lock);
+	release_blocks(fs, start, count, true);
+	pthread_mutex_unlock(&fs->alloc_lock);
+}
+
+/**
+ * Allocate count blocks in as few contiguous runs as possible. If the goal
+ * block is free, the run starting at it is taken first so that an extent can
+ * be grown in place; the rest comes from the first run after goal that is
+ * long enough, or from the longest runs available. The contents of the new
+ * blocks are undefined.
+ *
+ * Blocks reserved for the delayed appends of other files don't count as free.
+ * If the blocks are for a file with buffered appends, which only happens when
+ * the buffer is written out, they come out of its own reservation first.
+ * Blocks freed by a transaction that hasn't committed are only taken once
+ * nothing else is left.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file (or directory) the blocks are for
+ * @param goal		the preferred first block
+ * @param count		the number of blocks to allocate
+ * @param runs		receives the allocated runs, in order
+ * @param max_runs	the maximum number of runs to return
+ * @return			the number of runs on success; -ENOSPC if out of space or if
+ * 					more than max_runs runs would be needed; -ENOMEM if out of
+ * 					memory. Nothing is allocated on failure.
+ */
+int allocate_blocks(fs_ctx *fs, a1fs_inode *inode, a1fs_blk_t goal, uint64_t count,
+                    a1fs_extent *runs, int max_runs){
+	void *image = fs->image;
+	a1fs_superblock *sb = (a1fs_superblock*)(image);
+	unsigned char *block_bitmap = (unsigned char*)(image + (A1FS_BLOCK_SIZE * sb->block_bitmap));
+	pthread_mutex_lock(&fs->alloc_lock);
+	delalloc_buf *b = delalloc_get(&fs->delalloc, inode_number(image, inode));
+	uint64_t own = (b != NULL) ? b->reserved : 0;
+	uint64_t others = fs->delalloc.reserved - own;
+	if (others > sb->free_blocks_count || count > sb->free_blocks_count - others){
+		pthread_mutex_unlock(&fs->alloc_lock);
+		return -ENOSPC;
+	}
+
+	if (fs->freemap.npending > 0){
+		freemap_settle(&fs->freemap, journal_seq(&fs->journal));
+	}
+
+	uint64_t count_wanted = count;
+	int n = 0;
+	int ret = -ENOSPC;
+	while (count > 0){
+		a1fs_extent run;
+		if (n == max_runs){
+			break;
+		}
+		if (!freemap_ready(fs)){
+			ret = -ENOMEM;
+			break;
+		}
+		const freemap_node *at_goal = (n == 0) ? freemap_find(&fs->freemap, goal) : NULL;
+		if (at_goal != NULL){
+			uint64_t avail = at_goal->start + at_goal->count - goal;
+			run.start = goal;
+			run.count = (count < avail) ? count : avail;
+		} else if (!find_free_run(fs, goal, count, &run)){
+			// Rather than fail with ENOSPC, take the blocks freed by the
+			// running transaction; after a crash, the files they were freed
+			// from may show what is written to them next.
+			if (fs->freemap.npending == 0){
+				break;
+			}
+			freemap_settle(&fs->freemap, UINT64_MAX);
+			continue;
+		}
+
+		bitmap_set_range(block_bitmap, run.start, run.count, true);
+		bitmap_dirty(fs, block_bitmap, run.start, run.count);
+		sb->free_blocks_count -= run.count;
+		group_count_blocks(fs, run.start, run.count, true);
+		freemap_remove(&fs->freemap, run.start, run.count);
+		runs[n++] = run;
+		count -= run.count;
+		goal = run.start + run.count;
+	}
+
+	if (count > 0){
+		for (int i = 0; i < n; i++){
+			release_blocks(fs, runs[i].start, runs[i].count, false);
+		}
+		pthread_mutex_unlock(&fs->alloc_lock);
+		return ret;
+	}
+	if (b != NULL){
+		uint64_t used = (count_wanted < b->reserved) ? count_wanted : b->reserved;
+		b->reserved -= used;
+		fs->delalloc.reserved -= used;
+	}
+	pthread_mutex_unlock(&fs->alloc_lock);
+	return n;
+}
+
+/**
+ * Most blocks that an operation split across journal transactions allocates
+ * or frees in one step: a block bitmap block's worth, so that a step changes
+ * only a handful of metadata blocks.
+ */
+#define STEP_BLOCKS (A1FS_BLOCK_SIZE * 8)
+
+/**
+ * Free the last count blocks of a file, dropping the extents that become empty
+ * and the indirect block once no extent is stored in it. The extents of a file
+ * occupy the slots [0, inode->extents) in file order. The blocks are freed a
+ * step at a time, stopping early once the running journal transaction is due
+ * (see journal_due()).
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param count		the number of blocks to free
+ * @return			the number of blocks left to free (0 if the file has no
+ * 					blocks left)
+ */
+static uint64_t file_release_tail(fs_ctx *fs, a1fs_inode *inode, uint64_t count){
+	void *image = fs->image;
+
+	while (count > 0 && inode->extents > 0){
+		a1fs_extent *last = get_extent(image, inode, inode->extents - 1);
+		a1fs_blk_t n = (count < last->count) ? count : last->count;
+		if (n > STEP_BLOCKS){
+			n = STEP_BLOCKS;
+		}
+		if (last->start != A1FS_HOLE){
+			free_blocks(fs, last->start + last->count - n, n);
+		}
+		last->count -= n;
+		count -= n;
+		if (last->count == 0){
+			last->start = 0;
+			inode->extents--;
+		}
+		if (count > 0 && journal_due(&fs->journal)){
+			break;
+		}
+	}
+
+	if (inode->extents <= A1FS_IND_BLOCK && (inode->extent)[A1FS_IND_BLOCK].count > 0){
+		free_blocks(fs, (inode->extent)[A1FS_IND_BLOCK].start, 1);
+		(inode->extent)[A1FS_IND_BLOCK].count = 0;
+	}
+	file_extmap_sync(fs, inode, inode->extents);
+	return (inode->extents > 0) ? count : 0;
+}
+
+/**
+ * Make room for more extents in a file: check that there are enough free
+ * extent slots and allocate the indirect block if the new extents need it.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param extra		the number of extents to be added
+ * @return			0 on success; -ENOSPC if out of extent slots or free blocks
+ */
+static int extent_reserve(fs_ctx *fs, a1fs_inode *inode, int extra){
+	int new_extents = inode->extents + extra;
+	if (new_extents > A1FS_IND_BLOCK + A1FS_NUM_EXTENTS){
+		return -ENOSPC;
+	}
+	if (new_extents > A1FS_IND_BLOCK && (inode->extent)[A1FS_IND_BLOCK].count == 0){
+		a1fs_extent indirect;
+		int ret = allocate_blocks(fs, inode, file_goal(fs, inode), 1, &indirect, 1);
+		if (ret < 0){
+			return ret;
+		}
+		memset(data_block(fs->image, indirect.start), 0, A1FS_BLOCK_SIZE);
+		(inode->extent)[A1FS_IND_BLOCK] = indirect;
+	}
+	return 0;
+}
+
+/**
+ * Append count blocks to the end of a file with a single allocator call. The
+ * allocation aims right after the last extent so that it can be grown in
+ * place; runs elsewhere become new extents. The contents of the new blocks are
+ * undefined.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param count		the number of blocks to add
+ * @param first		receives the position of the first new block
+ * @return			0 on success; -ENOSPC if out of free blocks or extent slots,
+ * 					in which case nothing is allocated
+ */
+int file_extend(fs_ctx *fs, a1fs_inode *inode, uint64_t count, extent_cursor *first){
+	void *image = fs->image;
+	int old_extents = inode->extents;
+	a1fs_extent *last = (old_extents > 0) ? get_extent(image, inode, old_extents - 1) : NULL;
+	a1fs_blk_t old_count = (last != NULL) ? last->count : 0;
+	if (last != NULL && last->start == A1FS_HOLE){
+		last = NULL;// a hole can't be grown in place
+	}
+	a1fs_blk_t goal = (last != NULL) ? last->start + last->count : file_goal(fs, inode);
+
+	// The first run doesn't need a slot if it continues the last extent.
+	a1fs_extent runs[A1FS_IND_BLOCK + A1FS_NUM_EXTENTS + 1];
+	int free_slots = A1FS_IND_BLOCK + A1FS_NUM_EXTENTS - old_extents;
+	int n = allocate_blocks(fs, inode, goal, count, runs, free_slots + (last != NULL));
+	if (n < 0){
+		return n;
+	}
+	int merge = (last != NULL && runs[0].start == goal);
+	int ret = extent_reserve(fs, inode, n - merge);
+	if (ret != 0){
+		for (int i = 0; i < n; i++){
+			free_blocks(fs, runs[i].start, runs[i].count);
+		}
+		return ret;
+	}
+
+	for (int i = 0; i < n; i++){
+		if (i == 0 && merge){
+			last->count += runs[0].count;
+		} else {
+			*get_extent(image, inode, inode->extents) = runs[i];
+			inode->extents++;
+		}
+	}
+	file_extmap_sync(fs, inode, (old_extents > 0) ? old_extents - 1 : 0);
+
+	// The first new block either continues the old last extent or starts the next one.
+	if (merge){
+		first->slot = old_extents - 1;
+		first->off = old_count;
+	} else {
+		first->slot = old_extents;
+		first->off = 0;
+	}
+	first->extent = get_extent(image, inode, first->slot);
+	first->seen = first->slot + 1;
+	return 0;
+}
+
+/**
+ * Append count zeroed blocks to the end of a file. This is where blocks that
+ * grow a file past its data are zeroed, once; freeing blocks doesn't zero them.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param count		the number of blocks to add
+ * @return			0 on success; -ENOSPC if out of free blocks or extent slots,
+ * 					or -EIO if the blocks can't be zeroed, in which case
+ * 					nothing is allocated
+ */
+static int file_extend_zeroed(fs_ctx *fs, a1fs_inode *inode, uint64_t count){
+	extent_cursor first;
+	size_t in_block = 0;
+	int ret = file_extend(fs, inode, count, &first);
+	size_t size = count * A1FS_BLOCK_SIZE;
+	if (ret == 0 && extent_write(fs, inode, &first, &in_block, NULL, size) != size){
+		file_release_tail(fs, inode, count);
+		ret = -EIO;
+	}
+	return ret;
+}
+
+/**
+ * Append count zeroed blocks to the end of a file a step at a time, stopping
+ * early once the running journal transaction is due (see journal_due()).
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param count		the number of blocks to add
+ * @return			0 on success; -EAGAIN if some of the blocks are left to add
+ * 					in a new journal handle; -ENOSPC if out of free blocks or
+ * 					extent slots, in which case the steps before are kept
+ */
+static int file_extend_steps(fs_ctx *fs, a1fs_inode *inode, uint64_t count){
+	while (count > 0){
+		uint64_t n = (count < STEP_BLOCKS) ? count : STEP_BLOCKS;
+		int ret = file_extend_zeroed(fs, inode, n);
+		if (ret != 0){
+			return ret;
+		}
+		count -= n;
+		if (count > 0 && journal_due(&fs->journal)){
+			return -EAGAIN;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Insert an extent into the extents of a file, shifting the ones after it.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param slot		the slot of the new extent
+ * @param ext		the new extent
+ * @return			0 on success; -ENOSPC if out of extent slots or free blocks
+ */
+static int extent_insert(fs_ctx *fs, a1fs_inode *inode, int slot, a1fs_extent ext){
+	int ret = extent_reserve(fs, inode, 1);
+	if (ret != 0){
+		return ret;
+	}
+	for (int i = inode->extents; i > slot; i--){
+		*get_extent(fs->image, inode, i) = *get_extent(fs->image, inode, i - 1);
+	}
+	*get_extent(fs->image, inode, slot) = ext;
+	inode->extents++;
+	file_extmap_sync(fs, inode, slot);
+	return 0;
+}
+
+/**
+ * Remove an extent from the extents of a file, shifting the ones after it. The
+ * blocks of the extent are not freed.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param slot		the slot of the extent
+ */
+static void extent_delete(fs_ctx *fs, a1fs_inode *inode, int slot){
+	for (int i = slot; i < inode->extents - 1; i++){
+		*get_extent(fs->image, inode, i) = *get_extent(fs->image, inode, i + 1);
+	}
+	inode->extents--;
+	if (inode->extents <= A1FS_IND_BLOCK && (inode->extent)[A1FS_IND_BLOCK].count > 0){
+		free_blocks(fs, (inode->extent)[A1FS_IND_BLOCK].start, 1);
+		(inode->extent)[A1FS_IND_BLOCK].count = 0;
+	}
+	file_extmap_sync(fs, inode, slot);
+}
+
+/**
+ * Split an extent of a file in two at block at of the extent.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param slot		the slot of the extent; the second part goes into slot + 1
+ * @param at		the first block of the second part (0 < at < count)
+ * @return			0 on success; -ENOSPC if out of extent slots or free blocks
+ */
+static int extent_split(fs_ctx *fs, a1fs_inode *inode, int slot, a1fs_blk_t at){
+	a1fs_extent ext = *get_extent(fs->image, inode, slot);
+	a1fs_extent tail = { (ext.start == A1FS_HOLE) ? A1FS_HOLE : ext.start + at, ext.count - at };
+	int ret = extent_insert(fs, inode, slot + 1, tail);
+	if (ret != 0){
+		return ret;
+	}
+	get_extent(fs->image, inode, slot)->count = at;
+	file_extmap_sync(fs, inode, slot);
+	return 0;
+}
+
+/**
+ * Merge each hole in a range of extent slots of a file into the hole before
+ * it, if there is one.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param first		the first slot of the range
+ * @param last		the last slot of the range
+ */
+static void extent_merge_holes(fs_ctx *fs, a1fs_inode *inode, int first, int last){
+	if (first < 1){
+		first = 1;
+	}
+	for (int i = first; i <= last && i < inode->extents; ){
+		a1fs_extent *prev = get_extent(fs->image, inode, i - 1);
+		a1fs_extent *ext = get_extent(fs->image, inode, i);
+		if (prev->start == A1FS_HOLE && ext->start == A1FS_HOLE){
+			prev->count += ext->count;
+			extent_delete(fs, inode, i);
+			file_extmap_sync(fs, inode, i - 1);
+			last--;
+		} else {
+			i++;
+		}
+	}
+}
+
+/**
+ * Add a hole of count blocks to the end of a file.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param count		the number of blocks
+ * @return			0 on success; -ENOSPC if out of extent slots or free blocks
+ */
+static int file_append_hole(fs_ctx *fs, a1fs_inode *inode, uint64_t count){
+	if (inode->extents > 0){
+		a1fs_extent *last = get_extent(fs->image, inode, inode->extents - 1);
+		if (last->start == A1FS_HOLE){
+			last->count += count;
+			file_extmap_sync(fs, inode, inode->extents - 1);
+			return 0;
+		}
+	}
+	a1fs_extent hole = { A1FS_HOLE, count };
+	return extent_insert(fs, inode, inode->extents, hole);
+}
+
+/**
+ * Allocate zeroed blocks for a hole extent of a file. The first new run grows
+ * the extent before the hole if it continues it on disk.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param slot		the slot of the hole
+ * @return			the number of slots the hole takes up now (0 if it was merged
+ * 					into the extent before it); -errno on error
+ */
+static int extent_fill(fs_ctx *fs, a1fs_inode *inode, int slot){
+	a1fs_extent hole = *get_extent(fs->image, inode, slot);
+	a1fs_extent *prev = (slot > 0) ? get_extent(fs->image, inode, slot - 1) : NULL;
+	if (prev != NULL && prev->start == A1FS_HOLE){
+		prev = NULL;
+	}
+	a1fs_blk_t goal = (prev != NULL) ? prev->start + prev->count : file_goal(fs, inode);
+
+	a1fs_extent runs[A1FS_IND_BLOCK + A1FS_NUM_EXTENTS + 1];
+	int free_slots = A1FS_IND_BLOCK + A1FS_NUM_EXTENTS - inode->extents;
+	int n = allocate_blocks(fs, inode, goal, hole.count, runs, free_slots + 1 + (prev != NULL));
+	if (n < 0){
+		return n;
+	}
+	for (int i = 0; i < n; i++){
+		memset(file_block(fs, runs[i].start), 0, (size_t)runs[i].count * A1FS_BLOCK_SIZE);
+		writeback_dirty(&fs->writeback, file_block(fs, runs[i].start), (size_t)runs[i].count * A1FS_BLOCK_SIZE);
+	}
+	int merge = (prev != NULL && runs[0].start == goal);
+	int ret = extent_reserve(fs, inode, n - merge - 1);
+	if (ret != 0){
+		for (int i = 0; i < n; i++){
+			free_blocks(fs, runs[i].start, runs[i].count);
+		}
+		return ret;
+	}
+
+	// The hole's slot takes the first run that doesn't grow the previous extent.
+	if (merge){
+		prev->count += runs[0].count;
+	}
+	if (merge && n == 1){
+		extent_delete(fs, inode, slot);
+	} else {
+		*get_extent(fs->image, inode, slot) = runs[merge];
+		for (int i = merge + 1; i < n; i++){
+			extent_insert(fs, inode, slot + i - merge, runs[i]);
+		}
+	}
+	file_extmap_sync(fs, inode, (slot > 0) ? slot - 1 : 0);
+	return n - merge;
+}
+
+/**
+ * Allocate zeroed blocks for all the holes in a range of blocks of a file, a
+ * step at a time, stopping early once the running journal transaction is due
+ * (see journal_due()).
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param blk		the first block of the range
+ * @param count		the number of blocks in the range
+ * @return			0 on success; -EAGAIN if holes are left to fill in a new
+ * 					journal handle; -errno on error
+ */
+static int file_fill_holes(fs_ctx *fs, a1fs_inode *inode, uint64_t blk, uint64_t count){
+	uint64_t end = blk + count;
+	extent_cursor cur;
+	if (extent_seek(fs, inode, blk, &cur) == NULL){
+		return 0;
+	}
+
+	int slot = cur.slot;
+	a1fs_blk_t off = cur.off;
+	while (blk < end && slot < inode->extents){
+		a1fs_extent *ext = get_extent(fs->image, inode, slot);
+		if (ext->start != A1FS_HOLE){
+			blk += ext->count - off;
+			slot++;
+			off = 0;
+			continue;
+		}
+
+		// Cut the part of the hole inside the range out into an extent of its own.
+		int ret = 0;
+		if (off > 0){
+			ret = extent_split(fs, inode, slot, off);
+			slot++;
+			off = 0;
+		}
+		uint64_t n = end - blk;
+		if (n > STEP_BLOCKS){
+			n = STEP_BLOCKS;
+		}
+		if (ret == 0 && n < get_extent(fs->image, inode, slot)->count){
+			ret = extent_split(fs, inode, slot, n);
+		}
+		n = get_extent(fs->image, inode, slot)->count;
+		if (ret == 0){
+			ret = extent_fill(fs, inode, slot);
+		}
+		if (ret < 0){
+			return ret;
+		}
+		slot += ret;
+		blk += n;
+		if (blk < end && journal_due(&fs->journal)){
+			return -EAGAIN;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Turn a range of whole blocks of a file into a hole, freeing their blocks a
+ * step at a time and stopping early once the running journal transaction is
+ * due (see journal_due()). Once the hole has started, each step moves blocks
+ * from the front of the next extent into it, which needs no extent slots.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param blk		the first block of the range
+ * @param count		the number of blocks in the range
+ * @return			0 on success; -EAGAIN if blocks are left to free in a new
+ * 					journal handle; -ENOSPC if out of extent slots or free blocks
+ */
+static int file_punch_hole(fs_ctx *fs, a1fs_inode *inode, uint64_t blk, uint64_t count){
+	uint64_t end = blk + count;
+	extent_cursor cur;
+	if (count == 0 || extent_seek(fs, inode, blk, &cur) == NULL){
+		return 0;
+	}
+
+	int first = cur.slot;
+	int slot = cur.slot;
+	a1fs_blk_t off = cur.off;
+	int ret = 0;
+	while (blk < end && slot < inode->extents){
+		// Split the extent so that the part inside the range has a slot of its own.
+		if (off > 0){
+			ret = extent_split(fs, inode, slot, off);
+			if (ret != 0){
+				break;
+			}
+			slot++;
+			off = 0;
+		}
+		a1fs_extent *ext = get_extent(fs->image, inode, slot);
+		if (end - blk < ext->count){
+			ret = extent_split(fs, inode, slot, end - blk);
+			if (ret != 0){
+				break;
+			}
+			ext = get_extent(fs->image, inode, slot);
+		}
+
+		if (ext->start == A1FS_HOLE){
+			blk += ext->count;
+			slot++;
+			continue;
+		}
+
+		a1fs_extent *prev = (slot > 0) ? get_extent(fs->image, inode, slot - 1) : NULL;
+		a1fs_blk_t n = (ext->count < STEP_BLOCKS) ? ext->count : STEP_BLOCKS;
+		if (n < ext->count && prev != NULL && prev->start == A1FS_HOLE){
+			free_blocks(fs, ext->start, n);
+			prev->count += n;
+			ext->start += n;
+			ext->count -= n;
+			file_extmap_sync(fs, inode, slot - 1);
+		} else {
+			if (n < ext->count){
+				ret = extent_split(fs, inode, slot, n);
+				if (ret != 0){
+					break;
+				}
+				ext = get_extent(fs->image, inode, slot);
+			}
+			free_blocks(fs, ext->start, n);
+			ext->start = A1FS_HOLE;
+			slot++;
+		}
+		blk += n;
+		if (blk < end && journal_due(&fs->journal)){
+			ret = -EAGAIN;
+			break;
+		}
+	}
+	file_extents_dirty(fs, inode);
+	extent_merge_holes(fs, inode, first, slot);
+	return ret;
+}
+
+/**
+ * Give a write into a sparse file the blocks it stores data in. The blocks
+ * between the end of the file and the write become a hole, and so do the
+ * whole blocks of zeros in the write with --detect_zeroes; the holes under
+ * the rest of the write are filled.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param buf		the data
+ * @param size		the size of the data
+ * @param offset	the offset of the write
+ * @return			0 on success; -errno on error
+ */
+static int file_map_write(fs_ctx *fs, a1fs_inode *inode, const char *buf, size_t size, off_t offset){
+	uint64_t end = offset + size;
+	uint64_t first = offset / A1FS_BLOCK_SIZE;
+	uint64_t new_blocks = align_up(end, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
+	uint64_t blocks = file_blocks(fs, inode);
+	uint64_t hole_end = fs->opts->detect_zeroes ? new_blocks : first;
+	int ret = 0;
+	if (hole_end > blocks){
+		ret = file_append_hole(fs, inode, hole_end - blocks);
+		blocks = hole_end;
+	}
+	uint64_t limit = (new_blocks < blocks) ? new_blocks : blocks;
+	if (ret != 0 || first >= limit){
+		return ret;
+	}
+	if (!fs->opts->detect_zeroes){
+		return file_fill_holes(fs, inode, first, limit - first);
+	}
+
+	// Fill the holes under each run of blocks that aren't whole blocks of zeros.
+	uint64_t run = first;
+	for (uint64_t blk = first; blk <= limit && ret == 0; blk++){
+		uint64_t pos = blk * A1FS_BLOCK_SIZE;
+		bool zero = (blk == limit) ||
+			(pos >= (uint64_t)offset && pos + A1FS_BLOCK_SIZE <= end &&
+			 is_zeroed(buf + (pos - offset), A1FS_BLOCK_SIZE));
+		if (zero){
+			if (blk > run){
+				ret = file_fill_holes(fs, inode, run, blk - run);
+			}
+			run = blk + 1;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Write data to a file, allocating all the blocks needed to extend it at once.
+ * 
+ * @param fs		the file system context
+ * @param target	the file
+ * @param buf		the data; NULL if it is in bufv
+ * @param bufv		if buf is NULL, the FUSE buffer the data is copied from
+ * 					straight into the blocks; not with --detect_zeroes, which
+ * 					needs the data in memory, or the pread backend
+ * @param size		the number of bytes to write; must not be 0
+ * @param offset	the offset in the file to write to
+ * @param handle	the handle the file is written through; NULL if none
+ * @return			size on success; -errno on error
+ */
+static int file_write(fs_ctx *fs, a1fs_inode *target, const char *buf, struct fuse_bufvec *bufv,
+                      size_t size, off_t offset, a1fs_handle *handle){
+	if (sparse_files(fs->image)){
+		int ret = file_map_write(fs, target, buf, size, offset);
+		if (ret != 0){
+			return ret;
+		}
+	}
+
+	// A file has the blocks needed to hold its size, plus any preallocated past
+	// EOF (or holes, in a sparse file).
+	uint64_t old_size = target->size;
+	uint64_t end = offset + size;
+	uint64_t old_blocks = file_blocks(fs, target);
+	uint64_t new_blocks = align_up(end, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
+	bool prealloc = old_blocks > align_up(old_size, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
+
+	// Writing at or past EOF starts at EOF, which is found without a seek: it is
+	// either inside the last block of the last extent or in the first new block.
+	extent_cursor cur;
+	size_t in_block = old_size % A1FS_BLOCK_SIZE;
+	uint64_t start = old_size;
+	if ((uint64_t)offset >= old_size && in_block != 0 && target->extents > 0 && !prealloc){
+		cur.slot = target->extents - 1;
+		cur.seen = target->extents;
+		cur.extent = get_extent(fs->image, target, cur.slot);
+		cur.off = cur.extent->count - 1;
+	}
+
+	// Allocate all the blocks needed to extend the file in one go.
+	if (new_blocks > old_blocks){
+		extent_cursor first;
+		int ret = file_extend(fs, target, new_blocks - old_blocks, &first);
+		if (ret != 0){
+			return ret;
+		}
+		if ((uint64_t)offset >= old_size && in_block == 0 && !prealloc){
+			cur = first;
+		}
+	}
+
+	// Overwrites and writes into preallocated blocks seek straight to the block
+	// where they start, or continue from where the last write ended.
+	if ((uint64_t)offset < old_size || prealloc){
+		start = ((uint64_t)offset < old_size) ? (uint64_t)offset : old_size;
+		handle_seek(fs, handle, target, start, &cur);
+		in_block = start % A1FS_BLOCK_SIZE;
+	}
+
+	// Zero the gap between EOF and offset, then copy the data in. Only a write
+	// past EOF changes the size. The rest of the last block is zeroed so that
+	// growing the file later exposes zeros.
+	size_t gap = offset - start;
+	size_t tail = (end > old_size) ? new_blocks * A1FS_BLOCK_SIZE - end : 0;
+	bool ok = extent_write(fs, target, &cur, &in_block, NULL, gap) == gap;
+	if (ok && buf != NULL){
+		ok = extent_write(fs, target, &cur, &in_block, buf, size) == size;
+	} else if (ok){
+		ok = extent_splice(fs, target, &cur, &in_block, bufv, size) == size;
+	}
+	if (ok){
+		handle_save(fs, handle, end, &cur);
+		ok = extent_write(fs, target, &cur, &in_block, NULL, tail) == tail;
+	}
+
+	// On an I/O error the size stays as it was, and the blocks added for the
+	// write are given back so that they can't expose what they held before.
+	if (!ok){
+		if (new_blocks > old_blocks){
+			file_release_tail(fs, target, new_blocks - old_blocks);
+		}
+		return -EIO;
+	}
+	if (end > old_size){
+		target->size = end;
+		inode_dirty(fs, target);
+	}
+	return size;
+}
+
+
+/**
+ * Check if a file has appends buffered by delayed allocation.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @return			true if the file has a buffer
+ */
+static bool file_buffered(fs_ctx *fs, a1fs_inode *inode){
+	pthread_mutex_lock(&fs->alloc_lock);
+	bool buffered = delalloc_get(&fs->delalloc, inode_number(fs->image, inode)) != NULL;
+	pthread_mutex_unlock(&fs->alloc_lock);
+	return buffered;
+}
+
+/**
+ * Get the size of a file including the appends buffered by delayed allocation.
+ * The size in the inode only grows once they are written out, so that a commit
+ * in the meantime doesn't store a size that the file has no blocks for.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @return			the size of the file in bytes
+ */
+static uint64_t file_eof(fs_ctx *fs, a1fs_inode *inode){
+	pthread_mutex_lock(&fs->alloc_lock);
+	delalloc_buf *b = delalloc_get(&fs->delalloc, inode_number(fs->image, inode));
+	uint64_t eof = (b != NULL) ? b->start + b->len : inode->size;
+	pthread_mutex_unlock(&fs->alloc_lock);
+	return eof;
+}
+
+/**
+ * Write out the delayed allocation buffer of a file, if it has one. The blocks
+ * for all the buffered data are allocated in one go.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @return			0 on success; -errno on error, in which case the buffered
+ * 					data is lost and the file is cut back to where it began
+ */
+static int file_flush(fs_ctx *fs, a1fs_inode *inode){
+	a1fs_ino_t ino = inode_number(fs->image, inode);
+	pthread_mutex_lock(&fs->alloc_lock);
+	delalloc_buf *b = delalloc_get(&fs->delalloc, ino);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	if (b == NULL){
+		return 0;
+	}
+
+	// The buffered bytes are not on disk yet, so write them as a single append
+	// at the size in the inode, which is where the buffer began. Only the
+	// holder of the file's lock touches its buffer.
+	size_t len = b->len;
+	int ret = file_write(fs, inode, b->data, NULL, len, b->start, NULL);
+	pthread_mutex_lock(&fs->alloc_lock);
+	delalloc_remove(&fs->delalloc, ino);
+	fs->delalloc.flushes++;
+	pthread_mutex_unlock(&fs->alloc_lock);
+	if (ret < 0){
+		fprintf(stderr, "a1fs: lost %zu buffered bytes of inode %u: %s\n", len, ino, strerror(-ret));
+		return ret;
+	}
+	return 0;
+}
+
+/**
+ * Write out the delayed allocation buffers of all files. Only called when no
+ * other thread can be running (on unmount).
+ * 
+ * @param fs		the file system context
+ */
+static void file_flush_all(fs_ctx *fs){
+	delalloc_buf *b;
+	while ((b = delalloc_any(&fs->delalloc)) != NULL){
+		file_flush(fs, inode_by_number(fs->image, b->ino));
+	}
+}
+
+/** Number of other files whose buffers are looked at per pass when relieving
+ * memory pressure. */
+#define DELALLOC_FLUSH_BATCH 32
+
+/**
+ * Write out delayed allocation buffers until there is room for size more
+ * buffered bytes: first the file's own buffer, then those of other files. The
+ * caller holds the lock of the file, so other files are only flushed if their
+ * locks are free; a file that is busy has its buffer written out by its owner
+ * soon enough.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file being appended to (locked exclusively)
+ * @param size		the number of bytes about to be buffered
+ * @return			true if there is room for them now
+ */
+static bool file_flush_pressure(fs_ctx *fs, a1fs_inode *inode, size_t size){
+	delalloc *da = &fs->delalloc;
+	a1fs_ino_t self = inode_number(fs->image, inode);
+	file_flush(fs, inode);
+
+	a1fs_ino_t inos[DELALLOC_FLUSH_BATCH];
+	pthread_mutex_lock(&fs->alloc_lock);
+	size_t n = delalloc_list(da, inos, DELALLOC_FLUSH_BATCH);
+	bool room = da->bytes + size <= da->max_bytes;
+	pthread_mutex_unlock(&fs->alloc_lock);
+	for (size_t i = 0; i < n && !room; i++){
+		if (inos[i] == self || !inode_trylock(fs, inos[i])){
+			continue;
+		}
+		// The buffer may have been written out before the lock was taken,
+		// in which case this does nothing.
+		a1fs_inode *other = inode_by_number(fs->image, inos[i]);
+		file_flush(fs, other);
+		inode_unlock(fs, other);
+		pthread_mutex_lock(&fs->alloc_lock);
+		room = da->bytes + size <= da->max_bytes;
+		pthread_mutex_unlock(&fs->alloc_lock);
+	}
+	return room;
+}
+
+/**
+ * Append data to the delayed allocation buffer of a file. The blocks the data
+ * will need are reserved so that writing the buffer out later can't run out
+ * of space. If the buffers are using all the memory they may, they are
+ * written out first (see file_flush_pressure()).
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @param buf		the data
+ * @param size		the number of bytes to append
+ * @return			true if the data was buffered; false if it has to be
+ * 					written directly (not enough free space or memory)
+ */
+static bool file_buffer(fs_ctx *fs, a1fs_inode *inode, const char *buf, size_t size){
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	delalloc *da = &fs->delalloc;
+	a1fs_ino_t ino = inode_number(fs->image, inode);
+	if (size > da->max_bytes){
+		return false;
+	}
+	pthread_mutex_lock(&fs->alloc_lock);
+	bool full = da->bytes + size > da->max_bytes;
+	pthread_mutex_unlock(&fs->alloc_lock);
+	if (full && !file_flush_pressure(fs, inode, size)){
+		return false;
+	}
+
+	pthread_mutex_lock(&fs->alloc_lock);
+	if (da->bytes + size > da->max_bytes){
+		pthread_mutex_unlock(&fs->alloc_lock);
+		return false;
+	}
+
+	// Reserve the blocks that the appended bytes go past EOF into. A new buffer
+	// also reserves what else writing it out may allocate: the indirect extent
+	// block if the file has none yet, and the block at EOF if it may be a hole.
+	delalloc_buf *b = delalloc_get(da, ino);
+	uint64_t eof = (b != NULL) ? b->start + b->len : inode->size;
+	uint64_t end = eof + size;
+	uint64_t need = align_up(end, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE - align_up(eof, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
+	if (b == NULL){
+		need += ((inode->extent)[A1FS_IND_BLOCK].count == 0);
+		need += (sparse_files(fs->image) && inode->size % A1FS_BLOCK_SIZE != 0);
+	}
+	if (da->reserved <= sb->free_blocks_count && need <= sb->free_blocks_count - da->reserved){
+		b = delalloc_append(da, ino, inode->size, buf, size);
+	} else {
+		b = NULL;
+	}
+	if (b != NULL){
+		b->reserved += need;
+		da->reserved += need;
+	}
+	pthread_mutex_unlock(&fs->alloc_lock);
+	return b != NULL;
+}
+
+/**
+ * Grow a directory by one block.
+ * 
+ * @param fs		the file system context
+ * @param dir		the directory
+ * @param blk		receives the new block, which is zeroed
+ * @return			0 on success; -ENOSPC if there is no free block
+ */
+static int dir_alloc_block(fs_ctx *fs, a1fs_inode *dir, a1fs_blk_t *blk){
+	extent_cursor first;
+	int ret = file_extend(fs, dir, 1, &first);
+	if (ret != 0){
+		return ret;
+	}
+	*blk = first.extent->start + first.off;
+	memset(data_block(fs->image, *blk), 0, A1FS_BLOCK_SIZE);
+	meta_dirty(fs, data_block(fs->image, *blk), A1FS_BLOCK_SIZE);
+	return 0;
+}
+
+/** Insert an entry into an index node that is not full. */
+static void dx_insert_at(a1fs_dx_node *node, int pos, uint32_t hash, a1fs_blk_t blk){
+	memmove(node->entries + pos + 1, node->entries + pos, (node->count - pos)*sizeof(a1fs_dx_entry));
+	(node->entries)[pos].hash = hash;
+	(node->entries)[pos].block = blk;
+	node->count++;
+}
+
+/**
+ * Make room for a new entry in a full leaf of an indexed directory: split the
+ * leaf, add the new leaf to the index, and split index nodes (growing the tree
+ * by a level if the root is full) as needed. All the blocks needed are
+ * allocated up front so that running out of space leaves the index intact.
+ * With variable length entries a single split may not free enough space for a
+ * long name, in which case free_slot is set to NULL and the caller tries again.
+ * 
+ * @param fs		the file system context
+ * @param dir		an indexed directory
+ * @param hash		hash of the name to be inserted
+ * @param len		length of the name to be inserted
+ * @param free_slot	receives a place for the entry in the leaf that covers hash,
+ * 					or NULL if that leaf still has no room for it
+ * @return			0 on success; -ENOSPC if out of space
+ */
+static int dx_make_room(fs_ctx *fs, a1fs_inode *dir, uint32_t hash, size_t len, void **free_slot){
+	void *image = fs->image;
+	bool compact = compact_dentries(image);
+	dx_frame frames[DX_MAX_DEPTH];
+	int depth;
+	a1fs_blk_t leaf = dx_find_leaf(image, dir, hash, frames, &depth);
+
+	// Count the full index nodes on the path, starting from the bottom.
+	int full = 0;
+	while (full < depth && ((a1fs_dx_node*)data_block(image, frames[depth - 1 - full].blk))->count == A1FS_DX_LIMIT){
+		full++;
+	}
+	int grow = (full == depth);
+	if (grow && depth == DX_MAX_DEPTH){
+		return -ENOSPC;
+	}
+
+	a1fs_blk_t blocks[DX_MAX_DEPTH + 2];
+	int needed = 1 + full + grow;
+	for (int i = 0; i < needed; i++){
+		int ret = dir_alloc_block(fs, dir, blocks + i);
+		if (ret != 0){
+			return ret;
+		}
+	}
+	int next = 0;
+
+	a1fs_blk_t new_leaf = blocks[next++];
+	uint32_t split;
+	int ret = dblk_split(data_block(image, leaf), data_block(image, new_leaf), compact, &split);
+	if (ret != 0){
+		return ret;
+	}
+	meta_dirty(fs, data_block(image, leaf), A1FS_BLOCK_SIZE);
+
+	// The root is full: move its entries into a new node one level down.
+	if (grow){
+		a1fs_blk_t child = blocks[next++];
+		a1fs_dx_node *root = (a1fs_dx_node*)data_block(image, dir->dx_root);
+		memcpy(data_block(image, child), root, A1FS_BLOCK_SIZE);
+		root->level++;
+		root->count = 1;
+		(root->entries)[0].hash = 0;
+		(root->entries)[0].block = child;
+		meta_dirty(fs, root, A1FS_BLOCK_SIZE);
+		leaf = dx_find_leaf(image, dir, hash, frames, &depth);
+	}
+
+	// Add the new leaf to its parent, splitting full nodes bottom-up.
+	uint32_t new_hash = split;
+	a1fs_blk_t new_blk = new_leaf;
+	for (int d = depth - 1; d >= 0; d--){
+		a1fs_dx_node *node = (a1fs_dx_node*)data_block(image, frames[d].blk);
+		int pos = frames[d].pos + 1;
+		meta_dirty(fs, node, A1FS_BLOCK_SIZE);
+		if (node->count < A1FS_DX_LIMIT){
+			dx_insert_at(node, pos, new_hash, new_blk);
+			break;
+		}
+
+		a1fs_blk_t sibling_blk = blocks[next++];
+		a1fs_dx_node *sibling = (a1fs_dx_node*)data_block(image, sibling_blk);
+		int half = node->count / 2;
+		sibling->level = node->level;
+		sibling->count = node->count - half;
+		memcpy(sibling->entries, node->entries + half, sibling->count*sizeof(a1fs_dx_entry));
+		node->count = half;
+		if (pos > half){
+			dx_insert_at(sibling, pos - half, new_hash, new_blk);
+		} else {
+			dx_insert_at(node, pos, new_hash, new_blk);
+		}
+		new_hash = (sibling->entries)[0].hash;
+		new_blk = sibling_blk;
+	}
+
+	// The leaf that covers hash now has fewer entries.
+	*free_slot = dblk_find_space(data_block(image, (hash >= split) ? new_leaf : leaf), compact, len);
+	return 0;
+}
+
+/**
+ * Turn a linear directory whose only block is full into an indexed directory,
+ * with that block as its only leaf.
+ * 
+ * @param fs		the file system context
+ * @param dir		the directory
+ * @return			0 on success; -ENOSPC if out of space
+ */
+static int dx_convert(fs_ctx *fs, a1fs_inode *dir){
+	a1fs_blk_t leaf = get_extent(fs->image, dir, 0)->start;
+	a1fs_blk_t root_blk;
+	int ret = dir_alloc_block(fs, dir, &root_blk);
+	if (ret != 0){
+		return ret;
+	}
+
+	a1fs_dx_node *root = (a1fs_dx_node*)data_block(fs->image, root_blk);
+	root->level = 0;
+	root->count = 1;
+	(root->entries)[0].hash = 0;
+	(root->entries)[0].block = leaf;
+	dir->dx_root = root_blk;
+	dir->flags |= A1FS_INODE_INDEXED;
+	inode_dirty(fs, dir);
+	return 0;
+}
+
+/**
+ * Add an entry to a directory. The entry is stored in free_slot if the
+ * directory has room for it; otherwise the directory is grown by a block.
+ * If the file system has the directory index feature, a directory that
+ * outgrows its first block is converted to an indexed directory, and new
+ * entries are placed in the leaf that covers their name hash.
+ * 
+ * @param fs		the file system context
+ * @param dir		the directory to add the entry to
+ * @param free_slot	a free slot in dir for the entry (from dir_scan()), or NULL
+ * @param name		the name of the entry (not necessarily null-terminated)
+ * @param len		the length of the name
+ * @param ino		the inode number of the entry
+ * @param mode		the mode of the inode, whose type is stored in compact entries
+ * @return			0 on success; -ENOSPC if the directory could not be grown
+ */
+int dir_add_entry(fs_ctx *fs, a1fs_inode *dir, void *free_slot, const char *name, size_t len, a1fs_ino_t ino, mode_t mode){
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	bool compact = compact_dentries(fs->image);
+	uint32_t hash = a1fs_name_hash(name, len);
+
+	// The existing blocks had no space available, need to assign more space to the dir.
+	if (free_slot == NULL){
+		if (!(dir->flags & A1FS_INODE_INDEXED) && (sb->features & A1FS_FEATURE_DIR_INDEX) &&
+		    dir->extents == 1 && get_extent(fs->image, dir, 0)->count == 1){
+			int ret = dx_convert(fs, dir);
+			if (ret != 0){
+				return ret;
+			}
+		}
+
+		if (dir->flags & A1FS_INODE_INDEXED){
+			while (free_slot == NULL){
+				int ret = dx_make_room(fs, dir, hash, len, &free_slot);
+				if (ret != 0){
+					return ret;
+				}
+			}
+		} else {
+			a1fs_blk_t blk;
+			int ret = dir_alloc_block(fs, dir, &blk);
+			if (ret != 0){
+				return ret;
+			}
+			free_slot = data_block(fs->image, blk);
+			dblk_init(free_slot, compact);
+		}
+	}
+
+	dblk_insert(free_slot, compact, name, len, hash, ino, A1FS_DT(mode));
+	meta_dirty(fs, free_slot, 1);
+	dir->dentry++;
+	dir->size += dentry_size(len, compact);
+	inode_dirty(fs, dir);
+	a1fs_ino_t dir_ino = inode_number(fs->image, dir);
+	cache_shard *c = dcache_shard(fs, dir_ino, name, len);
+	pthread_mutex_lock(&c->lock);
+	dcache_insert(&c->dcache, dir_ino, name, len, ino);
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+/**
+ * Remove an entry from a directory.
+ * 
+ * @param fs		the file system context
+ * @param dir		the directory containing the entry
+ * @param entry		the entry to remove
+ * @param name		the name of the entry (not necessarily null-terminated)
+ * @param len		the length of the name
+ */
+void dir_remove_entry(fs_ctx *fs, a1fs_inode *dir, void *entry, const char *name, size_t len){
+	bool compact = compact_dentries(fs->image);
+	a1fs_ino_t dir_ino = inode_number(fs->image, dir);
+	cache_shard *c = dcache_shard(fs, dir_ino, name, len);
+	pthread_mutex_lock(&c->lock);
+	dcache_remove(&c->dcache, dir_ino, name, len);
+	pthread_mutex_unlock(&c->lock);
+	dblk_remove(entry, compact);
+	meta_dirty(fs, entry, 1);
+	dir->dentry--;
+	dir->size -= dentry_size(len, compact);
+	inode_dirty(fs, dir);
+}
+
+/**
+ * Free an inode along with all of its data blocks and its indirect block.
+ * 
+ * @param fs		the file system context
+ * @param inode		the inode to free
+ */
+void free_inode(fs_ctx *fs, a1fs_inode *inode){
+	a1fs_superblock *superblock = (a1fs_superblock*)(fs->image);
+	unsigned char *inode_bitmap = (unsigned char*)(fs->image + (A1FS_BLOCK_SIZE * superblock->inode_bitmap));
+	a1fs_ino_t ino = inode_number(fs->image, inode);
+
+	// Look through the inode's existing extents to free space
+	int extents_count = 0;
+	for (int i = 0; extents_count < inode->extents && i < A1FS_IND_BLOCK + A1FS_NUM_EXTENTS; i++){
+		a1fs_extent *curr_extent = get_extent(fs->image, inode, i);
+		if (curr_extent->count == 0){
+			continue;
+		}
+		extents_count++;
+		if (curr_extent->start != A1FS_HOLE){
+			free_blocks(fs, curr_extent->start, curr_extent->count);
+		}
+	}
+	if ((inode->extent)[A1FS_IND_BLOCK].count > 0){
+		free_blocks(fs, (inode->extent)[A1FS_IND_BLOCK].start, 1);
+	}
+
+	// A directory is empty by now, and every entry removed from it took its
+	// cached name with it, so the dentry cache has nothing of it left.
+	bool dir = S_ISDIR(inode->mode);
+	cache_shard *c = extmap_shard(fs, ino);
+	pthread_mutex_lock(&c->lock);
+	extmap_remove(&c->extmap, ino);
+	pthread_mutex_unlock(&c->lock);
+	fs->extent_gens[ino]++;
+	memset(inode, 0, sizeof(a1fs_inode));
+	inode_dirty(fs, inode);
+
+	uint32_t g = ino / fs->inodes_per_group;
+	a1fs_group_desc *desc = &fs->groups[g];
+	pthread_mutex_lock(&fs->alloc_lock);
+	delalloc_remove(&fs->delalloc, ino);
+	set_bm(inode_bitmap, ino, 0);
+	bitmap_dirty(fs, inode_bitmap, ino, 1);
+	superblock->free_inodes_count += 1;
+	desc->free_inodes_count += 1;
+	if (ino - g * fs->inodes_per_group < desc->first_free_inode){
+		desc->first_free_inode = ino - g * fs->inodes_per_group;
+	}
+	if (dir){
+		desc->used_dirs_count -= 1;
+	}
+	group_dirty(fs, g);
+	pthread_mutex_unlock(&fs->alloc_lock);
+}
+
+/**
+ * Free a removed inode along with its blocks, as much as fits in the running
+ * journal transaction. A large file is freed from the end a step at a time;
+ * what is left stays allocated to the inode.
+ * 
+ * @param fs		the file system context
+ * @param inode		the inode to free; has a link count of 0
+ * @return			true if the inode was freed; false if blocks remain (call
+ * 					again in a new journal handle)
+ */
+static bool inode_release(fs_ctx *fs, a1fs_inode *inode){
+	if (S_ISREG(inode->mode) && file_release_tail(fs, inode, UINT64_MAX) > 0){
+		return false;
+	}
+	free_inode(fs, inode);
+	return true;
+}
+
+/**
+ * Fill in the attributes of a file or directory. Called with it locked.
+ * 
+ * @param fs		the file system context
+ * @param target	the file or directory
+ * @param st		the struct stat that receives the result
+ */
+static void inode_stat(fs_ctx *fs, a1fs_inode *target, struct stat *st){
+	memset(st, 0, sizeof(*st));
+	st->st_mode = target->mode;
+	st->st_nlink = target->links;
+	st->st_size = S_ISREG(target->mode) ? file_eof(fs, target) : target->size;
+	st->st_blocks = st->st_size / 512;
+	if (sparse_files(fs->image) && S_ISREG(target->mode)){
+		// Holes take up no space.
+		uint64_t blocks = 0;
+		for (int i = 0; i < target->extents; i++){
+			a1fs_extent *ext = get_extent(fs->image, target, i);
+			blocks += (ext->start != A1FS_HOLE) ? ext->count : 0;
+		}
+		st->st_blocks = blocks * (A1FS_BLOCK_SIZE / 512);
+	}
+	st->st_mtim = target->mtime;
+}
+
+int fsop_getattr(fs_ctx *fs, a1fs_ino_t ino, struct stat *st){
+	a1fs_inode *target = (void *)0;
+	int ret = inode_get_locked(fs, ino, &target, false);
+	if (ret != 0){
+		return ret;
+	}
+	inode_stat(fs, target, st);
+	inode_unlock(fs, target);
+	return 0;
+}
+
+/** State passed to readdir_block() through dir_for_each_block(). */
+typedef struct readdir_state {
+	dentry_fn fn;
+	void *arg;
+	bool compact;
+} readdir_state;
+
+static int readdir_block(void *block, void *arg){
+	readdir_state *state = (readdir_state*)arg;
+	return dblk_for_each(block, state->compact, state->fn, state->arg);
+}
+
+int fsop_readdir(fs_ctx *fs, a1fs_ino_t ino, dentry_fn fn, void *arg){
+	a1fs_inode *target = (void *)0;
+	int ret = inode_get_locked(fs, ino, &target, false);
+	if (ret != 0){
+		return ret;
+	}
+	if (!S_ISDIR(target->mode)){
+		inode_unlock(fs, target);
+		return -ENOTDIR;
+	}
+
+	readdir_state state = { fn, arg, compact_dentries(fs->image) };
+	ret = dir_for_each_block(fs->image, target, readdir_block, &state);
+	inode_unlock(fs, target);
+	return ret;
+}
+
+
+int fsop_mkdir(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, mode_t mode, a1fs_ino_t *ino){
+	journal_start(&fs->journal);
+
+	// Find a free entry in the parent directory in a single scan.
+	a1fs_lookup lookup;
+	int ret = entry_resolve(fs, dir, name, len, &lookup);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		return ret;
+	}
+	if (lookup.inode != NULL){
+		inode_unlock(fs, lookup.parent);
+		journal_stop(&fs->journal);
+		return -EEXIST;
+	}
+
+	// Make sure we have an available inode for the new dir entry.
+	int64_t inode_index = alloc_inode(fs, dir, true);
+	if (inode_index == -1){
+		inode_unlock(fs, lookup.parent);
+		journal_stop(&fs->journal);
+		return -ENOSPC;
+	}
+
+	//create the inode for the new directory and save it to the inode table
+	a1fs_inode *inode = inode_by_number(fs->image, inode_index);
+	init_inode(inode, mode | S_IFDIR);
+	inode->links = 2;
+	inode->dentry = 0;
+	inode_dirty(fs, inode);
+
+	ret = dir_add_entry(fs, lookup.parent, lookup.free_slot, lookup.name, lookup.len, inode_index, mode | S_IFDIR);
+	if (ret != 0){
+		free_inode(fs, inode);
+	} else {
+		lookup.parent->links++;
+		if (ino != NULL){
+			*ino = inode_index;
+		}
+	}
+	inode_unlock(fs, lookup.parent);
+	journal_stop(&fs->journal);
+	return ret;
+}
+
+int fsop_rmdir(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, a1fs_ino_t *orphan){
+	journal_start(&fs->journal);
+
+	//find the directory to be removed and its entry in the parent
+	a1fs_lookup lookup;
+	int ret = entry_resolve(fs, dir, name, len, &lookup);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		return ret;
+	}
+	if (lookup.dentry == NULL){
+		inode_unlock(fs, lookup.parent);
+		journal_stop(&fs->journal);
+		return -ENOENT;
+	}
+	a1fs_inode *directory = lookup.inode;
+
+	//check if directory is empty or not (its lock keeps entries from being added)
+	inode_lock(fs, directory, true);
+	if (!S_ISDIR(directory->mode)) {
+		ret = -ENOTDIR;
+	} else if (directory->size != 0 || directory->dentry != 0) {
+		ret = -ENOTEMPTY;
+	} else {
+		dir_remove_entry(fs, lookup.parent, lookup.dentry, lookup.name, lookup.len);
+		lookup.parent->links--;
+		directory->links = 0;
+		inode_dirty(fs, directory);
+		if (orphan != NULL){
+			*orphan = inode_number(fs->image, directory);
+		} else {
+			free_inode(fs, directory);
+		}
+	}
+	inode_unlock(fs, directory);
+	inode_unlock(fs, lookup.parent);
+	journal_stop(&fs->journal);
+	return ret;
+}
+
+int fsop_create(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, mode_t mode,
+                struct fuse_file_info *fi, a1fs_ino_t *ino){
+	assert(S_ISREG(mode));
+
+	// Set up before the file is created, so that running out of memory doesn't
+	// leave it behind.
+	int ret = handle_open(fi, 0);
+	if (ret != 0){
+		return ret;
+	}
+
+	journal_start(&fs->journal);
+
+	//find the place in the parent directory to insert the new dentry into
+	a1fs_lookup lookup;
+	ret = entry_resolve(fs, dir, name, len, &lookup);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		handle_close(fi);
+		return ret;
+	}
+	if (lookup.inode != NULL){
+		inode_unlock(fs, lookup.parent);
+		journal_stop(&fs->journal);
+		handle_close(fi);
+		return -EEXIST;
+	}
+
+	int64_t inode_index = alloc_inode(fs, dir, false);
+	if (inode_index == -1){
+		inode_unlock(fs, lookup.parent);
+		journal_stop(&fs->journal);
+		handle_close(fi);
+		return -ENOSPC;
+	}
+
+	//create the inode for the new file and save it to the inode table
+	a1fs_inode *inode = inode_by_number(fs->image, inode_index);
+	init_inode(inode, mode);
+	inode->dentry = 0;
+	inode_dirty(fs, inode);
+
+	ret = dir_add_entry(fs, lookup.parent, lookup.free_slot, lookup.name, lookup.len, inode_index, mode);
+	if (ret != 0){
+		free_inode(fs, inode);
+	}
+	inode_unlock(fs, lookup.parent);
+	journal_stop(&fs->journal);
+	if (ret != 0){
+		handle_close(fi);
+	} else {
+		handle_get(fi)->ino = inode_index;
+		if (ino != NULL){
+			*ino = inode_index;
+		}
+	}
+	return ret;
+}
+
+int fsop_unlink(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, a1fs_ino_t *orphan){
+	journal_start(&fs->journal);
+
+	//find the file to be removed and its entry in the parent
+	a1fs_lookup lookup;
+	int ret = entry_resolve(fs, dir, name, len, &lookup);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		return ret;
+	}
+	if (lookup.dentry == NULL){
+		inode_unlock(fs, lookup.parent);
+		journal_stop(&fs->journal);
+		return -ENOENT;
+	}
+	if (S_ISDIR(lookup.inode->mode)){
+		inode_unlock(fs, lookup.parent);
+		journal_stop(&fs->journal);
+		return -EISDIR;
+	}
+
+	dir_remove_entry(fs, lookup.parent, lookup.dentry, lookup.name, lookup.len);
+	inode_lock(fs, lookup.inode, true);
+	lookup.inode->links = 0;
+	inode_dirty(fs, lookup.inode);
+	int64_t left = -1;
+	if (orphan != NULL){
+		*orphan = inode_number(fs->image, lookup.inode);
+	} else if (!inode_release(fs, lookup.inode)){
+		left = inode_number(fs->image, lookup.inode);
+	}
+	inode_unlock(fs, lookup.inode);
+	inode_unlock(fs, lookup.parent);
+	journal_stop(&fs->journal);
+	if (left >= 0){
+		fsop_evict(fs, left);
+	}
+	return 0;
+}
+
+void fsop_evict(fs_ctx *fs, a1fs_ino_t ino){
+	// A large file takes several transactions to free.
+	bool freed = false;
+	while (!freed){
+		journal_start(&fs->journal);
+		a1fs_inode *inode = inode_by_number(fs->image, ino);
+		inode_lock(fs, inode, true);
+		freed = inode_release(fs, inode);
+		inode_unlock(fs, inode);
+		journal_stop(&fs->journal);
+	}
+}
+
+/**
+ * Move the entry found by orig to the place found by dest, replacing the entry
+ * there if it exists. The caller must hold the locks of both parents.
+ * 
+ * @param fs		the file system context
+ * @param orig		the entry to move; must exist
+ * @param dest		where to move it
+ * @param orphan	NULL to free the replaced inode; otherwise, the replaced
+ * 					inode is kept and its number stored here
+ * @param left		receives the number of the replaced inode if it is too
+ * 					large to be freed in this journal handle; the caller frees
+ * 					the rest with fsop_evict() after journal_stop()
+ * @return			0 on success; -errno on error
+ */
+static int rename_entry(fs_ctx *fs, a1fs_lookup *orig, a1fs_lookup *dest, a1fs_ino_t *orphan, int64_t *left){
+	bool compact = compact_dentries(fs->image);
+	a1fs_ino_t ino = dentry_ino(orig->dentry, compact);
+	int is_dir = S_ISDIR(orig->inode->mode);
+
+	if (dest->inode != NULL) {
+		//to exists; it must be replaced by pointing its entry at the moved inode
+		a1fs_inode *replaced = dest->inode;
+		inode_lock(fs, replaced, true);
+		if (S_ISDIR(replaced->mode) && (replaced->size != 0 || replaced->dentry != 0)) {
+			inode_unlock(fs, replaced);
+			return -ENOTEMPTY;
+		}
+		dentry_set_ino(dest->dentry, compact, ino, A1FS_DT(orig->inode->mode));
+		meta_dirty(fs, dest->dentry, 1);
+		a1fs_ino_t parent_ino = inode_number(fs->image, dest->parent);
+		cache_shard *c = dcache_shard(fs, parent_ino, dest->name, dest->len);
+		pthread_mutex_lock(&c->lock);
+		dcache_insert(&c->dcache, parent_ino, dest->name, dest->len, ino);
+		pthread_mutex_unlock(&c->lock);
+		if (S_ISDIR(replaced->mode)) {
+			dest->parent->links--;
+			inode_dirty(fs, dest->parent);
+		}
+		replaced->links = 0;
+		inode_dirty(fs, replaced);
+		if (orphan != NULL){
+			*orphan = inode_number(fs->image, replaced);
+		} else if (!inode_release(fs, replaced)){
+			*left = inode_number(fs->image, replaced);
+		}
+		inode_unlock(fs, replaced);
+	}
+	else {
+		//to does not exist; add a new entry for the moved inode
+		int ret = dir_add_entry(fs, dest->parent, dest->free_slot, dest->name, dest->len, ino, orig->inode->mode);
+		if (ret != 0){
+			return ret;
+		}
+		//making room in an indexed directory may have moved the old entry
+		if (dest->free_slot == NULL && dest->parent == orig->parent){
+			orig->dentry = dir_scan(fs->image, orig->parent, orig->name, orig->len, NULL);
+		}
+	}
+
+	//delete the old entry from the original parent
+	dir_remove_entry(fs, orig->parent, orig->dentry, orig->name, orig->len);
+	if (is_dir) {
+		orig->parent->links--;
+		dest->parent->links++;
+		inode_dirty(fs, dest->parent);
+	}
+	return 0;
+}
+
+/**
+ * Lock the parents of a rename in the given order, then find the entries in
+ * them and move the one found by orig to the place found by dest. The caller must hold fs->rename_lock and a journal handle.
+ * 
+ * @param fs		the file system context
+ * @param orig		the parent and name of the entry to move
+ * @param dest		the parent and name to move it to
+ * @param first		the parent to lock first
+ * @param orphan	as for rename_entry()
+ * @param left		as for rename_entry(); -1 if nothing is left to free
+ * @return			0 on success; -errno on error
+ */
+static int rename_lookups(fs_ctx *fs, a1fs_lookup *orig, a1fs_lookup *dest, a1fs_inode *first,
+                          a1fs_ino_t *orphan, int64_t *left){
+	*left = -1;
+	a1fs_inode *second = (first == orig->parent) ? dest->parent : orig->parent;
+	inode_lock(fs, first, true);
+	if (second != first){
+		inode_lock(fs, second, true);
+	}
+
+	//find the entries of the file to be moved and the file to be replaced
+	int ret = -ENOENT;
+	if (orig->parent->links != 0 && dest->parent->links != 0){
+		path_scan(fs, orig);
+		path_scan(fs, dest);
+		if (orig->dentry != NULL){
+			ret = rename_entry(fs, orig, dest, orphan, left);
+		}
+	}
+
+	if (second != first){
+		inode_unlock(fs, second);
+	}
+	inode_unlock(fs, first);
+	return ret;
+}
+
+int fsop_rename_path(fs_ctx *fs, const char *from, const char *to){
+	if (!strcmp(from, to)) {			//are the same files; no need to modify anything
+		return 0;
+	}
+
+	journal_start(&fs->journal);
+
+	//find the parents of the file to be moved and of the file to be replaced
+	pthread_mutex_lock(&fs->rename_lock);
+	a1fs_lookup orig, dest;
+	int ret = path_walk(fs, from, &orig);
+	if (ret == 0){
+		ret = path_walk(fs, to, &dest);
+	}
+	if (ret != 0){
+		pthread_mutex_unlock(&fs->rename_lock);
+		journal_stop(&fs->journal);
+		return ret;
+	}
+
+	// Paths are normalized, so a parent path (up to and including the last '/')
+	// that is a prefix of the other is an ancestor of it. A directory can't be
+	// moved under itself, and can't replace one of its ancestors (which isn't
+	// empty).
+	size_t from_len = strlen(from), to_len = strlen(to);
+	size_t from_plen = orig.name - from, to_plen = dest.name - to;
+	if (to_len > from_len && !strncmp(to, from, from_len) && to[from_len] == '/'){
+		pthread_mutex_unlock(&fs->rename_lock);
+		journal_stop(&fs->journal);
+		return -EINVAL;
+	}
+	if (from_plen > to_len && !strncmp(from, to, to_len) && from[to_len] == '/'){
+		pthread_mutex_unlock(&fs->rename_lock);
+		journal_stop(&fs->journal);
+		return -ENOTEMPTY;
+	}
+
+	// Lock the parents ancestor first, or by inode number if they are unrelated.
+	a1fs_inode *first = orig.parent;
+	if (to_plen < from_plen && !strncmp(from, to, to_plen)){
+		first = dest.parent;
+	} else if (!(from_plen < to_plen && !strncmp(from, to, from_plen)) &&
+	           inode_number(fs->image, dest.parent) < inode_number(fs->image, orig.parent)){
+		first = dest.parent;
+	}
+	int64_t left;
+	ret = rename_lookups(fs, &orig, &dest, first, NULL, &left);
+
+	pthread_mutex_unlock(&fs->rename_lock);
+	journal_stop(&fs->journal);
+	if (left >= 0){
+		fsop_evict(fs, left);
+	}
+	return ret;
+}
+
+int fsop_rename(fs_ctx *fs, a1fs_ino_t from_dir, const char *from, size_t from_len,
+                a1fs_ino_t to_dir, const char *to, size_t to_len, a1fs_ino_t *orphan){
+	if (from_len >= A1FS_NAME_MAX || to_len >= A1FS_NAME_MAX){
+		return -ENAMETOOLONG;
+	}
+	if (from_dir == to_dir && from_len == to_len && !memcmp(from, to, from_len)){
+		return 0;
+	}
+
+	a1fs_lookup orig = { inode_by_number(fs->image, from_dir), NULL, NULL, NULL, from, from_len };
+	a1fs_lookup dest = { inode_by_number(fs->image, to_dir), NULL, NULL, NULL, to, to_len };
+
+	// There are no paths to tell which parent is the ancestor of the other, so
+	// they are locked by inode number. This is only safe because the kernel
+	// holds the locks of both parents for the whole rename, and of the parent
+	// and the victim for an rmdir(); it has also checked that a directory isn't
+	// moved under itself or onto one of its ancestors.
+	journal_start(&fs->journal);
+	pthread_mutex_lock(&fs->rename_lock);
+	a1fs_inode *first = (to_dir < from_dir) ? dest.parent : orig.parent;
+	int64_t left;
+	int ret = rename_lookups(fs, &orig, &dest, first, orphan, &left);
+	pthread_mutex_unlock(&fs->rename_lock);
+	journal_stop(&fs->journal);
+	if (left >= 0){
+		fsop_evict(fs, left);
+	}
+	return ret;
+}
+
+int fsop_utimens(fs_ctx *fs, a1fs_ino_t ino, const struct timespec *mtime){
+	journal_start(&fs->journal);
+
+	a1fs_inode *target = (void *)0;
+	int ret = inode_get_locked(fs, ino, &target, true);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		return ret;
+	}
+
+	if (mtime == NULL || mtime->tv_nsec == UTIME_NOW) {			//change to current time
+		clock_gettime(CLOCK_REALTIME, &target->mtime);
+	}
+	else if (mtime->tv_nsec != UTIME_OMIT) {					//change to time stored in struct
+		target->mtime.tv_sec = mtime->tv_sec;
+		target->mtime.tv_nsec = mtime->tv_nsec;
+	}
+	inode_dirty(fs, target);
+	inode_unlock(fs, target);
+
+	journal_stop(&fs->journal);
+	return 0;
+}
+
+/**
+ * Set the size of a file, holding its lock.
+ * 
+ * @param fs		the file system context
+ * @param target	the file
+ * @param size		the new size in bytes
+ * @return			0 on success; -EAGAIN if the file is only part of the way
+ * 					there, and this is to be called again in a new journal
+ * 					handle (see file_restart()); -errno on error
+ */
+static int file_truncate(fs_ctx *fs, a1fs_inode *target, off_t size){
+	int ret = file_flush(fs, target);
+	if (ret != 0){
+		return ret;
+	}
+
+	// The file is resized through its extents alone: shrinking frees every
+	// block past the new last block without touching them, then zeroes the
+	// rest of the new last block, the only partial one. Growing allocates the
+	// missing blocks and zeroes them there (or adds a hole, in a sparse file);
+	// the blocks past EOF that a file already has were zeroed when they were
+	// allocated, so the new range reads as zeros.
+	//
+	// Both go a step at a time (see journal_due()). A file stopped part of the
+	// way ends at the blocks it has at that point, so that each transaction
+	// leaves it as if it had been resized to there.
+	uint64_t blocks = file_blocks(fs, target);
+	uint64_t new_blocks = align_up(size, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
+	uint64_t left = 0;
+	if ((uint64_t)size < target->size){
+		// The rest of the new last block is zeroed first, so that an I/O
+		// error leaves the file as it was.
+		extent_cursor cur;
+		size_t in_block = size % A1FS_BLOCK_SIZE;
+		size_t rest = A1FS_BLOCK_SIZE - in_block;
+		if (in_block != 0 && extent_seek(fs, target, size / A1FS_BLOCK_SIZE, &cur) != NULL &&
+		    extent_write(fs, target, &cur, &in_block, NULL, rest) != rest){
+			return -EIO;
+		}
+		if (blocks > new_blocks){
+			left = file_release_tail(fs, target, blocks - new_blocks);
+		}
+		if (left > 0){
+			uint64_t end = (new_blocks + left) * A1FS_BLOCK_SIZE;
+			if (end < target->size){
+				target->size = end;
+				inode_dirty(fs, target);
+			}
+			return -EAGAIN;
+		}
+	} else if (new_blocks > blocks && sparse_files(fs->image)){
+		ret = file_append_hole(fs, target, new_blocks - blocks);
+	} else if (new_blocks > blocks){
+		ret = file_extend_steps(fs, target, new_blocks - blocks);
+		if (ret == -EAGAIN){
+			target->size = file_blocks(fs, target) * A1FS_BLOCK_SIZE;
+			inode_dirty(fs, target);
+		}
+	}
+	if (ret != 0){
+		return ret;
+	}
+	target->size = size;
+	inode_dirty(fs, target);
+	return 0;
+}
+
+/**
+ * Set the size of a file, holding its lock, restarting the journal handle as
+ * often as it takes.
+ * 
+ * @param fs		the file system context
+ * @param ino		the inode number of the file
+ * @param target	the file, locked for writing; set to NULL if it has been
+ * 					freed while the handle was restarted, and is no longer locked
+ * @param size		the new size in bytes
+ * @return			0 on success; -errno on error
+ */
+static int file_resize(fs_ctx *fs, a1fs_ino_t ino, a1fs_inode **target, off_t size){
+	int ret = file_truncate(fs, *target, size);
+	while (ret == -EAGAIN){
+		ret = file_restart(fs, ino, target);
+		if (ret != 0){
+			*target = NULL;
+			return ret;
+		}
+		ret = file_truncate(fs, *target, size);
+	}
+	return ret;
+}
+
+int fsop_truncate(fs_ctx *fs, a1fs_ino_t ino, off_t size){
+	journal_start(&fs->journal);
+
+	// FUSE has checked that the file exists, but another thread may have
+	// removed it since then.
+	a1fs_inode *target = (void *)0;
+	int ret = inode_get_locked(fs, ino, &target, true);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		return ret;
+	}
+	ret = file_resize(fs, ino, &target, size);
+	if (target != NULL){
+		inode_unlock(fs, target);
+	}
+	journal_stop(&fs->journal);
+	return ret;
+}
+
+int fsop_open(fs_ctx *fs, a1fs_ino_t ino, struct fuse_file_info *fi){
+	(void)fs;// unused
+	return handle_open(fi, ino);
+}
+
+void fsop_release(struct fuse_file_info *fi){
+	handle_close(fi);
+}
+
+a1fs_ino_t fsop_ino(struct fuse_file_info *fi){
+	return handle_get(fi)->ino;
+}
+
+/**
+ * Lock an open file for reading. Readers share the file's lock. Buffered
+ * appends have to be written out first, which takes the lock exclusively and a
+ * journal handle.
+ * 
+ * @param fs		the file system context
+ * @param handle	the handle the file is read through
+ * @param inode		receives the file, locked for reading
+ * @return			0 on success; -errno on error
+ */
+static int handle_lock_read(fs_ctx *fs, a1fs_handle *handle, a1fs_inode **inode){
+	int ret = handle_lock(fs, handle, inode, false);
+	while (ret == 0 && fs->opts->delalloc && file_buffered(fs, *inode)){
+		inode_unlock(fs, *inode);
+		journal_start(&fs->journal);
+		ret = handle_lock(fs, handle, inode, true);
+		if (ret == 0){
+			ret = file_flush(fs, *inode);
+			inode_unlock(fs, *inode);
+		}
+		journal_stop(&fs->journal);
+		if (ret == 0){
+			ret = handle_lock(fs, handle, inode, false);
+		}
+	}
+	return ret;
+}
+
+int fsop_read(fs_ctx *fs, struct fuse_file_info *fi, char *buf, size_t size, off_t offset){
+	a1fs_handle *handle = handle_get(fi);
+
+	a1fs_inode *target = (void *)0;
+	int ret = handle_lock_read(fs, handle, &target);
+	if (ret != 0){
+		return ret;
+	}
+
+	// Check if the offset is beyond EOF.
+	if ((uint64_t)offset >= target->size){
+		inode_unlock(fs, target);
+		return 0;
+	}
+	if (size > target->size - offset){
+		size = target->size - offset;
+	}
+
+	// Go straight to the block containing offset (or continue from where the
+	// last read ended), then copy whole runs of contiguous blocks out of each
+	// extent.
+	extent_cursor cur;
+	handle_seek(fs, handle, target, offset, &cur);
+	size_t in_block = offset % A1FS_BLOCK_SIZE;
+	unsigned int prefetch_min = (fs->opts->prefetch_min > 0) ? fs->opts->prefetch_min : PREFETCH_MIN_KB;
+	if (!fs->opts->noprefetch && size >= (size_t)prefetch_min << 10){
+		extent_prefetch(fs, target, cur, in_block, size);
+	}
+	size_t byte_count = extent_read(fs, target, &cur, &in_block, buf, size);
+	if (byte_count == size){
+		handle_save(fs, handle, offset + size, &cur);
+	}
+
+	uint64_t file_size = target->size;
+	inode_unlock(fs, target);
+
+	readahead_read(&fs->readahead, &handle->ra, handle->ino, offset, size, file_size);
+
+	// Anything past the last allocated block has never been written.
+	memset(buf + byte_count, 0, size - byte_count);
+	return size;
+}
+
+int fsop_read_iov(fs_ctx *fs, struct fuse_file_info *fi, size_t size, off_t offset,
+                  fsop_iov_fn fn, void *arg){
+	a1fs_handle *handle = handle_get(fi);
+
+	a1fs_inode *target = (void *)0;
+	int ret = handle_lock_read(fs, handle, &target);
+	if (ret != 0){
+		return ret;
+	}
+
+	if ((uint64_t)offset >= target->size){
+		size = 0;
+	} else if (size > target->size - offset){
+		size = target->size - offset;
+	}
+
+	// The data is handed out where it is in the image, and fn has to be done
+	// with it before the file is unlocked. The pread backend may have newer
+	// data in its buffer cache than in the image, so it always copies.
+	struct iovec iov[FSOP_IOV_MAX];
+	int count = 0;
+	bool mapped = !fs->opts->pread || size == 0;
+	if (!fs->opts->pread && size > 0){
+		extent_cursor cur;
+		handle_seek(fs, handle, target, offset, &cur);
+		size_t in_block = offset % A1FS_BLOCK_SIZE;
+		unsigned int prefetch_min = (fs->opts->prefetch_min > 0) ? fs->opts->prefetch_min : PREFETCH_MIN_KB;
+		if (!fs->opts->noprefetch && size >= (size_t)prefetch_min << 10){
+			extent_prefetch(fs, target, cur, in_block, size);
+		}
+		size_t byte_count = extent_map(fs, target, &cur, &in_block, size, iov, &count);
+		if (byte_count == size){
+			handle_save(fs, handle, offset + size, &cur);
+		}
+
+		// Anything past the last allocated block has never been written. If
+		// blocks are left, the range is too fragmented for iov.
+		mapped = (cur.extent == NULL || byte_count == size) &&
+		         iov_append(iov, &count, NULL, size - byte_count);
+	}
+	if (mapped){
+		uint64_t file_size = target->size;
+		fn(arg, iov, count);
+		inode_unlock(fs, target);
+		if (size > 0){
+			readahead_read(&fs->readahead, &handle->ra, handle->ino, offset, size, file_size);
+		}
+		return 0;
+	}
+	inode_unlock(fs, target);
+
+	char *buf = malloc(size);
+	if (buf == NULL){
+		return -ENOMEM;
+	}
+	ret = fsop_read(fs, fi, buf, size, offset);
+	if (ret >= 0){
+		iov[0].iov_base = buf;
+		iov[0].iov_len = ret;
+		fn(arg, iov, 1);
+		ret = 0;
+	}
+	free(buf);
+	return ret;
+}
+
+/**
+ * Grow a file up to a write that starts far past its end first, the way
+ * truncate() would, so that the blocks of the gap are added in steps rather
+ * than all in the write's journal handle. Sparse files get a hole instead.
+ * 
+ * @param fs		the file system context
+ * @param handle	the handle the file is written through
+ * @param target	the file, locked for writing; set to NULL if it has been
+ * 					freed, and is no longer locked
+ * @param offset	the offset of the write
+ * @return			0 on success; -errno on error
+ */
+static int file_write_gap(fs_ctx *fs, a1fs_handle *handle, a1fs_inode **target, off_t offset){
+	if (sparse_files(fs->image) || (uint64_t)offset <= (*target)->size + (uint64_t)STEP_BLOCKS * A1FS_BLOCK_SIZE){
+		return 0;
+	}
+	return file_resize(fs, handle->ino, target, offset);
+}
+
+int fsop_write(fs_ctx *fs, struct fuse_file_info *fi, const char *buf, size_t size, off_t offset){
+	a1fs_handle *handle = handle_get(fi);
+
+	if (size == 0){
+		return 0;
+	}
+
+	journal_start(&fs->journal);
+
+	a1fs_inode *target = (void *)0;
+	int ret = handle_lock(fs, handle, &target, true);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		return ret;
+	}
+
+	// With delayed allocation, appends only go to the file's buffer. Anything
+	// else writes the buffer out first.
+	if (fs->opts->delalloc){
+		if ((uint64_t)offset == file_eof(fs, target) && file_buffer(fs, target, buf, size)){
+			ret = size;
+		} else {
+			ret = file_flush(fs, target);
+		}
+	}
+	if (ret == 0){
+		ret = file_write_gap(fs, handle, &target, offset);
+	}
+	if (ret == 0){
+		ret = file_write(fs, target, buf, NULL, size, offset, handle);
+	}
+	if (target != NULL){
+		inode_unlock(fs, target);
+	}
+	journal_stop(&fs->journal);
+	return ret;
+}
+
+int fsop_write_buf(fs_ctx *fs, struct fuse_file_info *fi, struct fuse_bufvec *bufv, off_t offset){
+	// Data that is already in memory (e.g. in the request) is written from
+	// where it is.
+	size_t size = fuse_buf_size(bufv);
+	if (bufv->count == 1 && !(bufv->buf[0].flags & FUSE_BUF_IS_FD)){
+		return fsop_write(fs, fi, (const char*)bufv->buf[0].mem + bufv->off, size - bufv->off, offset);
+	}
+	if (size == 0){
+		return 0;
+	}
+
+	// Delayed allocation buffers the data and --detect_zeroes looks at it, and
+	// the pread backend writes through its buffer cache, so they need the data
+	// in memory first.
+	if (fs->opts->delalloc || fs->opts->detect_zeroes || fs->opts->pread){
+		char *buf = malloc(size);
+		if (buf == NULL){
+			return -ENOMEM;
+		}
+		struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+		dst.buf[0].mem = buf;
+		ssize_t len = fuse_buf_copy(&dst, bufv, 0);
+		int ret = (len < 0) ? (int)len : fsop_write(fs, fi, buf, len, offset);
+		free(buf);
+		return ret;
+	}
+
+	a1fs_handle *handle = handle_get(fi);
+	journal_start(&fs->journal);
+	a1fs_inode *target = (void *)0;
+	int ret = handle_lock(fs, handle, &target, true);
+	if (ret == 0){
+		ret = file_write_gap(fs, handle, &target, offset);
+		if (ret == 0){
+			ret = file_write(fs, target, NULL, bufv, size, offset, handle);
+		}
+		if (target != NULL){
+			inode_unlock(fs, target);
+		}
+	}
+	journal_stop(&fs->journal);
+	return ret;
+}
+
+int fsop_flush(fs_ctx *fs, struct fuse_file_info *fi){
+	a1fs_handle *handle = handle_get(fi);
+
+	a1fs_inode *target = inode_by_number(fs->image, handle->ino);
+	if (!file_buffered(fs, target)){
+		return 0;
+	}
+	journal_start(&fs->journal);
+	int ret = handle_lock(fs, handle, &target, true);
+	if (ret == 0){
+		ret = file_flush(fs, target);
+		inode_unlock(fs, target);
+	}
+	journal_stop(&fs->journal);
+	return ret;
+}
+
+/**
+ * Sync the changed blocks of a file: its data blocks, and unless the journal
+ * takes care of them, its inode and indirect block. Called with the file locked.
+ * 
+ * @param fs		the file system context
+ * @param inode		the file
+ * @return			0 on success; -errno on error
+ */
+static int file_sync(fs_ctx *fs, a1fs_inode *inode){
+	a1fs_superblock *sb = (a1fs_superblock*)(fs->image);
+	int ret = 0;
+	for (int i = 0; i < inode->extents; i++){
+		a1fs_extent *ext = get_extent(fs->image, inode, i);
+		if (ext->start != A1FS_HOLE){
+			int err = writeback_flush(&fs->writeback, (uint64_t)sb->data_region + ext->start, ext->count);
+			if (ret == 0){
+				ret = err;
+			}
+		}
+	}
+	if (fs->journal.span > 0){
+		return ret;
+	}
+
+	size_t off = (char*)inode - (char*)fs->image;
+	int err = writeback_flush(&fs->writeback, off / A1FS_BLOCK_SIZE, 1);
+	if (ret == 0){
+		ret = err;
+	}
+	if ((inode->extent)[A1FS_IND_BLOCK].count > 0){
+		err = writeback_flush(&fs->writeback, (uint64_t)sb->data_region + (inode->extent)[A1FS_IND_BLOCK].start, 1);
+		if (ret == 0){
+			ret = err;
+		}
+	}
+	return ret;
+}
+
+int fsop_fsync(fs_ctx *fs, struct fuse_file_info *fi){
+	journal_start(&fs->journal);
+	a1fs_inode *target = (void *)0;
+	int ret = handle_lock(fs, handle_get(fi), &target, true);
+	if (ret == 0){
+		ret = file_flush(fs, target);
+		if (ret == 0){
+			ret = file_sync(fs, target);
+		}
+		inode_unlock(fs, target);
+	}
+	journal_stop(&fs->journal);
+	if (ret == 0){
+		ret = journal_commit(&fs->journal);
+	}
+	return ret;
+}
+
+/**
+ * Preallocate space for a file or punch a hole in it, holding its lock. The
+ * arguments are as for fsop_fallocate() and have been checked.
+ * 
+ * @param fs		the file system context
+ * @param target	the file
+ * @param mode		the fallocate() mode
+ * @param offset	the offset of the start of the range
+ * @param length	the length of the range
+ * @return			0 on success; -EAGAIN if only part of the range is done,
+ * 					and this is to be called again in a new journal handle
+ * 					(see file_restart()); -errno on error
+ */
+static int file_fallocate(fs_ctx *fs, a1fs_inode *target, int mode, off_t offset, off_t length){
+	bool punch = mode & FALLOC_FL_PUNCH_HOLE;
+	int ret = file_flush(fs, target);
+	if (ret != 0){
+		return ret;
+	}
+
+	uint64_t end = offset + length;
+	uint64_t old_blocks = file_blocks(fs, target);
+	uint64_t new_blocks = align_up(end, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
+	if (punch){
+		// Zero the partial blocks at the edges, then free the whole ones.
+		if (end > old_blocks * A1FS_BLOCK_SIZE){
+			end = old_blocks * A1FS_BLOCK_SIZE;
+		}
+		if ((uint64_t)offset >= end){
+			return 0;
+		}
+		uint64_t first = align_up(offset, A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
+		uint64_t last = end / A1FS_BLOCK_SIZE;
+		extent_cursor cur;
+		size_t in_block = offset % A1FS_BLOCK_SIZE;
+		if (first > last){
+			extent_seek(fs, target, offset / A1FS_BLOCK_SIZE, &cur);
+			size_t len = end - offset;
+			return (extent_write(fs, target, &cur, &in_block, NULL, len) == len) ? 0 : -EIO;
+		}
+		size_t head = A1FS_BLOCK_SIZE - in_block;
+		if (in_block != 0){
+			extent_seek(fs, target, offset / A1FS_BLOCK_SIZE, &cur);
+			if (extent_write(fs, target, &cur, &in_block, NULL, head) != head){
+				return -EIO;
+			}
+		}
+		size_t tail = end % A1FS_BLOCK_SIZE;
+		if (tail != 0){
+			in_block = 0;
+			extent_seek(fs, target, last, &cur);
+			if (extent_write(fs, target, &cur, &in_block, NULL, tail) != tail){
+				return -EIO;
+			}
+		}
+		return file_punch_hole(fs, target, first, last - first);
+	}
+
+	// Holes inside the range get blocks, and so does the range past the last block.
+	if (sparse_files(fs->image) && (uint64_t)offset / A1FS_BLOCK_SIZE < old_blocks){
+		uint64_t first = offset / A1FS_BLOCK_SIZE;
+		uint64_t last = (new_blocks < old_blocks) ? new_blocks : old_blocks;
+		ret = file_fill_holes(fs, target, first, last - first);
+		if (ret != 0){
+			return ret;
+		}
+	}
+	if (new_blocks > old_blocks){
+		ret = file_extend_steps(fs, target, new_blocks - old_blocks);
+		if (ret != 0){
+			return ret;
+		}
+	}
+
+	if (!(mode & FALLOC_FL_KEEP_SIZE) && end > target->size){
+		target->size = end;
+		inode_dirty(fs, target);
+	}
+	return 0;
+}
+
+int fsop_fallocate(fs_ctx *fs, struct fuse_file_info *fi, int mode, off_t offset, off_t length){
+	bool punch = mode & FALLOC_FL_PUNCH_HOLE;
+	if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) ||
+	    (punch && (!(mode & FALLOC_FL_KEEP_SIZE) || !sparse_files(fs->image)))) {
+		return -EOPNOTSUPP;
+	}
+	if (offset < 0 || length <= 0) {
+		return -EINVAL;
+	}
+
+	journal_start(&fs->journal);
+
+	a1fs_inode *target = (void *)0;
+	int ret = handle_lock(fs, handle_get(fi), &target, true);
+	if (ret != 0){
+		journal_stop(&fs->journal);
+		return ret;
+	}
+	ret = file_fallocate(fs, target, mode, offset, length);
+	while (ret == -EAGAIN){
+		ret = file_restart(fs, handle_get(fi)->ino, &target);
+		if (ret != 0){
+			journal_stop(&fs->journal);
+			return ret;
+		}
+		ret = file_fallocate(fs, target, mode, offset, length);
+	}
+	inode_unlock(fs, target);
+	journal_stop(&fs->journal);
+	return ret;
+}
@@ -0,0 +1,227 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - File system operations header file.
+ *
+ * The file system operations shared by the high-level (path-based) and the
+ * low-level (inode-based) FUSE drivers. Files and directories are given by
+ * inode number, and new or removed entries by the inode number of their
+ * parent directory and a name in it; names are not null-terminated. Apart
+ * from fsop_walk() and fsop_path_lookup(), which resolve paths for the
+ * high-level driver, nothing here looks at paths.
+ *
+ * Unless stated otherwise, the functions return 0 on success and -errno on
+ * error, as FUSE callbacks do. Open files and directories keep their state in
+ * fi->fh; it is set up by fsop_open() or fsop_create() and freed by
+ * fsop_release().
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "a1fs.h"
+#include "dentry.h"
+#include "fs_ctx.h"
+#include "options.h"
+
+struct fuse_file_info;
+struct fuse_bufvec;
+
+
+/**
+ * Map the image and initialize the file system context. Called before FUSE
+ * is started, since its init() callback can't fail.
+ *
+ * @param fs    file system context to initialize.
+ * @param opts  command line options.
+ * @return      true on success; false on failure.
+ */
+bool fsop_init(fs_ctx *fs, a1fs_opts *opts);
+
+/**
+ * Start the background work of the file system: apply the mapping policy and
+ * start the journal commit, writeback and readahead threads. Called from the
+ * FUSE init() callback, once FUSE has forked into the background.
+ */
+void fsop_start(fs_ctx *fs);
+
+/**
+ * Write out what is still buffered, print the statistics if verbose, and free
+ * everything set up by fsop_init(). Called from the FUSE destroy() callback.
+ */
+void fsop_destroy(fs_ctx *fs);
+
+/** Get file system statistics, as for statvfs(). */
+void fsop_statfs(fs_ctx *fs, struct statvfs *st);
+
+/**
+ * Walk all the components of an absolute path except for the last one.
+ *
+ * @param path  an absolute path.
+ * @param dir   set to the inode number of the directory containing the last
+ *              component.
+ * @param name  set to point to the last component inside path.
+ * @param len   set to the length of the last component; 0 for "/".
+ * @return      0 on success; -ENOENT, -ENOTDIR or -ENAMETOOLONG on error.
+ */
+int fsop_walk(fs_ctx *fs, const char *path, a1fs_ino_t *dir, const char **name, size_t *len);
+
+/** Find the inode number of the file or directory given by an absolute path. */
+int fsop_path_lookup(fs_ctx *fs, const char *path, a1fs_ino_t *ino);
+
+/**
+ * Find the inode number of the entry called name in the directory dir.
+ *
+ * @return  0 on success; -ENOENT, -ENOTDIR or -ENAMETOOLONG on error.
+ */
+int fsop_lookup(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, a1fs_ino_t *ino);
+
+/** Get the attributes of a file or directory, as for stat(); st_ino is not set. */
+int fsop_getattr(fs_ctx *fs, a1fs_ino_t ino, struct stat *st);
+
+/**
+ * Set the modification time of a file or directory.
+ *
+ * @param mtime  the new time; NULL or UTIME_NOW for the current time, and
+ *               UTIME_OMIT to leave it unchanged.
+ */
+int fsop_utimens(fs_ctx *fs, a1fs_ino_t ino, const struct timespec *mtime);
+
+/** Change the size of a file. Extending it fills the new range with zeros. */
+int fsop_truncate(fs_ctx *fs, a1fs_ino_t ino, off_t size);
+
+/**
+ * Call fn for every entry of a directory, with the directory locked. The
+ * entry type passed to fn is 0 unless the directory entries record it.
+ *
+ * @return  0 on success; the first non-zero return value of fn, or -errno.
+ */
+int fsop_readdir(fs_ctx *fs, a1fs_ino_t ino, dentry_fn fn, void *arg);
+
+/**
+ * Create a directory.
+ *
+ * @param ino  if not NULL, set to the inode number of the new directory.
+ */
+int fsop_mkdir(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, mode_t mode, a1fs_ino_t *ino);
+
+/**
+ * Create a file and open it.
+ *
+ * @param fi   receives the state of the new open file.
+ * @param ino  if not NULL, set to the inode number of the new file.
+ */
+int fsop_create(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, mode_t mode,
+                struct fuse_file_info *fi, a1fs_ino_t *ino);
+
+/**
+ * Remove an empty directory, or a file.
+ *
+ * The removed inode is freed right away if orphan is NULL. Otherwise it is
+ * kept with a link count of 0, still readable and writable through its number,
+ * and its number is stored in orphan; the caller must free it with fsop_evict() once nothing
+ * refers to it any more.
+ */
+int fsop_rmdir(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, a1fs_ino_t *orphan);
+int fsop_unlink(fs_ctx *fs, a1fs_ino_t dir, const char *name, size_t len, a1fs_ino_t *orphan);
+
+/** Free an inode kept by fsop_rmdir(), fsop_unlink() or fsop_rename(). */
+void fsop_evict(fs_ctx *fs, a1fs_ino_t ino);
+
+/**
+ * Rename a file or directory given by absolute paths. Fails with -EINVAL if a
+ * directory would be moved under itself, and -ENOTEMPTY if it would replace
+ * one of its ancestors. A replaced inode is freed right away.
+ */
+int fsop_rename_path(fs_ctx *fs, const char *from, const char *to);
+
+/**
+ * Rename the entry called from in the directory from_dir to the name to in
+ * the directory to_dir, replacing the entry there if it exists. Moving a
+ * directory under itself is not checked for; the kernel does that.
+ *
+ * @param orphan  as for fsop_unlink(), for the replaced inode; left as it was
+ *                if nothing is replaced.
+ */
+int fsop_rename(fs_ctx *fs, a1fs_ino_t from_dir, const char *from, size_t from_len,
+                a1fs_ino_t to_dir, const char *to, size_t to_len, a1fs_ino_t *orphan);
+
+/** Open a file or directory; fi receives its state. */
+int fsop_open(fs_ctx *fs, a1fs_ino_t ino, struct fuse_file_info *fi);
+
+/** Free the state of an open file or directory. */
+void fsop_release(struct fuse_file_info *fi);
+
+/** Get the inode number of an open file or directory. */
+a1fs_ino_t fsop_ino(struct fuse_file_info *fi);
+
+/**
+ * Read from an open file, as for pread(). Reads past EOF are short; holes and
+ * blocks that have never been written read as zeros.
+ *
+ * @return  number of bytes read on success; -errno on error.
+ */
+int fsop_read(fs_ctx *fs, struct fuse_file_info *fi, char *buf, size_t size, off_t offset);
+
+/** Maximum number of pieces that fsop_read_iov() maps a read to. */
+#define FSOP_IOV_MAX 256
+
+/** Receives the data of a read as count pieces of memory. */
+typedef void (*fsop_iov_fn)(void *arg, const struct iovec *iov, int count);
+
+/**
+ * Read from an open file, as fsop_read(), without copying: fn is called once
+ * with the data where it is in the image, while the file is locked. Ranges too
+ * fragmented for FSOP_IOV_MAX pieces, and all reads with the pread backend,
+ * are copied into a buffer instead.
+ *
+ * @return  0 if fn was called; -errno on error.
+ */
+int fsop_read_iov(fs_ctx *fs, struct fuse_file_info *fi, size_t size, off_t offset,
+                  fsop_iov_fn fn, void *arg);
+
+/**
+ * Write to an open file, as for pwrite(), extending it if needed.
+ *
+ * @return  number of bytes written on success; -errno on error.
+ */
+int fsop_write(fs_ctx *fs, struct fuse_file_info *fi, const char *buf, size_t size, off_t offset);
+
+/**
+ * Write to an open file from a FUSE buffer, as fsop_write(). Data still in a
+ * pipe (with splice_read) is read from it straight into the file's blocks.
+ *
+ * @return  number of bytes written on success; -errno on error.
+ */
+int fsop_write_buf(fs_ctx *fs, struct fuse_file_info *fi, struct fuse_bufvec *bufv, off_t offset);
+
+/** Write out the data of an open file held back by delayed allocation. */
+int fsop_flush(fs_ctx *fs, struct fuse_file_info *fi);
+
+/** Sync the changed blocks of an open file and commit the journal. */
+int fsop_fsync(fs_ctx *fs, struct fuse_file_info *fi);
+
+/**
+ * Preallocate space for an open file, or punch a hole in it, as for
+ * fallocate(). Supports 0, FALLOC_FL_KEEP_SIZE, and (on images with the
+ * "sparse" feature) FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE.
+ */
+int fsop_fallocate(fs_ctx *fs, struct fuse_file_info *fi, int mode, off_t offset, off_t length);
@@ -0,0 +1,142 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Inode lock table implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ilock.h"
+
+
+static ilock_shard *shard_of(ilock_table *t, a1fs_ino_t ino)
+{
+	return &t->shards[ino & (ILOCK_SHARDS - 1)];
+}
+
+/** Find the active lock of an inode and the link pointing to it. */
+static ilock **find_link(ilock_shard *s, a1fs_ino_t ino)
+{
+	ilock **link = &s->active;
+	while (*link != NULL && (*link)->ino != ino) {
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+/** Get the lock of an inode and count the caller as its user. */
+static ilock *get(ilock_shard *s, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&s->lock);
+	ilock *l = *find_link(s, ino);
+	if (l == NULL) {
+		if (s->free != NULL) {
+			l = s->free;
+			s->free = l->next;
+		} else {
+			l = malloc(sizeof(*l));
+			if (l == NULL) {
+				fprintf(stderr, "a1fs: out of memory for an inode lock\n");
+				abort();
+			}
+			pthread_rwlock_init(&l->lock, NULL);
+		}
+		l->ino = ino;
+		l->users = 0;
+		l->next = s->active;
+		s->active = l;
+	}
+	l->users++;
+	pthread_mutex_unlock(&s->lock);
+	return l;
+}
+
+/** Drop a user of a lock; the caller must hold the shard mutex. */
+static void put_locked(ilock_shard *s, ilock *l)
+{
+	if (--l->users == 0) {
+		ilock **link = find_link(s, l->ino);
+		*link = l->next;
+		l->next = s->free;
+		s->free = l;
+	}
+}
+
+void ilock_init(ilock_table *t)
+{
+	for (size_t i = 0; i < ILOCK_SHARDS; i++) {
+		ilock_shard *s = &t->shards[i];
+		pthread_mutex_init(&s->lock, NULL);
+		s->active = NULL;
+		s->free = NULL;
+	}
+}
+
+static void free_list(ilock *l)
+{
+	while (l != NULL) {
+		ilock *next = l->next;
+		pthread_rwlock_destroy(&l->lock);
+		free(l);
+		l = next;
+	}
+}
+
+void ilock_destroy(ilock_table *t)
+{
+	for (size_t i = 0; i < ILOCK_SHARDS; i++) {
+		ilock_shard *s = &t->shards[i];
+		free_list(s->active);
+		free_list(s->free);
+		pthread_mutex_destroy(&s->lock);
+	}
+}
+
+void ilock_acquire(ilock_table *t, a1fs_ino_t ino, bool write)
+{
+	// The user count keeps the lock from being reused while we wait for it.
+	ilock *l = get(shard_of(t, ino), ino);
+	if (write) {
+		pthread_rwlock_wrlock(&l->lock);
+	} else {
+		pthread_rwlock_rdlock(&l->lock);
+	}
+}
+
+bool ilock_try(ilock_table *t, a1fs_ino_t ino, bool write)
+{
+	ilock_shard *s = shard_of(t, ino);
+	ilock *l = get(s, ino);
+	int ret = write ? pthread_rwlock_trywrlock(&l->lock) : pthread_rwlock_tryrdlock(&l->lock);
+	if (ret != 0) {
+		pthread_mutex_lock(&s->lock);
+		put_locked(s, l);
+		pthread_mutex_unlock(&s->lock);
+		return false;
+	}
+	return true;
+}
+
+void ilock_release(ilock_table *t, a1fs_ino_t ino)
+{
+	ilock_shard *s = shard_of(t, ino);
+	pthread_mutex_lock(&s->lock);
+	ilock *l = *find_link(s, ino);
+	// Unlocking never blocks, so it is safe under the shard mutex.
+	pthread_rwlock_unlock(&l->lock);
+	put_locked(s, l);
+	pthread_mutex_unlock(&s->lock);
+}
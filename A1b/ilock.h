@@ -0,0 +1,96 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Inode lock table header file.
+ *
+ * Every inode has its own reader/writer lock, but only while some thread holds
+ * or waits for it: a lock is set up the first time it is taken and put on a
+ * free list when its last user lets go. Memory and mount time therefore depend
+ * on the number of inodes in use, not on the size of the inode table. The
+ * table is split into shards with a mutex each, held only for the bookkeeping,
+ * so that threads working on different inodes rarely meet.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "a1fs.h"
+
+
+/** Number of shards of the inode lock table. Must be a power of 2. */
+#define ILOCK_SHARDS 64
+
+
+/** The lock of one inode. */
+typedef struct ilock {
+	/** Next lock in the same shard (active or free list). */
+	struct ilock *next;
+	/** Inode number the lock belongs to while it is active. */
+	a1fs_ino_t ino;
+	/** Number of threads holding or waiting for the lock. */
+	unsigned int users;
+	pthread_rwlock_t lock;
+
+} ilock;
+
+/** A shard of the inode lock table. */
+typedef struct ilock_shard {
+	/** Protects the lists and the user counts, not the inode locks. */
+	pthread_mutex_t lock;
+	/** Locks in use and locks ready to be reused. */
+	ilock *active;
+	ilock *free;
+
+} ilock_shard;
+
+/** Table of the locks of the inodes in use. */
+typedef struct ilock_table {
+	ilock_shard shards[ILOCK_SHARDS];
+
+} ilock_table;
+
+
+/** Initialize an empty inode lock table. */
+void ilock_init(ilock_table *t);
+
+/** Free all the memory used by the table. No lock may be held. */
+void ilock_destroy(ilock_table *t);
+
+/**
+ * Lock an inode, blocking until the lock is available.
+ *
+ * Runs out of memory only if the process does, in which case it aborts: the
+ * callers have no way to back out of taking a lock.
+ *
+ * @param t      the table.
+ * @param ino    inode number.
+ * @param write  true for exclusive access; false for shared access.
+ */
+void ilock_acquire(ilock_table *t, a1fs_ino_t ino, bool write);
+
+/**
+ * Lock an inode if it can be done without blocking.
+ *
+ * @param t      the table.
+ * @param ino    inode number.
+ * @param write  true for exclusive access; false for shared access.
+ * @return       true if the lock was taken; false otherwise.
+ */
+bool ilock_try(ilock_table *t, a1fs_ino_t ino, bool write);
+
+/** Unlock an inode locked with ilock_acquire() or ilock_try(). */
+void ilock_release(ilock_table *t, a1fs_ino_t ino);
@@ -0,0 +1,652 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Metadata journal implementation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bitmap.h"
+#include "journal.h"
+#include "util.h"
+
+
+/** Get a pointer to block blk of the image. */
+static inline void *image_block(void *image, uint64_t blk)
+{
+	return (char*)image + blk * A1FS_BLOCK_SIZE;
+}
+
+/** Get a pointer to block pos of a journal region. */
+static inline a1fs_journal_header *journal_block(void *image, uint64_t start, uint64_t pos)
+{
+	return (a1fs_journal_header*)image_block(image, start + pos);
+}
+
+/** Checksum of count blocks, seeded with the transaction sequence number (FNV-1a over 64-bit words). */
+static uint32_t checksum(const void *blocks, uint64_t count, uint64_t seq)
+{
+	const unsigned char *p = (const unsigned char*)blocks;
+	uint64_t hash = 14695981039346656037ull ^ seq;
+	for (size_t i = 0; i < count * A1FS_BLOCK_SIZE; i += sizeof(uint64_t)) {
+		uint64_t w;
+		memcpy(&w, p + i, sizeof(w));
+		hash = (hash ^ w) * 1099511628211ull;
+	}
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+/** Check that a journal block is a header of the given transaction. */
+static bool valid_header(const a1fs_journal_header *h, uint64_t seq)
+{
+	return h->magic == A1FS_JOURNAL_MAGIC && h->seq == seq &&
+	       h->type >= A1FS_JOURNAL_DESCRIPTOR && h->type <= A1FS_JOURNAL_COMMIT &&
+	       (h->type == A1FS_JOURNAL_COMMIT || h->count <= A1FS_JOURNAL_ENTRIES);
+}
+
+/** Allocate a zeroed bitmap of count bits, padded to whole 64-bit words. */
+static unsigned char *bitmap_alloc(uint64_t count)
+{
+	return calloc(align_up(count, 64) / 8, 1);
+}
+
+/** Append a block number to a growable list; false if out of memory. */
+static bool list_append(uint64_t **list, size_t *n, size_t *cap, uint64_t blk)
+{
+	if (*n == *cap) {
+		size_t new_cap = (*cap > 0) ? *cap * 2 : 64;
+		uint64_t *p = realloc(*list, new_cap * sizeof(uint64_t));
+		if (p == NULL) return false;
+		*list = p;
+		*cap = new_cap;
+	}
+	(*list)[(*n)++] = blk;
+	return true;
+}
+
+
+/** A block revoked during replay and the last transaction that revoked it. */
+typedef struct revoke_entry {
+	uint64_t blk;
+	uint64_t seq;
+} revoke_entry;
+
+static int revoke_cmp(const void *a, const void *b)
+{
+	const revoke_entry *x = (const revoke_entry*)a, *y = (const revoke_entry*)b;
+	if (x->blk != y->blk) return (x->blk < y->blk) ? -1 : 1;
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+/** Check if the copy of blk in transaction seq is revoked by a later (or the same) transaction. */
+static bool is_revoked(const revoke_entry *revokes, size_t n, uint64_t blk, uint64_t seq)
+{
+	// The entries are sorted by block, then by sequence number; find the last one for blk.
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (revokes[mid].blk <= blk) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo > 0 && revokes[lo - 1].blk == blk && revokes[lo - 1].seq >= seq;
+}
+
+/**
+ * Find the committed transactions in a journal, collecting their revoke
+ * records. The transactions end at the first one that is incomplete or whose
+ * checksum doesn't match.
+ *
+ * @return  the number of transactions; -1 if out of memory.
+ */
+static int64_t scan_journal(void *image, uint64_t start, uint64_t span, uint64_t seq,
+                            revoke_entry **revokes, size_t *nrevokes)
+{
+	size_t cap = 0;
+	int64_t ntxn = 0;
+	uint64_t pos = 1;
+	while (pos < span) {
+		uint64_t first = pos;
+		size_t txn_revokes = *nrevokes;
+		bool committed = false;
+		while (pos < span) {
+			a1fs_journal_header *h = journal_block(image, start, pos);
+			if (!valid_header(h, seq)) break;
+			if (h->type == A1FS_JOURNAL_COMMIT) {
+				committed = h->count == pos - first &&
+				            h->checksum == checksum(journal_block(image, start, first), pos - first, seq);
+				pos++;
+				break;
+			}
+			if (h->type == A1FS_JOURNAL_REVOKE) {
+				for (uint32_t i = 0; i < h->count; i++) {
+					if (*nrevokes == cap) {
+						size_t new_cap = (cap > 0) ? cap * 2 : 64;
+						revoke_entry *p = realloc(*revokes, new_cap * sizeof(revoke_entry));
+						if (p == NULL) return -1;
+						*revokes = p;
+						cap = new_cap;
+					}
+					(*revokes)[(*nrevokes)++] = (revoke_entry){ h->blocks[i], seq };
+				}
+			}
+			pos += 1 + ((h->type == A1FS_JOURNAL_DESCRIPTOR) ? h->count : 0);
+		}
+		if (!committed || pos > span) {
+			*nrevokes = txn_revokes;
+			break;
+		}
+		ntxn++;
+		seq++;
+	}
+	return ntxn;
+}
+
+int journal_replay(void *image, size_t size)
+{
+	a1fs_superblock *sb = (a1fs_superblock*)image;
+	if (!(sb->features & A1FS_FEATURE_JOURNAL)) return 0;
+
+	uint64_t image_blocks = size / A1FS_BLOCK_SIZE;
+	uint64_t start = sb->journal;
+	uint64_t span = sb->journal_span;
+	if (span < 2 || start + span > image_blocks) return -1;
+	a1fs_journal_sb *jsb = (a1fs_journal_sb*)image_block(image, start);
+	if (jsb->magic != A1FS_JOURNAL_MAGIC) return -1;
+
+	// First find the committed transactions and all their revoke records, so
+	// that a block isn't replayed if a later transaction revoked it.
+	revoke_entry *revokes = NULL;
+	size_t nrevokes = 0;
+	int64_t ntxn = scan_journal(image, start, span, jsb->seq, &revokes, &nrevokes);
+	if (ntxn < 0) {
+		free(revokes);
+		return -1;
+	}
+	if (nrevokes > 0) qsort(revokes, nrevokes, sizeof(revoke_entry), revoke_cmp);
+
+	// Then copy the blocks back in place, oldest transaction first.
+	uint64_t seq = jsb->seq;
+	uint64_t pos = 1;
+	bool valid = true;
+	for (int64_t t = 0; t < ntxn; t++, seq++) {
+		a1fs_journal_header *h;
+		while ((h = journal_block(image, start, pos))->type != A1FS_JOURNAL_COMMIT) {
+			pos++;
+			if (h->type != A1FS_JOURNAL_DESCRIPTOR) continue;
+			for (uint32_t i = 0; i < h->count; i++, pos++) {
+				uint64_t blk = h->blocks[i];
+				if (blk >= image_blocks || (blk >= start && blk < start + span)) {
+					valid = false;
+					continue;
+				}
+				if (!is_revoked(revokes, nrevokes, blk, seq)) {
+					memcpy(image_block(image, blk), journal_block(image, start, pos), A1FS_BLOCK_SIZE);
+				}
+			}
+		}
+		pos++;
+	}
+	free(revokes);
+	if (!valid) return -1;
+
+	// The replayed blocks must be on disk before the journal is emptied.
+	if (ntxn == 0) return 0;
+	if (msync(image, size, MS_SYNC) < 0) {
+		perror("msync");
+		return -1;
+	}
+	jsb->seq = seq;
+	if (msync(jsb, A1FS_BLOCK_SIZE, MS_SYNC) < 0) {
+		perror("msync");
+		return -1;
+	}
+	return (int)ntxn;
+}
+
+
+bool journal_init(journal *j, void *image, void *meta, size_t size, unsigned int interval)
+{
+	memset(j, 0, sizeof(*j));
+	j->image = image;
+	j->meta = meta;
+	j->image_blocks = size / A1FS_BLOCK_SIZE;
+	j->interval = interval;
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->cond, NULL);
+
+	a1fs_superblock *sb = (a1fs_superblock*)image;
+	if (!(sb->features & A1FS_FEATURE_JOURNAL)) return true;
+
+	a1fs_journal_sb *jsb = (a1fs_journal_sb*)image_block(image, sb->journal);
+	j->seq = jsb->seq;
+	j->head = 1;
+	j->max_txn = (sb->journal_span - 1) / 4;
+	j->dirty = bitmap_alloc(j->image_blocks);
+	j->revoked = bitmap_alloc(j->image_blocks);
+	j->committed = bitmap_alloc(j->image_blocks);
+	if (j->dirty == NULL || j->revoked == NULL || j->committed == NULL) {
+		journal_destroy(j);
+		return false;
+	}
+	j->start = sb->journal;
+	j->span = sb->journal_span;
+	return true;
+}
+
+/** Sync count blocks starting at blk in place. */
+static int sync_blocks(journal *j, uint64_t blk, uint64_t count)
+{
+	if (msync(image_block(j->image, blk), count * A1FS_BLOCK_SIZE, MS_SYNC) < 0) {
+		return -errno;
+	}
+	return 0;
+}
+
+/**
+ * Sync all the blocks of the committed transactions in place, then empty the
+ * journal. Committed changes are only copied in place by a commit, so the
+ * blocks hold exactly what was committed. Called with j->lock held.
+ */
+static int checkpoint(journal *j)
+{
+	int ret = 0;
+	uint64_t i = bitmap_find(j->committed, 0, j->image_blocks, true);
+	while (i < j->image_blocks) {
+		uint64_t end = bitmap_find(j->committed, i, j->image_blocks, false);
+		int err = sync_blocks(j, i, end - i);
+		if (ret == 0) ret = err;
+		bitmap_set_range(j->committed, i, end - i, false);
+		i = bitmap_find(j->committed, end, j->image_blocks, true);
+	}
+	if (ret != 0) return ret;
+
+	a1fs_journal_sb *jsb = (a1fs_journal_sb*)image_block(j->image, j->start);
+	jsb->seq = j->seq;
+	ret = sync_blocks(j, j->start, 1);
+	j->head = 1;
+	j->checkpoints++;
+	return ret;
+}
+
+/** Number of journal blocks the running transaction takes up (at most). */
+static uint64_t txn_blocks(journal *j)
+{
+	uint64_t per_block = A1FS_JOURNAL_ENTRIES;
+	uint64_t ndirty = j->ndirty + j->nunlisted;
+	return (ndirty + per_block - 1) / per_block + ndirty +
+	       (j->nrevoked + per_block - 1) / per_block + 1;
+}
+
+/**
+ * Drop the entries of the running transaction's lists whose bits were cleared
+ * (a block revoked after it was marked, or marked again after it was revoked),
+ * along with duplicates.
+ */
+static size_t list_compact(unsigned char *bm, uint64_t *list, size_t count)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!bitmap_get(bm, list[i])) continue;
+		bitmap_set_range(bm, list[i], 1, false);
+		list[n++] = list[i];
+	}
+	for (size_t i = 0; i < n; i++) {
+		bitmap_set_range(bm, list[i], 1, true);
+	}
+	return n;
+}
+
+static void txn_compact(journal *j)
+{
+	j->ndirty = list_compact(j->dirty, j->dirty_list, j->ndirty);
+	j->nrevoked = list_compact(j->revoked, j->revoke_list, j->nrevoked);
+}
+
+/**
+ * Rebuild the list of the running transaction's blocks from its bitmap, once
+ * journal_dirty() has run out of memory for some of them.
+ *
+ * @return  true on success; false if out of memory.
+ */
+static bool dirty_relist(journal *j)
+{
+	size_t n = 0;
+	for (uint64_t i = bitmap_find(j->dirty, 0, j->image_blocks, true); i < j->image_blocks;
+	     i = bitmap_find(j->dirty, i + 1, j->image_blocks, true)) {
+		n++;
+	}
+	uint64_t *list = malloc((n > 0) ? n * sizeof(uint64_t) : 1);
+	if (list == NULL) return false;
+	size_t k = 0;
+	for (uint64_t i = bitmap_find(j->dirty, 0, j->image_blocks, true); i < j->image_blocks;
+	     i = bitmap_find(j->dirty, i + 1, j->image_blocks, true)) {
+		list[k++] = i;
+	}
+	free(j->dirty_list);
+	j->dirty_list = list;
+	j->ndirty = j->dirty_cap = n;
+	j->nunlisted = 0;
+	return true;
+}
+
+/** Copy the blocks of the running transaction from the metadata view in place. */
+static void txn_install(journal *j)
+{
+	for (size_t i = 0; i < j->ndirty; i++) {
+		uint64_t blk = j->dirty_list[i];
+		memcpy(image_block(j->image, blk), image_block(j->meta, blk), A1FS_BLOCK_SIZE);
+		bitmap_set_range(j->committed, blk, 1, true);
+	}
+	// The revoked blocks don't need to be checkpointed anymore.
+	for (size_t i = 0; i < j->nrevoked; i++) {
+		bitmap_set_range(j->committed, j->revoke_list[i], 1, false);
+	}
+}
+
+/** Forget the running transaction, as it has been written. */
+static void txn_clear(journal *j)
+{
+	for (size_t i = 0; i < j->ndirty; i++) {
+		bitmap_set_range(j->dirty, j->dirty_list[i], 1, false);
+	}
+	for (size_t i = 0; i < j->nrevoked; i++) {
+		bitmap_set_range(j->revoked, j->revoke_list[i], 1, false);
+	}
+	j->ndirty = 0;
+	j->nrevoked = 0;
+}
+
+/**
+ * Write a transaction larger than the whole journal in place, as a last
+ * resort: operations that change many blocks are split across transactions,
+ * so only a single step changing that many blocks could get here. Its blocks
+ * are synced by a checkpoint, without the crash guarantee.
+ */
+static int commit_in_place(journal *j)
+{
+	fprintf(stderr, "a1fs: transaction of %zu blocks doesn't fit in the journal; writing it in place\n",
+	        j->ndirty);
+	txn_install(j);
+	txn_clear(j);
+	j->seq++;
+	return checkpoint(j);
+}
+
+/**
+ * Write the running transaction to the journal, then copy its blocks in place.
+ * If that fails, the transaction keeps running and the image is left as it
+ * was. Called with j->lock held and no open handles.
+ */
+static int commit_locked(journal *j)
+{
+	if (j->nunlisted > 0 && !dirty_relist(j)) return -ENOMEM;
+	txn_compact(j);
+	if (j->ndirty == 0 && j->nrevoked == 0) return 0;
+
+	uint64_t need = txn_blocks(j);
+	if (need > j->span - j->head) {
+		int ret = checkpoint(j);
+		if (ret != 0) return ret;
+	}
+	if (need > j->span - j->head) {
+		return commit_in_place(j);
+	}
+
+	// Descriptor blocks, each followed by the copies of the blocks it lists.
+	uint64_t first = j->head;
+	uint64_t pos = first;
+	for (size_t i = 0; i < j->ndirty; ) {
+		a1fs_journal_header *desc = journal_block(j->image, j->start, pos++);
+		size_t n = j->ndirty - i;
+		if (n > A1FS_JOURNAL_ENTRIES) n = A1FS_JOURNAL_ENTRIES;
+		memset(desc, 0, A1FS_BLOCK_SIZE);
+		*desc = (a1fs_journal_header){ A1FS_JOURNAL_MAGIC, A1FS_JOURNAL_DESCRIPTOR, j->seq, n, 0 };
+		for (size_t k = 0; k < n; k++, i++) {
+			uint64_t blk = j->dirty_list[i];
+			desc->blocks[k] = blk;
+			memcpy(journal_block(j->image, j->start, pos++), image_block(j->meta, blk), A1FS_BLOCK_SIZE);
+		}
+	}
+
+	// Revoke records.
+	for (size_t i = 0; i < j->nrevoked; ) {
+		a1fs_journal_header *rev = journal_block(j->image, j->start, pos++);
+		size_t n = j->nrevoked - i;
+		if (n > A1FS_JOURNAL_ENTRIES) n = A1FS_JOURNAL_ENTRIES;
+		memset(rev, 0, A1FS_BLOCK_SIZE);
+		*rev = (a1fs_journal_header){ A1FS_JOURNAL_MAGIC, A1FS_JOURNAL_REVOKE, j->seq, n, 0 };
+		for (size_t k = 0; k < n; k++, i++) {
+			rev->blocks[k] = j->revoke_list[i];
+		}
+	}
+
+	// The commit record makes the transaction valid once its checksum matches,
+	// so all of it can go to disk in a single flush.
+	a1fs_journal_header *commit = journal_block(j->image, j->start, pos);
+	memset(commit, 0, A1FS_BLOCK_SIZE);
+	*commit = (a1fs_journal_header){ A1FS_JOURNAL_MAGIC, A1FS_JOURNAL_COMMIT, j->seq, pos - first,
+	                                 checksum(journal_block(j->image, j->start, first), pos - first, j->seq) };
+	pos++;
+	int ret = sync_blocks(j, j->start + first, pos - first);
+	if (ret != 0) return ret;
+
+	// The transaction is durable, so its changes can reach the image.
+	txn_install(j);
+	j->blocks_logged += j->ndirty;
+	j->commits++;
+	txn_clear(j);
+	j->seq++;
+	j->head = pos;
+
+	// Leave room for a whole transaction, even one whose last handle takes it
+	// well past max_txn.
+	if (j->span - j->head < 2 * j->max_txn) {
+		ret = checkpoint(j);
+	}
+	return ret;
+}
+
+/** Commit the running transaction and wake up the handles waiting for it. Called with j->lock held and no open handles. */
+static void commit_and_wake(journal *j)
+{
+	int ret = commit_locked(j);
+	if (ret != 0) {
+		fprintf(stderr, "a1fs: journal commit failed: %s\n", strerror(-ret));
+	}
+	j->commit_error = ret;
+	j->commit_requested = false;
+	pthread_cond_broadcast(&j->cond);
+}
+
+/** Commit the running transaction once the open handles finish. Called with j->lock held. */
+static int commit_wait(journal *j)
+{
+	if (j->ndirty == 0 && j->nunlisted == 0 && j->nrevoked == 0) return 0;
+	j->commit_requested = true;
+	while (j->commit_requested && j->handles > 0) {
+		pthread_cond_wait(&j->cond, &j->lock);
+	}
+	// Otherwise the last handle committed everything, including ours.
+	if (j->commit_requested) {
+		commit_and_wake(j);
+	}
+	return j->commit_error;
+}
+
+static void *commit_thread(void *arg)
+{
+	journal *j = (journal*)arg;
+	pthread_mutex_lock(&j->lock);
+	while (!j->stopping) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += j->interval;
+		int err = 0;
+		while (!j->stopping && err != ETIMEDOUT) {
+			err = pthread_cond_timedwait(&j->cond, &j->lock, &deadline);
+		}
+		if (j->stopping) break;
+
+		// A failed commit has already been reported.
+		commit_wait(j);
+	}
+	pthread_mutex_unlock(&j->lock);
+	return NULL;
+}
+
+bool journal_run(journal *j)
+{
+	if (j->span == 0 || j->interval == 0) return true;
+	if (pthread_create(&j->thread, NULL, commit_thread, j) != 0) return false;
+	j->thread_running = true;
+	return true;
+}
+
+void journal_destroy(journal *j)
+{
+	if (j->thread_running) {
+		pthread_mutex_lock(&j->lock);
+		j->stopping = true;
+		pthread_cond_broadcast(&j->cond);
+		pthread_mutex_unlock(&j->lock);
+		pthread_join(j->thread, NULL);
+		j->thread_running = false;
+	}
+
+	if (j->span > 0) {
+		pthread_mutex_lock(&j->lock);
+		int ret = commit_locked(j);
+		if (ret == 0) ret = checkpoint(j);
+		if (ret != 0) {
+			fprintf(stderr, "a1fs: journal checkpoint failed: %s\n", strerror(-ret));
+		}
+		pthread_mutex_unlock(&j->lock);
+	}
+
+	free(j->dirty);
+	free(j->dirty_list);
+	free(j->revoked);
+	free(j->revoke_list);
+	free(j->committed);
+	j->dirty = j->revoked = j->committed = NULL;
+	j->dirty_list = j->revoke_list = NULL;
+	j->span = 0;
+	pthread_cond_destroy(&j->cond);
+	pthread_mutex_destroy(&j->lock);
+}
+
+void journal_start(journal *j)
+{
+	if (j->span == 0) return;
+	pthread_mutex_lock(&j->lock);
+	// A transaction that is due (e.g. one whose commit failed) is committed
+	// before it gets any larger.
+	if (txn_blocks(j) >= j->max_txn) {
+		j->commit_requested = true;
+	}
+	while (j->commit_requested) {
+		if (j->handles == 0) {
+			commit_and_wake(j);
+			break;
+		}
+		pthread_cond_wait(&j->cond, &j->lock);
+	}
+	j->handles++;
+	pthread_mutex_unlock(&j->lock);
+}
+
+void journal_stop(journal *j)
+{
+	if (j->span == 0) return;
+	pthread_mutex_lock(&j->lock);
+	assert(j->handles > 0);
+	j->handles--;
+	if (txn_blocks(j) >= j->max_txn) {
+		j->commit_requested = true;
+	}
+	if (j->commit_requested && j->handles == 0) {
+		commit_and_wake(j);
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+bool journal_due(journal *j)
+{
+	if (j->span == 0) return false;
+	pthread_mutex_lock(&j->lock);
+	bool due = j->commit_requested || txn_blocks(j) >= j->max_txn;
+	pthread_mutex_unlock(&j->lock);
+	return due;
+}
+
+uint64_t journal_seq(journal *j)
+{
+	if (j->span == 0) return 0;
+	pthread_mutex_lock(&j->lock);
+	uint64_t seq = j->seq;
+	pthread_mutex_unlock(&j->lock);
+	return seq;
+}
+
+void journal_dirty(journal *j, const void *ptr, size_t len)
+{
+	if (j->span == 0 || len == 0) return;
+	size_t offset = (const char*)ptr - (const char*)j->meta;
+	uint64_t first = offset / A1FS_BLOCK_SIZE;
+	uint64_t last = (offset + len - 1) / A1FS_BLOCK_SIZE;
+	assert(last < j->image_blocks);
+
+	pthread_mutex_lock(&j->lock);
+	for (uint64_t blk = first; blk <= last; blk++) {
+		if (bitmap_get(j->dirty, blk)) continue;
+		// Out of memory: the commit finds the block by its bit instead.
+		if (!list_append(&j->dirty_list, &j->ndirty, &j->dirty_cap, blk)) {
+			j->nunlisted++;
+		}
+		bitmap_set_range(j->dirty, blk, 1, true);
+		// The new copy replaces the one a revoke would have hidden.
+		bitmap_set_range(j->revoked, blk, 1, false);
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+void journal_revoke(journal *j, uint64_t blk, uint64_t count)
+{
+	if (j->span == 0) return;
+	pthread_mutex_lock(&j->lock);
+	bitmap_set_range(j->dirty, blk, count, false);
+	for (uint64_t i = blk; i < blk + count; i++) {
+		i = bitmap_find(j->committed, i, blk + count, true);
+		if (i == blk + count) break;
+		if (bitmap_get(j->revoked, i)) continue;
+		// Out of memory: after a crash, the old copy may be replayed over the block.
+		if (!list_append(&j->revoke_list, &j->nrevoked, &j->revoke_cap, i)) continue;
+		bitmap_set_range(j->revoked, i, 1, true);
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+int journal_commit(journal *j)
+{
+	if (j->span == 0) return 0;
+	pthread_mutex_lock(&j->lock);
+	int ret = commit_wait(j);
+	pthread_mutex_unlock(&j->lock);
+	return ret;
+}
@@ -0,0 +1,193 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Metadata journal header file.
+ *
+ * Every operation that changes metadata runs as a handle (journal_start() ..
+ * journal_stop()) and marks the blocks it changes with journal_dirty(). Only
+ * images with A1FS_FEATURE_JOURNAL have a journal; see a1fs.h for its format. The
+ * handles since the last commit form the running transaction. Metadata is
+ * changed through a private copy-on-write view of the image, so the changes
+ * can't reach the image file before they are committed. A commit copies its
+ * blocks from the view into the journal region, followed by a commit record
+ * with a checksum, and syncs only that part of the journal, so that many
+ * operations share a single flush (group commit). Only then are the blocks
+ * copied into the image in place, where the kernel writes them back at its own
+ * pace. Commits happen when the transaction gets large, every few seconds, on
+ * fsync() and on unmount.
+ *
+ * When the journal fills up it is checkpointed: the blocks of the committed
+ * transactions are synced in place and the journal starts over. After a crash,
+ * journal_replay() copies the committed blocks back in place; a transaction
+ * without a valid commit record is ignored. Blocks that are freed after being
+ * journaled are revoked so that replay doesn't overwrite their new contents.
+ *
+ * An operation that changes more blocks than a transaction should hold works
+ * in steps, each leaving the file system consistent, and restarts its handle
+ * between them once journal_due() says so. Only a transaction larger than the
+ * whole journal, which no single step comes close to, is written in place
+ * without the crash guarantee. File data is not journaled; it is read and
+ * written through the image itself.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "a1fs.h"
+
+
+/** Default commit interval in seconds. */
+#define JOURNAL_COMMIT_INTERVAL 5
+
+
+/** Journal of a mounted file system. */
+typedef struct journal {
+	/** The image, its size in blocks, and the journal region in it. */
+	void *image;
+	uint64_t image_blocks;
+	uint64_t start;
+	uint64_t span;
+	/** The view of the image that metadata is changed through; committed
+	 * blocks are copied from it into the image. */
+	void *meta;
+
+	/** Sequence number of the running transaction. */
+	uint64_t seq;
+	/** Where the next transaction goes (relative to start); block 0 holds
+	 * the journal superblock. */
+	uint64_t head;
+	/** Largest number of blocks a transaction collects before it is
+	 * committed. */
+	uint64_t max_txn;
+	/** Seconds between commits. */
+	unsigned int interval;
+
+	/** Blocks changed by the running transaction: a bitmap over the image
+	 * and the list of the blocks in it, in the order they were marked. */
+	unsigned char *dirty;
+	uint64_t *dirty_list;
+	size_t ndirty;
+	size_t dirty_cap;
+	/** Marked blocks that didn't fit in the list (out of memory); the
+	 * commit finds them by their bits. */
+	size_t nunlisted;
+	/** Blocks freed by the running transaction that are in committed
+	 * transactions that haven't been checkpointed yet. */
+	unsigned char *revoked;
+	uint64_t *revoke_list;
+	size_t nrevoked;
+	size_t revoke_cap;
+	/** Blocks in committed transactions that haven't been checkpointed. */
+	unsigned char *committed;
+
+	/** Number of open handles, and whether a commit is waiting for them to
+	 * finish; new handles wait for the commit. */
+	unsigned int handles;
+	bool commit_requested;
+	/** Result of the last commit, for the callers that waited for it. */
+	int commit_error;
+	/** Background thread that commits every interval seconds. */
+	pthread_t thread;
+	bool thread_running;
+	bool stopping;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/** Statistics. */
+	uint64_t commits;
+	uint64_t checkpoints;
+	uint64_t blocks_logged;
+
+} journal;
+
+
+/**
+ * Replay the committed transactions in the journal of an image, then empty
+ * the journal. Must be called before anything else reads the metadata.
+ *
+ * @param image  pointer to the start of the image.
+ * @param size   image size in bytes.
+ * @return       the number of transactions replayed; -1 if the journal is
+ *               invalid or out of memory.
+ */
+int journal_replay(void *image, size_t size);
+
+/**
+ * Initialize the journal of a mounted file system. An image without the
+ * journal feature gets a journal that does nothing.
+ *
+ * @param j         pointer to the journal to initialize.
+ * @param image     pointer to the start of the image.
+ * @param meta      pointer to the start of the private view of the image that
+ *                  metadata is changed through.
+ * @param size      image size in bytes.
+ * @param interval  commit interval in seconds.
+ * @return          true on success; false if out of memory.
+ */
+bool journal_init(journal *j, void *image, void *meta, size_t size, unsigned int interval);
+
+/**
+ * Start the background commit thread. Must be called after FUSE has forked
+ * into the background (i.e. from the init() callback).
+ *
+ * @return  true on success; false if the thread could not be created.
+ */
+bool journal_run(journal *j);
+
+/** Commit and checkpoint everything, then free the journal. */
+void journal_destroy(journal *j);
+
+/**
+ * Start a handle. Must be called before taking any of the file system locks,
+ * since it can wait for a commit.
+ */
+void journal_start(journal *j);
+
+/** Finish a handle; commits the running transaction if it is due. */
+void journal_stop(journal *j);
+
+/**
+ * Check if the running transaction has grown large enough to be committed. An
+ * operation split into steps restarts its handle (journal_stop(), then
+ * journal_start()) after a step when it has, so that the commit can happen.
+ */
+bool journal_due(journal *j);
+
+/**
+ * Get the sequence number of the running transaction; the transactions before
+ * it have committed. 0 without a journal.
+ */
+uint64_t journal_seq(journal *j);
+
+/** Mark the blocks overlapping [ptr, ptr + len) in the metadata view as changed. */
+void journal_dirty(journal *j, const void *ptr, size_t len);
+
+/** Tell the journal that count blocks starting at image block blk are free. */
+void journal_revoke(journal *j, uint64_t blk, uint64_t count);
+
+/**
+ * Commit the running transaction and wait until it is on disk. Must not be
+ * called with a handle open. If the commit fails, the transaction stays
+ * running and none of its changes reach the image.
+ *
+ * @return  0 on success; -errno if syncing failed or out of memory.
+ */
+int journal_commit(journal *j);
@@ -69,3 +69,23 @@ end:
 	close(fd);
 	return addr;
 }
+
+void *map_file_view(const char *path, size_t size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	// Only the pages that are changed take up memory, so don't reserve swap
+	// for the whole image up front; that would fail for an image larger than
+	// memory.
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		addr = NULL;
+	}
+	close(fd);
+	return addr;
+}
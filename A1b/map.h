@@ -33,3 +33,14 @@
  *                    NULL on failure.
  */
 void *map_file(const char *path, size_t block_size, size_t *size);
+
+/**
+ * Map a file into memory privately (copy-on-write): the mapping can be
+ * changed without the changes ever reaching the file, while the parts left
+ * unchanged keep showing the file's current contents.
+ *
+ * @param path  file path.
+ * @param size  file size in bytes, as returned by map_file().
+ * @return      pointer to the mapping on success; NULL on failure.
+ */
+void *map_file_view(const char *path, size_t size);
@@ -0,0 +1,92 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Memory mapping policy implementation.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "mappolicy.h"
+
+
+/** madvise() a range of the mapping, widened to whole pages. */
+static int advise(void *addr, size_t len, int advice)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)addr & ~(page - 1);
+	return madvise((void*)start, (uintptr_t)addr + len - start, advice);
+}
+
+bool mappolicy_valid_advice(const char *name)
+{
+	return strcmp(name, "normal") == 0 || strcmp(name, "random") == 0 ||
+	       strcmp(name, "sequential") == 0;
+}
+
+void mappolicy_apply(void *meta, void *image, size_t size, const a1fs_opts *opts)
+{
+	const a1fs_superblock *sb = (const a1fs_superblock*)meta;
+	// The journal sits between the inode table and the data region; it is
+	// only ever written sequentially and read back after a crash.
+	uint64_t meta_end = (sb->features & A1FS_FEATURE_JOURNAL) ? sb->journal : sb->data_region;
+	size_t meta_len = meta_end * A1FS_BLOCK_SIZE;
+	char *data = (char*)image + sb->data_region * A1FS_BLOCK_SIZE;
+	size_t data_len = size - sb->data_region * A1FS_BLOCK_SIZE;
+
+	if (opts->hugepages) {
+#ifdef MADV_HUGEPAGE
+		// Only takes effect where the kernel supports huge pages for file
+		// mappings (e.g. on tmpfs).
+		if (advise(meta, meta_len, MADV_HUGEPAGE) < 0) perror("madvise(MADV_HUGEPAGE)");
+#else
+		fprintf(stderr, "a1fs: huge pages are not supported\n");
+#endif
+	}
+	if (opts->populate) {
+#ifdef MADV_POPULATE_WRITE
+		if (advise(meta, meta_len, MADV_POPULATE_WRITE) < 0) perror("madvise(MADV_POPULATE_WRITE)");
+#else
+		if (advise(meta, meta_len, MADV_WILLNEED) < 0) perror("madvise(MADV_WILLNEED)");
+#endif
+	}
+	if (opts->mlock && mlock(meta, meta_len) < 0) {
+		perror("mlock");
+	}
+
+	if (opts->data_advice != NULL && data_len > 0) {
+		int advice = MADV_NORMAL;
+		if (strcmp(opts->data_advice, "random") == 0) advice = MADV_RANDOM;
+		else if (strcmp(opts->data_advice, "sequential") == 0) advice = MADV_SEQUENTIAL;
+		if (advise(data, data_len, advice) < 0) perror("madvise");
+	}
+
+	if (opts->verbose) {
+		fprintf(stderr, "mappolicy: %lu metadata blocks%s%s%s, data advice %s\n",
+		        (unsigned long)meta_end, opts->hugepages ? ", huge pages" : "",
+		        opts->populate ? ", populated" : "", opts->mlock ? ", locked" : "",
+		        (opts->data_advice != NULL) ? opts->data_advice : "normal");
+	}
+}
+
+void mappolicy_willneed(void *addr, size_t len)
+{
+	// Only a hint; a failure just means the copy faults the pages in.
+	advise(addr, len, MADV_WILLNEED);
+}
@@ -0,0 +1,56 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Memory mapping policy header file.
+ *
+ * Tells the kernel how the mapped image is going to be used. The metadata
+ * region (the superblock, group descriptors, bitmaps and inode table) is small
+ * and touched by nearly every operation, so it can be backed by huge pages,
+ * prefaulted and locked in memory, keeping it out of the way of bulk file
+ * data. The data region gets an access pattern hint, and large reads ask for
+ * their blocks ahead of copying them. None of this is needed for correctness;
+ * failures are reported and otherwise ignored.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "options.h"
+
+
+/** Default size of the reads (in KiB) whose blocks are prefetched. */
+#define PREFETCH_MIN_KB 128
+
+
+/** Check that a --data_advice value is one of "normal", "random" or "sequential". */
+bool mappolicy_valid_advice(const char *name);
+
+/**
+ * Apply the mapping policy chosen by the options to a mounted image. Locked
+ * memory is not inherited across fork(), so this must be called once FUSE has
+ * forked into the background (i.e. from the init() callback).
+ *
+ * @param meta   pointer to the start of the view that metadata is read and
+ *               changed through (the image itself without a journal).
+ * @param image  pointer to the start of the image.
+ * @param size   image size in bytes.
+ * @param opts   command line options.
+ */
+void mappolicy_apply(void *meta, void *image, size_t size, const a1fs_opts *opts);
+
+/** Ask the kernel to read [addr, addr + len) of the mapping ahead. */
+void mappolicy_willneed(void *addr, size_t len);
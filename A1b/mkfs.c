@@ -34,6 +34,12 @@ typedef struct mkfs_opts {
 	const char *img_path;
 	/** Number of inodes. */
 	size_t n_inodes;
+	/** Number of data blocks per allocation group. */
+	size_t blocks_per_group;
+	/** Feature flags (A1FS_FEATURE_*) to enable. */
+	unsigned int features;
+	/** Number of journal blocks; 0 to size the journal from the image. */
+	size_t journal_blocks;
 
 	/** Print help and exit. */
 	bool help;
@@ -56,6 +62,14 @@ its size must be a multiple of a1fs block size - %zu bytes.\n\
 \n\
 Options:\n\
     -i num  number of inodes; required argument\n\
+    -g num  number of data blocks per allocation group (default %d)\n\
+    -j num  number of journal blocks (default 1/64 of the image, at least\n\
+            %d and at most %d); implies -O journal\n\
+    -O feat[,feat...]  enable optional features:\n\
+            dir_index       use a hash index for large directories\n\
+            compact_dentry  use variable length directory entries\n\
+            sparse          allow holes in files\n\
+            journal         journal metadata changes\n\
     -h      print help and exit\n\
     -f      force format - overwrite existing a1fs file system\n\
     -s      sync image file contents to disk\n\
@@ -63,18 +77,61 @@ Options:\n\
     -z      zero out image contents\n\
 ";
 
+/** Largest journal mkfs picks by default: 32 MiB. */
+#define JOURNAL_MAX_BLOCKS 8192
+
 static void print_help(FILE *f, const char *progname)
 {
-	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE);
+	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE, A1FS_BLOCKS_PER_GROUP,
+	        A1FS_JOURNAL_MIN_BLOCKS, JOURNAL_MAX_BLOCKS);
 }
 
 
+/** Names of the optional features that can be enabled with -O. */
+static const struct {
+	const char *name;
+	unsigned int flag;
+} feature_names[] = {
+	{ "dir_index",      A1FS_FEATURE_DIR_INDEX      },
+	{ "compact_dentry", A1FS_FEATURE_COMPACT_DENTRY },
+	{ "sparse",         A1FS_FEATURE_SPARSE         },
+	{ "journal",        A1FS_FEATURE_JOURNAL        },
+};
+
+/** Parse a comma-separated list of feature names into feature flags. */
+static bool parse_features(const char *list, unsigned int *features)
+{
+	char buf[256];
+	if (strlen(list) >= sizeof(buf)) return false;
+	strcpy(buf, list);
+
+	for (char *name = strtok(buf, ","); name != NULL; name = strtok(NULL, ",")) {
+		size_t i = 0;
+		while (i < sizeof(feature_names) / sizeof(feature_names[0]) &&
+		       strcmp(name, feature_names[i].name) != 0) i++;
+		if (i == sizeof(feature_names) / sizeof(feature_names[0])) {
+			fprintf(stderr, "Unknown feature: %s\n", name);
+			return false;
+		}
+		*features |= feature_names[i].flag;
+	}
+	return true;
+}
+
 static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 {
 	char o;
-	while ((o = getopt(argc, argv, "i:hfsvz")) != -1) {
+	while ((o = getopt(argc, argv, "i:g:j:O:hfsvz")) != -1) {
 		switch (o) {
 			case 'i': opts->n_inodes = strtoul(optarg, NULL, 10); break;
+			case 'g': opts->blocks_per_group = strtoul(optarg, NULL, 10); break;
+			case 'j':
+				opts->journal_blocks = strtoul(optarg, NULL, 10);
+				opts->features |= A1FS_FEATURE_JOURNAL;
+				break;
+			case 'O':
+				if (!parse_features(optarg, &opts->features)) return false;
+				break;
 
 			case 'h': opts->help    = true; return true;// skip other arguments
 			case 'f': opts->force   = true; break;
@@ -93,10 +150,19 @@ static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 	}
 	opts->img_path = argv[optind];
 
-	if (opts->n_inodes == 0) {
+	if (opts->n_inodes == 0 || opts->n_inodes > UINT32_MAX) {
 		fprintf(stderr, "Missing or invalid number of inodes\n");
 		return false;
 	}
+	if (opts->blocks_per_group == 0 || opts->blocks_per_group > UINT32_MAX) {
+		fprintf(stderr, "Invalid number of blocks per group\n");
+		return false;
+	}
+	if ((opts->features & A1FS_FEATURE_JOURNAL) && opts->journal_blocks != 0 &&
+	    (opts->journal_blocks < A1FS_JOURNAL_MIN_BLOCKS || opts->journal_blocks > UINT32_MAX)) {
+		fprintf(stderr, "Invalid number of journal blocks\n");
+		return false;
+	}
 	return true;
 }
 
@@ -138,24 +204,73 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	sb->size = size;
 	sb->inodes_count = opts->n_inodes;
 	sb->free_inodes_count = opts->n_inodes;
+	sb->features = opts->features | A1FS_FEATURE_GROUPS | A1FS_FEATURE_64BIT;
 
 	// Calculate the block of the inodes table based on # of inodes.
-	int num_table_blocks = (opts->n_inodes * sizeof(a1fs_inode)) / A1FS_BLOCK_SIZE;
-	num_table_blocks += ((opts->n_inodes * sizeof(a1fs_inode)) % A1FS_BLOCK_SIZE) / ((opts->n_inodes * sizeof(a1fs_inode)) % A1FS_BLOCK_SIZE);
+	size_t bits_per_block = A1FS_BLOCK_SIZE * 8;
+	size_t num_blocks = size / A1FS_BLOCK_SIZE;
+	size_t num_table_blocks = (opts->n_inodes * sizeof(a1fs_inode) + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	size_t journal_blocks = 0;
+	if (sb->features & A1FS_FEATURE_JOURNAL) {
+		journal_blocks = opts->journal_blocks;
+		if (journal_blocks == 0) {
+			journal_blocks = num_blocks / 64;
+			if (journal_blocks < A1FS_JOURNAL_MIN_BLOCKS) journal_blocks = A1FS_JOURNAL_MIN_BLOCKS;
+			if (journal_blocks > JOURNAL_MAX_BLOCKS) journal_blocks = JOURNAL_MAX_BLOCKS;
+		}
+	}
+	sb->inode_bitmap_span = (sb->inodes_count + bits_per_block - 1) / bits_per_block;
+
+	// Size the group descriptor table for the whole image; the data region is
+	// a bit smaller, so this may leave part of the table unused.
+	size_t descs_per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_group_desc);
+	size_t max_groups = (num_blocks + opts->blocks_per_group - 1) / opts->blocks_per_group;
+	sb->group_table_span = (max_groups + descs_per_block - 1) / descs_per_block;
+
+	// The block bitmap only has to cover what is left after the other metadata,
+	// so this may round it up by one block at most.
+	size_t other_blocks = 1 + sb->group_table_span + sb->inode_bitmap_span + num_table_blocks + journal_blocks;
+	sb->block_bitmap_span = (num_blocks - other_blocks + bits_per_block - 1) / bits_per_block;
+	if (num_blocks <= other_blocks + sb->block_bitmap_span){
+		return false;
+	}
 
-	sb->block_bitmap = 1;
-	sb->inode_bitmap = 2;
-	sb->inode_table = 3;
-	sb->data_region = sb->inode_table + num_table_blocks;
+	// Lay the regions out back to back so that multi-block bitmaps don't overlap.
+	sb->group_table = 1;
+	sb->block_bitmap = sb->group_table + sb->group_table_span;
+	sb->inode_bitmap = sb->block_bitmap + sb->block_bitmap_span;
+	sb->inode_table = sb->inode_bitmap + sb->inode_bitmap_span;
+	sb->journal = sb->inode_table + num_table_blocks;
+	sb->journal_span = journal_blocks;
+	sb->data_region = sb->journal + sb->journal_span;
 
-	sb->free_blocks_count = size / A1FS_BLOCK_SIZE - 3 - num_table_blocks;
+	sb->free_blocks_count = num_blocks - sb->data_region;
 	sb->blocks_count = sb->free_blocks_count;
-	
-	sb->block_bitmap_span = sb->free_blocks_count / (A1FS_BLOCK_SIZE*8);
-    sb->block_bitmap_span += (sb->free_blocks_count % (A1FS_BLOCK_SIZE*8)) / (sb->free_blocks_count % (A1FS_BLOCK_SIZE*8));
 
-    sb->inode_bitmap_span = sb->inodes_count / (A1FS_BLOCK_SIZE*8);
-    sb->inode_bitmap_span += (sb->inodes_count % (A1FS_BLOCK_SIZE*8)) / (sb->inodes_count % (A1FS_BLOCK_SIZE*8));
+	// Clear the metadata in case the image is being reused. This also leaves
+	// the journal without any transactions.
+	memset(image + A1FS_BLOCK_SIZE * sb->group_table, 0, A1FS_BLOCK_SIZE * (sb->data_region - sb->group_table));
+	if (sb->features & A1FS_FEATURE_JOURNAL) {
+		a1fs_journal_sb *jsb = (a1fs_journal_sb*)(image + A1FS_BLOCK_SIZE * sb->journal);
+		jsb->magic = A1FS_JOURNAL_MAGIC;
+		jsb->seq = 1;
+	}
+
+	// Split the data blocks and the inodes into groups. With fewer inodes than
+	// groups, the last groups get none.
+	sb->blocks_per_group = opts->blocks_per_group;
+	sb->groups_count = (sb->blocks_count + sb->blocks_per_group - 1) / sb->blocks_per_group;
+	sb->inodes_per_group = (sb->inodes_count + sb->groups_count - 1) / sb->groups_count;
+	a1fs_group_desc *groups = (a1fs_group_desc*)(image + A1FS_BLOCK_SIZE * sb->group_table);
+	for (unsigned int g = 0; g < sb->groups_count; g++) {
+		size_t blocks_left = sb->blocks_count - (size_t)g * sb->blocks_per_group;
+		groups[g].free_blocks_count = (blocks_left < sb->blocks_per_group) ? blocks_left : sb->blocks_per_group;
+		size_t first_inode = (size_t)g * sb->inodes_per_group;
+		if (first_inode < sb->inodes_count) {
+			size_t inodes_left = sb->inodes_count - first_inode;
+			groups[g].free_inodes_count = (inodes_left < sb->inodes_per_group) ? inodes_left : sb->inodes_per_group;
+		}
+	}
 
 
 	// Create an empty root directory
@@ -166,6 +281,8 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	root_inode->links = 2;
 	root_inode->extents = 0;
 	root_inode->dentry = 0;
+	root_inode->flags = 0;
+	root_inode->dx_root = 0;
 
 	root_inode->size = sizeof(a1fs_dentry)*0;
 
@@ -174,6 +291,9 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	unsigned char *inode_bitmap = (unsigned char*)(image + (A1FS_BLOCK_SIZE * sb->inode_bitmap)); 
 	inode_bitmap[0] |= 1 << (0 % 8);
 	sb->free_inodes_count -= 1;
+	groups[0].free_inodes_count -= 1;
+	groups[0].used_dirs_count = 1;
+	groups[0].first_free_inode = 1;
 
 	return true;
 }
@@ -181,7 +301,8 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 
 int main(int argc, char *argv[])
 {
-	mkfs_opts opts = {0};// defaults are all 0
+	mkfs_opts opts = {0};// defaults are all 0, except:
+	opts.blocks_per_group = A1FS_BLOCKS_PER_GROUP;
 	if (!parse_args(argc, argv, &opts)) {
 		// Invalid arguments, print help to stderr
 		print_help(stderr, argv[0]);
@@ -211,6 +332,16 @@ int main(int argc, char *argv[])
 		goto end;
 	}
 
+	if (opts.verbose) {
+		const a1fs_superblock *sb = (const a1fs_superblock*)image;
+		printf("%lu data blocks in %lu groups of %lu, %lu inodes per group\n",
+		       (unsigned long)sb->blocks_count, (unsigned long)sb->groups_count,
+		       (unsigned long)sb->blocks_per_group, (unsigned long)sb->inodes_per_group);
+		if (sb->features & A1FS_FEATURE_JOURNAL) {
+			printf("%lu journal blocks\n", (unsigned long)sb->journal_span);
+		}
+	}
+
 	// Sync to disk if requested
 	if (opts.sync && (msync(image, size, MS_SYNC) < 0)) {
 		perror("msync");
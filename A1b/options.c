@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "mappolicy.h"
 #include "options.h"
 
 
@@ -38,6 +39,23 @@ static const struct fuse_opt opt_spec[] = {
 	A1FS_OPT("--sync"   , sync   ),
 	A1FS_OPT("--verbose", verbose),
 
+	A1FS_OPT("--delalloc", delalloc),
+	{ "--delalloc_max=%u", offsetof(a1fs_opts, delalloc_max), 0 },
+	A1FS_OPT("--detect_zeroes", detect_zeroes),
+	{ "--commit=%u", offsetof(a1fs_opts, commit_interval), 0 },
+	{ "--writeback_age=%u", offsetof(a1fs_opts, writeback_age), 0 },
+	{ "--writeback_max=%u", offsetof(a1fs_opts, writeback_max), 0 },
+	A1FS_OPT("--pread", pread),
+	{ "--cache_size=%u", offsetof(a1fs_opts, cache_size), 0 },
+	A1FS_OPT("--hugepages", hugepages),
+	A1FS_OPT("--populate", populate),
+	A1FS_OPT("--mlock", mlock),
+	{ "--data_advice=%s", offsetof(a1fs_opts, data_advice), 0 },
+	{ "--prefetch=%u", offsetof(a1fs_opts, prefetch_min), 0 },
+	A1FS_OPT("--noprefetch", noprefetch),
+	{ "--readahead=%u", offsetof(a1fs_opts, readahead_max), 0 },
+	A1FS_OPT("--noreadahead", noreadahead),
+
 	FUSE_OPT_END
 };
 
@@ -45,7 +63,6 @@ static const char *help_str = "\
 Usage: %s image dir [options]\n\
 \n\
 Mount a1fs image file at given mount point. Use fusermount(1) to unmount.\n\
-Only single-threaded mount is supported; -s FUSE option is implied.\n\
 \n\
 general options:\n\
     -o opt,[opt...]        mount options\n\
@@ -53,8 +70,34 @@ general options:\n\
     -V   --version         print version\n\
 \n\
 a1fs options:\n\
-    --sync                 sync image file contents to disk on unmount\n\
+    --sync                 sync changed blocks of the image to disk on unmount\n\
     --verbose              verbose output; only useful in foreground mode (-f)\n\
+    --delalloc             delay block allocation for appends until the file\n\
+                           is flushed (closed, fsync'ed or unmounted)\n\
+    --delalloc_max=N       keep at most N MiB of delayed appends in memory\n\
+                           (default: 64)\n\
+    --detect_zeroes        leave whole blocks of written zeros unallocated\n\
+                           (only on images with the \"sparse\" feature)\n\
+    --commit=N             commit the journal every N seconds (default: 5;\n\
+                           only on images with the \"journal\" feature)\n\
+    --writeback_age=N      sync changed blocks within N seconds (default: 30)\n\
+    --writeback_max=N      sync all changed blocks once there are N MiB of\n\
+                           them (default: 64)\n\
+    --pread                read and write file data with pread/pwrite through\n\
+                           a buffer cache instead of the memory mapping\n\
+    --cache_size=N         size of the buffer cache in MiB (default: 64)\n\
+    --hugepages            back the metadata region (superblock, bitmaps and\n\
+                           inode table) with huge pages where supported\n\
+    --populate             prefault the metadata region when mounting\n\
+    --mlock                lock the metadata region in memory\n\
+    --data_advice=ADVICE   access pattern of file data: normal, random or\n\
+                           sequential (default: normal)\n\
+    --prefetch=N           ask for the data of reads of at least N KiB ahead\n\
+                           of copying it (default: 128)\n\
+    --noprefetch           don't prefetch the data of large reads\n\
+    --readahead=N          read at most N KiB ahead of sequential and strided\n\
+                           reads through an open file (default: 1024)\n\
+    --noreadahead          don't read ahead of sequential and strided reads\n\
 \n\
 ";
 
@@ -90,8 +133,9 @@ bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
 		fprintf(stderr, "Missing image path\n");
 		return false;
 	}
-
-	// Only single-threaded mount is supported
-	fuse_opt_add_arg(args, "-s");
+	if (opts->data_advice != NULL && !mappolicy_valid_advice(opts->data_advice)) {
+		fprintf(stderr, "Invalid data access advice: %s\n", opts->data_advice);
+		return false;
+	}
 	return true;
 }
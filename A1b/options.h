@@ -33,11 +33,49 @@ typedef struct a1fs_opts {
 	/** Print version and exit. FUSE option. */
 	int version;
 
-	/** Sync memory-mapped image file contents to disk on unmount. */
+	/** Sync the dirty blocks of the image to disk on unmount. */
 	int sync;
 	/** Verbose output. Only print logging/debug info if this flag is set. */
 	int verbose;
 
+	/** Buffer appends and allocate their blocks when the file is flushed. */
+	int delalloc;
+	/** Bound on the memory used for delayed allocation buffers (in MiB). */
+	unsigned int delalloc_max;
+
+	/** Leave whole blocks of written zeros unallocated (needs "sparse"). */
+	int detect_zeroes;
+
+	/** Seconds between journal commits (images with a journal only). */
+	unsigned int commit_interval;
+
+	/** Seconds a changed block may stay in memory before it is synced. */
+	unsigned int writeback_age;
+	/** Amount of changed blocks that triggers syncing all of them (in MiB). */
+	unsigned int writeback_max;
+
+	/** Access file data with pread()/pwrite() through a buffer cache. */
+	int pread;
+	/** Size of the buffer cache (in MiB). */
+	unsigned int cache_size;
+
+	/** Back the metadata region with huge pages. */
+	int hugepages;
+	/** Prefault the metadata region when mounting. */
+	int populate;
+	/** Lock the metadata region in memory. */
+	int mlock;
+	/** Access pattern of the data region: "normal", "random" or "sequential". */
+	char *data_advice;
+	/** Reads of at least this many KiB prefetch their blocks. */
+	unsigned int prefetch_min;
+	/** Don't prefetch the blocks of large reads. */
+	int noprefetch;
+	/** Maximum readahead window of sequential and strided reads (in KiB). */
+	unsigned int readahead_max;
+	/** Don't read ahead of sequential and strided reads. */
+	int noreadahead;
+
 } a1fs_opts;
 
 /**
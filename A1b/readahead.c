@@ -0,0 +1,182 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Readahead implementation.
+ */
+
+#include <string.h>
+
+#include "readahead.h"
+
+
+/** Number of strided reads prefetched at most per request. */
+#define STRIDE_MAX_READS 16
+
+
+void readahead_init(readahead *ra, uint64_t max_window)
+{
+	memset(ra, 0, sizeof(*ra));
+	ra->max_window = max_window;
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+}
+
+void ra_state_init(ra_state *s)
+{
+	memset(s, 0, sizeof(*s));
+	pthread_mutex_init(&s->lock, NULL);
+}
+
+void ra_state_destroy(ra_state *s)
+{
+	pthread_mutex_destroy(&s->lock);
+}
+
+/** Queue a prefetch request. Called with ra->lock held. */
+static void queue_request(readahead *ra, a1fs_ino_t ino, uint64_t off, uint64_t len)
+{
+	if (!ra->thread_running) return;
+	if (ra->count == READAHEAD_QUEUE) {
+		ra->dropped++;
+		return;
+	}
+	ra_request *req = &ra->queue[(ra->head + ra->count) % READAHEAD_QUEUE];
+	req->ino = ino;
+	req->off = off;
+	req->len = len;
+	ra->count++;
+	ra->requests++;
+	pthread_cond_signal(&ra->cond);
+}
+
+void readahead_read(readahead *ra, ra_state *s, a1fs_ino_t ino, uint64_t off, size_t size,
+                    uint64_t file_size)
+{
+	if (size == 0) return;
+	uint64_t end = off + size;
+
+	// At most STRIDE_MAX_READS requests; sequential reads need only one
+	ra_request reqs[STRIDE_MAX_READS];
+	int nreqs = 0;
+
+	pthread_mutex_lock(&s->lock);
+	bool hit = (off >= s->ra_start) && (end <= s->ra_end);
+	bool sequential = (off == s->next);
+	bool strided = !sequential && (off > s->prev) && (off - s->prev == s->stride) &&
+	               (s->stride > size);
+
+	if ((sequential || strided) && ra->max_window > 0) {
+		if (s->window == 0) {
+			s->window = 4 * (uint64_t)size;
+		} else {
+			s->window *= 2;
+		}
+		if (s->window > ra->max_window) s->window = ra->max_window;
+	} else {
+		s->window = 0;
+		s->ra_start = s->ra_end = s->ra_next = 0;
+	}
+
+	if (s->window > 0 && sequential) {
+		// Only when less than half of the window is left ahead
+		if (s->ra_end < end + s->window / 2) {
+			uint64_t start = (s->ra_end > end) ? s->ra_end : end;
+			uint64_t stop = end + s->window;
+			if (stop > file_size) stop = file_size;
+			if (stop > start) {
+				reqs[nreqs++] = (ra_request){ ino, start, stop - start };
+				if (start != s->ra_end) s->ra_start = start;
+				s->ra_end = stop;
+			}
+		}
+	} else if (s->window > 0) {
+		// The next reads at the same stride, as many as fit in the window
+		uint64_t nreads = s->window / size;
+		if (nreads > STRIDE_MAX_READS) nreads = STRIDE_MAX_READS;
+		uint64_t last = off + nreads * s->stride;
+		uint64_t pos = (s->ra_next > off) ? s->ra_next : off + s->stride;
+		// Only when less than half of the reads are left ahead
+		if (pos - off <= nreads / 2 * s->stride) {
+			if (pos == off + s->stride) s->ra_start = pos;
+			for (; pos <= last && pos < file_size; pos += s->stride) {
+				uint64_t len = (pos + size > file_size) ? file_size - pos : size;
+				reqs[nreqs++] = (ra_request){ ino, pos, len };
+				s->ra_end = pos + len;
+			}
+			s->ra_next = pos;
+		}
+	}
+
+	s->stride = off - s->prev;
+	s->prev = off;
+	s->next = end;
+	pthread_mutex_unlock(&s->lock);
+
+	pthread_mutex_lock(&ra->lock);
+	ra->reads++;
+	if (hit) ra->hits++;
+	for (int i = 0; i < nreqs; i++) {
+		queue_request(ra, reqs[i].ino, reqs[i].off, reqs[i].len);
+	}
+	pthread_mutex_unlock(&ra->lock);
+}
+
+static void *readahead_thread(void *arg)
+{
+	readahead *ra = (readahead*)arg;
+
+	pthread_mutex_lock(&ra->lock);
+	while (!ra->stopping) {
+		if (ra->count == 0) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+			continue;
+		}
+		ra_request req = ra->queue[ra->head];
+		ra->head = (ra->head + 1) % READAHEAD_QUEUE;
+		ra->count--;
+
+		pthread_mutex_unlock(&ra->lock);
+		ra->fetch(ra->arg, req.ino, req.off, req.len);
+		pthread_mutex_lock(&ra->lock);
+		ra->bytes += req.len;
+	}
+	pthread_mutex_unlock(&ra->lock);
+	return NULL;
+}
+
+bool readahead_run(readahead *ra, ra_fetch_fn fetch, void *arg)
+{
+	if (ra->max_window == 0) return true;
+	ra->fetch = fetch;
+	ra->arg = arg;
+	if (pthread_create(&ra->thread, NULL, readahead_thread, ra) != 0) return false;
+	ra->thread_running = true;
+	return true;
+}
+
+void readahead_destroy(readahead *ra)
+{
+	if (ra->thread_running) {
+		pthread_mutex_lock(&ra->lock);
+		ra->stopping = true;
+		ra->count = 0;
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+		pthread_join(ra->thread, NULL);
+		ra->thread_running = false;
+	}
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->lock);
+}
@@ -0,0 +1,146 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Readahead header file.
+ *
+ * Every open file handle keeps track of its recent reads. Reads that continue
+ * where the previous one ended are sequential; reads that skip ahead by the
+ * same distance as last time are strided. For both, the data that is likely
+ * to be read next is prefetched by a helper thread, so that it is already in
+ * memory when the read comes. The window of data prefetched ahead starts at a
+ * few times the read size and doubles with every read that follows the
+ * pattern, up to a maximum; a read that breaks the pattern collapses it.
+ * Prefetching starts again once less than half of the window is left ahead
+ * of the reader, so it stays ahead without being asked on every read.
+ *
+ * Prefetch requests are queued to the helper thread, which calls back into
+ * the file system to turn them into blocks. A full queue drops requests;
+ * they are only hints.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Default maximum readahead window in KiB. */
+#define READAHEAD_MAX_KB 1024
+
+/** Maximum number of queued prefetch requests. */
+#define READAHEAD_QUEUE 64
+
+
+/** Readahead state of an open file handle. */
+typedef struct ra_state {
+	pthread_mutex_t lock;
+	/** Offset of the last read, where it ended, and how far it was from the
+	 * one before it. */
+	uint64_t prev;
+	uint64_t next;
+	uint64_t stride;
+	/** Current window in bytes; 0 if the reads don't follow a pattern. */
+	uint64_t window;
+	/** The range prefetched for the reads to come. */
+	uint64_t ra_start, ra_end;
+	/** Strided reads: the next offset that hasn't been prefetched. */
+	uint64_t ra_next;
+} ra_state;
+
+/** A queued prefetch request. */
+typedef struct ra_request {
+	a1fs_ino_t ino;
+	uint64_t off;
+	uint64_t len;
+} ra_request;
+
+/** Prefetches len bytes at offset off of the file with inode number ino. */
+typedef void (*ra_fetch_fn)(void *arg, a1fs_ino_t ino, uint64_t off, uint64_t len);
+
+/** Readahead engine of a mounted file system. */
+typedef struct readahead {
+	/** Maximum window in bytes. */
+	uint64_t max_window;
+
+	/** Ring buffer of prefetch requests. */
+	ra_request queue[READAHEAD_QUEUE];
+	size_t head;
+	size_t count;
+
+	/** Helper thread and the callback it prefetches with. */
+	ra_fetch_fn fetch;
+	void *arg;
+	pthread_t thread;
+	bool thread_running;
+	bool stopping;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/** Statistics: reads, reads of prefetched data, prefetch requests
+	 * issued and dropped, and bytes prefetched. */
+	uint64_t reads;
+	uint64_t hits;
+	uint64_t requests;
+	uint64_t dropped;
+	uint64_t bytes;
+
+} readahead;
+
+
+/**
+ * Initialize the readahead engine.
+ *
+ * @param ra          pointer to the engine to initialize.
+ * @param max_window  maximum window in bytes; 0 disables prefetching.
+ */
+void readahead_init(readahead *ra, uint64_t max_window);
+
+/**
+ * Start the helper thread. Must be called after FUSE has forked into the
+ * background (i.e. from the init() callback).
+ *
+ * @param fetch  callback that prefetches a range of a file.
+ * @param arg    first argument of the callback.
+ * @return       true on success; false if the thread could not be created.
+ */
+bool readahead_run(readahead *ra, ra_fetch_fn fetch, void *arg);
+
+/** Stop the helper thread; queued requests are dropped. */
+void readahead_destroy(readahead *ra);
+
+/** Initialize the readahead state of a new file handle. */
+void ra_state_init(ra_state *s);
+
+/** Free the readahead state of a file handle. */
+void ra_state_destroy(ra_state *s);
+
+/**
+ * Account for a read through a file handle and queue prefetches of what is
+ * likely to be read next.
+ *
+ * @param ra         the readahead engine.
+ * @param s          readahead state of the file handle.
+ * @param ino        inode number of the file.
+ * @param off        offset of the read.
+ * @param size       number of bytes read.
+ * @param file_size  size of the file; nothing past it is prefetched.
+ */
+void readahead_read(readahead *ra, ra_state *s, a1fs_ino_t ino, uint64_t off, size_t size,
+                    uint64_t file_size);
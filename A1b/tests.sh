@@ -0,0 +1,186 @@
+#!/bin/bash
+#
+# Mount tests for a1fs: formats images, mounts them with the given driver
+# (./a1fs by default, or ./a1fs_ll) and checks the results with ordinary
+# tools. Needs FUSE; run from this directory after make, or with make test.
+#
+#   journal   changes made after the last commit are rolled back when the
+#             driver is killed, everything committed survives, and a rename
+#             over an existing entry survives a remount
+#   delalloc  buffered appends still reach the file when other writes run
+#             the image out of space, and a crash before they are written out
+#             leaves the file at its committed size
+#   sparse    punched holes and holes past EOF read back as zeros and take
+#             up no blocks
+#   htree     an indexed directory spread over many blocks finds, removes
+#             and keeps its entries across a remount
+
+DRIVER=${1:-./a1fs}
+TMP=$(mktemp -d)
+IMG=$TMP/disk.img
+MNT=$TMP/mnt
+PID=
+FAILED=0
+
+cleanup() {
+	mountpoint -q "$MNT" && fusermount -u -z "$MNT"
+	rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+fail() {
+	echo "FAIL: $*"
+	FAILED=1
+}
+
+# format size [mkfs options...]
+format() {
+	local size=$1
+	shift
+	rm -f "$IMG"
+	truncate -s "$size" "$IMG"
+	./mkfs.a1fs -f "$@" "$IMG" >/dev/null || fail "mkfs $*"
+}
+
+# mount_fs [driver options...]
+mount_fs() {
+	"$DRIVER" "$IMG" "$MNT" -f "$@" &
+	PID=$!
+	for _ in $(seq 50); do
+		mountpoint -q "$MNT" && return 0
+		sleep 0.1
+	done
+	fail "mount $*"
+	return 1
+}
+
+unmount_fs() {
+	fusermount -u "$MNT"
+	wait "$PID"
+}
+
+# Simulate a crash: the driver dies without unmounting or committing.
+crash_fs() {
+	kill -9 "$PID"
+	wait "$PID" 2>/dev/null
+	fusermount -u -z "$MNT"
+}
+
+free_blocks() {
+	stat -f -c %f "$MNT"
+}
+
+mkdir "$MNT"
+head -c 1048576 /dev/urandom > "$TMP/data"
+
+
+echo "== journal replay after a crash"
+format 16M -i 256 -O journal
+mount_fs --commit=3600 || exit 1
+mkdir "$MNT/keep"
+for i in $(seq 20); do
+	head -c $((i * 5000)) "$TMP/data" > "$MNT/keep/f$i"
+done
+sync "$MNT/keep/f20"				# fsync commits the journal
+FREE=$(free_blocks)
+rm "$MNT"/keep/f1*
+mkdir "$MNT/new"
+echo lost > "$MNT/new/file"
+truncate -s 0 "$MNT/keep/f20"
+crash_fs
+mount_fs || exit 1
+for i in $(seq 20); do
+	head -c $((i * 5000)) "$TMP/data" | cmp -s - "$MNT/keep/f$i" || fail "journal: keep/f$i"
+done
+[ -e "$MNT/new" ] && fail "journal: uncommitted mkdir survived"
+[ "$(free_blocks)" = "$FREE" ] || fail "journal: $(free_blocks) free blocks after replay, expected $FREE"
+mkdir "$MNT/d1" "$MNT/d2"
+echo moved > "$MNT/d1/a"
+echo replaced > "$MNT/d2/b"
+sync "$MNT/d2/b"
+mv "$MNT/d1/a" "$MNT/d2/b"			# replaces an entry in a committed block
+unmount_fs
+mount_fs || exit 1
+[ "$(cat "$MNT/d2/b" 2>/dev/null)" = moved ] || fail "journal: rename over an entry lost after remount"
+[ -e "$MNT/d1/a" ] && fail "journal: renamed entry still in its old directory"
+unmount_fs
+
+
+echo "== delayed allocation running out of space"
+format 8M -i 64
+mount_fs --delalloc || exit 1
+exec 3>>"$MNT/a"
+dd if="$TMP/data" bs=4096 count=64 status=none >&3	# appends stay buffered
+dd if=/dev/zero of="$MNT/b" bs=65536 status=none 2>/dev/null && fail "delalloc: filling the image succeeded"
+exec 3>&-						# the buffer is written out on close
+head -c $((64 * 4096)) "$TMP/data" | cmp -s - "$MNT/a" || fail "delalloc: buffered appends lost"
+rm "$MNT/b"
+dd if="$TMP/data" bs=4096 skip=64 count=16 status=none >>"$MNT/a"
+head -c $((80 * 4096)) "$TMP/data" | cmp -s - "$MNT/a" || fail "delalloc: appends after freeing space"
+unmount_fs
+mount_fs || exit 1
+head -c $((80 * 4096)) "$TMP/data" | cmp -s - "$MNT/a" || fail "delalloc: appends lost after remount"
+unmount_fs
+format 8M -i 64 -O journal
+mount_fs --delalloc --commit=3600 || exit 1
+exec 3>>"$MNT/a"
+echo buffered >&3
+echo other > "$MNT/b"
+sync "$MNT/b"					# commits while a's append is buffered
+crash_fs
+exec 3>&-
+mount_fs || exit 1
+[ "$(stat -c %s "$MNT/a")" -eq 0 ] || fail "delalloc: size of a buffered append survived a crash"
+echo after >> "$MNT/a"
+[ "$(cat "$MNT/a")" = after ] || fail "delalloc: append after a crash"
+unmount_fs
+
+
+echo "== sparse files and punched holes"
+format 16M -i 64 -O sparse
+mount_fs || exit 1
+head -c 65536 "$TMP/data" > "$MNT/s"
+head -c 65536 "$TMP/data" > "$TMP/expected"
+BLOCKS=$(stat -c %b "$MNT/s")
+fallocate -p -o 8192 -l 16384 "$MNT/s"
+dd if=/dev/zero of="$TMP/expected" bs=4096 seek=2 count=4 conv=notrunc status=none
+cmp -s "$TMP/expected" "$MNT/s" || fail "sparse: punched range doesn't read as zeros"
+[ "$(stat -c %b "$MNT/s")" -eq $((BLOCKS - 32)) ] || fail "sparse: punched blocks still allocated"
+truncate -s 1G "$MNT/big"
+[ "$(stat -c %b "$MNT/big")" -eq 0 ] || fail "sparse: hole past EOF allocated"
+printf end | dd of="$MNT/big" bs=1 seek=$((1024 * 1024 * 1024 - 3)) conv=notrunc status=none
+[ "$(tail -c 3 "$MNT/big")" = end ] || fail "sparse: write at the end of a hole"
+head -c 1048576 /dev/zero | cmp -s - <(dd if="$MNT/big" bs=1M skip=512 count=1 status=none) ||
+	fail "sparse: hole doesn't read as zeros"
+unmount_fs
+mount_fs || exit 1
+cmp -s "$TMP/expected" "$MNT/s" || fail "sparse: punched file changed after remount"
+unmount_fs
+
+
+echo "== indexed directory past one block"
+format 16M -i 1024 -O dir_index
+mount_fs || exit 1
+NAME=file_with_a_reasonably_long_name_to_fill_blocks
+for i in $(seq 600); do
+	echo "$i" > "$MNT/${NAME}_$i"
+done
+[ "$(ls "$MNT" | wc -l)" -eq 600 ] || fail "htree: $(ls "$MNT" | wc -l) entries, expected 600"
+for i in $(seq 2 2 600); do
+	rm "$MNT/${NAME}_$i"
+done
+unmount_fs
+mount_fs || exit 1
+[ "$(ls "$MNT" | wc -l)" -eq 300 ] || fail "htree: $(ls "$MNT" | wc -l) entries after remount, expected 300"
+for i in $(seq 1 2 600); do
+	[ "$(cat "$MNT/${NAME}_$i" 2>/dev/null)" = "$i" ] || fail "htree: ${NAME}_$i"
+done
+[ -e "$MNT/${NAME}_600" ] && fail "htree: removed entry still found"
+unmount_fs
+
+
+if [ $FAILED -ne 0 ]; then
+	echo "$DRIVER: some tests failed"
+	exit 1
+fi
+echo "$DRIVER: all tests passed"
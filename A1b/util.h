@@ -21,6 +21,12 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 /** Check if x is a power of 2. */
@@ -42,3 +48,32 @@ static inline size_t align_up(size_t x, size_t alignment)
 	assert(is_powerof2(alignment));
 	return (x + alignment - 1) & (~alignment + 1);
 }
+
+/** Check if all size bytes of buf are zero. */
+static inline bool is_zeroed(const void *buf, size_t size)
+{
+	const unsigned char *p = buf;
+	size_t i = 0;
+#ifdef __SSE2__
+	// OR 64 bytes at a time together and test the result once
+	for (; i + 64 <= size; i += 64) {
+		__m128i v = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i)),
+			             _mm_loadu_si128((const __m128i*)(p + i + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)(p + i + 32)),
+			             _mm_loadu_si128((const __m128i*)(p + i + 48))));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff) {
+			return false;
+		}
+	}
+#endif
+	for (; i + 8 <= size; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, sizeof(w));
+		if (w != 0) return false;
+	}
+	for (; i < size; i++) {
+		if (p[i] != 0) return false;
+	}
+	return true;
+}
@@ -0,0 +1,184 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Incremental writeback implementation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "a1fs.h"
+#include "bitmap.h"
+#include "util.h"
+#include "writeback.h"
+
+
+bool writeback_init(writeback *wb, blockdev *bdev, unsigned int age, uint64_t threshold)
+{
+	memset(wb, 0, sizeof(*wb));
+	wb->bdev = bdev;
+	wb->image = bdev->image;
+	wb->image_blocks = bdev->size / A1FS_BLOCK_SIZE;
+	wb->age = age;
+	wb->threshold = threshold;
+	pthread_mutex_init(&wb->lock, NULL);
+	pthread_cond_init(&wb->cond, NULL);
+
+	for (int g = 0; g < 2; g++) {
+		wb->gen[g] = calloc(align_up(wb->image_blocks, 64) / 8, 1);
+		if (wb->gen[g] == NULL) {
+			writeback_destroy(wb);
+			return false;
+		}
+	}
+	return true;
+}
+
+void writeback_dirty(writeback *wb, const void *ptr, size_t len)
+{
+	if (len == 0) return;
+	size_t off = (const char*)ptr - (const char*)wb->image;
+	uint64_t first = off / A1FS_BLOCK_SIZE;
+	uint64_t last = (off + len - 1) / A1FS_BLOCK_SIZE;
+
+	pthread_mutex_lock(&wb->lock);
+	for (uint64_t blk = first; blk <= last; blk++) {
+		if (!bitmap_get(wb->gen[0], blk) && !bitmap_get(wb->gen[1], blk)) {
+			bitmap_set_range(wb->gen[wb->young], blk, 1, true);
+			wb->ndirty[wb->young]++;
+		}
+	}
+	if (!wb->pressure && wb->ndirty[0] + wb->ndirty[1] >= wb->threshold) {
+		wb->pressure = true;
+		pthread_cond_broadcast(&wb->cond);
+	}
+	pthread_mutex_unlock(&wb->lock);
+}
+
+/**
+ * Sync the runs of dirty blocks of generation g in [from, limit). The blocks
+ * are taken out of the generation before they are synced, so a block changed
+ * again meanwhile is dirty again. Called with wb->lock held; it is released
+ * while syncing.
+ */
+static int flush_gen(writeback *wb, int g, uint64_t from, uint64_t limit)
+{
+	int ret = 0;
+	uint64_t blk = bitmap_find(wb->gen[g], from, limit, true);
+	while (blk < limit) {
+		uint64_t end = bitmap_find(wb->gen[g], blk, limit, false);
+		bitmap_set_range(wb->gen[g], blk, end - blk, false);
+		wb->ndirty[g] -= end - blk;
+		wb->blocks_written += end - blk;
+
+		pthread_mutex_unlock(&wb->lock);
+		int err = blockdev_sync(wb->bdev, blk, end - blk);
+		if (ret == 0) ret = err;
+		pthread_mutex_lock(&wb->lock);
+
+		blk = bitmap_find(wb->gen[g], end, limit, true);
+	}
+	return ret;
+}
+
+int writeback_flush(writeback *wb, uint64_t blk, uint64_t count)
+{
+	uint64_t limit = blk + count;
+	if (limit > wb->image_blocks) limit = wb->image_blocks;
+	if (blk >= limit) return 0;
+
+	pthread_mutex_lock(&wb->lock);
+	int ret = flush_gen(wb, 0, blk, limit);
+	int ret2 = flush_gen(wb, 1, blk, limit);
+	pthread_mutex_unlock(&wb->lock);
+	return (ret != 0) ? ret : ret2;
+}
+
+int writeback_flush_all(writeback *wb)
+{
+	pthread_mutex_lock(&wb->lock);
+	int ret = flush_gen(wb, !wb->young, 0, wb->image_blocks);
+	int ret2 = flush_gen(wb, wb->young, 0, wb->image_blocks);
+	wb->flushes++;
+	pthread_mutex_unlock(&wb->lock);
+	return (ret != 0) ? ret : ret2;
+}
+
+static void *flusher_thread(void *arg)
+{
+	writeback *wb = (writeback*)arg;
+	unsigned int tick = (wb->age > 1) ? wb->age / 2 : 1;
+
+	pthread_mutex_lock(&wb->lock);
+	while (!wb->stopping) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += tick;
+		int err = 0;
+		while (!wb->stopping && !wb->pressure && err != ETIMEDOUT) {
+			err = pthread_cond_timedwait(&wb->cond, &wb->lock, &deadline);
+		}
+		if (wb->stopping) break;
+
+		int ret;
+		if (wb->pressure) {
+			// Both generations, the older one first.
+			ret = flush_gen(wb, !wb->young, 0, wb->image_blocks);
+			int ret2 = flush_gen(wb, wb->young, 0, wb->image_blocks);
+			if (ret == 0) ret = ret2;
+			wb->pressure = false;
+		} else {
+			// Only the blocks marked before the last tick. New blocks only go
+			// into the young generation, so the old one is empty afterwards.
+			ret = flush_gen(wb, !wb->young, 0, wb->image_blocks);
+			wb->young = !wb->young;
+		}
+		wb->flushes++;
+		if (ret != 0) {
+			fprintf(stderr, "a1fs: writeback failed: %s\n", strerror(-ret));
+		}
+	}
+	pthread_mutex_unlock(&wb->lock);
+	return NULL;
+}
+
+bool writeback_run(writeback *wb)
+{
+	if (wb->age == 0) return true;
+	if (pthread_create(&wb->thread, NULL, flusher_thread, wb) != 0) return false;
+	wb->thread_running = true;
+	return true;
+}
+
+void writeback_destroy(writeback *wb)
+{
+	if (wb->thread_running) {
+		pthread_mutex_lock(&wb->lock);
+		wb->stopping = true;
+		pthread_cond_broadcast(&wb->cond);
+		pthread_mutex_unlock(&wb->lock);
+		pthread_join(wb->thread, NULL);
+		wb->thread_running = false;
+	}
+
+	free(wb->gen[0]);
+	free(wb->gen[1]);
+	wb->gen[0] = wb->gen[1] = NULL;
+	pthread_cond_destroy(&wb->cond);
+	pthread_mutex_destroy(&wb->lock);
+}
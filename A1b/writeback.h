@@ -0,0 +1,119 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Incremental writeback header file.
+ *
+ * Keeps track of the blocks of the image that have been changed in memory but
+ * not synced, so that only those get written out: in the background once they
+ * are old enough or there are too many of them, on fsync() (only the blocks of
+ * that file), and on unmount with --sync.
+ *
+ * Blocks are tracked in two generations. A newly changed block goes into the
+ * young one; every age / 2 seconds the old generation is synced and the young
+ * one takes its place, so a block is synced between age / 2 and age seconds
+ * after it was first changed.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blockdev.h"
+
+
+/** Default number of seconds a block may stay dirty. */
+#define WRITEBACK_AGE 30
+/** Default number of MiB of dirty blocks that triggers writeback of all of them. */
+#define WRITEBACK_MAX_MB 64
+
+
+/** Dirty block tracker of a mounted file system. */
+typedef struct writeback {
+	/** The block device that syncs the blocks, the image and its size in
+	 * blocks. */
+	blockdev *bdev;
+	void *image;
+	uint64_t image_blocks;
+
+	/** The two generations of dirty blocks (one bitmap over the image each)
+	 * and the number of blocks in them; a block is in at most one of them.
+	 * gen[young] gets the newly changed blocks. */
+	unsigned char *gen[2];
+	uint64_t ndirty[2];
+	int young;
+
+	/** Seconds a block may stay dirty, and the number of dirty blocks that
+	 * triggers writeback of all of them. */
+	unsigned int age;
+	uint64_t threshold;
+	/** Set when the dirty blocks reach the threshold. */
+	bool pressure;
+
+	/** Background flusher thread. */
+	pthread_t thread;
+	bool thread_running;
+	bool stopping;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/** Statistics. */
+	uint64_t flushes;
+	uint64_t blocks_written;
+
+} writeback;
+
+
+/**
+ * Initialize the dirty block tracker.
+ *
+ * @param wb         pointer to the tracker to initialize.
+ * @param bdev       the block device of the image.
+ * @param age        seconds a block may stay dirty.
+ * @param threshold  number of dirty blocks that triggers writeback.
+ * @return           true on success; false if out of memory.
+ */
+bool writeback_init(writeback *wb, blockdev *bdev, unsigned int age, uint64_t threshold);
+
+/**
+ * Start the background flusher thread. Must be called after FUSE has forked
+ * into the background (i.e. from the init() callback).
+ *
+ * @return  true on success; false if the thread could not be created.
+ */
+bool writeback_run(writeback *wb);
+
+/** Stop the flusher thread and free the tracker. Dirty blocks are not synced. */
+void writeback_destroy(writeback *wb);
+
+/** Mark the blocks overlapping [ptr, ptr + len) in the image as dirty. */
+void writeback_dirty(writeback *wb, const void *ptr, size_t len);
+
+/**
+ * Sync the dirty blocks among count blocks starting at image block blk.
+ *
+ * @return  0 on success; -errno if syncing failed.
+ */
+int writeback_flush(writeback *wb, uint64_t blk, uint64_t count);
+
+/**
+ * Sync all the dirty blocks.
+ *
+ * @return  0 on success; -errno if syncing failed.
+ */
+int writeback_flush_all(writeback *wb);